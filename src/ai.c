@@ -76,6 +76,7 @@
 
 #include "array.h"
 #include "board.h"
+#include "conf.h"
 #include "escort.h"
 #include "faction.h"
 #include "hook.h"
@@ -94,6 +95,7 @@
 #include "player.h"
 #include "rng.h"
 #include "space.h"
+#include "threadpool.h"
 
 
 /*
@@ -117,6 +119,12 @@
 #define AI_MEM_DEF      "def" /**< Default pilot memory. */
 
 
+/*
+ * think phase
+ */
+#define AI_PRECOMPUTE_CHUNK   16 /**< Amount of pilots precomputed by a single job. */
+
+
 /*
  * all the AI profiles
  */
@@ -124,6 +132,17 @@ static AI_Profile* profiles = NULL; /**< Array of AI_Profiles loaded. */
 static nlua_env equip_env = LUA_NOREF; /**< Equipment enviornment. */
 
 
+/**
+ * @brief Range of the pilot stack precomputed by a single job.
+ */
+typedef struct AIPrecompute_ {
+   int start; /**< First pilot of the range. */
+   int end; /**< Pilot after the last pilot of the range. */
+} AIPrecompute;
+static AIPrecompute *ai_jobs = NULL; /**< Precomputation jobs. */
+static int ai_precomputed = 0; /**< Whether the current think phase was precomputed. */
+
+
 /*
  * extern pilot hacks
  */
@@ -135,6 +154,7 @@ extern int pilot_nstack;
  * prototypes
  */
 /* Internal C routines */
+static int ai_precompute( void *data );
 static void ai_run( nlua_env env, const char *funcname );
 static int ai_loadProfile( const char* filename );
 static void ai_setMemory (void);
@@ -731,6 +751,117 @@ void ai_exit (void)
    if (equip_env != LUA_NOREF)
       nlua_freeEnv(equip_env);
    equip_env = LUA_NOREF;
+
+   /* Free the think phase jobs. */
+   array_free( ai_jobs );
+   ai_jobs = NULL;
+}
+
+
+/**
+ * @brief Precomputes the pure C queries of a range of pilots.
+ *
+ * Runs on the threadpool while the main thread waits, so it must only read
+ *  the pilot stack and write the pilot's own cache. It must not run any Lua:
+ *  faction relations, including hostility with the player, are read from the
+ *  matrices the faction code keeps up to date on the main thread.
+ *
+ *    @param data Range of pilots to precompute (AIPrecompute).
+ *    @return 0 always.
+ */
+static int ai_precompute( void *data )
+{
+   int i;
+   AIPrecompute *job;
+   Pilot *p, *t;
+
+   job = (AIPrecompute*) data;
+   for (i=job->start; i<job->end; i++) {
+      p = pilot_stack[i];
+      p->ai_cached = 0;
+
+      /* Only pilots that may think. */
+      if ((p->ai == NULL) || pilot_isFlag(p, PILOT_DELETE) ||
+            pilot_isFlag(p, PILOT_INVISIBLE) || pilot_isFlag(p, PILOT_DEAD))
+         continue;
+
+      p->ai_enemy = pilot_getNearestEnemy( p );
+      t = pilot_get( p->target );
+      if ((t != NULL) && (t != p))
+         p->ai_inrange = pilot_inRangePilot( p, t, NULL );
+      else
+         p->ai_inrange = 0;
+      p->ai_cached = 1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Starts the think phase, precomputing the AI queries in parallel.
+ *
+ * Pilots don't move during the think phase, so target selection and sensor
+ *  checks can be done for all pilots at once on the threadpool and then be
+ *  consumed by the Lua calls of each pilot.
+ */
+void ai_thinkBegin (void)
+{
+   int i;
+   ThreadQueue *q;
+   AIPrecompute *job;
+
+   ai_precomputed = 0;
+   if (!conf.ai_parallel || (pilot_nstack <= 0))
+      return;
+
+   /* Split the pilot stack into jobs. */
+   if (ai_jobs == NULL)
+      ai_jobs = array_create( AIPrecompute );
+   array_resize( &ai_jobs, 0 );
+   for (i=0; i<pilot_nstack; i+=AI_PRECOMPUTE_CHUNK) {
+      job = &array_grow( &ai_jobs );
+      job->start = i;
+      job->end   = MIN( i+AI_PRECOMPUTE_CHUNK, pilot_nstack );
+   }
+
+   /* Not worth waking up the threads for a single job. */
+   if (array_size(ai_jobs) == 1)
+      ai_precompute( &ai_jobs[0] );
+   else {
+      q = vpool_create();
+      for (i=0; i<array_size(ai_jobs); i++)
+         vpool_enqueue( q, ai_precompute, &ai_jobs[i] );
+      vpool_wait( q );
+   }
+
+   ai_precomputed = 1;
+}
+
+
+/**
+ * @brief Ends the think phase, invalidating the precomputed queries.
+ */
+void ai_thinkEnd (void)
+{
+   ai_precomputed = 0;
+}
+
+
+/**
+ * @brief Checks to see if a pilot is in sensor range of another pilot.
+ *
+ * Uses the value precomputed during the think phase when available.
+ *
+ *    @param p Pilot doing the check.
+ *    @param target Pilot to check.
+ *    @return Same as pilot_inRangePilot.
+ */
+int ai_inRangePilot( const Pilot *p, const Pilot *target )
+{
+   if (ai_precomputed && p->ai_cached && (p->target == target->id))
+      return p->ai_inrange;
+   return pilot_inRangePilot( p, target, NULL );
 }
 
 
@@ -824,6 +955,9 @@ void ai_think( Pilot* pilot, const double dt )
 
    /* Clean up if necessary. */
    ai_taskGC( cur_pilot );
+
+   /* Precomputed values are only valid for one think. */
+   cur_pilot->ai_cached = 0;
 }
 
 
@@ -2825,8 +2959,19 @@ static int aiL_shoot( lua_State *L )
 static int aiL_getenemy( lua_State *L )
 {
    unsigned int id;
+   Pilot *p;
 
-   id = pilot_getNearestEnemy(cur_pilot);
+   /* Use the precomputed enemy if it is still a valid enemy. Earlier thinks
+    * may have killed it, hidden it or changed factions and standings. */
+   id = 0;
+   if (ai_precomputed && cur_pilot->ai_cached) {
+      id = cur_pilot->ai_enemy;
+      p  = pilot_get( id );
+      if ((p == NULL) || !pilot_validEnemy( cur_pilot, p ))
+         id = pilot_getNearestEnemy(cur_pilot);
+   }
+   else
+      id = pilot_getNearestEnemy(cur_pilot);
 
    if (id==0) /* No enemy found */
       return 0;
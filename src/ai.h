@@ -87,8 +87,11 @@ void ai_cleartasks( Pilot* p );
 void ai_attacked( Pilot* attacked, const unsigned int attacker, double dmg );
 void ai_refuel( Pilot* refueler, unsigned int target );
 void ai_getDistress( Pilot *p, const Pilot *distressed, const Pilot *attacker );
+void ai_thinkBegin (void);
+void ai_thinkEnd (void);
 void ai_think( Pilot* pilot, const double dt );
 void ai_setPilot( Pilot *p );
+int ai_inRangePilot( const Pilot *p, const Pilot *target );
 
 
 #endif /* AI_H */
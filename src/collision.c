@@ -10,17 +10,59 @@
 
 
 /** @cond */
+#include <stdlib.h>
+#include <string.h>
+
 #include "naev.h"
 /** @endcond */
 
 #include "collision.h"
 
 #include "log.h"
+#include "md5.h"
+#include "ndata.h"
+#include "nfile.h"
+#include "nstring.h"
+
+
+#define POLYGON_CACHE_MAGIC   0x474c504eu /**< "NPLG" in little endian. */
+#define POLYGON_CACHE_VERSION 1 /**< Bump when the cache layout changes. */
+
+
+/**
+ * @brief Header of a cached polygon file.
+ *
+ * It is followed by npolygon PolygonCacheEntry and then by the x and y
+ * coordinates of each polygon in order, so the whole file can be used as is.
+ */
+typedef struct PolygonCacheHeader_ {
+   uint32_t magic; /**< POLYGON_CACHE_MAGIC. */
+   uint32_t version; /**< POLYGON_CACHE_VERSION. */
+   uint32_t npolygon; /**< Number of polygons. */
+   uint32_t size; /**< Size of the whole file. */
+} PolygonCacheHeader;
+
+
+/**
+ * @brief Polygon of a cached polygon file.
+ */
+typedef struct PolygonCacheEntry_ {
+   uint32_t npt; /**< Number of points. */
+   float xmin; /**< Min of x. */
+   float xmax; /**< Max of x. */
+   float ymin; /**< Min of y. */
+   float ymax; /**< Max of y. */
+} PolygonCacheEntry;
 
 
 /*
  * Prototypes
  */
+static int LoadPolygonCache( CollPoly **polygon, int *npolygon,
+      const char *data, size_t size );
+static void SavePolygonCache( const CollPoly *polygon, int npolygon,
+      const char *path );
+static uint64_t CollideTransBits( const uint64_t *row, int stride, int x, int n );
 static int pointInPolygon( const CollPoly* at, const Vector2d* ap,
       float x, float y );
 static int LineOnPolygon( const CollPoly* at, const Vector2d* ap,
@@ -85,12 +127,230 @@ void LoadPolygon( CollPoly* polygon, xmlNodePtr node )
 }
 
 
+/**
+ * @brief Loads all the polygons of a collision polygon file.
+ *
+ * The parsed polygons are cached in a binary file keyed by the hash of the
+ * XML, so later runs don't have to parse it again.
+ *
+ *    @param[out] polygon Loaded polygons, NULL if none.
+ *    @param[out] npolygon Number of loaded polygons.
+ *    @param file Path of the XML file.
+ *    @return 0 on success.
+ */
+int LoadPolygonFile( CollPoly **polygon, int *npolygon, const char *file )
+{
+   char *buf, *data, *cachefile;
+   size_t i, size, cachesize;
+   char digest[33];
+   md5_state_t md5;
+   md5_byte_t md5val[16];
+   xmlDocPtr doc;
+   xmlNodePtr node, cur;
+
+   *polygon  = NULL;
+   *npolygon = 0;
+
+   buf = ndata_read( file, &size );
+   if (buf == NULL) {
+      WARN( _("Unable to read data from '%s'"), file );
+      return -1;
+   }
+
+   /* Look for a cache of this exact file. */
+   md5_init( &md5 );
+   md5_append( &md5, (md5_byte_t*)buf, size );
+   md5_finish( &md5, md5val );
+   for (i=0; i<16; i++)
+      nsnprintf( &digest[i * 2], 3, "%02x", md5val[i] );
+   cachefile = malloc( PATH_MAX );
+   nsnprintf( cachefile, PATH_MAX, "%spolygons/%s", nfile_cachePath(), digest );
+   if (nfile_fileExists( cachefile )) {
+      data = nfile_readFile( &cachesize, cachefile );
+      if ((data != NULL) && (LoadPolygonCache( polygon, npolygon, data, cachesize ) == 0)) {
+         free( data );
+         free( cachefile );
+         free( buf );
+         return 0;
+      }
+      free( data );
+   }
+
+   /* Parse the XML. */
+   doc = xmlParseMemory( buf, size );
+   free( buf );
+   if (doc == NULL) {
+      WARN( _("Unable to parse document '%s'"), file );
+      free( cachefile );
+      return -1;
+   }
+
+   node = doc->xmlChildrenNode; /* First polygon node */
+   if (node == NULL) {
+      xmlFreeDoc(doc);
+      WARN(_("Malformed %s file: does not contain elements"), file);
+      free( cachefile );
+      return -1;
+   }
+
+   do { /* load the polygon data */
+      if (xml_isNode(node,"polygons")) {
+         cur = node->children;
+         do {
+            if (xml_isNode(cur,"polygon")) {
+               (*npolygon)++;
+               *polygon = realloc( *polygon, sizeof(CollPoly) * (*npolygon) );
+               LoadPolygon( &(*polygon)[ *npolygon-1 ], cur );
+            }
+         } while (xml_nextNode(cur));
+      }
+   } while (xml_nextNode(node));
+   xmlFreeDoc(doc);
+
+   SavePolygonCache( *polygon, *npolygon, cachefile );
+   free( cachefile );
+   return 0;
+}
+
+
+/**
+ * @brief Loads polygons from a cached polygon file.
+ *
+ *    @param[out] polygon Loaded polygons.
+ *    @param[out] npolygon Number of loaded polygons.
+ *    @param data Contents of the cache file.
+ *    @param size Size of the cache file.
+ *    @return 0 on success, -1 if the cache is invalid.
+ */
+static int LoadPolygonCache( CollPoly **polygon, int *npolygon,
+      const char *data, size_t size )
+{
+   const PolygonCacheHeader *hdr;
+   const PolygonCacheEntry *e;
+   size_t off, n;
+   uint32_t i;
+   CollPoly *p;
+
+   if (size < sizeof(PolygonCacheHeader))
+      return -1;
+   hdr = (const PolygonCacheHeader*) data;
+   if ((hdr->magic != POLYGON_CACHE_MAGIC) ||
+         (hdr->version != POLYGON_CACHE_VERSION) ||
+         (hdr->size != size))
+      return -1;
+   off = sizeof(PolygonCacheHeader) + hdr->npolygon * sizeof(PolygonCacheEntry);
+   if (off > size)
+      return -1;
+
+   /* Check the sizes before allocating anything. */
+   e = (const PolygonCacheEntry*) &data[ sizeof(PolygonCacheHeader) ];
+   n = off;
+   for (i=0; i<hdr->npolygon; i++)
+      n += 2 * e[i].npt * sizeof(float);
+   if (n != size)
+      return -1;
+
+   *npolygon = hdr->npolygon;
+   *polygon  = (hdr->npolygon > 0) ? malloc( sizeof(CollPoly) * hdr->npolygon ) : NULL;
+   for (i=0; i<hdr->npolygon; i++) {
+      p       = &(*polygon)[i];
+      p->npt  = e[i].npt;
+      p->xmin = e[i].xmin;
+      p->xmax = e[i].xmax;
+      p->ymin = e[i].ymin;
+      p->ymax = e[i].ymax;
+      p->x    = malloc( sizeof(float) * MAX( 1, p->npt ) );
+      p->y    = malloc( sizeof(float) * MAX( 1, p->npt ) );
+      memcpy( p->x, &data[off], sizeof(float) * p->npt );
+      off    += sizeof(float) * p->npt;
+      memcpy( p->y, &data[off], sizeof(float) * p->npt );
+      off    += sizeof(float) * p->npt;
+   }
+   return 0;
+}
+
+
+/**
+ * @brief Writes polygons to a cached polygon file.
+ *
+ *    @param polygon Polygons to write.
+ *    @param npolygon Number of polygons.
+ *    @param path Path of the cache file.
+ */
+static void SavePolygonCache( const CollPoly *polygon, int npolygon,
+      const char *path )
+{
+   PolygonCacheHeader *hdr;
+   PolygonCacheEntry *e;
+   char *data;
+   size_t off, size;
+   int i;
+
+   size = sizeof(PolygonCacheHeader) + npolygon * sizeof(PolygonCacheEntry);
+   for (i=0; i<npolygon; i++)
+      size += 2 * polygon[i].npt * sizeof(float);
+
+   data          = calloc( 1, size );
+   hdr           = (PolygonCacheHeader*) data;
+   hdr->magic    = POLYGON_CACHE_MAGIC;
+   hdr->version  = POLYGON_CACHE_VERSION;
+   hdr->npolygon = npolygon;
+   hdr->size     = size;
+   e   = (PolygonCacheEntry*) &data[ sizeof(PolygonCacheHeader) ];
+   off = sizeof(PolygonCacheHeader) + npolygon * sizeof(PolygonCacheEntry);
+   for (i=0; i<npolygon; i++) {
+      e[i].npt  = polygon[i].npt;
+      e[i].xmin = polygon[i].xmin;
+      e[i].xmax = polygon[i].xmax;
+      e[i].ymin = polygon[i].ymin;
+      e[i].ymax = polygon[i].ymax;
+      memcpy( &data[off], polygon[i].x, sizeof(float) * polygon[i].npt );
+      off += sizeof(float) * polygon[i].npt;
+      memcpy( &data[off], polygon[i].y, sizeof(float) * polygon[i].npt );
+      off += sizeof(float) * polygon[i].npt;
+   }
+
+   nfile_dirMakeExist( nfile_cachePath(), "polygons/" );
+   nfile_writeFile( data, size, path );
+   free( data );
+}
+
+
+/**
+ * @brief Gets up to 64 consecutive bits of a row of a transparency map.
+ *
+ *    @param row Row of the transparency map.
+ *    @param stride Number of words in the row.
+ *    @param x First bit to get.
+ *    @param n Number of bits to get (1 to 64).
+ *    @return The bits with bit 0 being pixel x.
+ */
+static uint64_t CollideTransBits( const uint64_t *row, int stride, int x, int n )
+{
+   int w, o;
+   uint64_t bits;
+
+   w    = x / 64;
+   o    = x % 64;
+   bits = row[w] >> o;
+   if ((o > 0) && (w+1 < stride))
+      bits |= row[w+1] << (64-o);
+   if (n < 64)
+      bits &= (UINT64_C(1) << n) - 1;
+   return bits;
+}
+
+
 /**
  * @brief Checks whether or not two sprites collide.
  *
  * This function does pixel perfect checks.  If the collision actually occurs,
  *  crash is set to store the real position of the collision.
  *
+ * The overlap is first trimmed to the tight bounding boxes of both sprites,
+ *  then each row is tested 64 pixels at a time by and-ing the transparency
+ *  maps.
+ *
  *    @param[in] at Texture a.
  *    @param[in] asx Position of x of sprite a.
  *    @param[in] asy Position of y of sprite a.
@@ -106,12 +366,15 @@ int CollideSprite( const glTexture* at, const int asx, const int asy, const Vect
       const glTexture* bt, const int bsx, const int bsy, const Vector2d* bp,
       Vector2d* crash )
 {
-   int x,y;
+   int x,y, n;
    int ax1,ax2, ay1,ay2;
    int bx1,bx2, by1,by2;
    int inter_x0, inter_x1, inter_y0, inter_y1;
    int rasy, rbsy;
    int abx,aby, bbx, bby;
+   const glTransBox *abox, *bbox;
+   const uint64_t *arow, *brow;
+   uint64_t hit;
 
 #if DEBUGGING
    /* Make sure the surfaces have transparency maps. */
@@ -147,6 +410,16 @@ int CollideSprite( const glTexture* at, const int asx, const int asy, const Vect
    inter_y0 = MAX( ay1, by1 );
    inter_y1 = MIN( ay2, by2 );
 
+   /* trim to the opaque pixels of the sprites */
+   abox = gl_transBox( at, asx, asy );
+   bbox = gl_transBox( bt, bsx, bsy );
+   inter_x0 = MAX( inter_x0, MAX( ax1 + abox->x1, bx1 + bbox->x1 ) );
+   inter_x1 = MIN( inter_x1, MIN( ax1 + abox->x2, bx1 + bbox->x2 ) );
+   inter_y0 = MAX( inter_y0, MAX( ay1 + abox->y1, by1 + bbox->y1 ) );
+   inter_y1 = MIN( inter_y1, MIN( ay1 + abox->y2, by1 + bbox->y2 ) );
+   if ((inter_x0 > inter_x1) || (inter_y0 > inter_y1))
+      return 0;
+
    /* real vertical sprite value (flipped) */
    rasy = at->sy - asy - 1;
    rbsy = bt->sy - bsy - 1;
@@ -157,17 +430,22 @@ int CollideSprite( const glTexture* at, const int asx, const int asy, const Vect
    bbx =  bsx*(int)(bt->sw) - bx1;
    bby = rbsy*(int)(bt->sh) - by1;
 
-   for (y=inter_y0; y<=inter_y1; y++)
-      for (x=inter_x0; x<=inter_x1; x++)
-         /* compute offsets for surface before pass to TransparentPixel test */
-         if ((!gl_isTrans(at, abx + x, aby + y)) &&
-               (!gl_isTrans(bt, bbx + x, bby + y))) {
-
-            /* Set the crash position. */
-            crash->x = x;
-            crash->y = y;
-            return 1;
-         }
+   for (y=inter_y0; y<=inter_y1; y++) {
+      arow = &at->trans[ (aby + y) * at->trans_stride ];
+      brow = &bt->trans[ (bby + y) * bt->trans_stride ];
+      for (x=inter_x0; x<=inter_x1; x+=64) {
+         n   = MIN( 64, inter_x1 - x + 1 );
+         hit = CollideTransBits( arow, at->trans_stride, abx + x, n ) &
+               CollideTransBits( brow, bt->trans_stride, bbx + x, n );
+         if (hit == 0)
+            continue;
+
+         /* Set the crash position at the first overlapping pixel. */
+         crash->x = x + __builtin_ctzll( hit );
+         crash->y = y;
+         return 1;
+      }
+   }
 
    return 0;
 }
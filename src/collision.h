@@ -30,6 +30,7 @@ typedef struct CollPoly_ {
 
 /* Loads a polygon data from xml. */
 void LoadPolygon( CollPoly* polygon, xmlNodePtr node );
+int LoadPolygonFile( CollPoly **polygon, int *npolygon, const char *file );
 
 /* Returns 1 if collision is detected */
 int CollideSprite( const glTexture* at, const int asx, const int asy, const Vector2d* ap,
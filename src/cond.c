@@ -15,12 +15,33 @@
 
 #include "cond.h"
 
+#include "array.h"
 #include "log.h"
 #include "nlua.h"
 #include "nluadef.h"
+#include "nlua_rnd.h"
+#include "strhash.h"
+
+
+/**
+ * @brief A compiled conditional.
+ */
+typedef struct CondCache_ {
+   int func; /**< Reference to the compiled conditional, LUA_NOREF if not compiled. */
+   int memoable; /**< Whether or not the result can be memoized, cleared once it uses randomness. */
+   unsigned int memo_gen; /**< Generation of the memoized result. */
+   int memo; /**< Memoized result. */
+} CondCache;
 
 
 static nlua_env cond_env = LUA_NOREF; /** Conditional Lua env. */
+static CondCache *cond_cache = NULL; /**< Compiled conditionals, indexed by interned string id. */
+static unsigned int cond_gen = 1; /**< Current state generation. */
+static int cond_memo = 0; /**< Whether or not results are being memoized. */
+
+
+/* Prototypes. */
+static CondCache *cond_get( const char *cond );
 
 
 /**
@@ -46,14 +67,103 @@ int cond_init (void)
  */
 void cond_exit (void)
 {
+   int i;
+
    if (cond_env == LUA_NOREF)
       return;
 
+   for (i=0; i<array_size(cond_cache); i++)
+      if (cond_cache[i].func != LUA_NOREF)
+         luaL_unref( naevL, LUA_REGISTRYINDEX, cond_cache[i].func );
+   array_free( cond_cache );
+   cond_cache = NULL;
+
    nlua_freeEnv(cond_env);
    cond_env = LUA_NOREF;
 }
 
 
+/**
+ * @brief Starts memoizing conditional results.
+ *
+ * Until cond_memoEnd is called, a conditional is only run again if the state
+ *  it can depend on has changed (see cond_invalidate).
+ */
+void cond_memoStart (void)
+{
+   cond_memo = 1;
+   cond_invalidate();
+}
+
+
+/**
+ * @brief Stops memoizing conditional results.
+ */
+void cond_memoEnd (void)
+{
+   cond_memo = 0;
+}
+
+
+/**
+ * @brief Invalidates memoized results, should be called whenever the player,
+ *        faction, mission, event, unidiff, time or mission variable state
+ *        changes.
+ */
+void cond_invalidate (void)
+{
+   cond_gen++;
+}
+
+
+/**
+ * @brief Gets the cache entry of a conditional, compiling it if needed.
+ *
+ *    @param cond Conditional to get.
+ *    @return The cache entry or NULL on error.
+ */
+static CondCache *cond_get( const char *cond )
+{
+   CondCache *c;
+   int id, ret;
+
+   /* Get the entry. */
+   id = strhash_intern( cond );
+   if (cond_cache == NULL)
+      cond_cache = array_create( CondCache );
+   while (array_size(cond_cache) <= id) {
+      c = &array_grow( &cond_cache );
+      c->func     = LUA_NOREF;
+      c->memoable = 0;
+      c->memo_gen = 0;
+      c->memo     = 0;
+   }
+   c = &cond_cache[id];
+   if (c->func != LUA_NOREF)
+      return c;
+
+   /* Load the string. */
+   lua_pushstring(naevL, "return ");
+   lua_pushstring(naevL, cond);
+   lua_concat(naevL, 2);
+   ret = luaL_loadbuffer(naevL, lua_tostring(naevL,-1),
+                         lua_strlen(naevL,-1), "Lua Conditional");
+   if (ret != 0) {
+      WARN(_("Lua conditional syntax error: %s"), lua_tostring(naevL, -1));
+      return NULL;
+   }
+   nlua_pushenv(cond_env);
+   lua_setfenv(naevL, -2);
+   c->func = luaL_ref(naevL, LUA_REGISTRYINDEX);
+   lua_pop(naevL, 1);
+
+   /* Memoizable until it is seen rolling random numbers. */
+   c->memoable = 1;
+
+   return c;
+}
+
+
 /**
  * @brief Checks to see if a condition is true.
  *
@@ -62,19 +172,28 @@ void cond_exit (void)
  */
 int cond_check( const char* cond )
 {
+   CondCache *c;
    int b;
    int ret;
+   unsigned int rnd;
 
-   /* Load the string. */
-   lua_pushstring(naevL, "return ");
-   lua_pushstring(naevL, cond);
-   lua_concat(naevL, 2);
-   ret = nlua_dobufenv(cond_env, lua_tostring(naevL,-1),
-                       lua_strlen(naevL,-1), "Lua Conditional");
+   c = cond_get( cond );
+   if (c == NULL)
+      goto cond_err;
+
+   /* Use the memoized result if nothing changed. */
+   if (cond_memo && c->memoable && (c->memo_gen == cond_gen))
+      return c->memo;
+
+   /* Run the conditional. */
+   rnd = nlua_rndCalls();
+   lua_rawgeti(naevL, LUA_REGISTRYINDEX, c->func);
+   ret = nlua_pcall(cond_env, 0, 1);
+
+   /* Random conditionals have to be rolled every time. */
+   if (nlua_rndCalls() != rnd)
+      c->memoable = 0;
    switch (ret) {
-      case  LUA_ERRSYNTAX:
-         WARN(_("Lua conditional syntax error: %s"), lua_tostring(naevL, -1));
-         goto cond_err;
       case LUA_ERRRUN:
          WARN(_("Lua Conditional had a runtime error: %s"), lua_tostring(naevL, -1));
          goto cond_err;
@@ -100,6 +219,10 @@ int cond_check( const char* cond )
       /* Clear the stack. */
       lua_settop(naevL, 0);
 
+      /* Memoize. */
+      c->memo     = ret;
+      c->memo_gen = cond_gen;
+
       return ret;
    }
    WARN(_("Lua Conditional didn't return a boolean"));
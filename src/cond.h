@@ -10,6 +10,9 @@
 int cond_init (void);
 void cond_exit (void);
 int cond_check( const char *cond );
+void cond_memoStart (void);
+void cond_memoEnd (void);
+void cond_invalidate (void);
 
 
 #endif /* COND_H */
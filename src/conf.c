@@ -110,6 +110,10 @@ static void print_usage( void )
    LOG(_("   -s f, --svol f        sets the sound volume to f"));
    LOG(_("   -d, --datapath        adds a new datapath to be mounted (used for looking for game assets)"));
    LOG(_("   -X, --scale           defines the scale factor"));
+   LOG(_("   --bench s             runs a headless simulation benchmark in system s and exits"));
+   LOG(_("   --benchticks n        number of updates to run the benchmark for"));
+   LOG(_("   --benchpresence f     multiplies the presence of the benchmark fleets by f"));
+   LOG(_("   --benchrender         also renders every benchmark update and reports draw calls"));
 #ifdef DEBUGGING
    LOG(_("   --devmode             enables dev mode perks like the editors"));
    LOG(_("   --devcsv              generates csv output from the ndata for development purposes"));
@@ -169,6 +173,11 @@ void conf_setDefaults (void)
    conf.devmode      = 0;
    conf.devautosave  = 0;
    conf.devcsv       = 0;
+   free( conf.bench );
+   conf.bench        = NULL;
+   conf.bench_ticks  = 3000;
+   conf.bench_presence = 1.;
+   conf.bench_render = 0;
    free( conf.lastversion );
    conf.lastversion = strdup( "" );
 
@@ -206,6 +215,7 @@ void conf_setGameplayDefaults (void)
    conf.compression_velocity  = TIME_COMPRESSION_DEFAULT_MAX;
    conf.compression_mult      = TIME_COMPRESSION_DEFAULT_MULT;
    conf.save_compress         = SAVE_COMPRESSION_DEFAULT;
+   conf.ai_parallel           = AI_PARALLEL_DEFAULT;
    conf.mouse_thrust          = MOUSE_THRUST_DEFAULT;
    conf.mouse_doubleclick     = MOUSE_DOUBLECLICK_TIME;
    conf.autonav_reset_speed   = AUTONAV_RESET_SPEED_DEFAULT;
@@ -220,6 +230,7 @@ void conf_setAudioDefaults (void)
 {
    /* Sound. */
    conf.snd_voices   = VOICES_DEFAULT;
+   conf.snd_cache    = SND_CACHE_DEFAULT;
    conf.snd_pilotrel = PILOT_RELATIVE_DEFAULT;
    conf.al_efx       = USE_EFX_DEFAULT;
    conf.al_bufsize   = BUFFER_SIZE_DEFAULT;
@@ -294,6 +305,7 @@ void conf_cleanup (void)
    free(conf.joystick_nam);
 
    free(conf.lastversion);
+   free(conf.bench);
 
    free(conf.dev_save_sys);
    free(conf.dev_save_map);
@@ -386,6 +398,7 @@ int conf_loadConfig ( const char* file )
       /* Sound. */
       conf_loadInt( lEnv, "snd_voices", conf.snd_voices );
       conf.snd_voices = MAX( VOICES_MIN, conf.snd_voices ); /* Must be at least 16. */
+      conf_loadInt( lEnv, "snd_cache", conf.snd_cache );
       conf_loadBool( lEnv, "snd_pilotrel", conf.snd_pilotrel );
       conf_loadBool( lEnv, "al_efx", conf.al_efx );
       conf_loadInt( lEnv, "al_bufsize", conf.al_bufsize );
@@ -433,6 +446,7 @@ int conf_loadConfig ( const char* file )
       conf_loadFloat( lEnv, "compression_mult", conf.compression_mult );
       conf_loadBool( lEnv, "redirect_file", conf.redirect_file );
       conf_loadBool( lEnv, "save_compress", conf.save_compress );
+      conf_loadBool( lEnv, "ai_parallel", conf.ai_parallel );
       conf_loadInt( lEnv, "afterburn_sensitivity", conf.afterburn_sens );
       conf_loadInt( lEnv, "mouse_thrust", conf.mouse_thrust );
       conf_loadFloat( lEnv, "mouse_doubleclick", conf.mouse_doubleclick );
@@ -586,6 +600,10 @@ void conf_parseCLI( int argc, char** argv )
       { "svol", required_argument, 0, 's' },
       { "generate", no_argument, 0, 'G' },
       { "scale", required_argument, 0, 'X' },
+      { "bench", required_argument, 0, 'b' },
+      { "benchticks", required_argument, 0, 'T' },
+      { "benchpresence", required_argument, 0, 'P' },
+      { "benchrender", no_argument, 0, 'R' },
 #ifdef DEBUGGING
       { "devmode", no_argument, 0, 'D' },
       { "devcsv", no_argument, 0, 'C' },
@@ -650,6 +668,23 @@ void conf_parseCLI( int argc, char** argv )
          case 'X':
             conf.scalefactor = atof(optarg);
             break;
+         case 'b':
+            free(conf.bench);
+            conf.bench   = strdup(optarg);
+            conf.nosound = 1;
+            conf.vsync   = 0;
+            conf.fps_max = 0;
+            conf.fullscreen = 0;
+            break;
+         case 'T':
+            conf.bench_ticks = atoi(optarg);
+            break;
+         case 'P':
+            conf.bench_presence = atof(optarg);
+            break;
+         case 'R':
+            conf.bench_render = 1;
+            break;
 #ifdef DEBUGGING
          case 'D':
             conf.devmode = 1;
@@ -947,6 +982,10 @@ int conf_saveConfig ( const char* file )
    conf_saveInt("snd_voices",conf.snd_voices);
    conf_saveEmptyLine();
 
+   conf_saveComment(_("Megabytes of decoded sounds to keep in memory, sounds not played for a while get decoded again when needed."));
+   conf_saveInt("snd_cache",conf.snd_cache);
+   conf_saveEmptyLine();
+
    conf_saveComment(_("Sets sound to be relative to pilot when camera is following a pilot instead of referenced to camera."));
    conf_saveBool("snd_pilotrel",conf.snd_pilotrel);
    conf_saveEmptyLine();
@@ -1058,6 +1097,10 @@ int conf_saveConfig ( const char* file )
    conf_saveBool("save_compress",conf.save_compress);
    conf_saveEmptyLine();
 
+   conf_saveComment(_("Precomputes AI queries on multiple threads"));
+   conf_saveBool("ai_parallel",conf.ai_parallel);
+   conf_saveEmptyLine();
+
    conf_saveComment(_("Afterburner sensitivity"));
    conf_saveInt("afterburn_sensitivity",conf.afterburn_sens);
    conf_saveEmptyLine();
@@ -22,6 +22,7 @@
 #define MANUAL_ZOOM_DEFAULT                  0     /**< Whether or not to enable manual zoom controls. */
 #define MAP_OVERLAY_OPACITY_DEFAULT          0.3   /**< Opacity fraction (0-1) for the overlay map. */
 #define INPUT_MESSAGES_DEFAULT               5     /**< Amount of messages to display. */
+#define AI_PARALLEL_DEFAULT                  1     /**< Whether the AI precomputations run on the threadpool. */
 /* Video options */
 #define RESOLUTION_W_MIN                     1280  /**< Minimum screen width (below which graphics are downscaled). */
 #define RESOLUTION_H_MIN                     720   /**< Minimum screen height (below which graphics are downscaled). */
@@ -49,6 +50,7 @@
 /* Audio options */
 #define VOICES_DEFAULT                       128   /**< Amount of voices to use. */
 #define VOICES_MIN                           16    /**< Minimum amount of voices to use. */
+#define SND_CACHE_DEFAULT                    32    /**< Memory for decoded sounds in megabytes. */
 #define PILOT_RELATIVE_DEFAULT               1     /**< Whether the sound is relative to the pilot (as opposed to the camera). */
 #define USE_EFX_DEFAULT                      1     /**< Whether or not to use EFX (if using OpenAL). */
 #define BUFFER_SIZE_DEFAULT                  128   /**< Default buffer size (if using OpenAL). */
@@ -97,6 +99,7 @@ typedef struct PlayerConf_s {
 
    /* Sound. */
    int snd_voices; /**< Number of sound voices to use. */
+   int snd_cache; /**< Megabytes of decoded sounds to keep around. */
    int snd_pilotrel; /**< Sound is relative to pilot when following. */
    int al_efx; /**< Should EFX extension be used? (only applicable for OpenAL) */
    int al_bufsize; /**< Size of the buffer (in kilobytes) to use for music. */
@@ -144,6 +147,7 @@ typedef struct PlayerConf_s {
    double compression_mult; /**< Maximum time multiplier. */
    int redirect_file; /**< Redirect output to files. */
    int save_compress; /**< Compress saved game. */
+   int ai_parallel; /**< Precompute AI queries on the threadpool. */
    unsigned int afterburn_sens; /**< Afterburn sensibility. */
    int mouse_thrust; /**< Whether mouse flying controls thrust. */
    double mouse_doubleclick; /**< How long to consider double-clicks for. */
@@ -152,6 +156,10 @@ typedef struct PlayerConf_s {
    int devmode; /**< Developer mode. */
    int devautosave; /**< Developer mode autosave. */
    int devcsv; /**< Output CSV data. */
+   char *bench; /**< System to benchmark the simulation in, NULL if not benchmarking. */
+   int bench_ticks; /**< Number of updates to benchmark. */
+   double bench_presence; /**< Presence multiplier for the benchmark fleets. */
+   int bench_render; /**< Whether or not to render the benchmark updates. */
    char *lastversion; /**< The last version the game was ran in. */
 
    /* Debugging. */
@@ -31,6 +31,7 @@
 #include "opengl.h"
 #include "opengl_render.h"
 #include "space.h"
+#include "strhash.h"
 #include "tk/toolkit_priv.h"
 #include "toolkit.h"
 #include "unidiff.h"
@@ -378,6 +379,7 @@ static void sysedit_btnNew( unsigned int wid_unused, char *unused )
    p        = planet_new();
    p->real  = ASSET_REAL;
    p->name  = name;
+   strhash_set( STRHASH_PLANET, p->name, planet_index( p ) );
 
    /* Base planet data off another. */
    b                    = planet_get( space_getRndPlanet(0, 0, NULL) );
@@ -447,9 +449,11 @@ static void sysedit_btnRename( unsigned int wid_unused, char *unused )
 
          free(oldName);
          free(newName);
+         strhash_unset( STRHASH_PLANET, p->name, planet_index( p ) );
          free(p->name);
 
          p->name = name;
+         strhash_set( STRHASH_PLANET, p->name, planet_index( p ) );
          window_modifyText( sysedit_widEdit, "txtName", p->name );
          dpl_savePlanet( p );
       }
@@ -1484,6 +1488,7 @@ static void sysedit_editJumpClose( unsigned int wid, char *unused )
       jp_rmFlag( j, JP_EXITONLY );
    }
    j->hide  = pow2( atof(window_getInput( sysedit_widEdit, "inpHide" )) );
+   map_invalidateJumpPaths();
 
    window_close( wid, unused );
 }
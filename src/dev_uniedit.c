@@ -29,6 +29,7 @@
 #include "opengl.h"
 #include "pause.h"
 #include "space.h"
+#include "strhash.h"
 #include "tk/toolkit_priv.h"
 #include "toolkit.h"
 #include "unidiff.h"
@@ -715,9 +716,11 @@ static void uniedit_renameSys (void)
 
       free(oldName);
       free(newName);
+      strhash_unset( STRHASH_SYSTEM, sys->name, system_index( sys ) );
       free(sys->name);
 
       sys->name = name;
+      strhash_set( STRHASH_SYSTEM, sys->name, system_index( sys ) );
       dsys_saveSystem(sys);
 
       /* Re-save adjacent systems. */
@@ -758,6 +761,7 @@ static void uniedit_newSys( double x, double y )
    /* Create the system. */
    sys         = system_new();
    sys->name   = name;
+   strhash_set( STRHASH_SYSTEM, sys->name, system_index( sys ) );
    sys->pos.x  = x;
    sys->pos.y  = y;
    sys->stars  = STARS_DENSITY_DEFAULT;
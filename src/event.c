@@ -253,6 +253,9 @@ static int event_create( int dataid, unsigned int *id )
    Event_t *ev;
    EventData *data;
 
+   /* Conditionals may check running events. */
+   cond_invalidate();
+
    /* Create the event. */
    event_nactive++;
    if (event_nactive > event_mactive) {
@@ -308,6 +311,9 @@ static int event_create( int dataid, unsigned int *id )
  */
 static void event_cleanup( Event_t *ev )
 {
+   /* Conditionals may check running events. */
+   cond_invalidate();
+
    /* Free lua env. */
    nlua_freeEnv(ev->env);
 
@@ -11,6 +11,7 @@
 
 /** @cond */
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "naev.h"
@@ -20,6 +21,7 @@
 
 #include "array.h"
 #include "colour.h"
+#include "cond.h"
 #include "hook.h"
 #include "log.h"
 #include "ndata.h"
@@ -30,6 +32,7 @@
 #include "opengl.h"
 #include "rng.h"
 #include "space.h"
+#include "strhash.h"
 
 
 #define XML_FACTION_ID     "Factions"   /**< XML section identifier */
@@ -87,12 +90,28 @@ typedef struct Faction_ {
 
 static Faction* faction_stack = NULL; /**< Faction stack. */
 
+/*
+ * Relations between factions as bit matrices, one row of words per faction.
+ * The player's row is computed from the standings. They are rebuilt as soon
+ * as anything changes so reading them never has to run any Lua, and can be
+ * done from the threadpool.
+ */
+static uint64_t *faction_enemyMat = NULL; /**< Enemy relations. */
+static uint64_t *faction_allyMat  = NULL; /**< Ally relations. */
+static int faction_relWords       = 0; /**< Words in a row of the matrices. */
+static int faction_relN           = 0; /**< Factions in the matrices. */
+static int faction_relLoading     = 0; /**< Factions are being loaded, relations get built at the end. */
+
 
 /*
  * Prototypes
  */
 /* static */
 static void faction_freeOne( Faction *f );
+static void faction_relUpdate (void);
+static void faction_plyUpdate( int f );
+static void faction_relSet( uint64_t *mat, int a, int b, int val );
+static int faction_relGet( const uint64_t *mat, int a, int b );
 static void faction_sanitizePlayer( Faction* faction );
 static void faction_modPlayerLua( int f, double mod, const char *source, int secondary );
 static int faction_parse( Faction* temp, xmlNodePtr parent );
@@ -117,11 +136,8 @@ int faction_get( const char* name )
       return FACTION_PLAYER;
 
    if (name != NULL) {
-      for (i=0; i<array_size(faction_stack); i++)
-         if (strcmp(faction_stack[i].name, name)==0)
-            break;
-
-      if (i != array_size(faction_stack))
+      i = strhash_get( STRHASH_FACTION, name );
+      if (i >= 0)
          return i;
    }
 
@@ -470,6 +486,7 @@ void faction_addEnemy( int f, int o )
 
    tmp = &array_grow( &ff->enemies );
    *tmp = o;
+   faction_relUpdate();
 }
 
 
@@ -496,6 +513,7 @@ void faction_rmEnemy( int f, int o )
    for (i=0;i<array_size(ff->enemies);i++) {
       if (ff->enemies[i] == o) {
          array_erase( &ff->enemies, &ff->enemies[i], &ff->enemies[i+1] );
+         faction_relUpdate();
          return;
       }
    }
@@ -544,6 +562,7 @@ void faction_addAlly( int f, int o )
 
    tmp = &array_grow( &ff->allies );
    *tmp = o;
+   faction_relUpdate();
 }
 
 
@@ -570,6 +589,7 @@ void faction_rmAlly( int f, int o )
    for (i=0;i<array_size(ff->allies);i++) {
       if (ff->allies[i] == o) {
          array_erase( &ff->allies, &ff->allies[i], &ff->allies[i+1] );
+         faction_relUpdate();
          return;
       }
    }
@@ -611,6 +631,9 @@ nlua_env faction_getEquipper( int f )
  */
 static void faction_sanitizePlayer( Faction* faction )
 {
+   /* Standings changed, conditionals may depend on them. */
+   cond_invalidate();
+
    if (faction->player > 100.)
       faction->player = 100.;
    else if (faction->player < -100.)
@@ -664,6 +687,7 @@ static void faction_modPlayerLua( int f, double mod, const char *source, int sec
 
    /* Sanitize just in case. */
    faction_sanitizePlayer( faction );
+   faction_plyUpdate( f );
 
    /* Run hook if necessary. */
    delta = faction->player - old;
@@ -770,6 +794,7 @@ void faction_modPlayerRaw( int f, double mod )
 
    faction = &faction_stack[f];
    faction->player += mod;
+   cond_invalidate();
    /* Run hook if necessary. */
    hparam[0].type    = HOOK_PARAM_FACTION;
    hparam[0].u.lf    = f;
@@ -780,6 +805,7 @@ void faction_modPlayerRaw( int f, double mod )
 
    /* Sanitize just in case. */
    faction_sanitizePlayer( faction );
+   faction_plyUpdate( f );
 
    /* Tell space the faction changed. */
    space_factionChange();
@@ -806,6 +832,7 @@ void faction_setPlayer( int f, double value )
    faction = &faction_stack[f];
    mod = value - faction->player;
    faction->player = value;
+   cond_invalidate();
    /* Run hook if necessary. */
    hparam[0].type    = HOOK_PARAM_FACTION;
    hparam[0].u.lf    = f;
@@ -816,6 +843,7 @@ void faction_setPlayer( int f, double value )
 
    /* Sanitize just in case. */
    faction_sanitizePlayer( faction );
+   faction_plyUpdate( f );
 
    /* Tell space the faction changed. */
    space_factionChange();
@@ -1099,43 +1127,21 @@ const char *faction_getStandingBroad( int f, int bribed, int override )
  */
 int areEnemies( int a, int b)
 {
-   Faction *fa, *fb;
-   int i;
-
    if (a==b) return 0; /* luckily our factions aren't masochistic */
 
    /* handle a */
-   if (faction_isFaction(a))
-      fa = &faction_stack[a];
-   else { /* a is invalid */
+   if (!faction_isFaction(a)) { /* a is invalid */
       WARN(_("Faction id '%d' is invalid."), a);
       return 0;
    }
 
    /* handle b */
-   if (faction_isFaction(b))
-      fb = &faction_stack[b];
-   else { /* b is invalid */
+   if (!faction_isFaction(b)) { /* b is invalid */
       WARN(_("Faction id '%d' is invalid."), b);
       return 0;
    }
 
-   /* player handled separately */
-   if (a==FACTION_PLAYER) {
-      return faction_isPlayerEnemy(b);
-   }
-   else if (b==FACTION_PLAYER) {
-      return faction_isPlayerEnemy(a);
-   }
-
-   for (i=0;i<array_size(fa->enemies);i++)
-      if (fa->enemies[i] == b)
-         return 1;
-   for (i=0;i<array_size(fb->enemies);i++)
-      if (fb->enemies[i] == a)
-         return 1;
-
-   return 0;
+   return faction_relGet( faction_enemyMat, a, b );
 }
 
 
@@ -1148,44 +1154,128 @@ int areEnemies( int a, int b)
  */
 int areAllies( int a, int b )
 {
-   Faction *fa, *fb;
-   int i;
-
    /* If they are the same they must be allies. */
    if (a==b) return 1;
 
    /* handle a */
-   if (faction_isFaction(a))
-      fa = &faction_stack[a];
-   else { /* a is invalid */
+   if (!faction_isFaction(a)) { /* a is invalid */
       WARN(_("Faction id '%d' is invalid."), a);
       return 0;
    }
 
    /* handle b */
-   if (faction_isFaction(b))
-      fb = &faction_stack[b];
-   else { /* b is invalid */
+   if (!faction_isFaction(b)) { /* b is invalid */
       WARN(_("Faction id '%d' is invalid."), b);
       return 0;
    }
 
-   /* we assume player becomes allies with high rating */
-   if (a==FACTION_PLAYER) {
-      return faction_isPlayerFriend(b);
-   }
-   else if (b==FACTION_PLAYER) {
-      return faction_isPlayerFriend(a);
+   return faction_relGet( faction_allyMat, a, b );
+}
+
+
+/**
+ * @brief Sets a relation in a relation matrix.
+ *
+ *    @param mat Matrix to modify.
+ *    @param a Faction of the row.
+ *    @param b Faction of the column.
+ *    @param val Whether or not the relation holds.
+ */
+static void faction_relSet( uint64_t *mat, int a, int b, int val )
+{
+   uint64_t *w;
+
+   w = &mat[ a*faction_relWords + b/64 ];
+   if (val)
+      *w |= UINT64_C(1) << (b%64);
+   else
+      *w &= ~(UINT64_C(1) << (b%64));
+}
+
+
+/**
+ * @brief Tests a relation in a relation matrix.
+ *
+ *    @param mat Matrix to look in.
+ *    @param a Faction of the row.
+ *    @param b Faction of the column.
+ *    @return 1 if the relation holds.
+ */
+static int faction_relGet( const uint64_t *mat, int a, int b )
+{
+   /* Factions still being loaded have no relations. */
+   if ((a >= faction_relN) || (b >= faction_relN))
+      return 0;
+   return (mat[ a*faction_relWords + b/64 ] >> (b%64)) & 1;
+}
+
+
+/**
+ * @brief Rebuilds the relation matrices.
+ *
+ * The relations between factions are symmetric, like the scans over the
+ *  enemy and ally lists they replace. The relations with the player come
+ *  from the faction scripts.
+ */
+static void faction_relUpdate (void)
+{
+   int i, j, n, o;
+   Faction *f;
+
+   if (faction_relLoading)
+      return;
+
+   n = array_size(faction_stack);
+   faction_relN     = n;
+   faction_relWords = (n+63) / 64;
+   faction_enemyMat = realloc( faction_enemyMat, sizeof(uint64_t) * n * faction_relWords );
+   faction_allyMat  = realloc( faction_allyMat, sizeof(uint64_t) * n * faction_relWords );
+   memset( faction_enemyMat, 0, sizeof(uint64_t) * n * faction_relWords );
+   memset( faction_allyMat, 0, sizeof(uint64_t) * n * faction_relWords );
+
+   for (i=0; i<n; i++) {
+      if (i == FACTION_PLAYER)
+         continue;
+      f = &faction_stack[i];
+      for (j=0; j<array_size(f->enemies); j++) {
+         o = f->enemies[j];
+         if ((o == i) || (o == FACTION_PLAYER) || !faction_isFaction(o))
+            continue;
+         faction_relSet( faction_enemyMat, i, o, 1 );
+         faction_relSet( faction_enemyMat, o, i, 1 );
+      }
+      for (j=0; j<array_size(f->allies); j++) {
+         o = f->allies[j];
+         if ((o == i) || (o == FACTION_PLAYER) || !faction_isFaction(o))
+            continue;
+         faction_relSet( faction_allyMat, i, o, 1 );
+         faction_relSet( faction_allyMat, o, i, 1 );
+      }
    }
 
-   for (i=0;i<array_size(fa->allies);i++)
-      if (fa->allies[i] == b)
-         return 1;
-   for (i=0;i<array_size(fb->allies);i++)
-      if (fb->allies[i] == a)
-         return 1;
+   for (i=0; i<n; i++)
+      faction_plyUpdate( i );
+}
 
-   return 0;
+
+/**
+ * @brief Updates the relations of the player with a faction from its standing.
+ *
+ *    @param f Faction whose standing changed.
+ */
+static void faction_plyUpdate( int f )
+{
+   int o;
+
+   if ((f == FACTION_PLAYER) || (f >= faction_relN))
+      return;
+
+   o = faction_isPlayerEnemy(f);
+   faction_relSet( faction_enemyMat, FACTION_PLAYER, f, o );
+   faction_relSet( faction_enemyMat, f, FACTION_PLAYER, o );
+   o = faction_isPlayerFriend(f);
+   faction_relSet( faction_allyMat, FACTION_PLAYER, f, o );
+   faction_relSet( faction_allyMat, f, FACTION_PLAYER, o );
 }
 
 
@@ -1428,6 +1518,7 @@ void factions_reset (void)
       faction_stack[i].player = faction_stack[i].player_def;
       faction_stack[i].flags = faction_stack[i].oflags;
    }
+   faction_relUpdate();
 }
 
 
@@ -1460,6 +1551,9 @@ int factions_load (void)
       return -1;
    }
 
+   /* Relations are built once everything is loaded. */
+   faction_relLoading = 1;
+
    /* player faction is hard-coded */
    faction_stack = array_create( Faction );
    f = &array_grow( &faction_stack );
@@ -1484,6 +1578,10 @@ int factions_load (void)
       }
    } while (xml_nextNode(node));
 
+   /* Index names. */
+   for (i=0; i<array_size(faction_stack); i++)
+      strhash_set( STRHASH_FACTION, faction_stack[i].name, i );
+
    /* Second pass - sets allies and enemies */
    node = factions;
    do {
@@ -1528,6 +1626,8 @@ int factions_load (void)
    }
 
    xmlFreeDoc(doc);
+   faction_relLoading = 0;
+   faction_relUpdate();
 
    DEBUG( n_( "Loaded %d Faction", "Loaded %d Factions", array_size(faction_stack) ), array_size(faction_stack) );
 
@@ -1568,6 +1668,15 @@ void factions_free (void)
       faction_freeOne( &faction_stack[i] );
    array_free(faction_stack);
    faction_stack = NULL;
+   strhash_clear( STRHASH_FACTION );
+
+   /* free relations */
+   free(faction_enemyMat);
+   free(faction_allyMat);
+   faction_enemyMat = NULL;
+   faction_allyMat  = NULL;
+   faction_relN     = 0;
+   faction_relWords = 0;
 }
 
 
@@ -1649,6 +1758,9 @@ int pfaction_load( xmlNodePtr parent )
       }
    } while (xml_nextNode(node));
 
+   /* Standings changed. */
+   faction_relUpdate();
+
    return 0;
 }
 
@@ -1728,6 +1840,12 @@ void factions_clearDynamic (void)
          i--;
       }
    }
+
+   /* Reindex names, erasing moves the factions around. */
+   strhash_clear( STRHASH_FACTION );
+   for (i=0; i<array_size(faction_stack); i++)
+      strhash_set( STRHASH_FACTION, faction_stack[i].name, i );
+   faction_relUpdate();
 }
 
 
@@ -1747,6 +1865,7 @@ int faction_dynAdd( int base, const char *name, const char *display )
    memset( f, 0, sizeof(Faction) );
    f->name        = strdup( name );
    f->displayname = strdup( display );
+   strhash_set( STRHASH_FACTION, f->name, array_size(faction_stack)-1 );
    f->allies      = array_create( int );
    f->enemies     = array_create( int );
    f->equip_env   = LUA_NOREF;
@@ -1773,6 +1892,7 @@ int faction_dynAdd( int base, const char *name, const char *display )
       f->player_def = bf->player_def;
       f->player = bf->player;
    }
+   faction_relUpdate();
 
    return array_size(faction_stack)-1;
 }
@@ -39,6 +39,10 @@
 #define HASH_LUT_SIZE 512 /**< Size of glyph look up table. */
 #define DEFAULT_TEXTURE_SIZE 1024 /**< Default size of texture caches for glyphs. */
 #define MAX_ROWS 64 /**< Max number of rows per texture cache. */
+#define LAYOUT_LUT_SIZE 1024 /**< Size of the text layout look up table. */
+#define LAYOUT_MAX      2048 /**< Maximum number of cached text layouts. */
+#define LAYOUT_MAXAGE   120 /**< Frames a layout is kept without being drawn. */
+#define LAYOUT_SEEN_SIZE 256 /**< Size of the tables of text seen in a frame. */
 
 
 /**
@@ -152,6 +156,50 @@ typedef struct glFontStash_s {
    int refcount; /**< Reference counting. */
 } glFontStash;
 
+/**
+ * @brief A run of glyphs with the same texture and colour.
+ */
+typedef struct glFontRun_s {
+   GLuint tex; /**< Texture of the glyphs. */
+   const glColour *col; /**< Colour of the glyphs, NULL for the base colour. */
+   GLint first; /**< First vertex. */
+   GLsizei count; /**< Number of vertices. */
+} glFontRun;
+
+
+/**
+ * @brief Cached layout of a piece of text.
+ *
+ * Text is laid out once into a static VBO with the glyphs already placed, so
+ * drawing it again is just a few draw calls.
+ */
+typedef struct glFontLayout_s {
+   /* Key. */
+   uint32_t hash; /**< Hash of the key. */
+   int font; /**< Font stash id. */
+   char *text; /**< Text being laid out. */
+   int width; /**< Width to limit or wrap to, -1 for no limit. */
+   int height; /**< Height of the block, -1 for a single line. */
+   int line_height; /**< Height of the lines of a block. */
+   const glColour *start; /**< Colour restored at the start, NULL for the base colour. */
+
+   /* Result. */
+   int len; /**< Number of bytes drawn of a single line. */
+   int w; /**< Width of a single line. */
+   const glColour *lastcol; /**< Last colour set by the text. */
+   int setcol; /**< Whether the text sets a colour. */
+   glFontRun *runs; /**< Runs of glyphs to draw (array.h). */
+   gl_vbo *vbo; /**< Vertices with interleaved texture coordinates, NULL if there's nothing to draw. */
+   unsigned int frame; /**< Last frame it was used. */
+   struct glFontLayout_s *next; /**< Next layout in the bucket. */
+} glFontLayout;
+static glFontLayout *font_layouts[LAYOUT_LUT_SIZE]; /**< Cached text layouts. */
+static int font_nlayouts         = 0; /**< Number of cached text layouts. */
+static unsigned int font_frame   = 1; /**< Current frame for the layout cache. */
+static GLfloat *font_layoutData  = NULL; /**< Vertices of the layout being built (array.h). */
+static uint32_t font_layoutSeen[2][LAYOUT_SEEN_SIZE]; /**< Hashes of uncached text seen this frame and the previous one. */
+
+
 /**
  * Available fonts stashes.
  */
@@ -181,12 +229,23 @@ static glFontGlyph* gl_fontGetGlyph( glFontStash *stsh, uint32_t ch );
  * In particular, instead of writing char by char, they should be batched up by textures and rendered
  * when gl_fontRenderEnd() is called, saving lots of opengl calls.
  */
+static void gl_fontRenderUniforms( const glFontStash *stsh, double x, double y, const glColour *c, double outlineR );
 static void gl_fontRenderStart( const glFontStash *stsh, double x, double y, const glColour *c, double outlineR );
 static int gl_fontRenderGlyph( glFontStash *stsh, uint32_t ch, const glColour *c, int state );
 static void gl_fontRenderEnd (void);
 /* Fussy layout concerns. */
 static void gl_fontKernStart (void);
 static int gl_fontKernGlyph( glFontStash* stsh, uint32_t ch, glFontGlyph* glyph );
+/* Layout cache. */
+static glFontLayout* font_layoutGet( glFontStash *stsh, const char *text,
+      int width, int height, int line_height, int build );
+static void font_layoutBuild( glFontStash *stsh, glFontLayout *lay );
+static void font_layoutLine( glFontStash *stsh, glFontLayout *lay, const char *text,
+      size_t start, size_t end, double ox, double oy, const glColour **col, int *state );
+static void font_layoutRender( const glFontStash *stsh, const glFontLayout *lay,
+      double x, double y, const glColour *c, double outlineR );
+static void font_layoutFree( glFontLayout *lay );
+static void font_layoutClear( int font );
 
 
 /**
@@ -618,6 +677,7 @@ void gl_printRaw( const glFont *ft_font, double x, double y, const glColour* c,
       double outlineR, const char *text )
 {
    int s;
+   const glFontLayout *lay;
    size_t i;
    uint32_t ch;
 
@@ -625,6 +685,13 @@ void gl_printRaw( const glFont *ft_font, double x, double y, const glColour* c,
       ft_font = &gl_defFont;
    glFontStash *stsh = gl_fontGetStash( ft_font );
 
+   /* Use the cached layout if possible. */
+   lay = font_layoutGet( stsh, text, -1, -1, 0, 1 );
+   if (lay != NULL) {
+      font_layoutRender( stsh, lay, x, y, c, outlineR );
+      return;
+   }
+
    /* Render it. */
    s = 0;
    i = 0;
@@ -695,11 +762,19 @@ int gl_printMaxRaw( const glFont *ft_font, const int max, double x, double y,
    int s;
    size_t ret, i;
    uint32_t ch;
+   const glFontLayout *lay;
 
    if (ft_font == NULL)
       ft_font = &gl_defFont;
    glFontStash *stsh = gl_fontGetStash( ft_font );
 
+   /* Use the cached layout if possible. */
+   lay = font_layoutGet( stsh, text, MAX( 0, max ), -1, 0, 1 );
+   if (lay != NULL) {
+      font_layoutRender( stsh, lay, x, y, c, outlineR );
+      return lay->len;
+   }
+
    /* Limit size. */
    ret = font_limitSize( stsh, NULL, text, max );
 
@@ -770,11 +845,19 @@ int gl_printMidRaw(
    int n, s;
    size_t ret, i;
    uint32_t ch;
+   const glFontLayout *lay;
 
    if (ft_font == NULL)
       ft_font = &gl_defFont;
    glFontStash *stsh = gl_fontGetStash( ft_font );
 
+   /* Use the cached layout if possible. */
+   lay = font_layoutGet( stsh, text, MAX( 0, width ), -1, 0, 1 );
+   if (lay != NULL) {
+      font_layoutRender( stsh, lay, x + (double)(width - lay->w)/2., y, c, outlineR );
+      return lay->len;
+   }
+
    /* limit size */
    n = 0;
    ret = font_limitSize( stsh, &n, text, width );
@@ -852,6 +935,7 @@ int gl_printTextRaw( const glFont *ft_font,
    double x,y;
    size_t i, ret;
    uint32_t ch;
+   const glFontLayout *lay;
 
    if (ft_font == NULL)
       ft_font = &gl_defFont;
@@ -867,6 +951,13 @@ int gl_printTextRaw( const glFont *ft_font,
    /* Clears restoration. */
    gl_printRestoreClear();
 
+   /* Use the cached layout if possible. */
+   lay = font_layoutGet( stsh, text, width, MAX( 0, height ), line_height, 1 );
+   if (lay != NULL) {
+      font_layoutRender( stsh, lay, x, y, c, outlineR );
+      return 0;
+   }
+
    ch = text[0]; /* In case of a 0-width first line (ret==p) below, we just care if text is empty or not. */
    i = 0;
    s = 0;
@@ -952,11 +1043,17 @@ int gl_printWidthRaw( const glFont *ft_font, const char *text )
    GLfloat n;
    size_t i;
    uint32_t ch;
+   const glFontLayout *lay;
 
    if (ft_font == NULL)
       ft_font = &gl_defFont;
    glFontStash *stsh = gl_fontGetStash( ft_font );
 
+   /* Text that is being drawn already knows its width. */
+   lay = font_layoutGet( stsh, text, -1, -1, 0, 0 );
+   if (lay != NULL)
+      return lay->w;
+
    gl_fontKernStart();
    n = 0.;
    i = 0;
@@ -1064,6 +1161,366 @@ int gl_printHeight( const glFont *ft_font,
 }
 
 
+/**
+ * @brief Gets the cached layout of a piece of text.
+ *
+ * Text is only cached when it was also drawn the previous frame, which is
+ * tracked by hash in a small table, so text that changes every frame doesn't
+ * allocate or fill the cache.
+ *
+ *    @param stsh Font stash of the text.
+ *    @param text Text to get the layout of.
+ *    @param width Width to limit a line or wrap a block to, -1 for no limit.
+ *    @param height Height of a block, -1 for a single line.
+ *    @param line_height Height of the lines of a block.
+ *    @param build Whether to lay out the text if it's not cached.
+ *    @return The layout ready to render or NULL if the text has to be drawn directly.
+ */
+static glFontLayout* font_layoutGet( glFontStash *stsh, const char *text,
+      int width, int height, int line_height, int build )
+{
+   glFontLayout *lay;
+   const glColour *start;
+   const unsigned char *t;
+   uint32_t h;
+   int font;
+
+   if ((text == NULL) || (text[0] == '\0'))
+      return NULL;
+
+   /* Colour carried over from previous text. */
+   start = font_restoreLast ? font_lastCol : NULL;
+   font  = stsh - avail_fonts;
+
+   /* FNV-1a of the key. */
+   h = 2166136261u;
+   for (t=(const unsigned char*)text; *t!='\0'; t++) {
+      h ^= *t;
+      h *= 16777619u;
+   }
+   h ^= (uint32_t)font * 2654435761u;
+   h ^= (uint32_t)width * 40503u + (uint32_t)height * 31u + (uint32_t)line_height;
+
+   for (lay=font_layouts[ h & (LAYOUT_LUT_SIZE-1) ]; lay!=NULL; lay=lay->next) {
+      if ((lay->hash != h) || (lay->font != font) || (lay->width != width) ||
+            (lay->height != height) || (lay->line_height != line_height) ||
+            (strcmp( lay->text, text ) != 0))
+         continue;
+      /* Only the width is wanted, colours don't matter. */
+      if (!build)
+         return (lay->vbo != NULL) ? lay : NULL;
+      if (lay->start != start)
+         continue;
+
+      lay->frame = font_frame;
+      return (lay->vbo != NULL) ? lay : NULL;
+   }
+
+   if (!build)
+      return NULL;
+
+   /* Only worth laying out if it was drawn last frame too. */
+   if (font_layoutSeen[1][ h & (LAYOUT_SEEN_SIZE-1) ] != h) {
+      font_layoutSeen[0][ h & (LAYOUT_SEEN_SIZE-1) ] = h;
+      return NULL;
+   }
+   if (font_nlayouts >= LAYOUT_MAX)
+      return NULL;
+   lay = calloc( 1, sizeof(glFontLayout) );
+   lay->hash        = h;
+   lay->font        = font;
+   lay->text        = strdup( text );
+   lay->width       = width;
+   lay->height      = height;
+   lay->line_height = line_height;
+   lay->start       = start;
+   lay->frame       = font_frame;
+   lay->next        = font_layouts[ h & (LAYOUT_LUT_SIZE-1) ];
+   font_layouts[ h & (LAYOUT_LUT_SIZE-1) ] = lay;
+   font_nlayouts++;
+   font_layoutBuild( stsh, lay );
+   return (lay->vbo != NULL) ? lay : NULL;
+}
+
+
+/**
+ * @brief Lays out the text of a layout into its VBO.
+ *
+ * Mirrors what gl_printMaxRaw and gl_printTextRaw do when drawing directly.
+ */
+static void font_layoutBuild( glFontStash *stsh, glFontLayout *lay )
+{
+   int p, l, lp, state;
+   double y;
+   size_t ret;
+   const char *text;
+   const glColour *col;
+   glFont font;
+
+   if (font_layoutData == NULL)
+      font_layoutData = array_create( GLfloat );
+   array_resize( &font_layoutData, 0 );
+   lay->runs = array_create( glFontRun );
+
+   text    = lay->text;
+   col     = lay->start;
+   state   = 0;
+   font.id = lay->font;
+   font.h  = stsh->h;
+
+   /* Single line, possibly limited in width. */
+   if (lay->height < 0) {
+      lay->len = font_limitSize( stsh, &lay->w, text,
+            (lay->width < 0) ? INT_MAX : lay->width );
+      font_layoutLine( stsh, lay, text, 0, lay->len, 0., 0., &col, &state );
+   }
+   /* Block of text, same logic as gl_printTextRaw with y relative to the
+    * first line. */
+   else {
+      y  = 0.;
+      p  = 0;
+      while (y + lay->height - font.h > -1e-5) {
+         lp  = p;
+         l   = gl_printWidthForText( &font, &text[p], lay->width, NULL );
+         ret = p + l;
+         font_layoutLine( stsh, lay, text, p, ret, 0., y, &col, &state );
+
+         if (text[ret] == '\0')
+            break;
+         p = ret;
+         if ((text[p] == '\n') || (text[p] == ' '))
+            p++; /* Skip "empty char". */
+         y -= lay->line_height; /* move position down */
+         /* Case we haven't moved. */
+         if (p==lp)
+            break;
+      }
+   }
+
+   /* Upload. */
+   if (array_size(font_layoutData) > 0)
+      lay->vbo = gl_vboCreateStatic( sizeof(GLfloat) * array_size(font_layoutData),
+            font_layoutData );
+   else
+      lay->vbo = gl_vboCreateStatic( sizeof(GLfloat) * 4, (GLfloat[4]){ 0., 0., 0., 0. } );
+}
+
+
+/**
+ * @brief Lays out a line of text, appending the glyphs to the layout.
+ *
+ *    @param stsh Font stash to use.
+ *    @param lay Layout being built.
+ *    @param text Text to lay out.
+ *    @param start First byte of the line.
+ *    @param end Byte after the last one of the line.
+ *    @param ox X offset of the line in pixels.
+ *    @param oy Y offset of the line in pixels.
+ *    @param[in,out] col Current colour, NULL for the base colour.
+ *    @param[in,out] state Escape sequence state.
+ */
+static void font_layoutLine( glFontStash *stsh, glFontLayout *lay, const char *text,
+      size_t start, size_t end, double ox, double oy, const glColour **col, int *state )
+{
+   int j, n, kern_adv_x;
+   size_t i;
+   uint32_t ch;
+   double scale, px, py;
+   GLuint tex;
+   glFontGlyph *glyph;
+   glFontRun *run;
+   const GLshort *vert;
+   const GLfloat *tc;
+   GLfloat *data;
+   static const int order[6] = { 0, 1, 2, 2, 1, 3 }; /* Triangle strip to triangles. */
+
+   scale = (double)stsh->h / FONT_DISTANCE_FIELD_SIZE;
+   px    = ox / scale;
+   py    = oy / scale;
+
+   gl_fontKernStart();
+   i = start;
+   while (i < end) {
+      ch = u8_nextchar( text, &i );
+      if (ch == 0)
+         break;
+
+      /* Handle escape sequences. */
+      if ((ch == FONT_COLOUR_CODE) && (*state == 0)) {
+         *state = 1;
+         continue;
+      }
+      if (*state == 1) {
+         *col          = gl_fontGetColour( ch );
+         lay->lastcol  = *col;
+         lay->setcol   = 1;
+         *state        = 0;
+         continue;
+      }
+
+      glyph = gl_fontGetGlyph( stsh, ch );
+      if (glyph == NULL) {
+         WARN(_("Unable to find glyph '%d'!"), ch );
+         continue;
+      }
+
+      /* Kern if possible. */
+      kern_adv_x = gl_fontKernGlyph( stsh, ch, glyph );
+      px += kern_adv_x / scale;
+
+      /* Start a new run when the texture or colour change. */
+      tex = stsh->tex[glyph->tex_index].id;
+      run = (array_size(lay->runs) > 0) ? &array_back(lay->runs) : NULL;
+      if ((run == NULL) || (run->tex != tex) || (run->col != *col)) {
+         run        = &array_grow( &lay->runs );
+         run->tex   = tex;
+         run->col   = *col;
+         run->first = array_size(font_layoutData) / 4;
+         run->count = 0;
+      }
+      run->count += 6;
+
+      /* Copy the glyph quad moved into place. */
+      vert = &stsh->vbo_vert_data[ 2*glyph->vbo_id ];
+      tc   = &stsh->vbo_tex_data[ 2*glyph->vbo_id ];
+      n = array_size( font_layoutData );
+      array_resize( &font_layoutData, n + 6*4 );
+      data = &font_layoutData[n];
+      for (j=0; j<6; j++) {
+         data[4*j+0] = px + vert[ 2*order[j]+0 ];
+         data[4*j+1] = py + vert[ 2*order[j]+1 ];
+         data[4*j+2] = tc[ 2*order[j]+0 ];
+         data[4*j+3] = tc[ 2*order[j]+1 ];
+      }
+
+      px += glyph->adv_x / scale;
+   }
+}
+
+
+/**
+ * @brief Renders a cached layout.
+ */
+static void font_layoutRender( const glFontStash *stsh, const glFontLayout *lay,
+      double x, double y, const glColour *c, double outlineR )
+{
+   int i;
+   double a;
+   GLuint tex;
+   const glColour *col;
+   const glFontRun *run;
+
+   gl_fontRenderUniforms( stsh, x, y, c, outlineR );
+   gl_Matrix4_Uniform( shaders.font.projection, font_projection_mat );
+
+   glEnableVertexAttribArray( shaders.font.vertex );
+   gl_vboActivateAttribOffset( lay->vbo, shaders.font.vertex, 0,
+         2, GL_FLOAT, 4*sizeof(GLfloat) );
+   glEnableVertexAttribArray( shaders.font.tex_coord );
+   gl_vboActivateAttribOffset( lay->vbo, shaders.font.tex_coord, 2*sizeof(GLfloat),
+         2, GL_FLOAT, 4*sizeof(GLfloat) );
+
+   a   = (c==NULL) ? 1. : c->a;
+   col = lay->start;
+   tex = 0;
+   for (i=0; i<array_size(lay->runs); i++) {
+      run = &lay->runs[i];
+      if (run->col != col) {
+         col = run->col;
+         if (col != NULL)
+            gl_uniformAColor( shaders.font.color, col, a );
+         else if (c==NULL)
+            gl_uniformColor( shaders.font.color, &cWhite );
+         else
+            gl_uniformColor( shaders.font.color, c );
+      }
+      if (run->tex != tex) {
+         tex = run->tex;
+         glBindTexture( GL_TEXTURE_2D, tex );
+      }
+      glDrawArrays( GL_TRIANGLES, run->first, run->count );
+   }
+
+   /* Colour codes affect the text drawn after. */
+   if (lay->setcol)
+      font_lastCol = lay->lastcol;
+
+   gl_fontRenderEnd();
+}
+
+
+/**
+ * @brief Frees a cached layout.
+ */
+static void font_layoutFree( glFontLayout *lay )
+{
+   free( lay->text );
+   array_free( lay->runs );
+   gl_vboDestroy( lay->vbo );
+   free( lay );
+   font_nlayouts--;
+}
+
+
+/**
+ * @brief Advances the frame of the text layout cache, evicting old layouts.
+ *
+ * Should be called once per frame.
+ */
+void gl_fontFrame (void)
+{
+   int i;
+   glFontLayout *lay, **prev;
+
+   font_frame++;
+
+   /* What was seen this frame becomes the previous frame. */
+   memcpy( font_layoutSeen[1], font_layoutSeen[0], sizeof(font_layoutSeen[0]) );
+   memset( font_layoutSeen[0], 0, sizeof(font_layoutSeen[0]) );
+
+   if (font_frame % LAYOUT_MAXAGE != 0)
+      return;
+
+   for (i=0; i<LAYOUT_LUT_SIZE; i++) {
+      prev = &font_layouts[i];
+      while (*prev != NULL) {
+         lay = *prev;
+         if (font_frame - lay->frame > LAYOUT_MAXAGE) {
+            *prev = lay->next;
+            font_layoutFree( lay );
+         }
+         else
+            prev = &lay->next;
+      }
+   }
+}
+
+
+/**
+ * @brief Frees the cached layouts of a font stash, or all of them.
+ *
+ *    @param font Font stash id to free layouts of, -1 for all.
+ */
+static void font_layoutClear( int font )
+{
+   int i;
+   glFontLayout *lay, **prev;
+
+   for (i=0; i<LAYOUT_LUT_SIZE; i++) {
+      prev = &font_layouts[i];
+      while (*prev != NULL) {
+         lay = *prev;
+         if ((font < 0) || (lay->font == font)) {
+            *prev = lay->next;
+            font_layoutFree( lay );
+         }
+         else
+            prev = &lay->next;
+      }
+   }
+}
+
+
 /*
  *
  * G L _ F O N T
@@ -1156,9 +1613,9 @@ static int font_makeChar( glFontStash *stsh, font_char_t *c, uint32_t ch )
 
 
 /**
- * @brief Starts the rendering engine.
+ * @brief Sets up the shader to render text at a position.
  */
-static void gl_fontRenderStart( const glFontStash* stsh, double x, double y, const glColour *c, double outlineR )
+static void gl_fontRenderUniforms( const glFontStash* stsh, double x, double y, const glColour *c, double outlineR )
 {
    double a, scale;
    const glColour *col;
@@ -1187,6 +1644,15 @@ static void gl_fontRenderStart( const glFontStash* stsh, double x, double y, con
 
    font_restoreLast = 0;
    gl_fontKernStart();
+}
+
+
+/**
+ * @brief Starts the rendering engine.
+ */
+static void gl_fontRenderStart( const glFontStash* stsh, double x, double y, const glColour *c, double outlineR )
+{
+   gl_fontRenderUniforms( stsh, x, y, c, outlineR );
 
    /* Activate the appropriate VBOs. */
    glEnableVertexAttribArray( shaders.font.vertex );
@@ -1673,6 +2139,13 @@ void gl_freeFont( glFont* font )
       font_library = NULL;
    }
 
+   /* Cached layouts use the textures. */
+   font_layoutClear( stsh - avail_fonts );
+   if (font_library_refs == 0) {
+      array_free( font_layoutData );
+      font_layoutData = NULL;
+   }
+
    free( stsh->fname );
    for (i=0; i<array_size(stsh->tex); i++)
       glDeleteTextures( 1, &stsh->tex->id );
@@ -108,6 +108,7 @@ void gl_printStore( glFontRestore *restore, const char *text );
 
 /* Misc stuff. */
 void gl_fontSetFilter( const glFont *ft_font, GLint min, GLint mag );
+void gl_fontFrame (void);
 
 
 #endif /* FONT_H */
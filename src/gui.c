@@ -19,6 +19,7 @@
 #include "gui.h"
 
 #include "ai.h"
+#include "array.h"
 #include "camera.h"
 #include "comm.h"
 #include "conf.h"
@@ -1042,8 +1043,10 @@ int gui_radarInit( int circle, int w, int h )
 void gui_radarRender( double x, double y )
 {
    int i, j;
+   double r;
    Radar *radar;
    AsteroidAnchor *ast;
+   int *cand;
    gl_Matrix4 view_matrix_prev;
 
    /* The global radar. */
@@ -1100,11 +1103,13 @@ void gui_radarRender( double x, double y )
    if (j!=0)
       gui_renderPilot( pilot_stack[j], radar->shape, radar->w, radar->h, radar->res, 0 );
 
-   /* render the asteroids */
+   /* render the asteroids, only the ones in sensor range are shown */
+   r = sqrt( pilot_sensorRange() * player.p->ew_detect );
    for (i=0; i<cur_system->nasteroids; i++) {
-      ast = &cur_system->asteroids[i];
-      for (j=0; j<ast->nb; j++)
-         gui_renderAsteroid( &ast->asteroids[j], radar->w, radar->h, radar->res, 0 );
+      ast  = &cur_system->asteroids[i];
+      cand = asteroids_queryCircle( ast, &player.p->solid->pos, r );
+      for (j=0; j<array_size(cand); j++)
+         gui_renderAsteroid( &ast->asteroids[ cand[j] ], radar->w, radar->h, radar->res, 0 );
    }
 
    /* Interference. */
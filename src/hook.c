@@ -31,6 +31,7 @@
 
 #include "hook.h"
 
+#include "array.h"
 #include "claim.h"
 #include "event.h"
 #include "log.h"
@@ -42,9 +43,11 @@
 #include "nxml.h"
 #include "player.h"
 #include "space.h"
+#include "strhash.h"
 
 
 #define HOOK_CHUNK   32 /**< Size to grow by when out of space */
+#define HOOK_IDMAP_MIN  256 /**< Minimum size of the hook id map. */
 
 
 /**
@@ -79,9 +82,13 @@ typedef enum HookType_e {
  */
 typedef struct Hook_ {
    struct Hook_ *next; /**< Linked list. */
+   struct Hook_ *stack_next; /**< Next hook in the same stack. */
+   struct Hook_ *stack_prev; /**< Previous hook in the same stack. */
 
    unsigned int id; /**< unique id */
+   unsigned int seq; /**< Creation order. */
    char *stack; /**< stack it's a part of */
+   int stackid; /**< Interned id of the stack. */
    int created; /**< Hook has just been created. */
    int delete; /**< indicates it should be deleted when possible */
    int ran_once; /**< Indicates if the hook already ran, useful when iterating. */
@@ -89,7 +96,8 @@ typedef struct Hook_ {
 
    /* Timer information. */
    int is_timer; /**< Whether or not is actually a timer. */
-   double ms; /**< Milliseconds left. */
+   double deadline; /**< Timer clock value at which it runs. */
+   int heappos; /**< Position in the timer heap, -1 if not in it. */
 
    /* Date information. */
    int is_date; /**< Whether or not it is a date hook. */
@@ -117,6 +125,19 @@ static unsigned int hook_id   = 0; /**< Unique hook id generator. */
 static Hook* hook_list        = NULL; /**< Stack of hooks. */
 static int hook_runningstack  = 0; /**< Check if stack is running. */
 static int hook_loadingstack  = 0; /**< Check if the hooks are being loaded. */
+static unsigned int hook_seq  = 0; /**< Creation order generator. */
+
+
+/*
+ * Indices
+ */
+static Hook **hook_stacks     = NULL; /**< First hook of each stack, indexed by interned stack id. */
+static Hook **hook_idmap      = NULL; /**< Open addressing map of hooks by id. */
+static unsigned int hook_idmapSize = 0; /**< Size of the id map, power of two. */
+static unsigned int hook_nidmap = 0; /**< Number of hooks in the id map. */
+static Hook **hook_timers     = NULL; /**< Binary heap of timers by deadline. */
+static double hook_timerClock = 0.; /**< Time the timers have been updated for. */
+static double hook_timerBase  = 0.; /**< Time new timers count from. */
 
 
 /*
@@ -129,6 +150,19 @@ static void hooks_updateDateExecute( ntime_t change );
 static void hook_rmRaw( Hook *h );
 static void hooks_purgeList (void);
 static Hook* hook_get( unsigned int id );
+static Hook* hook_getStack( const char *stack );
+static void hook_stackAdd( Hook *h );
+static void hook_stackRm( Hook *h );
+static unsigned int hook_idHash( unsigned int id );
+static void hook_idAdd( Hook *h );
+static void hook_idRm( Hook *h );
+static int hook_timerLess( const Hook *a, const Hook *b );
+static void hook_timerSwap( int a, int b );
+static void hook_timerUp( int i );
+static void hook_timerDown( int i );
+static void hook_timerAdd( Hook *h, double ms );
+static void hook_timerRm( Hook *h );
+static int hook_cmpSeq( const void *p1, const void *p2 );
 static unsigned int hook_genID (void);
 static Hook* hook_new( HookType_t type, const char *stack );
 static int hook_parseParam( lua_State *L, HookParam *param );
@@ -438,6 +472,247 @@ static int hook_run( Hook *hook, HookParam *param, int claims )
 }
 
 
+/**
+ * @brief Gets the first hook of a stack.
+ *
+ *    @param stack Name of the stack.
+ *    @return First hook of the stack or NULL if it has none.
+ */
+static Hook* hook_getStack( const char *stack )
+{
+   int id;
+
+   id = strhash_find( stack );
+   if ((id < 0) || (hook_stacks == NULL) || (id >= array_size(hook_stacks)))
+      return NULL;
+   return hook_stacks[id];
+}
+
+
+/**
+ * @brief Adds a hook to the front of its stack, keeping the hook list order.
+ */
+static void hook_stackAdd( Hook *h )
+{
+   if (hook_stacks == NULL)
+      hook_stacks = array_create( Hook* );
+   h->stackid = strhash_intern( h->stack );
+   while (array_size(hook_stacks) <= h->stackid)
+      array_push_back( &hook_stacks, NULL );
+
+   h->stack_prev = NULL;
+   h->stack_next = hook_stacks[ h->stackid ];
+   if (h->stack_next != NULL)
+      h->stack_next->stack_prev = h;
+   hook_stacks[ h->stackid ] = h;
+}
+
+
+/**
+ * @brief Removes a hook from its stack.
+ */
+static void hook_stackRm( Hook *h )
+{
+   if (h->stack_prev != NULL)
+      h->stack_prev->stack_next = h->stack_next;
+   else
+      hook_stacks[ h->stackid ] = h->stack_next;
+   if (h->stack_next != NULL)
+      h->stack_next->stack_prev = h->stack_prev;
+   h->stack_next = NULL;
+   h->stack_prev = NULL;
+}
+
+
+/**
+ * @brief Hashes a hook id.
+ */
+static unsigned int hook_idHash( unsigned int id )
+{
+   return id * 2654435761u;
+}
+
+
+/**
+ * @brief Adds a hook to the id map, replacing any hook with the same id.
+ */
+static void hook_idAdd( Hook *h )
+{
+   unsigned int i, mask, size;
+   Hook **old;
+
+   /* Grow to keep it at most half full. */
+   if (2*(hook_nidmap+1) > hook_idmapSize) {
+      old  = hook_idmap;
+      size = hook_idmapSize;
+      hook_idmapSize = MAX( HOOK_IDMAP_MIN, 2*hook_idmapSize );
+      hook_idmap     = calloc( hook_idmapSize, sizeof(Hook*) );
+      hook_nidmap    = 0;
+      for (i=0; i<size; i++)
+         if (old[i] != NULL)
+            hook_idAdd( old[i] );
+      free( old );
+   }
+
+   mask = hook_idmapSize-1;
+   for (i=hook_idHash(h->id) & mask; hook_idmap[i] != NULL; i=(i+1) & mask) {
+      if (hook_idmap[i]->id == h->id) {
+         hook_idmap[i] = h;
+         return;
+      }
+   }
+   hook_idmap[i] = h;
+   hook_nidmap++;
+}
+
+
+/**
+ * @brief Removes a hook from the id map.
+ */
+static void hook_idRm( Hook *h )
+{
+   unsigned int i, j, k, mask;
+
+   if (hook_idmapSize == 0)
+      return;
+
+   /* Find the hook, it may have been replaced by another with the same id. */
+   mask = hook_idmapSize-1;
+   for (i=hook_idHash(h->id) & mask; hook_idmap[i] != h; i=(i+1) & mask)
+      if (hook_idmap[i] == NULL)
+         return;
+
+   /* Shift back the following entries so lookups don't stop early. */
+   j = i;
+   for (;;) {
+      j = (j+1) & mask;
+      if (hook_idmap[j] == NULL)
+         break;
+      k = hook_idHash( hook_idmap[j]->id ) & mask;
+      if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+         continue;
+      hook_idmap[i] = hook_idmap[j];
+      i = j;
+   }
+   hook_idmap[i] = NULL;
+   hook_nidmap--;
+}
+
+
+/**
+ * @brief Compares two timers, earliest deadline first then oldest first.
+ */
+static int hook_timerLess( const Hook *a, const Hook *b )
+{
+   if (a->deadline != b->deadline)
+      return (a->deadline < b->deadline);
+   return (a->seq < b->seq);
+}
+
+
+/**
+ * @brief Swaps two timers in the heap.
+ */
+static void hook_timerSwap( int a, int b )
+{
+   Hook *t;
+   t = hook_timers[a];
+   hook_timers[a] = hook_timers[b];
+   hook_timers[b] = t;
+   hook_timers[a]->heappos = a;
+   hook_timers[b]->heappos = b;
+}
+
+
+/**
+ * @brief Moves a timer up the heap.
+ */
+static void hook_timerUp( int i )
+{
+   while ((i > 0) && hook_timerLess( hook_timers[i], hook_timers[(i-1)/2] )) {
+      hook_timerSwap( i, (i-1)/2 );
+      i = (i-1)/2;
+   }
+}
+
+
+/**
+ * @brief Moves a timer down the heap.
+ */
+static void hook_timerDown( int i )
+{
+   int c, n;
+   n = array_size( hook_timers );
+   while ((c = 2*i+1) < n) {
+      if ((c+1 < n) && hook_timerLess( hook_timers[c+1], hook_timers[c] ))
+         c++;
+      if (!hook_timerLess( hook_timers[c], hook_timers[i] ))
+         break;
+      hook_timerSwap( i, c );
+      i = c;
+   }
+}
+
+
+/**
+ * @brief Adds a timer to the heap.
+ *
+ *    @param h Hook to add.
+ *    @param ms Time left until the timer runs.
+ */
+static void hook_timerAdd( Hook *h, double ms )
+{
+   if (hook_timers == NULL)
+      hook_timers = array_create( Hook* );
+   h->is_timer = 1;
+   h->deadline = hook_timerBase + ms;
+   h->heappos  = array_size( hook_timers );
+   array_push_back( &hook_timers, h );
+   hook_timerUp( h->heappos );
+}
+
+
+/**
+ * @brief Removes a timer from the heap.
+ */
+static void hook_timerRm( Hook *h )
+{
+   int i, n;
+
+   i = h->heappos;
+   if (i < 0)
+      return;
+   h->heappos = -1;
+
+   n = array_size( hook_timers )-1;
+   if (i != n) {
+      hook_timers[i] = hook_timers[n];
+      hook_timers[i]->heappos = i;
+   }
+   array_resize( &hook_timers, n );
+   if (i < n) {
+      hook_timerUp( i );
+      hook_timerDown( hook_timers[i]->heappos );
+   }
+}
+
+
+/**
+ * @brief Compares hooks so that the newest goes first, like in the hook list.
+ */
+static int hook_cmpSeq( const void *p1, const void *p2 )
+{
+   const Hook *h1, *h2;
+   h1 = *(const Hook**) p1;
+   h2 = *(const Hook**) p2;
+   if (h1->seq > h2->seq)
+      return -1;
+   else if (h1->seq < h2->seq)
+      return +1;
+   return 0;
+}
+
+
 /**
  * @brief Generates a new hook id.
  *
@@ -446,7 +721,6 @@ static int hook_run( Hook *hook, HookParam *param, int claims )
 static unsigned int hook_genID (void)
 {
    unsigned int id;
-   Hook *h;
    id = ++hook_id; /* default id, not safe if loading */
 
    /* If not loading we can just return. */
@@ -454,9 +728,8 @@ static unsigned int hook_genID (void)
       return id;
 
    /* Must check ids for collisions. */
-   for (h=hook_list; h!=NULL; h=h->next)
-      if (id == h->id) /* Check for collision. */
-         return hook_genID(); /* recursively try again */
+   if (hook_get( id ) != NULL)
+      return hook_genID(); /* recursively try again */
 
    return id;
 }
@@ -486,8 +759,14 @@ static Hook* hook_new( HookType_t type, const char *stack )
    /* Fill out generic details. */
    new_hook->type    = type;
    new_hook->id      = hook_genID();
+   new_hook->seq     = ++hook_seq;
    new_hook->stack   = strdup(stack);
    new_hook->created = 1;
+   new_hook->heappos = -1;
+
+   /* Index it. */
+   hook_stackAdd( new_hook );
+   hook_idAdd( new_hook );
 
    /** @TODO fix this hack. */
    if (strcmp(stack,"safe")==0)
@@ -563,8 +842,7 @@ unsigned int hook_addTimerMisn( unsigned int parent, const char *func, double ms
    new_hook->u.misn.func   = strdup(func);
 
    /* Timer information. */
-   new_hook->is_timer      = 1;
-   new_hook->ms            = ms;
+   hook_timerAdd( new_hook, ms );
 
    return new_hook->id;
 }
@@ -590,8 +868,7 @@ unsigned int hook_addTimerEvt( unsigned int parent, const char *func, double ms
    new_hook->u.event.func   = strdup(func);
 
    /* Timer information. */
-   new_hook->is_timer      = 1;
-   new_hook->ms            = ms;
+   hook_timerAdd( new_hook, ms );
 
    return new_hook->id;
 }
@@ -622,6 +899,9 @@ static void hooks_purgeList (void)
 
          /* Free. */
          h->next = NULL;
+         hook_stackRm( h );
+         hook_idRm( h );
+         hook_timerRm( h );
          hook_free( h );
 
          /* Last. */
@@ -660,13 +940,13 @@ static void hooks_updateDateExecute( ntime_t change )
       return;
 
    /* Clear creation flags. */
-   for (h=hook_list; h!=NULL; h=h->next)
+   for (h=hook_getStack("date"); h!=NULL; h=h->stack_next)
       h->created = 0;
 
    /* On j=0 we increment all timers and try to run, then on j=1 we update the timers. */
    hook_runningstack++; /* running hooks */
    for (j=1; j>=0; j--) {
-      for (h=hook_list; h!=NULL; h=h->next) {
+      for (h=hook_getStack("date"); h!=NULL; h=h->stack_next) {
          /* Not be deleting. */
          if (h->delete)
             continue;
@@ -744,42 +1024,63 @@ unsigned int hook_addDateEvt( unsigned int parent, const char *func, ntime_t res
  */
 void hooks_update( double dt )
 {
-   int j;
-   Hook *h;
+   int i, j;
+   unsigned int seq;
+   Hook *h, **run, **later;
 
    /* Don't update without player. */
    if ((player.p == NULL) || player_isFlag(PLAYER_CREATING))
       return;
 
-   /* Clear creation flags. */
-   for (h=hook_list; h!=NULL; h=h->next)
-      h->created = 0;
+   /* Timers created while updating start counting after this update. */
+   seq = hook_seq;
+   hook_timerBase = hook_timerClock + dt;
 
+   run   = array_create( Hook* );
+   later = array_create( Hook* );
    hook_runningstack++; /* running hooks */
    for (j=1; j>=0; j--) {
-      for (h=hook_list; h!=NULL; h=h->next) {
+      /* On j=0 the timers have their time decremented. */
+      if (j==0)
+         hook_timerClock = hook_timerBase;
+
+      /* Get the timers that are up. */
+      while ((hook_timers != NULL) && (array_size(hook_timers) > 0) &&
+            (hook_timers[0]->deadline <= hook_timerClock)) {
+         h = hook_timers[0];
+         hook_timerRm( h );
          /* Not be deleting. */
          if (h->delete)
             continue;
-         /* Find valid timer hooks. */
-         if (h->is_timer == 0)
-            continue;
          /* Don't update newly created hooks. */
-         if (h->created != 0)
-            continue;
+         if (h->seq > seq)
+            array_push_back( &later, h );
+         else
+            array_push_back( &run, h );
+      }
+      for (i=0; i<array_size(later); i++) {
+         h = later[i];
+         h->heappos = array_size( hook_timers );
+         array_push_back( &hook_timers, h );
+         hook_timerUp( h->heappos );
+      }
+      array_resize( &later, 0 );
 
-         /* Decrement timer and check to see if should run. */
-         if (j==0)
-            h->ms -= dt;
-         if (h->ms > 0.)
+      /* Run the timer hooks in the same order as the hook list. */
+      qsort( run, array_size(run), sizeof(Hook*), hook_cmpSeq );
+      for (i=0; i<array_size(run); i++) {
+         h = run[i];
+         /* May have been removed by another timer. */
+         if (h->delete)
             continue;
-
-         /* Run the timer hook. */
          hook_run( h, NULL, j );
          hook_rmRaw( h );
       }
+      array_resize( &run, 0 );
    }
    hook_runningstack--; /* not running hooks anymore */
+   array_free( run );
+   array_free( later );
 
    /* Second pass to delete. */
    hooks_purgeList();
@@ -909,16 +1210,15 @@ static int hooks_executeParam( const char* stack, HookParam *param )
       return 0;
 
    /* Reset the current stack's ran and creation flags. */
-   for (h=hook_list; h!=NULL; h=h->next)
-      if (strcmp(stack, h->stack)==0) {
-         h->ran_once = 0;
-         h->created = 0;
-      }
+   for (h=hook_getStack(stack); h!=NULL; h=h->stack_next) {
+      h->ran_once = 0;
+      h->created = 0;
+   }
 
    run = 0;
    hook_runningstack++; /* running hooks */
    for (j=1; j>=0; j--) {
-      for (h=hook_list; h!=NULL; h=h->next) {
+      for (h=hook_getStack(stack); h!=NULL; h=h->stack_next) {
          /* Should be deleted. */
          if (h->delete)
             continue;
@@ -928,9 +1228,6 @@ static int hooks_executeParam( const char* stack, HookParam *param )
          /* Don't update newly created hooks. */
          if (h->created != 0)
             continue;
-         /* Doesn't match stack. */
-         if (strcmp(stack, h->stack) != 0)
-            continue;
 
          /* Run hook. */
          hook_run( h, param, j );
@@ -1003,10 +1300,15 @@ int hooks_run( const char* stack )
  */
 static Hook* hook_get( unsigned int id )
 {
-   Hook *h;
-   for (h=hook_list; h!=NULL; h=h->next)
-      if (h->id == id)
-         return h;
+   unsigned int i, mask;
+
+   if (hook_idmapSize == 0)
+      return NULL;
+
+   mask = hook_idmapSize-1;
+   for (i=hook_idHash(id) & mask; hook_idmap[i] != NULL; i=(i+1) & mask)
+      if (hook_idmap[i]->id == id)
+         return hook_idmap[i];
 
    return NULL;
 }
@@ -1134,6 +1436,18 @@ void hook_cleanup (void)
    }
    /* safe defaults just in case */
    hook_list  = NULL;
+
+   /* Clear the indices. */
+   array_free( hook_stacks );
+   hook_stacks = NULL;
+   free( hook_idmap );
+   hook_idmap     = NULL;
+   hook_idmapSize = 0;
+   hook_nidmap    = 0;
+   array_free( hook_timers );
+   hook_timers     = NULL;
+   hook_timerClock = 0.;
+   hook_timerBase  = 0.;
 }
 
 
@@ -1354,7 +1668,9 @@ static int hook_parse( xmlNodePtr base )
          /* Set the id. */
          if (id != 0) {
             h = hook_get( new_id );
+            hook_idRm( h );
             h->id = id;
+            hook_idAdd( h );
 
             /* Additional info. */
             if (is_date) {
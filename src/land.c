@@ -21,6 +21,7 @@
 #include "land.h"
 
 #include "camera.h"
+#include "cond.h"
 #include "conf.h"
 #include "dialogue.h"
 #include "economy.h"
@@ -1015,6 +1016,9 @@ void land_genWindows( int load, int changetab )
        * Note that you can use the same function for both hooks. */
       if (!load)
          hooks_run("land");
+
+      /* Conditionals only need to be rerun when the state they check changes. */
+      cond_memoStart();
       events_trigger( EVENT_TRIGGER_LAND );
 
       /* 3) Generate computer and bar missions. */
@@ -1025,6 +1029,7 @@ void land_genWindows( int load, int changetab )
          mission_computer = missions_genList( &mission_ncomputer,
                land_planet->faction, land_planet->name, cur_system->name,
                MIS_AVAIL_COMPUTER );
+      cond_memoEnd();
    }
 
 
@@ -10,6 +10,10 @@
 
 
 /** @cond */
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "libxml/xmlreader.h"
+
 #include "naev.h"
 /** @endcond */
 
@@ -33,6 +37,7 @@
 #include "nxml.h"
 #include "outfit.h"
 #include "player.h"
+#include "save.h"
 #include "shiplog.h"
 #include "space.h"
 #include "toolkit.h"
@@ -44,8 +49,13 @@
 #define BUTTON_WIDTH    200 /**< Button width. */
 #define BUTTON_HEIGHT   30 /**< Button height. */
 
+#define LOAD_INDEX      "saveindex.xml" /**< Save header index in the cache path. */
+
 
 static nsave_t *load_saves = NULL; /**< Array of save.s */
+static nsave_t *load_failed = NULL; /**< Saves that failed to parse, only path, mtime and size are set (array.h). */
+static nsave_t *load_index = NULL; /**< Save headers from the index (array.h). */
+static nsave_t *load_indexFailed = NULL; /**< Failed saves from the index (array.h). */
 
 
 extern int save_loaded; /**< From save.c */
@@ -81,94 +91,375 @@ static void load_menu_close( unsigned int wdw, char *str );
 static void load_menu_load( unsigned int wdw, char *str );
 static void load_menu_delete( unsigned int wdw, char *str );
 static int load_load( nsave_t *save, const char *path );
+static char *load_readerStr( xmlTextReaderPtr reader );
+static char *load_readerAttr( xmlTextReaderPtr reader, const char *name );
+static void load_saveFree( nsave_t *ns );
+static void load_indexLoad (void);
+static int load_indexSave (void);
+static void load_indexFree (void);
+static int load_indexFind( nsave_t *index, nsave_t *save, const char *path, int64_t mtime, int64_t size );
 static int load_gameInternal( const char* file, const char* version );
 
 
 /**
- * @brief Loads an individual save.
+ * @brief Gets the text of the current node of a reader.
+ *
+ *    @param reader Reader to get text from.
+ *    @return Newly allocated text or NULL if empty.
+ */
+static char *load_readerStr( xmlTextReaderPtr reader )
+{
+   xmlChar *xstr;
+   char *str;
+
+   xstr = xmlTextReaderReadString( reader );
+   if (xstr == NULL)
+      return NULL;
+   str = strdup( (char*)xstr );
+   xmlFree( xstr );
+   return str;
+}
+
+
+/**
+ * @brief Gets an attribute of the current node of a reader.
+ *
+ *    @param reader Reader to get attribute from.
+ *    @param name Name of the attribute.
+ *    @return Newly allocated attribute value or NULL if not found.
+ */
+static char *load_readerAttr( xmlTextReaderPtr reader, const char *name )
+{
+   xmlChar *xstr;
+   char *str;
+
+   xstr = xmlTextReaderGetAttribute( reader, (xmlChar*)name );
+   if (xstr == NULL)
+      return NULL;
+   str = strdup( (char*)xstr );
+   xmlFree( xstr );
+   return str;
+}
+
+
+/**
+ * @brief Loads the header of an individual save.
+ *
+ * The save is streamed and reading stops as soon as the player's current
+ *  ship is found, so the bulk of the save is never parsed.
  */
 static int load_load( nsave_t *save, const char *path )
 {
-   xmlDocPtr doc;
-   xmlNodePtr root, parent, node, cur;
+   xmlTextReaderPtr reader;
+   const char *name;
+   char *str;
+   int ret, depth, inversion, inplayer;
    int cycles, periods, seconds;
 
    memset( save, 0, sizeof(nsave_t) );
 
-   /* Load the XML. */
-   doc   = xmlParseFile(path);
-   if (doc == NULL) {
+   reader = xmlReaderForFile( path, NULL, 0 );
+   if (reader == NULL) {
       WARN( _("Unable to parse save path '%s'."), path);
       return -1;
    }
-   root = doc->xmlChildrenNode; /* base node */
-   if (root == NULL) {
-      WARN( _("Unable to get child node of save '%s'."), path);
-      xmlFreeDoc(doc);
-      return -1;
-   }
 
    /* Save path. */
    save->path = strdup(path);
 
-   /* Iterate inside the naev_save. */
-   parent = root->xmlChildrenNode;
-   do {
-      xml_onlyNodes(parent);
+   inversion = 0;
+   inplayer  = 0;
+   cycles = periods = seconds = 0;
+   while ((ret = xmlTextReaderRead( reader )) == 1) {
+      if (xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT)
+         continue;
+      name  = (const char*)xmlTextReaderConstName( reader );
+      depth = xmlTextReaderDepth( reader );
+
+      /* Children of naev_save. */
+      if (depth == 1) {
+         /* Everything we want is before the end of the player. */
+         if (inplayer)
+            break;
+         inversion = (strcmp( name, "version" ) == 0);
+         if (strcmp( name, "player" ) == 0) {
+            inplayer = 1;
+            save->name = load_readerAttr( reader, "name" );
+         }
+         continue;
+      }
 
       /* Info. */
-      if (xml_isNode(parent, "version")) {
-         node = parent->xmlChildrenNode;
-         do {
-            xmlr_strd(node, "naev", save->version);
-            xmlr_strd(node, "data", save->data);
-         } while (xml_nextNode(node));
+      if (inversion) {
+         if (strcmp( name, "naev" ) == 0)
+            save->version = load_readerStr( reader );
+         else if (strcmp( name, "data" ) == 0)
+            save->data = load_readerStr( reader );
          continue;
       }
 
-      if (xml_isNode(parent, "player")) {
-         /* Get name. */
-         xmlr_attr_strd(parent, "name", save->name);
-         /* Parse rest. */
-         node = parent->xmlChildrenNode;
-         do {
-            xml_onlyNodes(node);
-
-            /* Player info. */
-            xmlr_strd(node, "location", save->planet);
-            xmlr_ulong(node, "credits", save->credits);
-
-            /* Time. */
-            if (xml_isNode(node, "time")) {
-               cur = node->xmlChildrenNode;
-               cycles = periods = seconds = 0;
-               do {
-                  xmlr_int(cur, "SCU", cycles);
-                  xmlr_int(cur, "STP", periods);
-                  xmlr_int(cur, "STU", seconds);
-               } while (xml_nextNode(cur));
-               save->date = ntime_create( cycles, periods, seconds );
-               continue;
-            }
-
-            /* Ship info. */
-            if (xml_isNode(node, "ship")) {
-               xmlr_attr_strd(node, "name", save->shipname);
-               xmlr_attr_strd(node, "model", save->shipmodel);
-               continue;
-            }
-         } while (xml_nextNode(node));
+      if (!inplayer)
          continue;
+
+      /* Player info. */
+      if (depth == 2) {
+         if (strcmp( name, "location" ) == 0)
+            save->planet = load_readerStr( reader );
+         else if (strcmp( name, "credits" ) == 0) {
+            str = load_readerStr( reader );
+            save->credits = (str == NULL) ? 0 : strtoull( str, NULL, 10 );
+            free( str );
+         }
+         /* Ship info, written last. */
+         else if (strcmp( name, "ship" ) == 0) {
+            save->shipname  = load_readerAttr( reader, "name" );
+            save->shipmodel = load_readerAttr( reader, "model" );
+            break;
+         }
+      }
+      /* Time. */
+      else if (depth == 3) {
+         str = load_readerStr( reader );
+         if (strcmp( name, "SCU" ) == 0)
+            cycles = (str == NULL) ? 0 : atoi( str );
+         else if (strcmp( name, "STP" ) == 0)
+            periods = (str == NULL) ? 0 : atoi( str );
+         else if (strcmp( name, "STU" ) == 0)
+            seconds = (str == NULL) ? 0 : atoi( str );
+         free( str );
       }
-   } while (xml_nextNode(parent));
+   }
+   save->date = ntime_create( cycles, periods, seconds );
+   xmlFreeTextReader( reader );
+
+   if (ret < 0) {
+      WARN( _("Unable to parse save path '%s'."), path);
+      load_saveFree( save );
+      return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Frees the contents of a save.
+ *
+ *    @param ns Save to free contents of.
+ */
+static void load_saveFree( nsave_t *ns )
+{
+   free(ns->path);
+   free(ns->name);
+   free(ns->version);
+   free(ns->data);
+   free(ns->planet);
+   free(ns->shipname);
+   free(ns->shipmodel);
+   memset( ns, 0, sizeof(nsave_t) );
+}
+
+
+/**
+ * @brief Loads the save header index from the cache.
+ */
+static void load_indexLoad (void)
+{
+   char file[PATH_MAX];
+   xmlDocPtr doc;
+   xmlNodePtr node, cur;
+   nsave_t *ns;
+
+   load_index = array_create( nsave_t );
+   load_indexFailed = array_create( nsave_t );
+
+   nsnprintf( file, sizeof(file), "%s"LOAD_INDEX, nfile_cachePath() );
+   if (!nfile_fileExists( file ))
+      return;
+   doc = xmlParseFile( file );
+   if (doc == NULL)
+      return;
+
+   node = doc->xmlChildrenNode;
+   if ((node == NULL) || !xml_isNode(node, "saves")) {
+      xmlFreeDoc(doc);
+      return;
+   }
+
+   node = node->xmlChildrenNode;
+   do {
+      xml_onlyNodes(node);
+
+      /* Saves that couldn't be parsed only need to be recognized. */
+      if (xml_isNode(node, "failed")) {
+         ns = &array_grow( &load_indexFailed );
+         memset( ns, 0, sizeof(nsave_t) );
+         xmlr_attr_strd( node, "path", ns->path );
+         xmlr_attr_ulong( node, "mtime", ns->mtime );
+         xmlr_attr_ulong( node, "size", ns->size );
+         if (ns->path == NULL)
+            array_resize( &load_indexFailed, array_size(load_indexFailed)-1 );
+         continue;
+      }
+
+      if (!xml_isNode(node, "save"))
+         continue;
+
+      ns = &array_grow( &load_index );
+      memset( ns, 0, sizeof(nsave_t) );
+      xmlr_attr_strd( node, "path", ns->path );
+      xmlr_attr_ulong( node, "mtime", ns->mtime );
+      xmlr_attr_ulong( node, "size", ns->size );
+      cur = node->xmlChildrenNode;
+      do {
+         xml_onlyNodes(cur);
+         xmlr_strd(cur, "name", ns->name);
+         xmlr_strd(cur, "version", ns->version);
+         xmlr_strd(cur, "data", ns->data);
+         xmlr_strd(cur, "planet", ns->planet);
+         xmlr_long(cur, "date", ns->date);
+         xmlr_ulong(cur, "credits", ns->credits);
+         xmlr_strd(cur, "shipname", ns->shipname);
+         xmlr_strd(cur, "shipmodel", ns->shipmodel);
+      } while (xml_nextNode(cur));
+
+      /* Entries without a path are useless. */
+      if (ns->path == NULL) {
+         load_saveFree( ns );
+         array_resize( &load_index, array_size(load_index)-1 );
+      }
+   } while (xml_nextNode(node));
 
-   /* Clean up. */
+   xmlFreeDoc(doc);
+}
+
+
+/**
+ * @brief Writes the headers of the current saves to the index.
+ *
+ *    @return 0 on success.
+ */
+static int load_indexSave (void)
+{
+   char file[PATH_MAX];
+   xmlDocPtr doc;
+   xmlTextWriterPtr writer;
+   nsave_t *ns;
+   int i;
+
+   nsnprintf( file, sizeof(file), "%s"LOAD_INDEX, nfile_cachePath() );
+   writer = xmlNewTextWriterDoc(&doc, 0);
+   if (writer == NULL) {
+      WARN(_("Unable to create the xml writer for the save index '%s'."), file);
+      return -1;
+   }
+   xmlw_setParams( writer );
+
+   xmlw_start(writer);
+   xmlw_startElem(writer, "saves");
+   for (i=0; i<array_size(load_saves); i++) {
+      ns = &load_saves[i];
+      xmlw_startElem(writer, "save");
+      xmlw_attr(writer, "path", "%s", ns->path);
+      xmlw_attr(writer, "mtime", "%"PRId64, ns->mtime);
+      xmlw_attr(writer, "size", "%"PRId64, ns->size);
+      if (ns->name != NULL)
+         xmlw_elem(writer, "name", "%s", ns->name);
+      if (ns->version != NULL)
+         xmlw_elem(writer, "version", "%s", ns->version);
+      if (ns->data != NULL)
+         xmlw_elem(writer, "data", "%s", ns->data);
+      if (ns->planet != NULL)
+         xmlw_elem(writer, "planet", "%s", ns->planet);
+      xmlw_elem(writer, "date", "%"PRId64, ns->date);
+      xmlw_elem(writer, "credits", "%"PRIu64, ns->credits);
+      if (ns->shipname != NULL)
+         xmlw_elem(writer, "shipname", "%s", ns->shipname);
+      if (ns->shipmodel != NULL)
+         xmlw_elem(writer, "shipmodel", "%s", ns->shipmodel);
+      xmlw_endElem(writer); /* "save" */
+   }
+   for (i=0; i<array_size(load_failed); i++) {
+      ns = &load_failed[i];
+      xmlw_startElem(writer, "failed");
+      xmlw_attr(writer, "path", "%s", ns->path);
+      xmlw_attr(writer, "mtime", "%"PRId64, ns->mtime);
+      xmlw_attr(writer, "size", "%"PRId64, ns->size);
+      xmlw_endElem(writer); /* "failed" */
+   }
+   xmlw_endElem(writer); /* "saves" */
+   xmlw_done(writer);
+   xmlFreeTextWriter(writer);
+
+   if (nfile_dirMakeExist( nfile_cachePath() ) < 0) {
+      WARN(_("Failed to create cache directory '%s'."), nfile_cachePath());
+      xmlFreeDoc(doc);
+      return -1;
+   }
+   if (xmlSaveFileEnc( file, doc, "UTF-8" ) < 0) {
+      WARN(_("Failed to write save index '%s'."), file);
+      xmlFreeDoc(doc);
+      return -1;
+   }
    xmlFreeDoc(doc);
 
    return 0;
 }
 
 
+/**
+ * @brief Frees the save header index.
+ */
+static void load_indexFree (void)
+{
+   int i;
+
+   if (load_index == NULL)
+      return;
+
+   for (i=0; i<array_size(load_index); i++)
+      load_saveFree( &load_index[i] );
+   array_free( load_index );
+   load_index = NULL;
+
+   for (i=0; i<array_size(load_indexFailed); i++)
+      load_saveFree( &load_indexFailed[i] );
+   array_free( load_indexFailed );
+   load_indexFailed = NULL;
+}
+
+
+/**
+ * @brief Takes the header of an unchanged save from the index.
+ *
+ *    @param index Index entries to look in.
+ *    @param[out] save Save to fill with the indexed header.
+ *    @param path Path of the save.
+ *    @param mtime Modification time of the save.
+ *    @param size Size of the save.
+ *    @return 1 if the save was indexed and unchanged, 0 otherwise.
+ */
+static int load_indexFind( nsave_t *index, nsave_t *save, const char *path, int64_t mtime, int64_t size )
+{
+   int i;
+   nsave_t *ns;
+
+   for (i=0; i<array_size(index); i++) {
+      ns = &index[i];
+      if ((ns->path == NULL) || (strcmp( ns->path, path ) != 0))
+         continue;
+      if ((ns->mtime != mtime) || (ns->size != size))
+         return 0;
+
+      /* Steal the entry, it can only match once. */
+      *save = *ns;
+      memset( ns, 0, sizeof(nsave_t) );
+      return 1;
+   }
+   return 0;
+}
+
+
 /**
  * @brief Loads or refreshes saved games.
  */
@@ -176,8 +467,12 @@ int load_refresh (void)
 {
    char **files, buf[PATH_MAX], *tmp;
    size_t nfiles, i, len;
-   int ok;
-   nsave_t *ns;
+   int ok, dirty, nindexed;
+   nsave_t *ns, failed;
+   struct stat sb;
+
+   /* Don't read a save while it's being written. */
+   save_wait();
 
    if (load_saves != NULL)
       load_free();
@@ -225,20 +520,55 @@ int load_refresh (void)
       files[i+1]  = tmp;
    }
 
-   /* Allocate and parse. */
+   /* Allocate and parse, only reading headers of saves that changed. */
+   load_indexLoad();
+   load_failed = array_create( nsave_t );
+   nindexed = array_size( load_index ) + array_size( load_indexFailed );
+   dirty = 0;
    ok = 0;
    ns = NULL;
    for (i=0; i<nfiles; i++) {
       if (!ok)
          ns = &array_grow( &load_saves );
       nsnprintf( buf, sizeof(buf), "%ssaves/%s", nfile_dataPath(), files[i] );
+      if (stat( buf, &sb ) != 0)
+         memset( &sb, 0, sizeof(sb) );
+      if (load_indexFind( load_index, ns, buf, sb.st_mtime, sb.st_size )) {
+         nindexed--;
+         ok = 0;
+         continue;
+      }
+      /* Known to be broken, don't bother parsing it again. */
+      if (load_indexFind( load_indexFailed, &failed, buf, sb.st_mtime, sb.st_size )) {
+         array_push_back( &load_failed, failed );
+         nindexed--;
+         ok = -1;
+         continue;
+      }
       ok = load_load( ns, buf );
+      ns->mtime = sb.st_mtime;
+      ns->size  = sb.st_size;
+      dirty = 1;
+
+      /* Remember it failed so the index stays valid. */
+      if (ok) {
+         memset( &failed, 0, sizeof(nsave_t) );
+         failed.path  = strdup( buf );
+         failed.mtime = sb.st_mtime;
+         failed.size  = sb.st_size;
+         array_push_back( &load_failed, failed );
+      }
    }
 
    /* If the save was invalid, array is 1 member too large. */
    if (ok)
       array_resize( &load_saves, array_size(load_saves)-1 );
 
+   /* Update the index if saves were added or removed. */
+   load_indexFree();
+   if (dirty || (nindexed > 0))
+      load_indexSave();
+
    /* Clean up memory. */
    for (i=0; i<nfiles; i++)
       free(files[i]);
@@ -254,22 +584,20 @@ int load_refresh (void)
 void load_free (void)
 {
    int i;
-   nsave_t *ns;
 
    if (load_saves != NULL) {
-      for (i=0; i<array_size(load_saves); i++) {
-         ns = &load_saves[i];
-         free(ns->path);
-         free(ns->name);
-         free(ns->version);
-         free(ns->data);
-         free(ns->planet);
-         free(ns->shipname);
-         free(ns->shipmodel);
-      }
+      for (i=0; i<array_size(load_saves); i++)
+         load_saveFree( &load_saves[i] );
       array_free( load_saves );
    }
    load_saves = NULL;
+
+   if (load_failed != NULL) {
+      for (i=0; i<array_size(load_failed); i++)
+         load_saveFree( &load_failed[i] );
+      array_free( load_failed );
+   }
+   load_failed = NULL;
 }
 
 
@@ -460,6 +788,9 @@ static void load_menu_delete( unsigned int wdw, char *str )
    nsave_t *ns;
    int n;
 
+   /* The save could still be getting written. */
+   save_wait();
+
    wid = window_get( "wdwLoadGameMenu" );
    save = toolkit_getList( wid, "lstSaves" );
 
@@ -534,6 +865,9 @@ int load_gameDiff( const char* file )
    xmlNodePtr node;
    xmlDocPtr doc;
 
+   /* Don't read a save while it's being written. */
+   save_wait();
+
    /* Make sure it exists. */
    if (!nfile_fileExists(file)) {
       dialogue_alert( _("Saved game file seems to have been deleted.") );
@@ -572,6 +906,7 @@ err:
  */
 int load_gameFile( const char *file )
 {
+   save_wait();
    return load_gameInternal( file, naev_version(0) );
 }
 
@@ -584,6 +919,7 @@ int load_gameFile( const char *file )
  */
 int load_game( nsave_t *ns )
 {
+   save_wait();
    return load_gameInternal( ns->path, ns->version );
 }
 
@@ -33,6 +33,10 @@ typedef struct nsave_s {
    /* Ship info. */
    char *shipname; /**< Name of the ship. */
    char *shipmodel; /**< Model of the ship. */
+
+   /* File info, to know when the header has to be read again. */
+   int64_t mtime; /**< Modification time of the file. */
+   int64_t size; /**< Size of the file. */
 } nsave_t;
 
 
@@ -152,6 +152,8 @@ void map_exit (void)
       decorator_stack = NULL;
       decorator_nstack = 0;
    }
+
+   map_invalidateJumpPaths();
 }
 
 
@@ -2056,139 +2058,286 @@ void map_select( StarSystem *sys, char shifted )
 }
 
 /*
- * A* algorithm for shortest path finding
+ * Jump path finding.
+ *
+ * Every jump costs the same so there is no admissible heuristic for A*, this
+ * is just Dijkstra over an indexed binary heap. The heap is ordered by cost and
+ * then by insertion order, so systems are expanded in a stable order and the
+ * same path is always chosen between two systems.
  *
- * Note since that we can't actually get an admissible heurestic for A* this is
- * in reality just Djikstras. I've removed the heurestic bit to make sure I
- * don't try to implement an admissible heuristic when I'm pretty sure there is
- * none.
+ * Paths that don't depend on what the player knows are cached as a shortest
+ * path tree per source system, built lazily and thrown away whenever the jumps
+ * change.
+ */
+/**
+ * @brief Jump graph of the universe in compressed sparse row form.
  */
+typedef struct MapJumpGraph_ {
+   int nsys; /**< Number of systems in the graph. */
+   int *start; /**< Offset of each system's edges (nsys+1 elements). */
+   int *target; /**< Target system of each edge. */
+   JumpPoint **jp; /**< Jump point of each edge. */
+   int **tree[2]; /**< Cached shortest path trees by source, indexed by show_hidden. */
+} MapJumpGraph;
+static MapJumpGraph map_graph = { .nsys = -1 }; /**< Jump graph, built on demand. */
 /**
- * @brief Node structure for A* pathfinding.
+ * @brief Scratch state of a path search.
  */
-typedef struct SysNode_ {
-   struct SysNode_ *next; /**< Next node */
-   struct SysNode_ *gnext; /**< Next node in the garbage collector. */
-
-   struct SysNode_ *parent; /**< Parent node. */
-   StarSystem* sys; /**< System in node. */
-   int g; /**< step */
-} SysNode; /**< System Node for use in A* pathfinding. */
-static SysNode *A_gc;
+typedef struct MapPathState_ {
+   int *heap; /**< Binary heap of systems. */
+   int *hpos; /**< Position of each system in the heap, -1 if not in it. */
+   int *seq; /**< Insertion order of each system in the heap. */
+   int nheap; /**< Number of elements in the heap. */
+   int nseq; /**< Insertion counter. */
+   int *tree; /**< Tree for searches that can't be cached. */
+} MapPathState;
+static MapPathState map_pstate = { .heap = NULL }; /**< Path search scratch state. */
 /* prototypes */
-static SysNode* A_newNode( StarSystem* sys );
-static int A_g( SysNode* n );
-static SysNode* A_add( SysNode *first, SysNode *cur );
-static SysNode* A_rm( SysNode *first, StarSystem *cur );
-static SysNode* A_in( SysNode *first, StarSystem *cur );
-static SysNode* A_lowest( SysNode *first );
-static void A_freeList( SysNode *first );
+static void map_graphBuild (void);
+static void map_graphFree (void);
+static int map_heapLess( const int *g, int a, int b );
+static void map_heapSwap( int a, int b );
+static void map_heapUp( const int *g, int i );
+static void map_heapDown( const int *g, int i );
+static void map_pathSearch( int src, int dst, int ignore_known, int show_hidden, int *tree );
+static const int* map_pathTree( int src, int dst, int ignore_known, int show_hidden );
 static int map_decorator_parse( MapDecorator *temp, xmlNodePtr parent );
-/** @brief Creates a new node link to star system. */
-static SysNode* A_newNode( StarSystem* sys )
+/** @brief Builds the jump graph from the system stack. */
+static void map_graphBuild (void)
 {
-   SysNode* n;
-
-   n        = malloc(sizeof(SysNode));
+   int i, j, n;
+   StarSystem *sys;
 
-   n->next  = NULL;
-   n->sys   = sys;
+   map_graphFree();
 
-   n->gnext = A_gc;
-   A_gc     = n;
+   map_graph.nsys  = systems_nstack;
+   map_graph.start = malloc( sizeof(int) * (systems_nstack+1) );
+   n = 0;
+   for (i=0; i<systems_nstack; i++) {
+      map_graph.start[i] = n;
+      n += systems_stack[i].njumps;
+   }
+   map_graph.start[systems_nstack] = n;
+   map_graph.target = malloc( sizeof(int) * MAX(n,1) );
+   map_graph.jp     = malloc( sizeof(JumpPoint*) * MAX(n,1) );
+   for (i=0; i<systems_nstack; i++) {
+      sys = &systems_stack[i];
+      for (j=0; j<sys->njumps; j++) {
+         map_graph.target[ map_graph.start[i]+j ] = sys->jumps[j].targetid;
+         map_graph.jp[ map_graph.start[i]+j ]     = &sys->jumps[j];
+      }
+   }
+   map_graph.tree[0] = calloc( systems_nstack, sizeof(int*) );
+   map_graph.tree[1] = calloc( systems_nstack, sizeof(int*) );
+
+   /* Scratch space. */
+   map_pstate.heap = malloc( sizeof(int) * systems_nstack );
+   map_pstate.hpos = malloc( sizeof(int) * systems_nstack );
+   map_pstate.seq  = malloc( sizeof(int) * systems_nstack );
+   map_pstate.tree = malloc( sizeof(int) * 2 * systems_nstack );
+}
+/** @brief Frees the jump graph and all the cached paths. */
+static void map_graphFree (void)
+{
+   int i, j;
 
-   return n;
+   for (j=0; j<2; j++) {
+      if (map_graph.tree[j] == NULL)
+         continue;
+      for (i=0; i<map_graph.nsys; i++)
+         free( map_graph.tree[j][i] );
+      free( map_graph.tree[j] );
+      map_graph.tree[j] = NULL;
+   }
+   free( map_graph.start );
+   free( map_graph.target );
+   free( map_graph.jp );
+   map_graph.start  = NULL;
+   map_graph.target = NULL;
+   map_graph.jp     = NULL;
+   map_graph.nsys   = -1;
+
+   free( map_pstate.heap );
+   free( map_pstate.hpos );
+   free( map_pstate.seq );
+   free( map_pstate.tree );
+   map_pstate.heap = NULL;
+   map_pstate.hpos = NULL;
+   map_pstate.seq  = NULL;
+   map_pstate.tree = NULL;
 }
-/** @brief Gets the g from a node. */
-static int A_g( SysNode* n )
+/** @brief Compares two heap entries by cost and then insertion order. */
+static int map_heapLess( const int *g, int a, int b )
 {
-   return n->g;
+   int sa, sb;
+   sa = map_pstate.heap[a];
+   sb = map_pstate.heap[b];
+   if (g[sa] != g[sb])
+      return g[sa] < g[sb];
+   return map_pstate.seq[sa] < map_pstate.seq[sb];
 }
-/** @brief Adds a node to the linked list. */
-static SysNode* A_add( SysNode *first, SysNode *cur )
+/** @brief Swaps two heap entries. */
+static void map_heapSwap( int a, int b )
 {
-   SysNode *n;
-
-   if (first == NULL)
-      return cur;
-
-   n = first;
-   while (n->next != NULL)
-      n = n->next;
-   n->next = cur;
-
-   return first;
+   int t;
+   t = map_pstate.heap[a];
+   map_pstate.heap[a] = map_pstate.heap[b];
+   map_pstate.heap[b] = t;
+   map_pstate.hpos[ map_pstate.heap[a] ] = a;
+   map_pstate.hpos[ map_pstate.heap[b] ] = b;
 }
-/* @brief Removes a node from a linked list. */
-static SysNode* A_rm( SysNode *first, StarSystem *cur )
+/** @brief Moves a heap entry up until the heap property holds. */
+static void map_heapUp( const int *g, int i )
 {
-   SysNode *n, *p;
+   while ((i > 0) && map_heapLess( g, i, (i-1)/2 )) {
+      map_heapSwap( i, (i-1)/2 );
+      i = (i-1)/2;
+   }
+}
+/** @brief Moves a heap entry down until the heap property holds. */
+static void map_heapDown( const int *g, int i )
+{
+   int c;
+   while ((c = 2*i+1) < map_pstate.nheap) {
+      if ((c+1 < map_pstate.nheap) && map_heapLess( g, c+1, c ))
+         c++;
+      if (!map_heapLess( g, c, i ))
+         break;
+      map_heapSwap( i, c );
+      i = c;
+   }
+}
+/**
+ * @brief Runs the path search from a system.
+ *
+ *    @param src Index of the system to start from.
+ *    @param dst Index of the system to stop at, or -1 to build the whole tree.
+ *    @param ignore_known Whether or not to ignore if systems and jump points are known.
+ *    @param show_hidden Whether or not to use hidden jumps points.
+ *    @param[out] tree Parent of each system (-1 if not reached) followed by
+ *                     the number of jumps to reach it.
+ */
+static void map_pathSearch( int src, int dst, int ignore_known, int show_hidden, int *tree )
+{
+   int i, j, cur, cost, n;
+   int *parent, *g;
+   JumpPoint *jp;
+   StarSystem *sys;
 
-   if (first->sys == cur) {
-      n = first->next;
-      first->next = NULL;
-      return n;
+   n      = map_graph.nsys;
+   parent = tree;
+   g      = &tree[n];
+   for (i=0; i<n; i++) {
+      parent[i] = -1;
+      g[i]      = -1;
+      map_pstate.hpos[i] = -1;
    }
 
-   p = first;
-   n = p->next;
-   do {
-      if (n->sys == cur) {
-         n->next = NULL;
-         p->next = n->next;
+   /* Initial open node is the start system. */
+   g[src]           = 0;
+   map_pstate.heap[0] = src;
+   map_pstate.hpos[src] = 0;
+   map_pstate.seq[src]  = 0;
+   map_pstate.nheap = 1;
+   map_pstate.nseq  = 1;
+
+   j = 0;
+   while (map_pstate.nheap > 0) {
+      cur = map_pstate.heap[0];
+
+      /* End condition. */
+      if (cur == dst)
          break;
-      }
-      p = n;
-   } while ((n=n->next) != NULL);
 
-   return first;
-}
-/** @brief Checks to see if node is in linked list. */
-static SysNode* A_in( SysNode *first, StarSystem *cur )
-{
-   SysNode *n;
+      /* Break if infinite loop, full trees expand each system once. */
+      j++;
+      if ((dst >= 0) && (j > MAP_LOOP_PROT))
+         break;
 
-   if (first == NULL)
-      return NULL;
+      /* Get best from open and close it. */
+      map_pstate.nheap--;
+      map_heapSwap( 0, map_pstate.nheap );
+      map_pstate.hpos[cur] = -1;
+      map_heapDown( g, 0 );
+      cost = g[cur] + 1; /* Base unit is jump and always increases by 1. */
 
-   n = first;
-   do {
-      if (n->sys == cur)
-         return n;
-   } while ((n=n->next) != NULL);
-   return NULL;
-}
-/** @brief Returns the lowest ranking node from a linked list of nodes. */
-static SysNode* A_lowest( SysNode *first )
-{
-   SysNode *lowest, *n;
+      for (i=map_graph.start[cur]; i<map_graph.start[cur+1]; i++) {
+         jp  = map_graph.jp[i];
+         sys = jp->target;
 
-   if (first == NULL)
-      return NULL;
+         /* Make sure it's reachable */
+         if (!ignore_known) {
+            if (!jp_isKnown(jp))
+               continue;
+            if (!sys_isKnown(sys) && !space_sysReachable(sys))
+               continue;
+         }
+         if (jp_isFlag( jp, JP_EXITONLY ))
+            continue;
 
-   n = first;
-   lowest = n;
-   do {
-      if (n->g < lowest->g)
-         lowest = n;
-   } while ((n=n->next) != NULL);
-   return lowest;
+         /* Skip hidden jumps if they're not specifically requested */
+         if (!show_hidden && jp_isFlag( jp, JP_HIDDEN ))
+            continue;
+
+         /* Already reached with a path as good. */
+         if ((g[ map_graph.target[i] ] >= 0) && (cost >= g[ map_graph.target[i] ]))
+            continue;
+
+         /* Open or reopen the node. */
+         parent[ map_graph.target[i] ] = cur;
+         g[ map_graph.target[i] ]      = cost;
+         map_pstate.seq[ map_graph.target[i] ] = map_pstate.nseq++;
+         if (map_pstate.hpos[ map_graph.target[i] ] < 0) {
+            map_pstate.heap[ map_pstate.nheap ] = map_graph.target[i];
+            map_pstate.hpos[ map_graph.target[i] ] = map_pstate.nheap;
+            map_pstate.nheap++;
+            map_heapUp( g, map_pstate.nheap-1 );
+         }
+         else {
+            /* Reopened nodes go after everything else with the same cost. */
+            map_heapUp( g, map_pstate.hpos[ map_graph.target[i] ] );
+            map_heapDown( g, map_pstate.hpos[ map_graph.target[i] ] );
+         }
+      }
+   }
 }
-/** @brief Frees a linked list. */
-static void A_freeList( SysNode *first )
+/**
+ * @brief Gets the shortest path tree from a system.
+ *
+ *    @param src Index of the system to start from.
+ *    @param dst Index of the system to go to.
+ *    @param ignore_known Whether or not to ignore if systems and jump points are known.
+ *    @param show_hidden Whether or not to use hidden jumps points.
+ *    @return Parents followed by number of jumps of each system (see map_pathSearch).
+ */
+static const int* map_pathTree( int src, int dst, int ignore_known, int show_hidden )
 {
-   SysNode *p, *n;
+   int **tree;
 
-   if (first == NULL)
-      return;
+   if (map_graph.nsys != systems_nstack)
+      map_graphBuild();
 
-   p = NULL;
-   n = first;
-   do {
-      free(p);
-      p = n;
-   } while ((n=n->gnext) != NULL);
-   free(p);
+   /* Paths that depend on the player's knowledge can't be cached. */
+   if (!ignore_known) {
+      map_pathSearch( src, dst, ignore_known, show_hidden, map_pstate.tree );
+      return map_pstate.tree;
+   }
+
+   tree = &map_graph.tree[ show_hidden ? 1 : 0 ][src];
+   if (*tree == NULL) {
+      *tree = malloc( sizeof(int) * 2 * map_graph.nsys );
+      map_pathSearch( src, -1, ignore_known, show_hidden, *tree );
+   }
+   return *tree;
+}
+/**
+ * @brief Invalidates the cached jump paths.
+ *
+ * Must be called whenever jumps are added, removed or change flags.
+ */
+void map_invalidateJumpPaths (void)
+{
+   map_graphFree();
 }
 
 /** @brief Sets map_zoom to zoom and recreates the faction disk texture. */
@@ -2212,16 +2361,9 @@ StarSystem** map_getJumpPath( int* njumps, const char* sysstart,
     const char* sysend, int ignore_known, int show_hidden,
     StarSystem** old_data )
 {
-   int i, j, cost, ojumps;
-
-   StarSystem *sys, *ssys, *esys, **res;
-   JumpPoint *jp;
-
-   SysNode *cur,   *neighbour;
-   SysNode *open,  *closed;
-   SysNode *ocost, *ccost;
-
-   A_gc = NULL;
+   int i, cur, ojumps;
+   const int *tree;
+   StarSystem *ssys, *esys, **res;
 
    /* initial and target systems */
    ssys = system_get(sysstart); /* start */
@@ -2249,78 +2391,11 @@ StarSystem** map_getJumpPath( int* njumps, const char* sysstart,
       return NULL;
    }
 
-   /* start the linked lists */
-   open     = closed = NULL;
-   cur      = A_newNode( ssys );
-   cur->parent = NULL;
-   cur->g   = 0;
-   open     = A_add( open, cur ); /* Initial open node is the start system */
-
-   j = 0;
-   while ((cur = A_lowest(open))) {
-      /* End condition. */
-      if (cur->sys == esys)
-         break;
-
-      /* Break if infinite loop. */
-      j++;
-      if (j > MAP_LOOP_PROT)
-         break;
-
-      /* Get best from open and toss to closed */
-      open   = A_rm( open, cur->sys );
-      closed = A_add( closed, cur );
-      cost   = A_g(cur) + 1; /* Base unit is jump and always increases by 1. */
-
-      for (i=0; i<cur->sys->njumps; i++) {
-         jp  = &cur->sys->jumps[i];
-         sys = jp->target;
-
-         /* Make sure it's reachable */
-         if (!ignore_known) {
-            if (!jp_isKnown(jp))
-               continue;
-            if (!sys_isKnown(sys) && !space_sysReachable(sys))
-               continue;
-         }
-         if (jp_isFlag( jp, JP_EXITONLY ))
-            continue;
-
-         /* Skip hidden jumps if they're not specifically requested */
-         if (!show_hidden && jp_isFlag( jp, JP_HIDDEN ))
-            continue;
-
-         /* Check to see if it's already in the closed set. */
-         ccost = A_in(closed, sys);
-         if ((ccost != NULL) && (cost >= A_g(ccost)))
-            continue;
-            //closed = A_rm( closed, sys );
-
-         /* Remove if it exists and current is better. */
-         ocost = A_in(open, sys);
-         if (ocost != NULL) {
-            if (cost < A_g(ocost))
-               open = A_rm( open, sys ); /* New path is better */
-            else
-               continue; /* This node is worse, so ignore it. */
-         }
-
-         /* Create the node. */
-         neighbour         = A_newNode( sys );
-         neighbour->parent = cur;
-         neighbour->g      = cost;
-         open              = A_add( open, neighbour );
-      }
-
-      /* Safety check in case not linked. */
-      if (open == NULL)
-         break;
-   }
+   tree = map_pathTree( ssys->id, esys->id, ignore_known, show_hidden );
 
-   /* Build path backwards if not broken from loop. */
-   if ( cur != NULL && esys == cur->sys ) {
-      (*njumps) = A_g(cur);
-      assert( *njumps > 0 );
+   /* Build path backwards if reached. */
+   if (tree[ map_graph.nsys + esys->id ] > 0) {
+      (*njumps) = tree[ map_graph.nsys + esys->id ];
       if (old_data == NULL)
          res      = malloc( sizeof(StarSystem*) * (*njumps) );
       else {
@@ -2328,9 +2403,10 @@ StarSystem** map_getJumpPath( int* njumps, const char* sysstart,
          res      = realloc( old_data, sizeof(StarSystem*) * (*njumps) );
       }
       /* Build path. */
+      cur = esys->id;
       for (i=0; i<((*njumps)-ojumps); i++) {
-         res[(*njumps)-i-1] = cur->sys;
-         cur                = cur->parent;
+         res[(*njumps)-i-1] = system_getIndex( cur );
+         cur                = tree[cur];
       }
    }
    else {
@@ -2339,8 +2415,6 @@ StarSystem** map_getJumpPath( int* njumps, const char* sysstart,
       free( old_data );
    }
 
-   /* free the linked lists */
-   A_freeList(A_gc);
    return res;
 }
 
@@ -37,6 +37,7 @@ void map_clear (void);
 void map_jump (void);
 
 /* manipulate universe stuff */
+void map_invalidateJumpPaths (void);
 StarSystem **map_getJumpPath( int *njumps, const char *sysstart, const char *sysend, int ignore_known, int show_hidden,
                               StarSystem **old_data ) WARN_IF( *njumps < 0, "njumps must be >= 0" );
 int map_map( const Outfit *map );
@@ -490,8 +490,9 @@ void ovr_render( double dt )
    int i, j;
    Pilot **pstk;
    AsteroidAnchor *ast;
+   int *cand;
    int n;
-   double w, h, res;
+   double w, h, res, r;
    double x,y;
 
    /* Must be open. */
@@ -548,11 +549,13 @@ void ovr_render( double dt )
       gl_printMarkerRaw( &gl_smallFont, x+10., y-gl_smallFont.h/2., &cRadar_hilight, _("TARGET") );
    }
 
-   /* render the asteroids */
+   /* render the asteroids, only the ones in sensor range are shown */
+   r = sqrt( pilot_sensorRange() * player.p->ew_detect );
    for (i=0; i<cur_system->nasteroids; i++) {
-      ast = &cur_system->asteroids[i];
-      for (j=0; j<ast->nb; j++)
-         gui_renderAsteroid( &ast->asteroids[j], w, h, res, 1 );
+      ast  = &cur_system->asteroids[i];
+      cand = asteroids_queryCircle( ast, &player.p->solid->pos, r );
+      for (j=0; j<array_size(cand); j++)
+         gui_renderAsteroid( &ast->asteroids[ cand[j] ], w, h, res, 1 );
    }
 
    /* Render the player. */
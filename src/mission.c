@@ -39,6 +39,7 @@
 #include "player.h"
 #include "rng.h"
 #include "space.h"
+#include "strhash.h"
 
 
 #define XML_MISSION_TAG       "mission" /**< XML mission tag. */
@@ -111,9 +112,9 @@ int mission_getID( const char* name )
 {
    int i;
 
-   for (i=0; i<array_size(mission_stack); i++)
-      if (strcmp(name,mission_stack[i].name)==0)
-         return i;
+   i = strhash_get( STRHASH_MISSION, name );
+   if (i >= 0)
+      return i;
 
    DEBUG(_("Mission '%s' not found in stack"), name);
    return -1;
@@ -165,6 +166,9 @@ static int mission_init( Mission* mission, MissionData* misn, int genid, int cre
    /* clear the mission */
    memset( mission, 0, sizeof(Mission) );
 
+   /* Conditionals may check running missions. */
+   cond_invalidate();
+
    /* Create id if needed. */
    mission->id    = (genid) ? mission_genID() : 0;
 
@@ -215,7 +219,10 @@ static int mission_init( Mission* mission, MissionData* misn, int genid, int cre
  */
 int mission_accept( Mission* mission )
 {
-   return misn_run( mission, "accept" );
+   int ret;
+   ret = misn_run( mission, "accept" );
+   cond_invalidate();
+   return ret;
 }
 
 
@@ -503,6 +510,9 @@ void mission_cleanup( Mission* misn )
 {
    int i, ret;
 
+   /* Conditionals may check running missions. */
+   cond_invalidate();
+
    /* Hooks and missions. */
    if (misn->id != 0) {
       hook_rmMisnParent( misn->id ); /* remove existing hooks */
@@ -885,6 +895,10 @@ int missions_load (void)
    /* Sort based on priority so higher priority missions can establish claims first. */
    qsort( mission_stack, array_size(mission_stack), sizeof(MissionData), missions_cmp );
 
+   /* Index names, ids are the positions in the sorted stack. */
+   for (i=0; i<array_size(mission_stack); i++)
+      strhash_set( STRHASH_MISSION, mission_stack[i].name, i );
+
    DEBUG( n_("Loaded %d Mission", "Loaded %d Missions", array_size(mission_stack) ), array_size(mission_stack) );
 
    return 0;
@@ -985,6 +999,7 @@ void missions_free (void)
       mission_freeData( &mission_stack[i] );
    array_free( mission_stack );
    mission_stack = NULL;
+   strhash_clear( STRHASH_MISSION );
 
    /* Free the player mission stack. */
    for (i=0; i<MISSION_MAX; i++)
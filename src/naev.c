@@ -86,7 +86,9 @@
 #include "physics.h"
 #include "pilot.h"
 #include "player.h"
+#include "profile.h"
 #include "rng.h"
+#include "save.h"
 #include "semver.h"
 #include "ship.h"
 #include "slots.h"
@@ -94,6 +96,7 @@
 #include "space.h"
 #include "spfx.h"
 #include "start.h"
+#include "strhash.h"
 #include "tech.h"
 #include "threadpool.h"
 #include "toolkit.h"
@@ -105,6 +108,10 @@
 
 #define NAEV_INIT_DELAY 3000 /**< Minimum amount of time_ms to wait with loading screen */
 
+#define BENCH_DT        (1./60.) /**< Fixed delta tick used when benchmarking. */
+#define BENCH_SEED      1337 /**< Random seed used when benchmarking. */
+
+
 
 static int quit               = 0; /**< For primary loop */
 static unsigned int time_ms   = 0; /**< used to calculate FPS and movement. */
@@ -151,6 +158,7 @@ static double fps_elapsed (void);
 static void fps_control (void);
 static void update_all (void);
 static void render_all (void);
+static int naev_bench (void);
 /* Misc. */
 void loadscreen_render( double done, const char *msg ); /* nebula.c */
 void main_loop( int update ); /* dialogue.c */
@@ -175,6 +183,7 @@ void naev_quit (void)
 int main( int argc, char** argv )
 {
    char buf[PATH_MAX];
+   int bench_failed = 0;
 
    env_detect( argc, argv );
 
@@ -372,14 +381,22 @@ int main( int argc, char** argv )
    /* Unload load screen. */
    loadscreen_unload();
 
-   /* Start menu. */
-   menu_main();
+   /* Benchmark instead of playing. */
+   if (conf.bench != NULL) {
+      if (naev_bench())
+         bench_failed = 1;
+      quit = 1;
+   }
+   else {
+      /* Start menu. */
+      menu_main();
 
-   LOG( _( "Reached main menu" ) );
+      LOG( _( "Reached main menu" ) );
 
-   /* Force a minimum delay with loading screen */
-   if ((SDL_GetTicks() - time_ms) < NAEV_INIT_DELAY)
-      SDL_Delay( NAEV_INIT_DELAY - (SDL_GetTicks() - time_ms) );
+      /* Force a minimum delay with loading screen */
+      if ((SDL_GetTicks() - time_ms) < NAEV_INIT_DELAY)
+         SDL_Delay( NAEV_INIT_DELAY - (SDL_GetTicks() - time_ms) );
+   }
    fps_init(); /* initializes the time_ms */
 
 
@@ -392,7 +409,7 @@ int main( int argc, char** argv )
    while (SDL_PollEvent(&event));
 
    /* Incomplete game note (shows every time version number changes). */
-   if ( conf.lastversion == NULL || naev_versionCompare(conf.lastversion) != 0 ) {
+   if ( !quit && (conf.lastversion == NULL || naev_versionCompare(conf.lastversion) != 0) ) {
       free( conf.lastversion );
       conf.lastversion = strdup( naev_version(0) );
       dialogue_msg(
@@ -435,7 +452,11 @@ int main( int argc, char** argv )
    }
 
    /* Save configuration. */
-   conf_saveConfig(buf);
+   if (conf.bench == NULL)
+      conf_saveConfig(buf);
+
+   /* Finish writing the last saved game. */
+   save_wait();
 
    /* data unloading */
    unload_all();
@@ -483,7 +504,7 @@ int main( int argc, char** argv )
    log_clean();
 
    /* all is well */
-   exit(EXIT_SUCCESS);
+   exit( bench_failed ? EXIT_FAILURE : EXIT_SUCCESS );
 }
 
 
@@ -542,6 +563,10 @@ void loadscreen_render( double done, const char *msg )
    double rh;  /**<  Loading Progress Text Relative Height */
    SDL_Event event;
 
+   /* Nothing is shown when benchmarking. */
+   if (conf.bench != NULL)
+      return;
+
    /* Clear background. */
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -680,6 +705,7 @@ void unload_all (void)
    commodity_free();
    var_cleanup(); /* cleans up mission variables */
    sp_cleanup();
+   strhash_free(); /* Frees the interned names. */
 }
 
 
@@ -692,6 +718,8 @@ void main_loop( int update )
     * Control FPS.
     */
    fps_control(); /* everyone loves fps control */
+   profile_frame(); /* new frame for the profiler */
+   gl_fontFrame(); /* ages the cached text layouts */
 
    /*
     * Handle update.
@@ -709,15 +737,23 @@ void main_loop( int update )
    /* Safe hook should be run every frame regardless of whether game is paused or not. */
    hooks_run( "safe" );
 
+   /* Saves are written in the background, complain once they fail. */
+   save_update();
+
    /*
     * Handle render.
     */
    /* Clear buffer. */
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   profile_begin( PROFILE_RENDER );
    render_all();
+   profile_end( PROFILE_RENDER );
    /* Toolkit is rendered on top. */
-   if (toolkit_isOpen())
+   if (toolkit_isOpen()) {
+      profile_begin( PROFILE_TOOLKIT );
       toolkit_render();
+      profile_end( PROFILE_TOOLKIT );
+   }
    gl_checkErr(); /* check error every loop */
    /* Draw buffer. */
    SDL_GL_SwapWindow( gl_screen.window );
@@ -922,16 +958,101 @@ void update_routine( double dt, int enter_sys )
    }
 
    /* Update engine stuff. */
+   profile_begin( PROFILE_SPACE );
    space_update(dt);
+   profile_end( PROFILE_SPACE );
+   profile_begin( PROFILE_WEAPONS );
    weapons_update(dt);
+   profile_end( PROFILE_WEAPONS );
+   profile_begin( PROFILE_SPFX );
    spfx_update(dt);
+   profile_end( PROFILE_SPFX );
+   profile_begin( PROFILE_AI );
+   pilots_think(dt);
+   profile_end( PROFILE_AI );
+   profile_begin( PROFILE_PILOTS );
    pilots_update(dt);
+   profile_end( PROFILE_PILOTS );
 
    /* Update camera. */
    cam_update( dt );
 
-   if (!enter_sys)
+   if (!enter_sys) {
+      profile_begin( PROFILE_HOOKS );
       hook_exclusionEnd( dt );
+      profile_end( PROFILE_HOOKS );
+   }
+}
+
+
+/**
+ * @brief Runs the simulation benchmark.
+ *
+ * Enters the benchmark system with its faction presence scaled so the
+ *  schedulers spawn a big battle, then updates it at a fixed delta tick
+ *  without rendering and prints how long each subsystem took.
+ *
+ *    @return 0 on success.
+ */
+static int naev_bench (void)
+{
+   int i, npilots;
+   StarSystem *sys;
+   Uint64 start;
+   double t, total;
+
+   sys = system_get( conf.bench );
+   if (sys == NULL) {
+      WARN(_("Benchmark system '%s' not found!"), conf.bench);
+      return -1;
+   }
+
+   /* Same universe every run. */
+   rng_seed( BENCH_SEED );
+
+   /* Let the faction schedulers spawn the fleets. */
+   for (i=0; i<sys->npresence; i++)
+      sys->presence[i].value *= conf.bench_presence;
+   space_init( sys->name );
+   pilot_getAll( &npilots );
+   LOG(_("Benchmarking %d updates in %s with %d pilots..."),
+         conf.bench_ticks, sys->name, npilots);
+
+   /* Run the simulation. */
+   profile_reset();
+   start = SDL_GetPerformanceCounter();
+   for (i=0; i<conf.bench_ticks; i++) {
+      update_routine( BENCH_DT, 0 );
+
+      /* Optionally draw every update into the hidden window. */
+      if (conf.bench_render) {
+         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+         profile_begin( PROFILE_RENDER );
+         render_all();
+         profile_end( PROFILE_RENDER );
+      }
+   }
+   total = 1000. * (double)(SDL_GetPerformanceCounter() - start)
+         / (double)SDL_GetPerformanceFrequency();
+
+   /* Print results, the toolkit is never rendered. */
+   pilot_getAll( &npilots );
+   LOG(_("Benchmark finished with %d pilots, %.3f ms/update:"), npilots,
+         total / (double)MAX(1,conf.bench_ticks));
+   for (i=0; i<=(conf.bench_render ? PROFILE_RENDER : PROFILE_HOOKS); i++) {
+      t = profile_total( i );
+      LOG("   %-10s %10.3f ms %8.4f ms/update %5.1f%%", profile_name( i ),
+            t, t / (double)MAX(1,conf.bench_ticks),
+            100. * t / MAX(1e-9,total));
+   }
+   if (conf.bench_render) {
+      for (i=0; i<PROFILE_NCOUNTERS; i++) {
+         t = profile_countTotal( i );
+         LOG("   %-10s %10.0f    %8.1f /update", profile_countName( i ),
+               t, t / (double)MAX(1,conf.bench_ticks));
+      }
+   }
+   return 0;
 }
 
 
@@ -956,10 +1077,12 @@ void update_routine( double dt, int enter_sys )
 static void render_all (void)
 {
    double dt;
+   int draws, sprites;
 
    dt = (paused) ? 0. : game_dt;
 
    /* setup */
+   gl_batchResetStats();
    spfx_begin(dt, real_dt);
    /* BG */
    space_render(dt);
@@ -978,6 +1101,12 @@ static void render_all (void)
    spfx_end();
    gui_render(dt);
    ovr_render(dt);
+
+   /* Report the sprite batch to the profiler before showing it. */
+   gl_batchStats( &draws, &sprites );
+   profile_count( PROFILE_SPRITES, sprites );
+   profile_count( PROFILE_DRAWS, draws );
+
    display_fps( real_dt ); /* Exception. */
 }
 
@@ -993,6 +1122,9 @@ static void display_fps( const double dt )
 {
    double x,y;
    double dt_mod_base = 1.;
+#ifdef DEBUGGING
+   int front, back;
+#endif /* DEBUGGING */
 
    fps_dt  += dt;
    fps_cur += 1.;
@@ -1006,8 +1138,16 @@ static void display_fps( const double dt )
    if (conf.fps_show) {
       gl_print( NULL, x, y, NULL, "%3.2f", fps );
       y -= gl_defFont.h + 5.;
+#ifdef DEBUGGING
+      spfx_stats( &front, &back );
+      gl_print( NULL, x, y, NULL, _("%d effects"), front+back );
+      y -= gl_defFont.h + 5.;
+#endif /* DEBUGGING */
    }
 
+   /* Frame profiler next to the FPS. */
+   profile_render( fps_x + 120., fps_y + gl_defFont.h );
+
    if ((player.p != NULL) && !player_isFlag(PLAYER_DESTROYED) &&
          !player_isFlag(PLAYER_CREATING)) {
       dt_mod_base = player_dt_default();
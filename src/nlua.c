@@ -16,6 +16,7 @@
 
 #include "nlua.h"
 
+#include "array.h"
 #include "log.h"
 #include "lutf8lib.h"
 #include "ndata.h"
@@ -47,10 +48,26 @@ lua_State *naevL = NULL;
 nlua_env __NLUA_CURENV = LUA_NOREF;
 
 
+/**
+ * @brief Compiled module shared by all the environments.
+ */
+typedef struct NLuaChunk_ {
+   char *name; /**< Name the module is required as. */
+   char *path; /**< Path the module was found at. */
+   char *code; /**< Dumped bytecode of the module. */
+   size_t size; /**< Size of the bytecode. */
+} NLuaChunk;
+static NLuaChunk *nlua_chunks = NULL; /**< Compiled modules sorted by name (array.h). */
+
+
 /*
  * prototypes
  */
 static int nlua_require( lua_State* L );
+static void nlua_loadModule( lua_State* L, const char *filename );
+static int nlua_chunkFind( const char *name, int *pos );
+static int nlua_chunkWriter( lua_State* L, const void* p, size_t sz, void* ud );
+static void nlua_chunkFree (void);
 static lua_State *nlua_newState (void); /* creates a new state */
 static int nlua_loadBasic( lua_State* L );
 /* gettext */
@@ -133,6 +150,7 @@ void lua_init(void) {
 void lua_exit(void) {
    lua_close(naevL);
    naevL = NULL;
+   nlua_chunkFree();
 }
 
 
@@ -390,12 +408,7 @@ static int nlua_loadBasic( lua_State* L )
 static int nlua_require( lua_State* L )
 {
    const char *filename;
-   size_t bufsize;
    int envtab;
-   char *buf, *q;
-   char path_filename[PATH_MAX], tmpname[PATH_MAX], tried_paths[STRMAX];
-   const char *packagepath, *start, *end;
-   int i, done;
 
    /* Environment table to load module into */
    envtab = lua_upvalueindex(1);
@@ -430,6 +443,65 @@ static int nlua_require( lua_State* L )
       return 1;
    }
 
+   /* Get the compiled module. */
+   nlua_loadModule( L, filename );
+
+   lua_pushvalue(L, envtab);
+   lua_setfenv(L, -2);
+
+   /* run the buffer */
+   lua_pushstring(L, filename); /* pass name as first parameter */
+#if 0
+   if (lua_pcall(L, 1, 1, 0) != 0) {
+      /* will push the current error from the dobuffer */
+      lua_error(L);
+      return 1;
+   }
+#endif
+   lua_call(L, 1, 1);
+
+   /* Mark as loaded. */
+   /* val */
+   if (lua_isnil(L,-1)) {
+      lua_pop(L, 1);
+      lua_pushboolean(L, 1);
+   }
+   lua_getfield(L, envtab, NLUA_LOAD_TABLE); /* val, t */
+   lua_pushvalue(L, -2);                     /* val, t, val */
+   lua_setfield(L, -2, filename);            /* val, t */
+   lua_pop(L, 1);                            /* val */
+
+   /* success */
+   return 1;
+}
+
+
+/**
+ * @brief Pushes the compiled chunk of a module.
+ *
+ * Modules are only read and parsed the first time they are required. After
+ *  that their bytecode is kept and loaded directly in the new environments.
+ *
+ *    @param L Lua state.
+ *    @param filename Name of the module.
+ */
+static void nlua_loadModule( lua_State* L, const char *filename )
+{
+   size_t bufsize;
+   char *buf, *q;
+   char path_filename[PATH_MAX], tmpname[PATH_MAX], tried_paths[STRMAX];
+   const char *packagepath, *start, *end;
+   int i, done, pos;
+   NLuaChunk *chunk;
+
+   /* Already compiled. */
+   if (nlua_chunkFind( filename, &pos )) {
+      chunk = &nlua_chunks[pos];
+      if (luaL_loadbuffer(L, chunk->code, chunk->size, chunk->path) != 0)
+         lua_error(L);
+      return;
+   }
+
    /* Get paths to check. */
    lua_getglobal(naevL, "package");
    if (!lua_istable(L,-1)) {
@@ -489,43 +561,95 @@ static int nlua_require( lua_State* L )
    /* Must have buf by now. */
    if (buf == NULL) {
       NLUA_ERROR(L, _("require: %s not found in ndata.\nTried:%s"), filename, tried_paths);
-      return 1;
+      return;
    }
 
    /* Try to process the Lua. */
    if (luaL_loadbuffer(L, buf, bufsize, path_filename) != 0) {
+      free(buf);
       lua_error(L);
-      return 1;
+      return;
    }
+   free(buf);
 
-   lua_pushvalue(L, envtab);
-   lua_setfenv(L, -2);
+   /* Keep the bytecode for the other environments. */
+   chunk = &array_grow( &nlua_chunks );
+   memmove( &nlua_chunks[pos+1], &nlua_chunks[pos],
+         sizeof(NLuaChunk) * (array_size(nlua_chunks)-pos-1) );
+   chunk = &nlua_chunks[pos];
+   chunk->name = strdup( filename );
+   chunk->path = strdup( path_filename );
+   chunk->code = NULL;
+   chunk->size = 0;
+   lua_dump( L, nlua_chunkWriter, chunk );
+}
 
-   /* run the buffer */
-   lua_pushstring(L, filename); /* pass name as first parameter */
-#if 0
-   if (lua_pcall(L, 1, 1, 0) != 0) {
-      /* will push the current error from the dobuffer */
-      lua_error(L);
-      return 1;
-   }
-#endif
-   lua_call(L, 1, 1);
 
-   /* Mark as loaded. */
-   /* val */
-   if (lua_isnil(L,-1)) {
-      lua_pop(L, 1);
-      lua_pushboolean(L, 1);
+/**
+ * @brief Finds a compiled module.
+ *
+ *    @param name Name of the module.
+ *    @param[out] pos Position of the module or where to insert it.
+ *    @return 1 if found, 0 otherwise.
+ */
+static int nlua_chunkFind( const char *name, int *pos )
+{
+   int lo, hi, mid, c;
+
+   lo = 0;
+   hi = (nlua_chunks == NULL) ? 0 : array_size(nlua_chunks);
+   while (lo < hi) {
+      mid = (lo+hi) / 2;
+      c   = strcmp( nlua_chunks[mid].name, name );
+      if (c == 0) {
+         *pos = mid;
+         return 1;
+      }
+      else if (c < 0)
+         lo = mid+1;
+      else
+         hi = mid;
    }
-   lua_getfield(L, envtab, NLUA_LOAD_TABLE); /* val, t */
-   lua_pushvalue(L, -2);                     /* val, t, val */
-   lua_setfield(L, -2, filename);            /* val, t */
-   lua_pop(L, 1);                            /* val */
+   *pos = lo;
+   if (nlua_chunks == NULL)
+      nlua_chunks = array_create( NLuaChunk );
+   return 0;
+}
 
-   /* cleanup, success */
-   free(buf);
-   return 1;
+
+/**
+ * @brief Writer for lua_dump that appends to a compiled module.
+ */
+static int nlua_chunkWriter( lua_State* L, const void* p, size_t sz, void* ud )
+{
+   NLuaChunk *chunk;
+   (void) L;
+
+   chunk = (NLuaChunk*) ud;
+   chunk->code = realloc( chunk->code, chunk->size + sz );
+   memcpy( &chunk->code[ chunk->size ], p, sz );
+   chunk->size += sz;
+   return 0;
+}
+
+
+/**
+ * @brief Frees the compiled modules.
+ */
+static void nlua_chunkFree (void)
+{
+   int i;
+
+   if (nlua_chunks == NULL)
+      return;
+
+   for (i=0; i<array_size(nlua_chunks); i++) {
+      free( nlua_chunks[i].name );
+      free( nlua_chunks[i].path );
+      free( nlua_chunks[i].code );
+   }
+   array_free( nlua_chunks );
+   nlua_chunks = NULL;
 }
 
 
@@ -18,11 +18,18 @@
 
 #include "log.h"
 #include "mission.h"
+#include "nfile.h"
 #include "nluadef.h"
+#include "nstring.h"
+#include "profile.h"
 
 
 /* CLI */
+static int cliL_profile( lua_State *L );
+static int cliL_profileDump( lua_State *L );
 static const luaL_Reg cli_methods[] = {
+   { "profile", cliL_profile },
+   { "profileDump", cliL_profileDump },
    {0,0}
 }; /**< CLI Lua methods. */
 
@@ -39,3 +46,56 @@ int nlua_loadCLI( nlua_env env )
    return 0;
 }
 
+
+/**
+ * @brief Console only bindings.
+ *
+ * @luamod cli
+ */
+/**
+ * @brief Shows or hides the frame profiler graph next to the FPS counter.
+ *
+ * @usage cli.profile() -- Toggles the graph
+ * @usage cli.profile( true ) -- Shows the graph
+ *
+ *    @luatparam[opt] boolean show Whether or not to show the graph, toggles if omitted.
+ * @luafunc profile
+ */
+static int cliL_profile( lua_State *L )
+{
+   if (lua_isnoneornil(L,1))
+      profile_show( !profile_isShown() );
+   else
+      profile_show( lua_toboolean(L,1) );
+   return 0;
+}
+
+
+/**
+ * @brief Dumps the percentiles of the frame profiler to a CSV file.
+ *
+ * The file is written in the user data directory.
+ *
+ * @usage cli.profileDump( "lag.csv" )
+ *
+ *    @luatparam[opt="profile.csv"] string filename Name of the file to write.
+ *    @luatreturn string Path of the written file.
+ * @luafunc profileDump
+ */
+static int cliL_profileDump( lua_State *L )
+{
+   const char *name;
+   char path[PATH_MAX];
+
+   name = luaL_optstring( L, 1, "profile.csv" );
+   if ((strchr( name, '/' ) != NULL) || (strchr( name, '\\' ) != NULL))
+      NLUA_ERROR( L, _("Profile dump name '%s' must not be a path."), name );
+   if (nfile_dirMakeExist( nfile_dataPath() ))
+      NLUA_ERROR( L, _("Unable to create '%s'."), nfile_dataPath() );
+
+   nsnprintf( path, sizeof(path), "%s%s", nfile_dataPath(), name );
+   if (profile_dumpCSV( path ))
+      NLUA_ERROR( L, _("Unable to dump profile to '%s'."), path );
+   lua_pushstring( L, path );
+   return 1;
+}
@@ -40,6 +40,9 @@ static const luaL_Reg rnd_methods[] = {
 }; /**< Random Lua methods. */
 
 
+static unsigned int rnd_calls = 0; /**< Number of random numbers generated from Lua. */
+
+
 /**
  * @brief Loads the Random Number Lua library.
  *
@@ -53,6 +56,19 @@ int nlua_loadRnd( nlua_env env )
 }
 
 
+/**
+ * @brief Gets the number of times Lua generated random numbers.
+ *
+ * Lets callers find out if a chunk of Lua used randomness when run.
+ *
+ *    @return Number of random calls done from Lua so far.
+ */
+unsigned int nlua_rndCalls (void)
+{
+   return rnd_calls;
+}
+
+
 /**
  * @brief Bindings for interacting with the random number generator.
  *
@@ -92,6 +108,8 @@ static int rnd_int( lua_State *L )
    int o;
    int l,h;
 
+   rnd_calls++;
+
    o = lua_gettop(L);
 
    if (o==0)
@@ -122,6 +140,7 @@ static int rnd_int( lua_State *L )
  */
 static int rnd_sigma( lua_State *L )
 {
+   rnd_calls++;
    lua_pushnumber(L, RNG_1SIGMA());
    return 1;
 }
@@ -140,6 +159,7 @@ static int rnd_sigma( lua_State *L )
  */
 static int rnd_twosigma( lua_State *L )
 {
+   rnd_calls++;
    lua_pushnumber(L, RNG_2SIGMA());
    return 1;
 }
@@ -159,6 +179,7 @@ static int rnd_twosigma( lua_State *L )
  */
 static int rnd_threesigma( lua_State *L )
 {
+   rnd_calls++;
    lua_pushnumber(L, RNG_3SIGMA());
    return 1;
 }
@@ -184,6 +205,8 @@ static int rnd_permutation( lua_State *L )
    int i, j, temp, max;
    int new_table;
 
+   rnd_calls++;
+
    NLUA_MIN_ARGS(1);
    if (lua_isnumber(L,1)) {
       max = lua_tointeger(L,1);
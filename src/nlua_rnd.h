@@ -11,6 +11,7 @@
 
 
 int nlua_loadRnd( nlua_env env );
+unsigned int nlua_rndCalls (void);
 
 
 #endif /* NLUA_RND_H */
@@ -21,6 +21,7 @@
 
 #include "nlua_var.h"
 
+#include "cond.h"
 #include "log.h"
 #include "nluadef.h"
 #include "nstring.h"
@@ -200,6 +201,8 @@ static int var_add( misn_var *new_var )
 {
    int i;
 
+   cond_invalidate();
+
    if (var_nstack+1 > var_mstack) { /* more memory */
       var_mstack += 64; /* overkill ftw */
       var_stack = realloc( var_stack, var_mstack * sizeof(misn_var) );
@@ -310,6 +313,7 @@ static int var_pop( lua_State *L )
 
    for (i=0; i<var_nstack; i++)
       if (strcmp(str,var_stack[i].name)==0) {
+         cond_invalidate();
          var_free( &var_stack[i] );
          memmove( &var_stack[i], &var_stack[i+1], sizeof(misn_var)*(var_nstack-i-1) );
          var_nstack--;
@@ -391,6 +395,8 @@ static void var_free( misn_var* var )
 void var_cleanup (void)
 {
    int i;
+
+   cond_invalidate();
    for (i=0; i<var_nstack; i++)
       var_free( &var_stack[i] );
 
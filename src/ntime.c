@@ -41,6 +41,7 @@
 
 #include "ntime.h"
 
+#include "cond.h"
 #include "economy.h"
 #include "hook.h"
 #include "nstring.h"
@@ -91,6 +92,8 @@ void ntime_update( double dt )
 
    /* Increment. */
    naev_time     += inc;
+   if (inc > 0)
+      cond_invalidate();
    hooks_updateDate( inc );
 }
 
@@ -234,6 +237,7 @@ void ntime_set( ntime_t t )
 {
    naev_time      = t;
    naev_remainder = 0.;
+   cond_invalidate();
 }
 
 
@@ -245,6 +249,7 @@ void ntime_setR( int cycles, int periods, int seconds, double rem )
    naev_time   = ntime_create( cycles, periods, seconds );
    naev_time  += floor(rem);
    naev_remainder = fmod( rem, 1. );
+   cond_invalidate();
 }
 
 
@@ -256,6 +261,7 @@ void ntime_setR( int cycles, int periods, int seconds, double rem )
 void ntime_inc( ntime_t t )
 {
    naev_time += t;
+   cond_invalidate();
    economy_update( t );
 
    /* Run hooks. */
@@ -319,6 +325,7 @@ void ntime_refresh (void)
 
       /* Run hook stuff and actually update time. */
       naev_time += ntu->inc;
+      cond_invalidate();
       economy_update( ntu->inc );
 
       /* Remove the increment. */
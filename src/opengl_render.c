@@ -32,6 +32,7 @@
 
 #include "opengl_render.h"
 
+#include "array.h"
 #include "camera.h"
 #include "conf.h"
 #include "gui.h"
@@ -42,6 +43,32 @@
 
 
 #define OPENGL_RENDER_VBO_SIZE      256 /**< Size of VBO. */
+#define OPENGL_BATCH_VERTEX   9 /**< Floats per batch vertex: position, texture, colour and interpolation. */
+#define OPENGL_BATCH_LOOKBACK 16 /**< Number of runs to look back at when merging a quad into a run. */
+
+
+/**
+ * @brief A quad in the sprite batch.
+ */
+typedef struct glBatchQuad_ {
+   int run; /**< Run the quad belongs to. */
+   GLfloat v[6*OPENGL_BATCH_VERTEX]; /**< Vertices of the two triangles. */
+} glBatchQuad;
+
+
+/**
+ * @brief Quads drawn together with a single draw call.
+ */
+typedef struct glBatchRun_ {
+   GLuint ta; /**< First texture. */
+   GLuint tb; /**< Second texture. */
+   double x1; /**< Left of the bounding box of the quads. */
+   double y1; /**< Bottom of the bounding box of the quads. */
+   double x2; /**< Right of the bounding box of the quads. */
+   double y2; /**< Top of the bounding box of the quads. */
+   int n; /**< Number of quads. */
+   int first; /**< First quad when drawing. */
+} glBatchRun;
 
 
 static gl_vbo *gl_renderVBO = 0; /**< VBO for rendering stuff. */
@@ -53,11 +80,29 @@ static gl_vbo *gl_triangleVBO = 0;
 static int gl_renderVBOtexOffset = 0; /**< VBO texture offset. */
 static int gl_renderVBOcolOffset = 0; /**< VBO colour offset. */
 
+/* Sprite batch. */
+static int gl_batchActive        = 0; /**< Whether or not blits are being batched. */
+static glBatchQuad *gl_batchQuads = NULL; /**< Batched quads. */
+static glBatchRun *gl_batchRuns  = NULL; /**< Runs of quads with the same textures. */
+static GLfloat *gl_batchData     = NULL; /**< Vertex data to upload. */
+static gl_vbo *gl_batchVBO       = NULL; /**< VBO the batch is streamed into. */
+static GLsizei gl_batchVBOsize   = 0; /**< Size of the batch VBO. */
+static int gl_batchDraws         = 0; /**< Draw calls done by the batch. */
+static int gl_batchSprites       = 0; /**< Sprites drawn by the batch. */
+
+/* Clipping. */
+static int gl_clipX = 0; /**< X offset of the render target in real pixels. */
+static int gl_clipY = 0; /**< Y offset of the render target in real pixels. */
+
 /*
  * prototypes
  */
 static void gl_drawCircleEmpty( const double cx, const double cy,
       const double r, const glColour *c );
+static void gl_batchAdd( GLuint ta, GLuint tb, double inter,
+      double x, double y, double w, double h,
+      double tx, double ty, double tw, double th,
+      const glColour *c, double angle );
 
 
 void gl_beginSolidProgram(gl_Matrix4 projection, const glColour *c)
@@ -214,15 +259,22 @@ void gl_blitTexture(  const glTexture* texture,
    double hw, hh; 
    gl_Matrix4 projection, tex_mat;
 
+   /* Must have colour for now. */
+   if (c == NULL)
+      c = &cWhite;
+
+   /* Batch it if possible. */
+   if (gl_batchActive) {
+      gl_batchAdd( texture->texture, texture->texture, 1., x, y, w, h,
+            tx, ty, tw, th, c, angle );
+      return;
+   }
+
    glUseProgram(shaders.texture.program);
 
    /* Bind the texture. */
    glBindTexture( GL_TEXTURE_2D, texture->texture);
 
-   /* Must have colour for now. */
-   if (c == NULL)
-      c = &cWhite;
-
    hw = w/2.0;
    hh = h/2.0;
 
@@ -308,6 +360,17 @@ void gl_blitTextureInterpolate(  const glTexture* ta,
 
    gl_Matrix4 projection, tex_mat;
 
+   /* Must have colour for now. */
+   if (c == NULL)
+      c = &cWhite;
+
+   /* Batch it if possible. */
+   if (gl_batchActive) {
+      gl_batchAdd( ta->texture, tb->texture, inter, x, y, w, h,
+            tx, ty, tw, th, c, 0. );
+      return;
+   }
+
    glUseProgram(shaders.texture_interpolate.program);
 
    /* Bind the textures. */
@@ -316,10 +379,6 @@ void gl_blitTextureInterpolate(  const glTexture* ta,
    glActiveTexture( GL_TEXTURE1 );
    glBindTexture( GL_TEXTURE_2D, tb->texture);
 
-   /* Must have colour for now. */
-   if (c == NULL)
-      c = &cWhite;
-
    /* Set the vertex. */
    projection = gl_view_matrix;
    projection = gl_Matrix4_Translate(projection, x, y, 0);
@@ -354,6 +413,238 @@ void gl_blitTextureInterpolate(  const glTexture* ta,
 }
 
 
+/**
+ * @brief Starts batching sprites.
+ *
+ * Until gl_batchEnd is called, gl_blitTexture and gl_blitTextureInterpolate
+ *  (and all the sprite functions built on them) queue quads instead of drawing
+ *  them. Anything else drawn in between must call gl_batchFlush first so that
+ *  it is drawn in the right order.
+ */
+void gl_batchStart (void)
+{
+   gl_batchActive = 1;
+}
+
+
+/**
+ * @brief Draws the batched sprites and stops batching.
+ */
+void gl_batchEnd (void)
+{
+   gl_batchFlush();
+   gl_batchActive = 0;
+}
+
+
+/**
+ * @brief Adds a quad to the sprite batch.
+ *
+ * The quad joins the most recent run with the same textures unless a quad of
+ *  a later run overlaps it, so the result looks the same as drawing in order.
+ */
+static void gl_batchAdd( GLuint ta, GLuint tb, double inter,
+      double x, double y, double w, double h,
+      double tx, double ty, double tw, double th,
+      const glColour *c, double angle )
+{
+   int i, j, r, nruns;
+   double px[4], py[4], u, v, hw, hh, cx, cy, ca, sa;
+   double x1, y1, x2, y2;
+   const int order[6] = { 0, 1, 2, 1, 2, 3 };
+   GLfloat *f;
+   glBatchQuad *q;
+   glBatchRun *run;
+
+   if (gl_batchQuads == NULL) {
+      gl_batchQuads = array_create( glBatchQuad );
+      gl_batchRuns  = array_create( glBatchRun );
+   }
+
+   /* Corners, in the same order as the square VBO. */
+   hw = w/2.;
+   hh = h/2.;
+   cx = x+hw;
+   cy = y+hh;
+   ca = cos(angle);
+   sa = sin(angle);
+   for (i=0; i<4; i++) {
+      u = (i & 1) ? hw : -hw;
+      v = (i & 2) ? hh : -hh;
+      if (angle == 0.) {
+         px[i] = cx + u;
+         py[i] = cy + v;
+      }
+      else {
+         px[i] = cx + ca*u - sa*v;
+         py[i] = cy + sa*u + ca*v;
+      }
+   }
+   x1 = MIN( MIN(px[0], px[1]), MIN(px[2], px[3]) );
+   x2 = MAX( MAX(px[0], px[1]), MAX(px[2], px[3]) );
+   y1 = MIN( MIN(py[0], py[1]), MIN(py[2], py[3]) );
+   y2 = MAX( MAX(py[0], py[1]), MAX(py[2], py[3]) );
+
+   /* Find a run to join. */
+   r = -1;
+   nruns = array_size( gl_batchRuns );
+   for (i=nruns-1; i>=MAX(0,nruns-OPENGL_BATCH_LOOKBACK); i--) {
+      run = &gl_batchRuns[i];
+      if ((run->ta == ta) && (run->tb == tb)) {
+         r = i;
+         break;
+      }
+      /* Can't be drawn before an overlapping quad. */
+      if ((x1 < run->x2) && (run->x1 < x2) && (y1 < run->y2) && (run->y1 < y2))
+         break;
+   }
+   if (r < 0) {
+      r   = nruns;
+      run = &array_grow( &gl_batchRuns );
+      run->ta = ta;
+      run->tb = tb;
+      run->x1 = x1;
+      run->y1 = y1;
+      run->x2 = x2;
+      run->y2 = y2;
+      run->n  = 0;
+   }
+   else {
+      run = &gl_batchRuns[r];
+      run->x1 = MIN( run->x1, x1 );
+      run->y1 = MIN( run->y1, y1 );
+      run->x2 = MAX( run->x2, x2 );
+      run->y2 = MAX( run->y2, y2 );
+   }
+   run->n++;
+
+   /* Add the two triangles. */
+   q = &array_grow( &gl_batchQuads );
+   q->run = r;
+   for (i=0; i<6; i++) {
+      j = order[i];
+      f = &q->v[ i*OPENGL_BATCH_VERTEX ];
+      f[0] = px[j];
+      f[1] = py[j];
+      f[2] = tx + ((j & 1) ? tw : 0.);
+      f[3] = ty + ((j & 2) ? th : 0.);
+      f[4] = c->r;
+      f[5] = c->g;
+      f[6] = c->b;
+      f[7] = c->a;
+      f[8] = inter;
+   }
+}
+
+
+/**
+ * @brief Draws all the batched sprites.
+ */
+void gl_batchFlush (void)
+{
+   int i, n, nruns, pos;
+   GLsizei size;
+   glBatchRun *run;
+   GLsizei stride;
+
+   if ((gl_batchQuads == NULL) || (array_size(gl_batchQuads) == 0))
+      return;
+
+   /* Place the quads run after run, keeping their order in each run. */
+   n     = array_size( gl_batchQuads );
+   nruns = array_size( gl_batchRuns );
+   pos   = 0;
+   for (i=0; i<nruns; i++) {
+      gl_batchRuns[i].first = pos;
+      pos += gl_batchRuns[i].n;
+      gl_batchRuns[i].n = 0;
+   }
+   size = sizeof(GLfloat) * n * 6 * OPENGL_BATCH_VERTEX;
+   gl_batchData = realloc( gl_batchData, size );
+   for (i=0; i<n; i++) {
+      run = &gl_batchRuns[ gl_batchQuads[i].run ];
+      memcpy( &gl_batchData[ (run->first + run->n) * 6 * OPENGL_BATCH_VERTEX ],
+            gl_batchQuads[i].v, sizeof(gl_batchQuads[i].v) );
+      run->n++;
+   }
+
+   /* Upload. */
+   if (size > gl_batchVBOsize) {
+      gl_batchVBOsize = MAX( size, 2*gl_batchVBOsize );
+      gl_vboData( gl_batchVBO, gl_batchVBOsize, NULL );
+   }
+   gl_vboSubData( gl_batchVBO, 0, size, gl_batchData );
+
+   /* Set up the program. */
+   glUseProgram(shaders.texture_batch.program);
+   stride = sizeof(GLfloat) * OPENGL_BATCH_VERTEX;
+   glEnableVertexAttribArray( shaders.texture_batch.vertex );
+   glEnableVertexAttribArray( shaders.texture_batch.vertex_tex );
+   glEnableVertexAttribArray( shaders.texture_batch.vertex_color );
+   glEnableVertexAttribArray( shaders.texture_batch.vertex_inter );
+   gl_vboActivateAttribOffset( gl_batchVBO, shaders.texture_batch.vertex,
+         0, 2, GL_FLOAT, stride );
+   gl_vboActivateAttribOffset( gl_batchVBO, shaders.texture_batch.vertex_tex,
+         sizeof(GLfloat) * 2, 2, GL_FLOAT, stride );
+   gl_vboActivateAttribOffset( gl_batchVBO, shaders.texture_batch.vertex_color,
+         sizeof(GLfloat) * 4, 4, GL_FLOAT, stride );
+   gl_vboActivateAttribOffset( gl_batchVBO, shaders.texture_batch.vertex_inter,
+         sizeof(GLfloat) * 8, 1, GL_FLOAT, stride );
+   glUniform1i( shaders.texture_batch.sampler1, 0 );
+   glUniform1i( shaders.texture_batch.sampler2, 1 );
+   gl_Matrix4_Uniform( shaders.texture_batch.projection, gl_view_matrix );
+
+   /* Draw the runs. */
+   for (i=0; i<nruns; i++) {
+      run = &gl_batchRuns[i];
+      glActiveTexture( GL_TEXTURE0 );
+      glBindTexture( GL_TEXTURE_2D, run->ta );
+      glActiveTexture( GL_TEXTURE1 );
+      glBindTexture( GL_TEXTURE_2D, run->tb );
+      glDrawArrays( GL_TRIANGLES, run->first*6, run->n*6 );
+   }
+   gl_batchDraws   += nruns;
+   gl_batchSprites += n;
+
+   /* Clear state. */
+   glDisableVertexAttribArray( shaders.texture_batch.vertex );
+   glDisableVertexAttribArray( shaders.texture_batch.vertex_tex );
+   glDisableVertexAttribArray( shaders.texture_batch.vertex_color );
+   glDisableVertexAttribArray( shaders.texture_batch.vertex_inter );
+   glActiveTexture( GL_TEXTURE0 );
+   glUseProgram(0);
+
+   /* anything failed? */
+   gl_checkErr();
+
+   array_resize( &gl_batchQuads, 0 );
+   array_resize( &gl_batchRuns, 0 );
+}
+
+
+/**
+ * @brief Gets the sprite batch statistics since they were last reset.
+ *
+ *    @param[out] draws Number of draw calls done.
+ *    @param[out] sprites Number of sprites drawn.
+ */
+void gl_batchStats( int *draws, int *sprites )
+{
+   *draws   = gl_batchDraws;
+   *sprites = gl_batchSprites;
+}
+
+
+/**
+ * @brief Resets the sprite batch statistics.
+ */
+void gl_batchResetStats (void)
+{
+   gl_batchDraws   = 0;
+   gl_batchSprites = 0;
+}
+
+
 /**
  * @brief Converts in-game coordinates to screen coordinates.
  *
@@ -756,8 +1047,8 @@ void gl_drawLine( const double x1, const double y1,
 void gl_clipRect( int x, int y, int w, int h )
 {
    double rx, ry, rw, rh;
-   rx = (x + gl_screen.x) / gl_screen.mxscale;
-   ry = (y + gl_screen.y) / gl_screen.myscale;
+   rx = (x + gl_screen.x) / gl_screen.mxscale - gl_clipX;
+   ry = (y + gl_screen.y) / gl_screen.myscale - gl_clipY;
    rw = w / gl_screen.mxscale;
    rh = h / gl_screen.myscale;
    glScissor( rx, ry, rw, rh );
@@ -771,7 +1062,23 @@ void gl_clipRect( int x, int y, int w, int h )
 void gl_unclipRect (void)
 {
    glDisable( GL_SCISSOR_TEST );
-   glScissor( 0, 0, gl_screen.rw, gl_screen.rh );
+   glScissor( -gl_clipX, -gl_clipY, gl_screen.rw, gl_screen.rh );
+}
+
+
+/**
+ * @brief Sets the origin of the render target the clipping planes refer to.
+ *
+ * Used when rendering to an offscreen framebuffer that only covers part of
+ *  the screen, with the viewport moved by the same offset.
+ *
+ *    @param x X position of the render target in real pixels.
+ *    @param y Y position of the render target in real pixels.
+ */
+void gl_clipOffset( int x, int y )
+{
+   gl_clipX = x;
+   gl_clipY = y;
 }
 
 
@@ -800,6 +1107,10 @@ int gl_initRender (void)
    vertex[7] = 1.;
    gl_squareVBO = gl_vboCreateStatic( sizeof(GLfloat) * 8, vertex );
 
+   /* Sprite batch, grows as needed. */
+   gl_batchVBOsize = sizeof(GLfloat) * OPENGL_RENDER_VBO_SIZE * 6 * OPENGL_BATCH_VERTEX;
+   gl_batchVBO = gl_vboCreateStream( gl_batchVBOsize, NULL );
+
    vertex[0] = 0.;
    vertex[1] = 0.;
    vertex[2] = 1.;
@@ -857,4 +1168,14 @@ void gl_exitRender (void)
    gl_vboDestroy( gl_lineVBO );
    gl_vboDestroy( gl_triangleVBO );
    gl_renderVBO = NULL;
+
+   /* Destroy the sprite batch. */
+   gl_vboDestroy( gl_batchVBO );
+   gl_batchVBO = NULL;
+   array_free( gl_batchQuads );
+   array_free( gl_batchRuns );
+   gl_batchQuads = NULL;
+   gl_batchRuns  = NULL;
+   free( gl_batchData );
+   gl_batchData  = NULL;
 }
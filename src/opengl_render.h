@@ -73,6 +73,14 @@ void gl_blitStatic( const glTexture* texture,
 
 
 extern gl_vbo *gl_squareVBO;
+
+/* Sprite batching. */
+void gl_batchStart (void);
+void gl_batchFlush (void);
+void gl_batchEnd (void);
+void gl_batchStats( int *draws, int *sprites );
+void gl_batchResetStats (void);
+
 void gl_beginSolidProgram(gl_Matrix4 projection, const glColour *c);
 void gl_endSolidProgram (void);
 void gl_beginSmoothProgram(gl_Matrix4 projection);
@@ -100,6 +108,7 @@ void gl_renderTriangleEmpty( double x, double y, double a, double s, double leng
 /* Clipping. */
 void gl_clipRect( int x, int y, int w, int h );
 void gl_unclipRect (void);
+void gl_clipOffset( int x, int y );
 
 
 #endif /* OPENGL_RENDER_H */
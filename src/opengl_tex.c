@@ -10,6 +10,7 @@
 
 
 /** @cond */
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "physfsrwops.h"
@@ -17,6 +18,7 @@
 #include "naev.h"
 /** @endcond */
 
+#include "array.h"
 #include "conf.h"
 #include "gui.h"
 #include "log.h"
@@ -41,6 +43,39 @@ typedef struct glTexList_ {
 static glTexList* texture_list = NULL; /**< Texture list. */
 
 
+/**
+ * @brief Image decoded ahead of time by a worker thread.
+ *
+ * Only the upload to OpenGL has to be done by the main thread when the
+ * image gets loaded.
+ */
+typedef struct glTexPrefetch_ {
+   char *path; /**< Path of the image. */
+   SDL_Surface *surface; /**< Decoded and padded surface, NULL while still decoding. */
+   uint64_t *trans; /**< Transparency map or NULL if not requested. */
+   int w; /**< Non-padded width. */
+   int h; /**< Non-padded height. */
+} glTexPrefetch;
+static glTexPrefetch **gl_prefetch = NULL; /**< Prefetched images waiting to be loaded. */
+static SDL_mutex *gl_prefetchLock = NULL; /**< Lock for the prefetched images. */
+
+
+/*
+ * Transparency map cache.
+ */
+#define TRANS_CACHE_MAGIC     0x4e52544eu /**< "NTRN" in little endian. */
+#define TRANS_CACHE_VERSION   1 /**< Bump when the cache layout changes. */
+/**
+ * @brief Header of a cached transparency map, followed by the map itself.
+ */
+typedef struct glTransCacheHeader_ {
+   uint32_t magic; /**< TRANS_CACHE_MAGIC. */
+   uint32_t version; /**< TRANS_CACHE_VERSION. */
+   uint32_t w; /**< Non-padded width of the image. */
+   uint32_t h; /**< Non-padded height of the image. */
+} glTransCacheHeader;
+
+
 /*
  * Extensions.
  */
@@ -53,13 +88,17 @@ static int gl_tex_ext_npot = 0; /**< Support for GL_ARB_texture_non_power_of_two
 /* misc */
 /*static int SDL_VFlipSurface( SDL_Surface* surface );*/
 static int SDL_IsTrans( SDL_Surface* s, int x, int y );
-static uint8_t* SDL_MapTrans( SDL_Surface* s, int w, int h );
+static uint64_t* SDL_MapTrans( SDL_Surface* s, int w, int h );
 static size_t gl_transSize( const int w, const int h );
+static glTransBox* gl_transBoxes( const uint64_t *trans, int stride, int w, int h, int sx, int sy );
+static uint64_t* gl_loadTrans( SDL_Surface *surface, SDL_RWops *rw, int w, int h );
 /* glTexture */
 static GLuint gl_texParameters( unsigned int flags );
 static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned int flags, int freesur );
 static glTexture* gl_loadNewImage( const char* path, unsigned int flags );
 static glTexture* gl_loadNewImageRWops( const char *path, SDL_RWops *rw, const unsigned int flags );
+/* Prefetching. */
+static glTexture* gl_loadPrefetched( const char *path, const unsigned int flags );
 /* List. */
 static glTexture* gl_texExists( const char* path );
 static int gl_texAdd( glTexture *tex );
@@ -172,11 +211,11 @@ static int SDL_IsTrans( SDL_Surface* s, int x, int y )
  *    @param h Height to map.
  *    @return 0 on success.
  */
-static uint8_t* SDL_MapTrans( SDL_Surface* s, int w, int h )
+static uint64_t* SDL_MapTrans( SDL_Surface* s, int w, int h )
 {
-   int i,j;
+   int i,j, stride;
    size_t size;
-   uint8_t *t;
+   uint64_t *t;
 
    /* Get limit.s */
    if (w < 0)
@@ -193,15 +232,59 @@ static uint8_t* SDL_MapTrans( SDL_Surface* s, int w, int h )
    }
    memset(t, 0, size); /* important, must be set to zero */
 
-   /* Check each pixel individually. */
+   /* Check each pixel individually, every row starts on a new word. */
+   stride = (w+63) / 64;
    for (i=0; i<h; i++)
       for (j=0; j<w; j++) /* sets each bit to be 1 if not transparent or 0 if is */
-         t[(i*w+j)/8] |= (SDL_IsTrans(s,j,i)) ? 0 : (1<<((i*w+j)%8));
+         if (!SDL_IsTrans(s,j,i))
+            t[i*stride + j/64] |= UINT64_C(1) << (j%64);
 
    return t;
 }
 
 
+/**
+ * @brief Computes the tight bounding box of the opaque pixels of each sprite.
+ *
+ *    @param trans Transparency map.
+ *    @param stride Words per row of the transparency map.
+ *    @param w Width of the map.
+ *    @param h Height of the map.
+ *    @param sx X sprites.
+ *    @param sy Y sprites.
+ *    @return The bounding boxes, indexed by map row then column.
+ */
+static glTransBox* gl_transBoxes( const uint64_t *trans, int stride, int w, int h, int sx, int sy )
+{
+   int i, j, x, y, sw, sh;
+   glTransBox *boxes, *b;
+
+   boxes = malloc( sizeof(glTransBox) * sx * sy );
+   sw    = w / sx;
+   sh    = h / sy;
+   for (i=0; i<sy; i++) {
+      for (j=0; j<sx; j++) {
+         b = &boxes[ i*sx + j ];
+         b->x1 = sw;
+         b->y1 = sh;
+         b->x2 = -1;
+         b->y2 = -1;
+         for (y=0; y<sh; y++) {
+            for (x=0; x<sw; x++) {
+               if (!(trans[ (i*sh+y)*stride + (j*sw+x)/64 ] & (UINT64_C(1) << ((j*sw+x)%64))))
+                  continue;
+               b->x1 = MIN( b->x1, x );
+               b->y1 = MIN( b->y1, y );
+               b->x2 = MAX( b->x2, x );
+               b->y2 = MAX( b->y2, y );
+            }
+         }
+      }
+   }
+   return boxes;
+}
+
+
 /*
  * @brief Gets the size needed for a transparency map.
  *
@@ -211,8 +294,8 @@ static uint8_t* SDL_MapTrans( SDL_Surface* s, int w, int h )
  */
 static size_t gl_transSize( const int w, const int h )
 {
-   /* One bit per pixel, plus remainder. */
-   return w*h/8 + ((w*h%8)?1:0);
+   /* One bit per pixel, rows padded to 64-bit words. */
+   return sizeof(uint64_t) * ((w+63) / 64) * h;
 }
 
 
@@ -439,43 +522,28 @@ static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned i
 
 
 /**
- * @brief Wrapper for gl_loadImagePad that includes transparency mapping.
+ * @brief Gets the transparency map of a surface.
  *
- *    @param name Name to load with.
- *    @param surface Surface to load.
- *    @param rw RWops containing data to hash.
- *    @param flags Flags to use.
+ * Maps are cached on disk by the hash of the image file. Only touches the
+ * surface and the cache so it is safe to use from worker threads.
+ *
+ *    @param surface Surface to map.
+ *    @param rw RWops containing data to hash or NULL to not use the cache.
  *    @param w Non-padded width.
  *    @param h Non-padded height.
- *    @param sx X sprites.
- *    @param sy Y sprites.
- *    @param freesur Whether or not to free the surface.
- *    @return The glTexture for surface.
+ *    @return The transparency map.
  */
-glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWops *rw,
-      unsigned int flags, int w, int h, int sx, int sy, int freesur )
+static uint64_t* gl_loadTrans( SDL_Surface *surface, SDL_RWops *rw, int w, int h )
 {
-   glTexture *texture;
    size_t i, filesize;
    size_t cachesize, pngsize;
-   uint8_t *trans;
+   uint64_t *trans;
    char *cachefile, *data;
+   glTransCacheHeader *hdr;
    char digest[33];
    md5_state_t md5;
    md5_byte_t *md5val;
 
-   if (name != NULL) {
-      texture = gl_texExists( name );
-      if (texture != NULL) {
-         if (freesur)
-            SDL_FreeSurface( surface );
-         return texture;
-      }
-   }
-
-   if (flags & OPENGL_TEX_MAPTRANS)
-      flags ^= OPENGL_TEX_MAPTRANS;
-
    /* Appropriate size for the transparency map, see SDL_MapTrans */
    cachesize = gl_transSize(w, h);
 
@@ -504,31 +572,28 @@ glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWo
       free(md5val);
 
       cachefile = malloc( PATH_MAX );
-      nsnprintf( cachefile, PATH_MAX, "%scollisions/%s",
+      nsnprintf( cachefile, PATH_MAX, "%scollisions64/%s",
          nfile_cachePath(), digest );
 
       /* Attempt to find a cached transparency map. */
       if (nfile_fileExists(cachefile)) {
-         trans = (uint8_t*)nfile_readFile( &filesize, cachefile );
-
-         /* Consider cached data invalid if the length doesn't match. */
-         if (trans != NULL && cachesize != (unsigned int)filesize) {
-            free(trans);
-            trans = NULL;
-         }
-         /* Cached data matches, no need to overwrite. */
-         else {
+         data = nfile_readFile( &filesize, cachefile );
+         hdr  = (glTransCacheHeader*) data;
+
+         /* Consider cached data invalid if the header or length doesn't match. */
+         if ((data != NULL) && (filesize == sizeof(glTransCacheHeader) + cachesize) &&
+               (hdr->magic == TRANS_CACHE_MAGIC) &&
+               (hdr->version == TRANS_CACHE_VERSION) &&
+               (hdr->w == (uint32_t)w) && (hdr->h == (uint32_t)h)) {
+            /* Cached data matches, no need to overwrite. */
+            trans = malloc( cachesize );
+            memcpy( trans, &data[ sizeof(glTransCacheHeader) ], cachesize );
             free(cachefile);
             cachefile = NULL;
          }
+         free(data);
       }
    }
-   else {
-      /* We could hash raw pixel data here, but that's slower than just
-       * generating the map from scratch.
-       */
-      WARN(_("Texture '%s' has no RWops"), name);
-   }
 
    if (trans == NULL) {
       SDL_LockSurface(surface);
@@ -537,14 +602,98 @@ glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWo
 
       if (cachefile != NULL) {
          /* Cache newly-generated transparency map. */
-         nfile_dirMakeExist( nfile_cachePath(), "collisions/" );
-         nfile_writeFile( (char*)trans, cachesize, cachefile );
-         free(cachefile);
+         data         = malloc( sizeof(glTransCacheHeader) + cachesize );
+         hdr          = (glTransCacheHeader*) data;
+         hdr->magic   = TRANS_CACHE_MAGIC;
+         hdr->version = TRANS_CACHE_VERSION;
+         hdr->w       = w;
+         hdr->h       = h;
+         memcpy( &data[ sizeof(glTransCacheHeader) ], trans, cachesize );
+         nfile_dirMakeExist( nfile_cachePath(), "collisions64/" );
+         nfile_writeFile( data, sizeof(glTransCacheHeader) + cachesize, cachefile );
+         free(data);
+      }
+   }
+   free(cachefile);
+
+   return trans;
+}
+
+
+/**
+ * @brief Wrapper for gl_loadImagePad that includes transparency mapping.
+ *
+ *    @param name Name to load with.
+ *    @param surface Surface to load.
+ *    @param rw RWops containing data to hash.
+ *    @param flags Flags to use.
+ *    @param w Non-padded width.
+ *    @param h Non-padded height.
+ *    @param sx X sprites.
+ *    @param sy Y sprites.
+ *    @param freesur Whether or not to free the surface.
+ *    @return The glTexture for surface.
+ */
+glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWops *rw,
+      unsigned int flags, int w, int h, int sx, int sy, int freesur )
+{
+   glTexture *texture;
+
+   if (name != NULL) {
+      texture = gl_texExists( name );
+      if (texture != NULL) {
+         if (freesur)
+            SDL_FreeSurface( surface );
+         return texture;
+      }
+   }
+
+   /* We could hash raw pixel data here, but that's slower than just
+    * generating the map from scratch. */
+   if (rw == NULL)
+      WARN(_("Texture '%s' has no RWops"), name);
+
+   return gl_loadImagePadTransMap( name, surface, gl_loadTrans( surface, rw, w, h ),
+         flags, w, h, sx, sy, freesur );
+}
+
+
+/**
+ * @brief Loads a surface with an already computed transparency map.
+ *
+ *    @param name Name to load with.
+ *    @param surface Surface to load.
+ *    @param trans Transparency map, owned by the texture afterwards.
+ *    @param flags Flags to use.
+ *    @param w Non-padded width.
+ *    @param h Non-padded height.
+ *    @param sx X sprites.
+ *    @param sy Y sprites.
+ *    @param freesur Whether or not to free the surface.
+ *    @return The glTexture for surface.
+ */
+glTexture* gl_loadImagePadTransMap( const char *name, SDL_Surface* surface, uint64_t *trans,
+      unsigned int flags, int w, int h, int sx, int sy, int freesur )
+{
+   glTexture *texture;
+
+   if (name != NULL) {
+      texture = gl_texExists( name );
+      if (texture != NULL) {
+         free( trans );
+         if (freesur)
+            SDL_FreeSurface( surface );
+         return texture;
       }
    }
 
+   if (flags & OPENGL_TEX_MAPTRANS)
+      flags ^= OPENGL_TEX_MAPTRANS;
+
    texture = gl_loadImagePad( name, surface, flags, w, h, sx, sy, freesur );
-   texture->trans = trans;
+   texture->trans        = trans;
+   texture->trans_stride = (w+63) / 64;
+   texture->trans_box    = gl_transBoxes( trans, texture->trans_stride, w, h, sx, sy );
    return texture;
 }
 
@@ -740,6 +889,11 @@ static glTexture* gl_loadNewImage( const char* path, const unsigned int flags )
       return NULL;
    }
 
+   /* Already decoded by a worker. */
+   texture = gl_loadPrefetched( path, flags );
+   if (texture != NULL)
+      return texture;
+
    /* Load from packfile */
    rw = PHYSFSRWOPS_openRead( path );
    if (rw == NULL) {
@@ -798,6 +952,167 @@ static glTexture* gl_loadNewImageRWops( const char *path, SDL_RWops *rw, const u
 }
 
 
+/**
+ * @brief Decodes an image ahead of time so loading it later only uploads it.
+ *
+ * Meant to be run from worker threads while loading data. The decoded image
+ * is picked up by gl_newImage and friends, or by gl_texPrefetchTake.
+ *
+ *    @param path Path of the image to decode.
+ *    @param flags Flags the image will be loaded with.
+ *    @return 0 on success.
+ */
+int gl_texPrefetch( const char *path, const unsigned int flags )
+{
+   glTexPrefetch *pf;
+   SDL_RWops *rw;
+   npng_t *npng;
+   png_uint_32 w, h;
+   SDL_Surface *surface;
+   uint64_t *trans;
+   int i;
+
+   /* Images shared by many files only need to be decoded once, so the entry
+    * is reserved before decoding to keep other jobs from doing it too. */
+   SDL_mutexP( gl_prefetchLock );
+   for (i=0; i<array_size(gl_prefetch); i++) {
+      if (strcmp( gl_prefetch[i]->path, path ) == 0) {
+         SDL_mutexV( gl_prefetchLock );
+         return 0;
+      }
+   }
+   pf = calloc( 1, sizeof(glTexPrefetch) );
+   pf->path = strdup( path );
+   if (gl_prefetch == NULL)
+      gl_prefetch = array_create( glTexPrefetch* );
+   array_push_back( &gl_prefetch, pf );
+   SDL_mutexV( gl_prefetchLock );
+
+   /* Errors are left for the actual load to report. */
+   surface = NULL;
+   trans   = NULL;
+   rw = PHYSFSRWOPS_openRead( path );
+   if (rw != NULL) {
+      npng = npng_open( rw );
+      if (npng != NULL) {
+         npng_dim( npng, &w, &h );
+         surface = npng_readSurface( npng, gl_needPOT(), 1 );
+         npng_close( npng );
+      }
+      if ((surface != NULL) && (flags & OPENGL_TEX_MAPTRANS))
+         trans = gl_loadTrans( surface, rw, w, h );
+      SDL_RWclose( rw );
+   }
+
+   SDL_mutexP( gl_prefetchLock );
+   if (surface == NULL) {
+      /* Release the reservation. */
+      for (i=0; i<array_size(gl_prefetch); i++) {
+         if (gl_prefetch[i] == pf) {
+            array_erase( &gl_prefetch, &gl_prefetch[i], &gl_prefetch[i+1] );
+            break;
+         }
+      }
+      free( pf->path );
+      free( pf );
+   }
+   else {
+      pf->surface = surface;
+      pf->trans   = trans;
+      pf->w       = w;
+      pf->h       = h;
+   }
+   SDL_mutexV( gl_prefetchLock );
+   return (surface == NULL) ? -1 : 0;
+}
+
+
+/**
+ * @brief Takes a prefetched image.
+ *
+ *    @param path Path of the image.
+ *    @param[out] trans Transparency map, NULL if it wasn't requested.
+ *    @param[out] w Non-padded width.
+ *    @param[out] h Non-padded height.
+ *    @return The decoded surface, owned by the caller, or NULL if the image
+ *            was not prefetched.
+ */
+SDL_Surface* gl_texPrefetchTake( const char *path, uint64_t **trans, int *w, int *h )
+{
+   int i;
+   glTexPrefetch *pf;
+   SDL_Surface *surface;
+
+   surface = NULL;
+   SDL_mutexP( gl_prefetchLock );
+   for (i=0; i<array_size(gl_prefetch); i++) {
+      pf = gl_prefetch[i];
+      if ((pf->surface == NULL) || (strcmp( pf->path, path ) != 0))
+         continue;
+      surface = pf->surface;
+      *trans  = pf->trans;
+      *w      = pf->w;
+      *h      = pf->h;
+      free( pf->path );
+      free( pf );
+      array_erase( &gl_prefetch, &gl_prefetch[i], &gl_prefetch[i+1] );
+      break;
+   }
+   SDL_mutexV( gl_prefetchLock );
+   return surface;
+}
+
+
+/**
+ * @brief Frees the prefetched images that were never loaded.
+ */
+void gl_texPrefetchFree (void)
+{
+   int i;
+
+   SDL_mutexP( gl_prefetchLock );
+   for (i=0; i<array_size(gl_prefetch); i++) {
+      SDL_FreeSurface( gl_prefetch[i]->surface );
+      free( gl_prefetch[i]->trans );
+      free( gl_prefetch[i]->path );
+      free( gl_prefetch[i] );
+   }
+   array_free( gl_prefetch );
+   gl_prefetch = NULL;
+   SDL_mutexV( gl_prefetchLock );
+}
+
+
+/**
+ * @brief Uploads a prefetched image.
+ *
+ *    @param path Path of the image.
+ *    @param flags Flags to control image parameters.
+ *    @return The texture or NULL if the image was not prefetched.
+ */
+static glTexture* gl_loadPrefetched( const char *path, const unsigned int flags )
+{
+   SDL_Surface *surface;
+   uint64_t *trans;
+   int w, h;
+
+   surface = gl_texPrefetchTake( path, &trans, &w, &h );
+   if (surface == NULL)
+      return NULL;
+
+   /* Prefetched without the map, can't use the cache anymore. */
+   if ((flags & OPENGL_TEX_MAPTRANS) && (trans == NULL))
+      trans = gl_loadTrans( surface, NULL, w, h );
+
+   if (trans != NULL) {
+      if (flags & OPENGL_TEX_MAPTRANS)
+         return gl_loadImagePadTransMap( path, surface, trans, flags, w, h, 1, 1, 1 );
+      free( trans );
+   }
+   return gl_loadImagePad( path, surface, flags, w, h, 1, 1, 1 );
+}
+
+
 /**
  * @brief Loads the texture immediately, but also sets it as a sprite.
  *
@@ -823,6 +1138,13 @@ glTexture* gl_newSprite( const char* path, const int sx, const int sy,
    texture->sh    = texture->h / texture->sy;
    texture->srw   = texture->sw / texture->rw;
    texture->srh   = texture->sh / texture->rh;
+
+   /* Boxes were computed for the image as a single sprite. */
+   if (texture->trans != NULL) {
+      free( texture->trans_box );
+      texture->trans_box = gl_transBoxes( texture->trans, texture->trans_stride,
+            (int)texture->w, (int)texture->h, sx, sy );
+   }
    return texture;
 }
 
@@ -853,6 +1175,13 @@ glTexture* gl_newSpriteRWops( const char* path, SDL_RWops *rw,
    texture->sh    = texture->h / texture->sy;
    texture->srw   = texture->sw / texture->rw;
    texture->srh   = texture->sh / texture->rh;
+
+   /* Boxes were computed for the image as a single sprite. */
+   if (texture->trans != NULL) {
+      free( texture->trans_box );
+      texture->trans_box = gl_transBoxes( texture->trans, texture->trans_stride,
+            (int)texture->w, (int)texture->h, sx, sy );
+   }
    return texture;
 }
 
@@ -878,6 +1207,7 @@ void gl_freeTexture( glTexture* texture )
             /* free the texture */
             glDeleteTextures( 1, &texture->texture );
             free(texture->trans);
+            free(texture->trans_box);
             free(texture->name);
             free(texture);
 
@@ -904,6 +1234,7 @@ void gl_freeTexture( glTexture* texture )
    /* Free anyways */
    glDeleteTextures( 1, &texture->texture );
    free(texture->trans);
+   free(texture->trans_box);
    free(texture->name);
    free(texture);
 
@@ -951,12 +1282,24 @@ glTexture* gl_dupTexture( glTexture *texture )
  */
 int gl_isTrans( const glTexture* t, const int x, const int y )
 {
-   int i;
+   /* Rows are aligned to words, pull out the individual bit. */
+   return !(t->trans[ y*t->trans_stride + x/64 ] & (UINT64_C(1) << (x%64)));
+}
+
 
-   /* Get the position in the sheet. */
-   i = y*(int)(t->w) + x ;
-   /* Now we have to pull out the individual bit. */
-   return !(t->trans[ i/8 ] & (1 << (i%8)));
+/**
+ * @brief Gets the tight bounding box of the opaque pixels of a sprite.
+ *
+ *    @param t Texture to get bounding box of.
+ *    @param sx X position of the sprite.
+ *    @param sy Y position of the sprite.
+ *    @return The bounding box relative to the sprite in the transparency map.
+ */
+const glTransBox* gl_transBox( const glTexture* t, const int sx, const int sy )
+{
+   assert( (sx >= 0) && (sx < (int)t->sx) && (sy >= 0) && (sy < (int)t->sy) );
+   /* Sprites are flipped vertically in the map. */
+   return &t->trans_box[ ((int)t->sy - sy - 1)*(int)t->sx + sx ];
 }
 
 
@@ -1048,6 +1391,8 @@ int gl_initTextures (void)
    if (gl_hasVersion(2,0))
       gl_tex_ext_npot = 1;
 
+   gl_prefetchLock = SDL_CreateMutex();
+
    return 0;
 }
 
@@ -1059,6 +1404,10 @@ void gl_exitTextures (void)
 {
    glTexList *tex;
 
+   gl_texPrefetchFree();
+   SDL_DestroyMutex( gl_prefetchLock );
+   gl_prefetchLock = NULL;
+
    /* Make sure there's no texture leak */
    if (texture_list != NULL) {
       DEBUG(_("Texture leak detected!"));
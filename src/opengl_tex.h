@@ -38,6 +38,22 @@
 #define OPENGL_TEX_MAPTRANS   (1<<0) /**< Create a transparency map. */
 #define OPENGL_TEX_MIPMAPS    (1<<1) /**< Creates mipmaps. */
 
+#define OPENGL_TEX_PREFETCH_BATCH 64 /**< Files to prefetch before uploading, bounds memory use. */
+
+/**
+ * @brief Tight bounding box of the opaque pixels of a sprite.
+ *
+ * Coordinates are relative to the sprite in the transparency map. Empty
+ *  sprites have x1 > x2.
+ */
+typedef struct glTransBox_ {
+   int x1; /**< Left-most opaque column. */
+   int y1; /**< First opaque row. */
+   int x2; /**< Right-most opaque column. */
+   int y2; /**< Last opaque row. */
+} glTransBox;
+
+
 /**
  * @brief Abstraction for rendering sprite sheets.
  *
@@ -62,7 +78,9 @@ typedef struct glTexture_ {
 
    /* data */
    GLuint texture; /**< the opengl texture itself */
-   uint8_t* trans; /**< maps the transparency */
+   uint64_t* trans; /**< Transparency map, one bit per opaque pixel in rows of trans_stride words. */
+   int trans_stride; /**< Number of 64-bit words per row of the transparency map. */
+   glTransBox* trans_box; /**< Tight bounding box of each sprite, indexed by map row then column. */
 
    /* properties */
    uint8_t flags; /**< flags used for texture properties */
@@ -90,6 +108,8 @@ glTexture* gl_loadImagePad( const char *name, SDL_Surface* surface,
       unsigned int flags, int w, int h, int sx, int sy, int freesur );
 glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWops *rw,
       unsigned int flags, int w, int h, int sx, int sy, int freesur );
+glTexture* gl_loadImagePadTransMap( const char *name, SDL_Surface* surface, uint64_t *trans,
+      unsigned int flags, int w, int h, int sx, int sy, int freesur );
 glTexture* gl_loadImage( SDL_Surface* surface, const unsigned int flags ); /* Frees the surface. */
 glTexture* gl_newImage( const char* path, const unsigned int flags );
 glTexture* gl_newImageRWops( const char* path, SDL_RWops *rw, const unsigned int flags ); /* Does not close the RWops. */
@@ -99,6 +119,13 @@ glTexture* gl_newSpriteRWops( const char* path, SDL_RWops *rw,
    const int sx, const int sy, const unsigned int flags );
 glTexture* gl_dupTexture( glTexture *texture );
 
+/*
+ * Prefetching, decoding can be done from worker threads.
+ */
+int gl_texPrefetch( const char *path, const unsigned int flags );
+SDL_Surface* gl_texPrefetchTake( const char *path, uint64_t **trans, int *w, int *h );
+void gl_texPrefetchFree (void);
+
 /*
  * Clean up.
  */
@@ -114,6 +141,7 @@ int gl_texHasCompress (void);
  * Misc.
  */
 int gl_isTrans( const glTexture* t, const int x, const int y );
+const glTransBox* gl_transBox( const glTexture* t, const int sx, const int sy );
 void gl_getSpriteFromDir( int* x, int* y, const glTexture* t, const double dir );
 int gl_needPOT (void);
 glTexture** gl_copyTexArray( glTexture **tex, int texn, int *n );
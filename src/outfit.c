@@ -38,6 +38,8 @@
 #include "ship.h"
 #include "slots.h"
 #include "spfx.h"
+#include "strhash.h"
+#include "threadpool.h"
 #include "unistd.h"
 
 
@@ -54,6 +56,15 @@
 static Outfit* outfit_stack = NULL; /**< Stack of outfits. */
 
 
+/**
+ * @brief Outfit file being loaded by a worker thread.
+ */
+typedef struct OutfitLoadJob_ {
+   char *file; /**< Path of the outfit file. */
+   xmlDocPtr doc; /**< Parsed document, NULL on failure. */
+} OutfitLoadJob;
+
+
 /*
  * Prototypes
  */
@@ -64,7 +75,8 @@ static void outfit_launcherDesc( Outfit* o );
 /* parsing */
 static int outfit_loadDir( char *dir );
 static int outfit_parseDamage( Damage *dmg, xmlNodePtr node );
-static int outfit_parse( Outfit* temp, const char* file );
+static int outfit_parse( Outfit* temp, xmlDocPtr doc );
+static int outfit_loadJob( void *data );
 static void outfit_parseSBolt( Outfit* temp, const xmlNodePtr parent );
 static void outfit_parseSBeam( Outfit* temp, const xmlNodePtr parent );
 static void outfit_parseSLauncher( Outfit* temp, const xmlNodePtr parent );
@@ -90,9 +102,9 @@ Outfit* outfit_get( const char* name )
 {
    int i;
 
-   for (i=0; i<array_size(outfit_stack); i++)
-      if (strcmp(name,outfit_stack[i].name)==0)
-         return &outfit_stack[i];
+   i = strhash_get( STRHASH_OUTFIT, name );
+   if (i >= 0)
+      return &outfit_stack[i];
 
    WARN(_("Outfit '%s' not found in stack."), name);
    return NULL;
@@ -108,9 +120,9 @@ Outfit* outfit_get( const char* name )
 Outfit* outfit_getW( const char* name )
 {
    int i;
-   for (i=0; i<array_size(outfit_stack); i++)
-      if (strcmp(name,outfit_stack[i].name)==0)
-         return &outfit_stack[i];
+   i = strhash_get( STRHASH_OUTFIT, name );
+   if (i >= 0)
+      return &outfit_stack[i];
    return NULL;
 }
 
@@ -1042,9 +1054,6 @@ static int outfit_loadPLG( Outfit *temp, char *buf, unsigned int bolt )
 {
    char *file;
    int sl;
-   CollPoly *polygon;
-   xmlDocPtr doc;
-   xmlNodePtr node, cur;
 
    if (bolt)
       temp->u.blt.npolygon = 0;
@@ -1065,58 +1074,12 @@ that can be found in Naev's artwork repo."), file);
       return 0;
    }
 
-   /* Load the XML. */
-   doc  = xml_parsePhysFS( file );
-
-   if (doc == NULL) {
-      free(file);
-      return 0;
-   }
-
-   node = doc->xmlChildrenNode; /* First polygon node */
-   if (node == NULL) {
-      xmlFreeDoc(doc);
-      WARN(_("Malformed %s file: does not contain elements"), file);
-      free(file);
-      return 0;
-   }
-
+   /* Load the polygons, cached after the first time. */
+   if (bolt)
+      LoadPolygonFile( &temp->u.blt.polygon, &temp->u.blt.npolygon, file );
+   else /* Second case: outfit is an ammo */
+      LoadPolygonFile( &temp->u.amm.polygon, &temp->u.amm.npolygon, file );
    free(file);
-
-   if (bolt) {
-      do { /* load the polygon data */
-         if (xml_isNode(node,"polygons")) {
-            cur = node->children;
-            temp->u.blt.polygon = malloc( sizeof(CollPoly) );
-            do {
-               if (xml_isNode(cur,"polygon")) {
-                  temp->u.blt.npolygon++;
-                  temp->u.blt.polygon = realloc( temp->u.blt.polygon, sizeof(CollPoly) * temp->u.blt.npolygon );
-                  polygon = &temp->u.blt.polygon[temp->u.blt.npolygon-1];
-                  LoadPolygon( polygon, cur );
-               }
-            } while (xml_nextNode(cur));
-         }
-      } while (xml_nextNode(node));
-   }
-   else {
-      do { /* Second case: outfit is an ammo */
-         if (xml_isNode(node,"polygons")) {
-            cur = node->children;
-            temp->u.amm.polygon = malloc( sizeof(CollPoly) );
-            do {
-               if (xml_isNode(cur,"polygon")) {
-                  temp->u.amm.npolygon++;
-                  temp->u.amm.polygon = realloc( temp->u.amm.polygon, sizeof(CollPoly) * temp->u.amm.npolygon );
-                  polygon = &temp->u.amm.polygon[temp->u.amm.npolygon-1];
-                  LoadPolygon( polygon, cur );
-               }
-            } while (xml_nextNode(cur));
-         }
-      } while (xml_nextNode(node));
-   }
-
-   xmlFreeDoc(doc);
    return 0;
 }
 
@@ -2096,10 +2059,10 @@ if (o) WARN(_("Outfit '%s' missing/invalid '%s' element"), temp->name, s)
  * @brief Parses and returns Outfit from parent node.
 
  *    @param temp Outfit to load into.
- *    @param file Path to the XML file (relative to base directory).
+ *    @param doc Parsed XML file, freed when done.
  *    @return 0 on success.
  */
-static int outfit_parse( Outfit* temp, const char* file )
+static int outfit_parse( Outfit* temp, xmlDocPtr doc )
 {
    xmlNodePtr cur, ccur, node, parent;
    char *prop, *desc_extra;
@@ -2107,7 +2070,6 @@ static int outfit_parse( Outfit* temp, const char* file )
    int group, m, l;
    ShipStatList *ll;
 
-   xmlDocPtr doc = xml_parsePhysFS( file );
    if (doc == NULL)
       return -1;
 
@@ -2323,19 +2285,42 @@ if (o) WARN( _("Outfit '%s' missing/invalid '%s' element"), temp->name, s) /**<
  */
 static int outfit_loadDir( char *dir )
 {
-   int i, n, ret;
+   int i, n, ret, start, end;
    char **outfit_files;
+   OutfitLoadJob *jobs;
+   ThreadQueue *q;
 
    outfit_files = ndata_listRecursive( dir );
-   for ( i = 0; i < array_size( outfit_files ); i++ ) {
-      ret = outfit_parse( &array_grow(&outfit_stack), outfit_files[i] );
-      if (ret < 0) {
-         n = array_size(outfit_stack);
-         array_erase( &outfit_stack, &outfit_stack[n-1], &outfit_stack[n] );
+
+   jobs = calloc( array_size( outfit_files ), sizeof(OutfitLoadJob) );
+
+   /* Work in batches so only a batch worth of decoded sprites is in memory. */
+   for ( start = 0; start < array_size( outfit_files ); start += OPENGL_TEX_PREFETCH_BATCH ) {
+      end = MIN( start + OPENGL_TEX_PREFETCH_BATCH, array_size( outfit_files ) );
+
+      /* Read, parse and decode the graphics on the threadpool. */
+      q = vpool_create();
+      for ( i = start; i < end; i++ ) {
+         jobs[i].file = outfit_files[i];
+         vpool_enqueue( q, outfit_loadJob, &jobs[i] );
+      }
+      vpool_wait( q );
+
+      /* Parse the outfits in order, only the uploads to OpenGL are left. */
+      for ( i = start; i < end; i++ ) {
+         ret = outfit_parse( &array_grow(&outfit_stack), jobs[i].doc );
+         if (ret < 0) {
+            n = array_size(outfit_stack);
+            array_erase( &outfit_stack, &outfit_stack[n-1], &outfit_stack[n] );
+         }
+         free( outfit_files[i] );
       }
-      free( outfit_files[i] );
+
+      /* Drop images that were decoded but already loaded. */
+      gl_texPrefetchFree();
    }
    array_free( outfit_files );
+   free( jobs );
 
    /* Reduce size. */
    array_shrink( &outfit_stack );
@@ -2343,6 +2328,77 @@ static int outfit_loadDir( char *dir )
    return 0;
 }
 
+/**
+ * @brief Reads an outfit file and decodes its graphics, run on the threadpool.
+ *
+ * Must not touch OpenGL, the textures are uploaded by outfit_parse.
+ *
+ *    @param data OutfitLoadJob to process.
+ *    @return 0 on success.
+ */
+static int outfit_loadJob( void *data )
+{
+   OutfitLoadJob *job;
+   xmlNodePtr node, cur, ccur;
+   char *prop, str[PATH_MAX];
+   unsigned int flags;
+   OutfitType type;
+
+   job      = (OutfitLoadJob*) data;
+   job->doc = xml_parsePhysFS( job->file );
+   if ((job->doc == NULL) || (job->doc->xmlChildrenNode == NULL))
+      return -1;
+
+   /* Decode the graphics the same way outfit_parse will look them up. */
+   node = job->doc->xmlChildrenNode->xmlChildrenNode;
+   if (node == NULL)
+      return 0;
+   do {
+      xml_onlyNodes(node);
+      if (xml_isNode(node,"general")) {
+         cur = node->children;
+         do {
+            xml_onlyNodes(cur);
+            if (xml_isNode(cur,"gfx_store") && (xml_get(cur) != NULL)) {
+               nsnprintf( str, PATH_MAX, OUTFIT_GFX_PATH"store/%s.png", xml_get(cur) );
+               gl_texPrefetch( str, OPENGL_TEX_MIPMAPS );
+            }
+            else if (xml_isNode(cur,"gfx_overlays")) {
+               ccur = cur->children;
+               do {
+                  xml_onlyNodes(ccur);
+                  if (xml_isNode(ccur,"gfx_overlay") && (xml_get(ccur) != NULL)) {
+                     nsnprintf( str, PATH_MAX, OVERLAY_GFX_PATH"%s.png", xml_get(ccur) );
+                     gl_texPrefetch( str, OPENGL_TEX_MIPMAPS );
+                  }
+               } while (xml_nextNode(ccur));
+            }
+         } while (xml_nextNode(cur));
+      }
+      else if (xml_isNode(node,"specific")) {
+         xmlr_attr_strd(node, "type", prop);
+         type = (prop != NULL) ? outfit_strToOutfitType(prop) : OUTFIT_TYPE_NULL;
+         free(prop);
+         /* Beams don't use transparency maps. */
+         flags = OPENGL_TEX_MIPMAPS;
+         if ((type != OUTFIT_TYPE_BEAM) && (type != OUTFIT_TYPE_TURRET_BEAM))
+            flags |= OPENGL_TEX_MAPTRANS;
+         cur = node->children;
+         do {
+            xml_onlyNodes(cur);
+            if ((xml_isNode(cur,"gfx") || xml_isNode(cur,"gfx_end")) &&
+                  (xml_get(cur) != NULL)) {
+               nsnprintf( str, PATH_MAX, OUTFIT_GFX_PATH"space/%s.png", xml_get(cur) );
+               gl_texPrefetch( str, flags );
+            }
+         } while (xml_nextNode(cur));
+      }
+   } while (xml_nextNode(node));
+
+   return 0;
+}
+
+
 /**
  * @brief Loads all the outfits.
  *
@@ -2359,6 +2415,10 @@ int outfit_load (void)
    array_shrink(&outfit_stack);
    noutfits = array_size(outfit_stack);
 
+   /* Index names. */
+   for (i=0; i<noutfits; i++)
+      strhash_set( STRHASH_OUTFIT, outfit_stack[i].name, i );
+
    /* Second pass, sets up ammunition relationships. */
    for (i=0; i<noutfits; i++) {
       o = &outfit_stack[i];
@@ -2613,5 +2673,6 @@ void outfit_free (void)
    }
 
    array_free(outfit_stack);
+   strhash_clear( STRHASH_OUTFIT );
 }
 
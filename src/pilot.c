@@ -24,6 +24,7 @@
 #include "array.h"
 #include "board.h"
 #include "camera.h"
+#include "cond.h"
 #include "damagetype.h"
 #include "debris.h"
 #include "escort.h"
@@ -80,7 +81,6 @@ static void pilot_refuel( Pilot *p, double dt );
 /* Clean up. */
 static void pilot_dead( Pilot* p, unsigned int killer );
 /* Targeting. */
-static int pilot_validEnemy( const Pilot* p, const Pilot* target );
 /* Misc. */
 static void pilot_setCommMsg( Pilot *p, const char *s );
 static int pilot_getStackPos( const unsigned int id );
@@ -260,7 +260,7 @@ int pilot_validTarget( const Pilot* p, const Pilot* target )
  *    @param target Pilot to see if is a valid enemy of the reference.
  *    @return 1 if it is valid, 0 otherwise.
  */
-static int pilot_validEnemy( const Pilot* p, const Pilot* target )
+int pilot_validEnemy( const Pilot* p, const Pilot* target )
 {
    /* Should either be hostile by faction or by player. */
    if ( !( areEnemies( p->faction, target->faction )
@@ -2517,6 +2517,9 @@ int pilot_hasCredits( Pilot *p, credits_t amount )
  */
 credits_t pilot_modCredits( Pilot *p, credits_t amount )
 {
+   if (p == player.p)
+      cond_invalidate();
+
    if (amount > 0) {
       if (CREDITS_MAX - p->credits <= amount)
          p->credits = CREDITS_MAX;
@@ -3114,15 +3117,21 @@ void pilots_cleanAll (void)
 
 
 /**
- * @brief Updates all the pilots.
+ * @brief Runs the AI of all the pilots.
+ *
+ * Also cleans up the pilots marked for deletion, so it has to be run before
+ *  pilots_update.
  *
  *    @param dt Delta tick for the update.
  */
-void pilots_update( double dt )
+void pilots_think( double dt )
 {
    int i;
    Pilot *p;
 
+   /* Precompute what the AI will need. */
+   ai_thinkBegin();
+
    /* Now update all the pilots. */
    for (i=0; i<pilot_nstack; i++) {
       p = pilot_stack[i];
@@ -3162,6 +3171,19 @@ void pilots_update( double dt )
             !pilot_isFlag(p, PILOT_TAKEOFF))
          p->think(p, dt);
    }
+   ai_thinkEnd();
+}
+
+
+/**
+ * @brief Updates all the pilots.
+ *
+ *    @param dt Delta tick for the update.
+ */
+void pilots_update( double dt )
+{
+   int i;
+   Pilot *p;
 
    /* Now update all the pilots. */
    for (i=0; i<pilot_nstack; i++) {
@@ -3190,6 +3212,9 @@ void pilots_update( double dt )
 void pilots_render( double dt )
 {
    int i;
+
+   /* Ships only blit sprites so they can all be batched. */
+   gl_batchStart();
    for (i=0; i<pilot_nstack; i++) {
 
       /* Invisible, not doing anything. */
@@ -3199,6 +3224,7 @@ void pilots_render( double dt )
       if (pilot_stack[i]->render != NULL) /* render */
          pilot_stack[i]->render(pilot_stack[i], dt);
    }
+   gl_batchEnd();
 }
 
 
@@ -347,6 +347,9 @@ typedef struct Pilot_ {
    double timer[MAX_AI_TIMERS]; /**< timers for AI */
    Task* task;       /**< current action */
    unsigned int shoot_indicator; /**< Indicator to inform the AI if a seeker has been shot recently. */
+   int ai_cached;    /**< Whether the values below were precomputed for this think phase. */
+   unsigned int ai_enemy; /**< Precomputed nearest enemy. */
+   int ai_inrange;   /**< Precomputed sensor range check of the current target. */
 
    /* Misc */
    double comm_msgTimer; /**< Message timer for the comm. */
@@ -398,6 +401,7 @@ double pilot_getNearestAng( const Pilot *p, unsigned int *tp, double ang, int di
 int pilot_getJumps( const Pilot* p );
 const glColour* pilot_getColour( const Pilot* p );
 int pilot_validTarget( const Pilot* p, const Pilot* target );
+int pilot_validEnemy( const Pilot* p, const Pilot* target );
 
 /* non-lua wrappers */
 double pilot_relsize( const Pilot* cur_pilot, const Pilot* p );
@@ -475,6 +479,7 @@ void pilot_setTurn( Pilot *p, double turn );
  * update
  */
 void pilot_update( Pilot* pilot, const double dt );
+void pilots_think( double dt );
 void pilots_update( double dt );
 void pilots_render( double dt );
 void pilots_renderOverlay( double dt );
@@ -21,6 +21,7 @@
 #include "camera.h"
 #include "claim.h"
 #include "comm.h"
+#include "cond.h"
 #include "conf.h"
 #include "dialogue.h"
 #include "economy.h"
@@ -408,6 +409,9 @@ Pilot* player_newShip( Ship* ship, const char *def_name,
    int i, len, w;
    Pilot *new_ship;
 
+   /* Conditionals may depend on this. */
+   cond_invalidate();
+
    /* temporary values while player doesn't exist */
    player_creds = (player.p != NULL) ? player.p->credits : 0;
    player_ship    = ship;
@@ -539,6 +543,9 @@ void player_swapShip( const char *shipname )
    Vector2d v;
    double dir;
 
+   /* Conditionals may depend on this. */
+   cond_invalidate();
+
    for (i=0; i<array_size(player_stack); i++) {
       if (strcmp(shipname,player_stack[i].p->name)!=0)
          continue;
@@ -637,6 +644,9 @@ void player_rmShip( const char *shipname )
 {
    int i, w;
 
+   /* Conditionals may depend on this. */
+   cond_invalidate();
+
    for (i=0; i<array_size(player_stack); i++) {
       /* Not the ship we are looking for. */
       if (strcmp(shipname,player_stack[i].p->name)!=0)
@@ -2631,6 +2641,9 @@ int player_addOutfit( const Outfit *o, int quantity )
    if (quantity == 0)
       return 0;
 
+   /* Conditionals may depend on this. */
+   cond_invalidate();
+
    /* Don't readd uniques. */
    if (outfit_isProp(o,OUTFIT_PROP_UNIQUE) && (player_outfitOwned(o)>0))
       return 0;
@@ -2692,6 +2705,9 @@ int player_rmOutfit( const Outfit *o, int quantity )
 {
    int i, q;
 
+   /* Conditionals may depend on this. */
+   cond_invalidate();
+
    /* Try to find it. */
    for (i=0; i<player_noutfits; i++) {
       if (player_outfits[i].o == o) {
@@ -2727,6 +2743,8 @@ void player_missionFinished( int id )
    if (player_missionAlreadyDone(id))
       return;
 
+   cond_invalidate();
+
    /* Mark as done. */
    missions_ndone++;
    if (missions_ndone > missions_mdone) { /* need to grow */
@@ -2764,6 +2782,8 @@ void player_eventFinished( int id )
    if (player_eventAlreadyDone(id))
       return;
 
+   cond_invalidate();
+
    /* Add to done. */
    events_ndone++;
    if (events_ndone > events_mdone) { /* need to grow */
@@ -2821,6 +2841,8 @@ void player_addLicense( char *license )
    if (player_hasLicense(license))
       return;
 
+   cond_invalidate();
+
    /* Add the license. */
    player_nlicenses++;
    player_licenses = realloc( player_licenses, sizeof(char*)*player_nlicenses );
@@ -0,0 +1,382 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file profile.c
+ *
+ * @brief Lightweight per-subsystem frame profiler.
+ *
+ * The time spent in each section is accumulated every frame into a ring
+ * buffer of the last frames. It can be shown as a stacked bar graph next to
+ * the FPS counter or dumped as percentiles to a CSV file, which helps find
+ * out which subsystem is responsible for frame drops. Quantities such as draw
+ * calls are counted per frame alongside.
+ */
+
+/** @cond */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+
+#include "naev.h"
+/** @endcond */
+
+#include "profile.h"
+
+#include "colour.h"
+#include "font.h"
+#include "log.h"
+#include "nstring.h"
+#include "opengl.h"
+
+
+#define PROFILE_FRAMES     128 /**< Number of frames kept in the ring buffer. */
+#define PROFILE_BAR_W      2. /**< Width of the bar of a frame. */
+#define PROFILE_BAR_SCALE  3. /**< Height of a millisecond in the graph. */
+#define PROFILE_BUDGET     (1000./60.) /**< Frame budget marked in the graph, in milliseconds. */
+
+
+static const char *profile_names[PROFILE_NSECTIONS] = {
+   N_("Space"), N_("Weapons"), N_("Effects"), N_("AI"),
+   N_("Pilots"), N_("Hooks"), N_("Render"), N_("Toolkit")
+}; /**< Names of the sections. */
+static const glColour *profile_colours[PROFILE_NSECTIONS] = {
+   &cPurple, &cRed, &cOrange, &cYellow,
+   &cGreen, &cCyan, &cBlue, &cGrey70
+}; /**< Colours of the sections in the graph. */
+static const char *profile_countNames[PROFILE_NCOUNTERS] = {
+   N_("Sprites"), N_("Draws")
+}; /**< Names of the counters. */
+
+static Uint64 profile_start[PROFILE_NSECTIONS]; /**< When each section was entered. */
+static Uint64 profile_totals[PROFILE_NSECTIONS]; /**< Accumulated time since last reset. */
+static float profile_samples[PROFILE_FRAMES][PROFILE_NSECTIONS]; /**< Per frame samples in milliseconds. */
+static double profile_countTotals[PROFILE_NCOUNTERS]; /**< Accumulated counts since last reset. */
+static float profile_counts[PROFILE_FRAMES][PROFILE_NCOUNTERS]; /**< Per frame counts. */
+static int profile_cur     = 0; /**< Current frame in the ring buffer. */
+static int profile_nframes = 0; /**< Number of frames in the ring buffer. */
+static int profile_shown   = 0; /**< Whether or not to render the graph. */
+
+
+/* Prototypes. */
+static int profile_cmpFloat( const void *p1, const void *p2 );
+static double profile_percentile( const float *sorted, int n, double p );
+static int profile_writeRow( SDL_RWops *rw, const char *name, float *sorted, int n, double sum );
+
+
+/**
+ * @brief Starts timing a section.
+ *
+ *    @param s Section to time.
+ */
+void profile_begin( ProfileSection s )
+{
+   profile_start[s] = SDL_GetPerformanceCounter();
+}
+
+
+/**
+ * @brief Stops timing a section, adding the elapsed time to the frame.
+ *
+ *    @param s Section to stop timing.
+ */
+void profile_end( ProfileSection s )
+{
+   Uint64 dt;
+
+   dt = SDL_GetPerformanceCounter() - profile_start[s];
+   profile_totals[s] += dt;
+   profile_samples[profile_cur][s] += 1000. * (double)dt / (double)SDL_GetPerformanceFrequency();
+}
+
+
+/**
+ * @brief Marks the start of a new frame.
+ */
+void profile_frame (void)
+{
+   int i;
+
+   profile_cur = (profile_cur+1) % PROFILE_FRAMES;
+   profile_nframes = MIN( profile_nframes+1, PROFILE_FRAMES );
+   for (i=0; i<PROFILE_NSECTIONS; i++)
+      profile_samples[profile_cur][i] = 0.;
+   for (i=0; i<PROFILE_NCOUNTERS; i++)
+      profile_counts[profile_cur][i] = 0.;
+}
+
+
+/**
+ * @brief Clears all the samples and accumulated times.
+ */
+void profile_reset (void)
+{
+   memset( profile_totals, 0, sizeof(profile_totals) );
+   memset( profile_samples, 0, sizeof(profile_samples) );
+   memset( profile_countTotals, 0, sizeof(profile_countTotals) );
+   memset( profile_counts, 0, sizeof(profile_counts) );
+   profile_cur     = 0;
+   profile_nframes = 0;
+}
+
+
+/**
+ * @brief Gets the time accumulated in a section since the last reset.
+ *
+ *    @param s Section to get time of.
+ *    @return Time spent in the section in milliseconds.
+ */
+double profile_total( ProfileSection s )
+{
+   return 1000. * (double)profile_totals[s] / (double)SDL_GetPerformanceFrequency();
+}
+
+
+/**
+ * @brief Gets the translated name of a section.
+ *
+ *    @param s Section to get name of.
+ *    @return Name of the section.
+ */
+const char *profile_name( ProfileSection s )
+{
+   return _(profile_names[s]);
+}
+
+
+/**
+ * @brief Adds to a counter of the current frame.
+ *
+ *    @param c Counter to add to.
+ *    @param n Amount to add.
+ */
+void profile_count( ProfileCounter c, int n )
+{
+   profile_countTotals[c] += n;
+   profile_counts[profile_cur][c] += n;
+}
+
+
+/**
+ * @brief Gets the count accumulated in a counter since the last reset.
+ *
+ *    @param c Counter to get.
+ *    @return Total of the counter.
+ */
+double profile_countTotal( ProfileCounter c )
+{
+   return profile_countTotals[c];
+}
+
+
+/**
+ * @brief Gets the translated name of a counter.
+ *
+ *    @param c Counter to get name of.
+ *    @return Name of the counter.
+ */
+const char *profile_countName( ProfileCounter c )
+{
+   return _(profile_countNames[c]);
+}
+
+
+/**
+ * @brief Sets whether or not to render the profiler graph.
+ *
+ *    @param enable Whether or not to render the graph.
+ */
+void profile_show( int enable )
+{
+   profile_shown = enable;
+}
+
+
+/**
+ * @brief Checks to see if the profiler graph is shown.
+ *
+ *    @return 1 if the graph is shown.
+ */
+int profile_isShown (void)
+{
+   return profile_shown;
+}
+
+
+/**
+ * @brief Renders the last frames as a stacked bar graph with a legend.
+ *
+ *    @param x X position of the top left of the graph.
+ *    @param y Y position of the top left of the graph.
+ */
+void profile_render( double x, double y )
+{
+   int i, j, f;
+   double by, h, hmax, avg;
+   glColour c;
+
+   if (!profile_shown)
+      return;
+
+   /* Background. */
+   hmax = 2. * PROFILE_BUDGET * PROFILE_BAR_SCALE;
+   y   -= hmax;
+   c    = cBlack;
+   c.a  = 0.5;
+   gl_renderRect( x, y, PROFILE_FRAMES*PROFILE_BAR_W, hmax, &c );
+
+   /* Bars, oldest frame on the left. The current frame is still being
+    * timed so it is skipped. */
+   for (i=1; i<profile_nframes; i++) {
+      f  = (profile_cur - profile_nframes + i + PROFILE_FRAMES) % PROFILE_FRAMES;
+      by = y;
+      for (j=0; j<PROFILE_NSECTIONS; j++) {
+         h = MIN( profile_samples[f][j] * PROFILE_BAR_SCALE, y+hmax-by );
+         if (h <= 0.)
+            continue;
+         gl_renderRect( x + (i-1)*PROFILE_BAR_W, by, PROFILE_BAR_W, h, profile_colours[j] );
+         by += h;
+      }
+   }
+
+   /* Frame budget. */
+   gl_renderRect( x, y + PROFILE_BUDGET*PROFILE_BAR_SCALE,
+         PROFILE_FRAMES*PROFILE_BAR_W, 1., &cWhite );
+
+   /* Legend with the averages. */
+   x += PROFILE_FRAMES*PROFILE_BAR_W + 5.;
+   y += hmax - gl_smallFont.h;
+   for (j=0; j<PROFILE_NSECTIONS; j++) {
+      avg = 0.;
+      for (i=1; i<profile_nframes; i++)
+         avg += profile_samples[ (profile_cur - profile_nframes + i + PROFILE_FRAMES) % PROFILE_FRAMES ][j];
+      avg /= MAX( 1, profile_nframes-1 );
+      gl_renderRect( x, y, gl_smallFont.h, gl_smallFont.h, profile_colours[j] );
+      gl_print( &gl_smallFont, x + gl_smallFont.h + 4., y, &cFontWhite,
+            "%s %.2f ms", profile_name(j), avg );
+      y -= gl_smallFont.h + 3.;
+   }
+   for (j=0; j<PROFILE_NCOUNTERS; j++) {
+      avg = 0.;
+      for (i=1; i<profile_nframes; i++)
+         avg += profile_counts[ (profile_cur - profile_nframes + i + PROFILE_FRAMES) % PROFILE_FRAMES ][j];
+      avg /= MAX( 1, profile_nframes-1 );
+      gl_print( &gl_smallFont, x + gl_smallFont.h + 4., y, &cFontWhite,
+            "%s %.0f", profile_countName(j), avg );
+      y -= gl_smallFont.h + 3.;
+   }
+}
+
+
+/**
+ * @brief Compares two floats for qsort.
+ */
+static int profile_cmpFloat( const void *p1, const void *p2 )
+{
+   float f1, f2;
+   f1 = *(const float*)p1;
+   f2 = *(const float*)p2;
+   if (f1 < f2)
+      return -1;
+   else if (f1 > f2)
+      return +1;
+   return 0;
+}
+
+
+/**
+ * @brief Gets a percentile from sorted samples.
+ *
+ *    @param sorted Sorted samples.
+ *    @param n Number of samples.
+ *    @param p Percentile to get (0 to 100).
+ *    @return The percentile.
+ */
+static double profile_percentile( const float *sorted, int n, double p )
+{
+   int i;
+   i = (int)round( p / 100. * (double)(n-1) );
+   return sorted[ CLAMP( 0, n-1, i ) ];
+}
+
+
+/**
+ * @brief Writes the percentiles of a section or counter as a CSV row.
+ *
+ *    @param rw File to write to.
+ *    @param name Name of the row.
+ *    @param sorted Samples, sorted in place.
+ *    @param n Number of samples.
+ *    @param sum Sum of the samples.
+ *    @return 0 on success.
+ */
+static int profile_writeRow( SDL_RWops *rw, const char *name, float *sorted, int n, double sum )
+{
+   int l;
+   char buf[ 256 ];
+
+   qsort( sorted, n, sizeof(float), profile_cmpFloat );
+   if (n > 0)
+      l = nsnprintf( buf, sizeof(buf), "%s,%d,%f,%f,%f,%f,%f\n",
+            name, n, sum / (double)n,
+            profile_percentile( sorted, n, 50. ),
+            profile_percentile( sorted, n, 90. ),
+            profile_percentile( sorted, n, 99. ),
+            sorted[n-1] );
+   else
+      l = nsnprintf( buf, sizeof(buf), "%s,0,0,0,0,0,0\n", name );
+   return (SDL_RWwrite( rw, buf, l, 1 ) == 1) ? 0 : -1;
+}
+
+
+/**
+ * @brief Dumps the percentiles of the last frames to a CSV file.
+ *
+ * Sections are in milliseconds, counters in units per frame.
+ *
+ *    @param path Path of the file to write.
+ *    @return 0 on success.
+ */
+int profile_dumpCSV( const char *path )
+{
+   int i, j, l, n, f;
+   float sorted[PROFILE_FRAMES];
+   double sum;
+   SDL_RWops *rw;
+   char buf[ 256 ];
+
+   rw = SDL_RWFromFile( path, "w" );
+   if (rw == NULL) {
+      WARN(_("Unable to open '%s' for writing: %s"), path, SDL_GetError());
+      return -1;
+   }
+
+   /* Skip the frame being timed. */
+   n = MAX( 0, profile_nframes-1 );
+
+   l = nsnprintf( buf, sizeof(buf), "section,frames,mean,p50,p90,p99,max\n" );
+   SDL_RWwrite( rw, buf, l, 1 );
+   for (j=0; j<PROFILE_NSECTIONS; j++) {
+      sum = 0.;
+      for (i=0; i<n; i++) {
+         f         = (profile_cur - n + i + PROFILE_FRAMES) % PROFILE_FRAMES;
+         sorted[i] = profile_samples[f][j];
+         sum      += sorted[i];
+      }
+      profile_writeRow( rw, profile_names[j], sorted, n, sum );
+   }
+   for (j=0; j<PROFILE_NCOUNTERS; j++) {
+      sum = 0.;
+      for (i=0; i<n; i++) {
+         f         = (profile_cur - n + i + PROFILE_FRAMES) % PROFILE_FRAMES;
+         sorted[i] = profile_counts[f][j];
+         sum      += sorted[i];
+      }
+      profile_writeRow( rw, profile_countNames[j], sorted, n, sum );
+   }
+
+   SDL_RWclose( rw );
+   return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef PROFILE_H
+#  define PROFILE_H
+
+
+/**
+ * @brief Subsystems timed by the frame profiler.
+ */
+typedef enum ProfileSection_ {
+   PROFILE_SPACE, /**< Space and fleet spawning. */
+   PROFILE_WEAPONS, /**< Weapons. */
+   PROFILE_SPFX, /**< Special effects. */
+   PROFILE_AI, /**< Pilot AI. */
+   PROFILE_PILOTS, /**< Pilot physics and outfits. */
+   PROFILE_HOOKS, /**< Hooks. */
+   PROFILE_RENDER, /**< Rendering the game. */
+   PROFILE_TOOLKIT, /**< Rendering the toolkit. */
+   PROFILE_NSECTIONS /**< Number of sections, not a real section. */
+} ProfileSection;
+
+
+/**
+ * @brief Quantities counted every frame by the frame profiler.
+ */
+typedef enum ProfileCounter_ {
+   PROFILE_SPRITES, /**< Sprites drawn. */
+   PROFILE_DRAWS, /**< Draw calls done by the sprite batch. */
+   PROFILE_NCOUNTERS /**< Number of counters, not a real counter. */
+} ProfileCounter;
+
+
+/*
+ * Timing.
+ */
+void profile_begin( ProfileSection s );
+void profile_end( ProfileSection s );
+void profile_frame (void);
+void profile_reset (void);
+double profile_total( ProfileSection s );
+const char *profile_name( ProfileSection s );
+
+
+/*
+ * Counting.
+ */
+void profile_count( ProfileCounter c, int n );
+double profile_countTotal( ProfileCounter c );
+const char *profile_countName( ProfileCounter c );
+
+
+/*
+ * Output.
+ */
+void profile_show( int enable );
+int profile_isShown (void);
+void profile_render( double x, double y );
+int profile_dumpCSV( const char *path );
+
+
+#endif /* PROFILE_H */
@@ -89,6 +89,23 @@ void rng_init (void)
 }
 
 
+/**
+ * @brief Seeds the random subsystem with a fixed seed.
+ *
+ * Used to get reproducible runs, like when benchmarking.
+ *
+ *    @param seed Seed to use.
+ */
+void rng_seed( unsigned int seed )
+{
+   int i;
+
+   mt_initArray( seed );
+   for (i=0; i<10; i++) /* generate numbers to get away from poor initial values */
+      mt_genArray();
+}
+
+
 /**
  * @fn static uint32_t rng_timeEntropy (void)
  *
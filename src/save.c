@@ -10,8 +10,18 @@
 
 /** @cond */
 #include <errno.h>
+#include <stdio.h>
+#include "SDL_thread.h"
 
 #include "naev.h"
+
+#if HAS_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* HAS_POSIX */
+#if HAS_WIN32
+#include <windows.h>
+#endif /* HAS_WIN32 */
 /** @endcond */
 
 #include "save.h"
@@ -33,10 +43,29 @@
 #include "player.h"
 #include "shiplog.h"
 #include "start.h"
+#include "threadpool.h"
 #include "unidiff.h"
 
+
+/**
+ * @brief Snapshot of the game waiting to be written to disk.
+ */
+typedef struct SaveWrite_ {
+   xmlDocPtr doc; /**< Serialized game. */
+   char path[PATH_MAX]; /**< Save file to write. */
+   int backup; /**< Whether or not to back up the old save first. */
+   void (*done)( struct SaveWrite_ *sw, int ret ); /**< Completion callback. */
+} SaveWrite;
+
+
 int save_loaded   = 0; /**< Just loaded the saved game. */
 
+static SDL_mutex *save_lock = NULL; /**< Protects the background writer state. */
+static SDL_cond *save_cond  = NULL; /**< Signalled when a write finishes. */
+static int save_pending     = 0; /**< A save is being written. */
+static int save_failed      = 0; /**< The last save could not be written. */
+static int save_unreported  = 0; /**< A failed write hasn't been shown to the player yet. */
+
 
 /*
  * prototypes
@@ -64,6 +93,9 @@ extern int economy_sysSave( xmlTextWriterPtr writer ); /**< Saves the economy st
 extern int diff_save( xmlTextWriterPtr writer ); /**< Saves the universe diffs. */
 /* static */
 static int save_data( xmlTextWriterPtr writer );
+static int save_write( SaveWrite *sw );
+static int save_writeThread( void *data );
+static void save_writeDone( SaveWrite *sw, int ret );
 
 
 /**
@@ -93,18 +125,26 @@ static int save_data( xmlTextWriterPtr writer )
 /**
  * @brief Saves the current game.
  *
- *    @return 0 on success.
+ * The game is serialized to an XML document on the main thread, which is a
+ *  consistent snapshot of the game. The document is then compressed and
+ *  written in the background by save_write. Failures of the background
+ *  write are reported by save_update once it finishes.
+ *
+ *    @return 0 on success, -1 if the snapshot could not be created.
  */
 int save_all (void)
 {
-   char file[PATH_MAX];
    xmlDocPtr doc;
    xmlTextWriterPtr writer;
+   SaveWrite *sw;
 
    /* Do not save if saving is off. */
    if (player_isFlag(PLAYER_NOSAVE))
       return 0;
 
+   /* Only one save can be written at a time. */
+   save_wait();
+
    /* Create the writer. */
    writer = xmlNewTextWriterDoc(&doc, conf.save_compress);
    if (writer == NULL) {
@@ -134,32 +174,28 @@ int save_all (void)
    /* Finish element. */
    xmlw_endElem(writer); /* "naev_save" */
    xmlw_done(writer);
+   xmlFreeTextWriter(writer);
 
-   /* Write to file. */
+   /* Make sure the save directory exists. */
    if ((nfile_dirMakeExist(nfile_dataPath()) < 0) ||
          (nfile_dirMakeExist(nfile_dataPath(), "saves") < 0)) {
       WARN(_("Failed to create save directory '%ssaves'."), nfile_dataPath());
-      goto err_writer;
+      goto err;
    }
-   nsnprintf(file, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
 
-   /* Back up old saved game. */
-   if (!save_loaded) {
-      if (nfile_backupIfExists(file) < 0) {
-         WARN(_("Aborting save..."));
-         goto err_writer;
-      }
-   }
+   /* Hand the snapshot over to the background writer. */
+   sw          = calloc( 1, sizeof(SaveWrite) );
+   sw->doc     = doc;
+   sw->backup  = !save_loaded;
+   sw->done    = save_writeDone;
+   nsnprintf(sw->path, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
    save_loaded = 0;
 
-   /* Critical section, if crashes here player's game gets corrupted.
-    * Luckily we have a copy just in case... */
-   xmlFreeTextWriter(writer);
-   if (xmlSaveFileEnc(file, doc, "UTF-8") < 0) {
-      WARN(_("Failed to write saved game!  You'll most likely have to restore it by copying your backup saved game over your current saved game."));
-      goto err;
-   }
-   xmlFreeDoc(doc);
+   SDL_mutexP( save_lock );
+   save_pending = 1;
+   SDL_mutexV( save_lock );
+   if (threadpool_newJob( save_writeThread, sw ) < 0)
+      save_writeThread( sw ); /* No threadpool, write it now. */
 
    return 0;
 
@@ -170,12 +206,156 @@ err:
    return -1;
 }
 
+
+/**
+ * @brief Writes a snapshot to disk.
+ *
+ * The document is written to a temporary file that is synced and then
+ *  atomically renamed over the save, so a crash at any point leaves either
+ *  the old or the new save intact.
+ *
+ *    @param sw Snapshot to write.
+ *    @return 0 on success.
+ */
+static int save_write( SaveWrite *sw )
+{
+   char tmp[PATH_MAX];
+#if HAS_POSIX
+   int fd;
+#endif /* HAS_POSIX */
+
+   nsnprintf(tmp, PATH_MAX, "%s.tmp", sw->path);
+   if (xmlSaveFileEnc(tmp, sw->doc, "UTF-8") < 0) {
+      WARN(_("Failed to write '%s'."), tmp);
+      return -1;
+   }
+
+#if HAS_POSIX
+   /* Make sure the data hits the disk before replacing the save. */
+   fd = open( tmp, O_RDONLY );
+   if ((fd < 0) || (fsync(fd) != 0))
+      WARN(_("Failed to sync '%s': %s"), tmp, strerror(errno));
+   if (fd >= 0)
+      close( fd );
+#endif /* HAS_POSIX */
+
+   /* Back up old saved game. */
+   if (sw->backup && (nfile_backupIfExists(sw->path) < 0)) {
+      WARN(_("Aborting save..."));
+      remove( tmp );
+      return -1;
+   }
+
+#if HAS_WIN32
+   /* rename doesn't replace existing files on Windows. */
+   if (!MoveFileEx( tmp, sw->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH )) {
+      WARN(_("Error renaming %s to %s: error %lu"), tmp, sw->path, (unsigned long)GetLastError());
+      return -1;
+   }
+#else /* HAS_WIN32 */
+   if (rename( tmp, sw->path ) != 0) {
+      WARN(_("Error renaming %s to %s: %s"), tmp, sw->path, strerror(errno));
+      return -1;
+   }
+#endif /* HAS_WIN32 */
+
+   return 0;
+}
+
+
+/**
+ * @brief Threadpool job that writes a snapshot.
+ *
+ *    @param data Snapshot to write.
+ *    @return 0 always, errors are reported by the completion callback.
+ */
+static int save_writeThread( void *data )
+{
+   SaveWrite *sw;
+
+   sw = (SaveWrite*) data;
+   sw->done( sw, save_write( sw ) );
+   return 0;
+}
+
+
+/**
+ * @brief Completion callback of the background writer.
+ *
+ *    @param sw Snapshot that was written, freed here.
+ *    @param ret Result of writing the snapshot.
+ */
+static void save_writeDone( SaveWrite *sw, int ret )
+{
+   if (ret < 0)
+      WARN(_("Failed to write saved game '%s'!  You'll most likely have to restore it by copying your backup saved game over your current saved game."),
+            sw->path);
+
+   xmlFreeDoc( sw->doc );
+   free( sw );
+
+   SDL_mutexP( save_lock );
+   save_pending = 0;
+   save_failed  = (ret < 0);
+   if (ret < 0)
+      save_unreported = 1;
+   SDL_CondBroadcast( save_cond );
+   SDL_mutexV( save_lock );
+}
+
+
+/**
+ * @brief Waits for the save being written in the background, if any.
+ *
+ *    @return 0 on success, -1 if the last save could not be written.
+ */
+int save_wait (void)
+{
+   int ret;
+
+   if (save_lock == NULL) {
+      save_lock = SDL_CreateMutex();
+      save_cond = SDL_CreateCond();
+   }
+
+   SDL_mutexP( save_lock );
+   while (save_pending)
+      SDL_CondWait( save_cond, save_lock );
+   ret = save_failed ? -1 : 0;
+   SDL_mutexV( save_lock );
+
+   return ret;
+}
+
+
+/**
+ * @brief Tells the player about background saves that failed.
+ *
+ * Must be called from the main thread.
+ */
+void save_update (void)
+{
+   int failed;
+
+   if (save_lock == NULL)
+      return;
+
+   SDL_mutexP( save_lock );
+   failed = save_unreported;
+   save_unreported = 0;
+   SDL_mutexV( save_lock );
+
+   if (failed)
+      dialogue_alert( _("Failed to save game! You should exit and check the log to see what happened and then file a bug report!") );
+}
+
 /**
  * @brief Reload the current saved game.
  */
 void save_reload (void)
 {
    char path[PATH_MAX];
+   save_wait();
    nsnprintf(path, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
    load_gameFile( path );
 }
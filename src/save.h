@@ -8,6 +8,8 @@
 
 
 int save_all (void);
+int save_wait (void);
+void save_update (void);
 void save_reload (void);
 int save_hasSave (void);
 
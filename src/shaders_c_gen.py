@@ -47,6 +47,13 @@ SHADERS = [
       attributes = ["vertex"],
       uniforms = ["projection", "color", "tex_mat", "sampler1", "sampler2", "inter"]
    ),
+   Shader(
+      name = "texture_batch",
+      vs_path = "texture_batch.vert",
+      fs_path = "texture_batch.frag",
+      attributes = ["vertex", "vertex_tex", "vertex_color", "vertex_inter"],
+      uniforms = ["projection", "sampler1", "sampler2"]
+   ),
    Shader(
       name = "nebula",
       vs_path = "nebula.vert",
@@ -29,6 +29,8 @@
 #include "nxml.h"
 #include "shipstats.h"
 #include "slots.h"
+#include "strhash.h"
+#include "threadpool.h"
 #include "toolkit.h"
 #include "unistd.h"
 
@@ -52,12 +54,23 @@
 static Ship* ship_stack = NULL; /**< Stack of ships available in the game. */
 
 
+/**
+ * @brief Ship file being loaded by a worker thread.
+ */
+typedef struct ShipLoadJob_ {
+   char *file; /**< Path of the ship file. */
+   xmlDocPtr doc; /**< Parsed document, NULL on failure. */
+} ShipLoadJob;
+
+
 /*
  * Prototypes
  */
+static int ship_gfxBase( char *base, const char *buf );
 static int ship_loadGFX( Ship *temp, char *buf, int sx, int sy, int engine );
 static int ship_loadPLG( Ship *temp, char *buf );
 static int ship_parse( Ship *temp, xmlNodePtr parent );
+static int ship_loadJob( void *data );
 
 
 /**
@@ -68,13 +81,11 @@ static int ship_parse( Ship *temp, xmlNodePtr parent );
  */
 Ship* ship_get( const char* name )
 {
-   Ship *temp;
    int i;
 
-   temp = ship_stack;
-   for (i=0; i < array_size(ship_stack); i++)
-      if (strcmp(temp[i].name, name)==0)
-         return &temp[i];
+   i = strhash_get( STRHASH_SHIP, name );
+   if (i >= 0)
+      return &ship_stack[i];
 
    WARN(_("Ship %s does not exist"), name);
    return NULL;
@@ -89,13 +100,11 @@ Ship* ship_get( const char* name )
  */
 Ship* ship_getW( const char* name )
 {
-   Ship *temp;
    int i;
 
-   temp = ship_stack;
-   for (i=0; i < array_size(ship_stack); i++)
-      if (strcmp(temp[i].name, name)==0)
-         return &temp[i];
+   i = strhash_get( STRHASH_SHIP, name );
+   if (i >= 0)
+      return &ship_stack[i];
 
    return NULL;
 }
@@ -498,18 +507,34 @@ static int ship_loadSpaceImage( Ship *temp, char *str, int sx, int sy )
    SDL_RWops *rw;
    npng_t *npng;
    SDL_Surface *surface;
+   uint64_t *trans;
+   int pw, ph;
    int ret;
 
-   /* Load the space sprite. */
-   rw    = PHYSFSRWOPS_openRead( str );
-   npng  = npng_open( rw );
-   npng_dim( npng, &w, &h );
-   surface = npng_readSurface( npng, gl_needPOT(), 1 );
-
-   /* Load the texture. */
-   temp->gfx_space = gl_loadImagePadTrans( str, surface, rw,
-         OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS,
-         w, h, sx, sy, 0 );
+   /* Use the sprite decoded by ships_load if available. */
+   surface = gl_texPrefetchTake( str, &trans, &pw, &ph );
+   if ((surface != NULL) && (trans != NULL)) {
+      rw   = NULL;
+      npng = NULL;
+      temp->gfx_space = gl_loadImagePadTransMap( str, surface, trans,
+            OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS,
+            pw, ph, sx, sy, 0 );
+   }
+   else {
+      if (surface != NULL)
+         SDL_FreeSurface( surface );
+
+      /* Load the space sprite. */
+      rw    = PHYSFSRWOPS_openRead( str );
+      npng  = npng_open( rw );
+      npng_dim( npng, &w, &h );
+      surface = npng_readSurface( npng, gl_needPOT(), 1 );
+
+      /* Load the texture. */
+      temp->gfx_space = gl_loadImagePadTrans( str, surface, rw,
+            OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS,
+            w, h, sx, sy, 0 );
+   }
 
    /* Create the target graphic. */
    ret = ship_genTargetGFX( temp, surface, sx, sy );
@@ -517,8 +542,10 @@ static int ship_loadSpaceImage( Ship *temp, char *str, int sx, int sy )
       return ret;
 
    /* Free stuff. */
-   npng_close( npng );
-   SDL_RWclose( rw );
+   if (npng != NULL)
+      npng_close( npng );
+   if (rw != NULL)
+      SDL_RWclose( rw );
    SDL_FreeSurface( surface );
 
    /* Calculate mount angle. */
@@ -543,6 +570,28 @@ static int ship_loadEngineImage( Ship *temp, char *str, int sx, int sy )
 }
 
 
+/**
+ * @brief Gets the base path of the graphics of a ship.
+ *
+ *    @param[out] base Base path, NDATA_PATH_MAX long.
+ *    @param buf Name of the texture to work with.
+ *    @return 0 on success.
+ */
+static int ship_gfxBase( char *base, const char *buf )
+{
+   size_t i;
+
+   for (i=0; i<NDATA_PATH_MAX; i++) {
+      if ((buf[i] == '\0') || (buf[i] == '_')) {
+         base[i] = '\0';
+         return 0;
+      }
+      base[i] = buf[i];
+   }
+   return -1;
+}
+
+
 /**
  * @brief Loads the graphics for a ship.
  *
@@ -555,17 +604,9 @@ static int ship_loadEngineImage( Ship *temp, char *str, int sx, int sy )
 static int ship_loadGFX( Ship *temp, char *buf, int sx, int sy, int engine )
 {
    char base[NDATA_PATH_MAX], str[PATH_MAX];
-   size_t i;
 
    /* Get base path. */
-   for (i=0; i<sizeof(base); i++) {
-      if ((buf[i] == '\0') || (buf[i] == '_')) {
-         base[i] = '\0';
-         break;
-      }
-      base[i] = buf[i];
-   }
-   if (i>=sizeof(base)) {
+   if (ship_gfxBase( base, buf )) {
       WARN(_("Failed to get base path of '%s'."), buf);
       return -1;
    }
@@ -599,9 +640,6 @@ static int ship_loadPLG( Ship *temp, char *buf )
 {
    char *file;
    int sl;
-   CollPoly *polygon;
-   xmlDocPtr doc;
-   xmlNodePtr node, cur;
 
    temp->npolygon = 0;
 
@@ -620,41 +658,9 @@ static int ship_loadPLG( Ship *temp, char *buf )
       return 0;
    }
 
-   /* Load the XML. */
-   doc  = xml_parsePhysFS( file );
-
-   if (doc == NULL) {
-      free(file);
-      return 0;
-   }
-
-   node = doc->xmlChildrenNode; /* First polygon node */
-   if (node == NULL) {
-      xmlFreeDoc(doc);
-      WARN(_("Malformed %s file: does not contain elements"), file);
-      free(file);
-      return 0;
-   }
-
+   /* Load the polygons, cached after the first time. */
+   LoadPolygonFile( &temp->polygon, &temp->npolygon, file );
    free(file);
-
-   do { /* load the polygon data */
-      if (xml_isNode(node,"polygons")) {
-         cur = node->children;
-         temp->polygon = malloc( sizeof(CollPoly) );
-         do {
-            if (xml_isNode(cur,"polygon")) {
-               temp->npolygon++;
-               temp->polygon = realloc( temp->polygon, sizeof(CollPoly) * temp->npolygon );
-               polygon = &temp->polygon[temp->npolygon-1];
-
-               LoadPolygon( polygon, cur );
-            }
-         } while (xml_nextNode(cur));
-      }
-   } while (xml_nextNode(node));
-
-   xmlFreeDoc(doc);
    return 0;
 }
 
@@ -1090,10 +1096,11 @@ static int ship_parse( Ship *temp, xmlNodePtr parent )
 int ships_load (void)
 {
    size_t nfiles;
-   char **ship_files, *file;
-   int i, sl;
+   char **ship_files;
+   int i, sl, start, end;
    xmlNodePtr node;
-   xmlDocPtr doc;
+   ShipLoadJob *jobs;
+   ThreadQueue *q;
 
    /* Validity. */
    ss_check();
@@ -1106,40 +1113,54 @@ int ships_load (void)
       ship_stack = array_create_size(Ship, nfiles);
    }
 
+   jobs = calloc( nfiles, sizeof(ShipLoadJob) );
    for (i=0; ship_files[i]!=NULL; i++) {
       /* Get the file name .*/
       sl   = strlen(SHIP_DATA_PATH)+strlen(ship_files[i])+1;
-      file = malloc( sl );
-      nsnprintf( file, sl, "%s%s", SHIP_DATA_PATH, ship_files[i] );
+      jobs[i].file = malloc( sl );
+      nsnprintf( jobs[i].file, sl, "%s%s", SHIP_DATA_PATH, ship_files[i] );
+   }
 
-      /* Load the XML. */
-      doc  = xml_parsePhysFS( file );
+   /* Work in batches so only a batch worth of decoded sprites is in memory. */
+   for (start=0; start<(int)nfiles; start+=OPENGL_TEX_PREFETCH_BATCH) {
+      end = MIN( start+OPENGL_TEX_PREFETCH_BATCH, (int)nfiles );
 
-      if (doc == NULL) {
-         free(file);
-         continue;
-      }
+      /* Read, parse and decode the graphics on the threadpool. */
+      q = vpool_create();
+      for (i=start; i<end; i++)
+         vpool_enqueue( q, ship_loadJob, &jobs[i] );
+      vpool_wait( q );
 
-      node = doc->xmlChildrenNode; /* First ship node */
-      if (node == NULL) {
-         xmlFreeDoc(doc);
-         WARN(_("Malformed %s file: does not contain elements"), file);
-         free(file);
-         continue;
-      }
+      /* Parse the ships in order, only the uploads to OpenGL are left. */
+      for (i=start; i<end; i++) {
+         if (jobs[i].doc == NULL) {
+            free(jobs[i].file);
+            continue;
+         }
 
-      free(file);
+         node = jobs[i].doc->xmlChildrenNode; /* First ship node */
+         if (node == NULL)
+            WARN(_("Malformed %s file: does not contain elements"), jobs[i].file);
+         else if (xml_isNode(node, XML_SHIP))
+            /* Load the ship. */
+            ship_parse( &array_grow(&ship_stack), node );
 
-      if (xml_isNode(node, XML_SHIP))
-         /* Load the ship. */
-         ship_parse( &array_grow(&ship_stack), node );
+         /* Clean up. */
+         xmlFreeDoc(jobs[i].doc);
+         free(jobs[i].file);
+      }
 
-      /* Clean up. */
-      xmlFreeDoc(doc);
+      /* Drop images that were decoded but already loaded. */
+      gl_texPrefetchFree();
    }
+   free(jobs);
 
    /* Shrink stack. */
    array_shrink(&ship_stack);
+
+   /* Index names. */
+   for (i=0; i<array_size(ship_stack); i++)
+      strhash_set( STRHASH_SHIP, ship_stack[i].name, i );
    DEBUG( n_( "Loaded %d Ship", "Loaded %d Ships", array_size(ship_stack) ), array_size(ship_stack) );
 
    /* Clean up. */
@@ -1149,6 +1170,65 @@ int ships_load (void)
 }
 
 
+/**
+ * @brief Reads a ship file and decodes its graphics, run on the threadpool.
+ *
+ * Must not touch OpenGL, the textures are uploaded by ship_parse.
+ *
+ *    @param data ShipLoadJob to process.
+ *    @return 0 on success.
+ */
+static int ship_loadJob( void *data )
+{
+   ShipLoadJob *job;
+   xmlNodePtr node;
+   char *buf, base[NDATA_PATH_MAX], str[PATH_MAX];
+   int noengine;
+
+   job      = (ShipLoadJob*) data;
+   job->doc = xml_parsePhysFS( job->file );
+   if ((job->doc == NULL) || (job->doc->xmlChildrenNode == NULL))
+      return -1;
+
+   /* Decode the sprites the same way ship_parse will look them up. */
+   node = job->doc->xmlChildrenNode->xmlChildrenNode;
+   if (node == NULL)
+      return 0;
+   do {
+      xml_onlyNodes(node);
+      if (!xml_isNode(node,"GFX") && !xml_isNode(node,"gfx_space")
+            && !xml_isNode(node,"gfx_engine"))
+         continue;
+      buf = xml_get(node);
+      if (buf == NULL)
+         continue;
+
+      if (xml_isNode(node,"gfx_space")) {
+         nsnprintf( str, PATH_MAX, GFX_PATH"%s", buf );
+         gl_texPrefetch( str, OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+         continue;
+      }
+      if (xml_isNode(node,"gfx_engine")) {
+         nsnprintf( str, PATH_MAX, GFX_PATH"%s", buf );
+         gl_texPrefetch( str, OPENGL_TEX_MIPMAPS );
+         continue;
+      }
+
+      if (ship_gfxBase( base, buf ))
+         continue;
+      nsnprintf( str, PATH_MAX, SHIP_GFX_PATH"%s/%s"SHIP_EXT, base, buf );
+      gl_texPrefetch( str, OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+      xmlr_attr_int(node, "noengine", noengine );
+      if (!noengine && conf.engineglow) {
+         nsnprintf( str, PATH_MAX, SHIP_GFX_PATH"%s/%s"SHIP_ENGINE SHIP_EXT, base, buf );
+         gl_texPrefetch( str, OPENGL_TEX_MIPMAPS );
+      }
+   } while (xml_nextNode(node));
+
+   return 0;
+}
+
+
 /**
  * @brief Frees all the ships.
  */
@@ -1203,4 +1283,5 @@ void ships_free (void)
 
    array_free(ship_stack);
    ship_stack = NULL;
+   strhash_clear( STRHASH_SHIP );
 }
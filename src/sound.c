@@ -33,6 +33,7 @@
 #include "physics.h"
 #include "player.h"
 #include "sound_openal.h"
+#include "threadpool.h"
 
 
 #define SOUND_SUFFIX_WAV   ".wav" /**< Suffix of sounds. */
@@ -42,6 +43,30 @@
 #define voiceLock()        SDL_LockMutex(voice_mutex)
 #define voiceUnlock()      SDL_UnlockMutex(voice_mutex)
 
+#define VOICE_INDEX_BITS   16 /**< Bits of a voice handle used for the slot. */
+#define VOICE_INDEX_MASK   ((1<<VOICE_INDEX_BITS)-1) /**< Mask to get the slot of a voice handle. */
+#define VOICE_GEN_MAX      0x7FFF /**< Maximum slot generation, keeps handles positive. */
+
+
+/**
+ * @brief A sound being decoded on a worker thread.
+ */
+typedef struct SoundPrefetch_ {
+   int sound; /**< Sound being decoded. */
+   char *filename; /**< File to decode. */
+   alSound snd; /**< Decoded buffer. */
+   int ret; /**< 0 if it was decoded. */
+} SoundPrefetch;
+
+
+/**
+ * @brief Priority of a voice used when scheduling sources.
+ */
+typedef struct VoicePrio_ {
+   int slot; /**< Slot of the voice. */
+   double key; /**< Lower plays first. */
+} VoicePrio;
+
 
 /*
  * Global sound properties.
@@ -52,17 +77,36 @@ static int sound_initialized  = 0; /**< Whether or not sound is initialized. */
 
 /*
  * Sound list.
+ *
+ * Sounds are only registered by name at init and decoded the first time they
+ * are played. Decoded buffers not used for a while get evicted when they take
+ * more memory than conf.snd_cache.
  */
 static alSound *sound_list    = NULL; /**< List of available sounds. */
+static size_t sound_cached    = 0; /**< Bytes of decoded sound buffers. */
+static unsigned int sound_tick = 0; /**< Counter to find the least recently used sounds. */
+static SDL_mutex *sound_prefetchLock = NULL; /**< Lock for the decoded prefetched sounds. */
+static SoundPrefetch **sound_prefetchDone = NULL; /**< Prefetched sounds waiting to be picked up. */
+static int sound_prefetchPending = 0; /**< Prefetch jobs not picked up yet. */
 
 
 /*
  * Voices.
+ *
+ * Voices live in slots and are referred to by handles that pack the slot and
+ * its generation, so looking one up is O(1) and stale handles are rejected.
+ * There can be more voices than sources: only the most important ones are
+ * bound to a source and the rest play virtually.
  */
-static int voice_genid        = 0; /**< Voice identifier generator. */
-alVoice *voice_active         = NULL; /**< Active voices. */
-static alVoice *voice_pool    = NULL; /**< Pool of free voices. */
+static alVoice *voice_slots   = NULL; /**< Voice slots. */
+static int *voice_free        = NULL; /**< Free slots, last one gets used first. */
+static int *voice_active      = NULL; /**< Slots of the active voices. */
+static VoicePrio *voice_prio  = NULL; /**< Scratch space of the scheduler. */
 static SDL_mutex *voice_mutex = NULL; /**< Lock for voices. */
+static double voice_lx        = 0.; /**< X position of the listener. */
+static double voice_ly        = 0.; /**< Y position of the listener. */
+static double voice_speed     = 1.; /**< Speed voices are playing at. */
+static int voice_paused       = 0; /**< Whether voices are paused. */
 
 
 /*
@@ -78,8 +122,17 @@ static double snd_compression_gain = 0.; /**< Current compression gain. */
  */
 /* General. */
 static int sound_makeList (void);
+static int sound_register( const char *filename, const char *name );
+static alSound* sound_load( int sound );
+static void sound_unload( alSound *snd );
+static void sound_evict (void);
+static int sound_prefetchJob( void *data );
+static void sound_prefetchCollect( int wait );
 static void sound_free( alSound *snd );
 /* Voices. */
+static void voice_release( alVoice *v );
+static void voice_schedule (void);
+static int voice_cmpPrio( const void *p1, const void *p2 );
 
 
 /**
@@ -114,6 +167,14 @@ int sound_init (void)
    voice_mutex = SDL_CreateMutex();
    if (voice_mutex == NULL)
       WARN(_("Unable to create voice mutex."));
+   voice_slots  = array_create( alVoice );
+   voice_free   = array_create( int );
+   voice_active = array_create( int );
+   voice_prio   = array_create( VoicePrio );
+
+   /* Create prefetch lock. */
+   sound_prefetchLock = SDL_CreateMutex();
+   sound_prefetchDone = array_create( SoundPrefetch* );
 
    /* Load available sounds. */
    ret = sound_makeList();
@@ -155,7 +216,6 @@ int sound_init (void)
 void sound_exit (void)
 {
    int i;
-   alVoice *v;
 
    /* Nothing to disable. */
    if (sound_disabled || !sound_initialized)
@@ -164,19 +224,24 @@ void sound_exit (void)
    /* Exit music subsystem. */
    music_exit();
 
+   /* Wait for the sounds still being decoded. */
+   sound_prefetchCollect( 1 );
+   array_free( sound_prefetchDone );
+   sound_prefetchDone = NULL;
+   SDL_DestroyMutex( sound_prefetchLock );
+   sound_prefetchLock = NULL;
+
    if (voice_mutex != NULL) {
       voiceLock();
       /* free the voices. */
-      while (voice_active != NULL) {
-         v = voice_active;
-         voice_active = v->next;
-         free(v);
-      }
-      while (voice_pool != NULL) {
-         v = voice_pool;
-         voice_pool = v->next;
-         free(v);
-      }
+      array_free( voice_slots );
+      array_free( voice_free );
+      array_free( voice_active );
+      array_free( voice_prio );
+      voice_slots  = NULL;
+      voice_free   = NULL;
+      voice_active = NULL;
+      voice_prio   = NULL;
       voiceUnlock();
 
       /* Destroy voice lock. */
@@ -188,6 +253,8 @@ void sound_exit (void)
    for (i=0; i<array_size(sound_list); i++)
       sound_free( &sound_list[i] );
    array_free( sound_list );
+   sound_list   = NULL;
+   sound_cached = 0;
 
    /* Exit sound subsystem. */
    sound_al_exit();
@@ -227,10 +294,17 @@ int sound_get( const char* name )
  */
 double sound_getLength( int sound )
 {
+   alSound *s;
+
    if (sound_disabled)
       return 0.;
 
-   return sound_list[sound].length;
+   /* The length is only known once decoded. */
+   s = sound_load( sound );
+   if (s == NULL)
+      return 0.;
+
+   return s->length;
 }
 
 
@@ -248,14 +322,15 @@ int sound_play( int sound )
    if (sound_disabled)
       return 0;
 
-   if ((sound < 0) || (sound >= array_size(sound_list)))
+   /* Get the sound. */
+   s = sound_load( sound );
+   if (s == NULL)
       return -1;
 
    /* Gets a new voice. */
    v = voice_new();
-
-   /* Get the sound. */
-   s = &sound_list[sound];
+   if (v == NULL)
+      return -1;
 
    /* Try to play the sound. */
    if (sound_al_play( v, s ))
@@ -263,7 +338,6 @@ int sound_play( int sound )
 
    /* Set state and add to list. */
    v->state = VOICE_PLAYING;
-   v->id = ++voice_genid;
    voice_add(v);
 
    return v->id;
@@ -310,11 +384,15 @@ int sound_playPos( int sound, double px, double py, double vx, double vy )
          return 0;
    }
 
+   /* Get the sound. */
+   s = sound_load( sound );
+   if (s == NULL)
+      return -1;
+
    /* Gets a new voice. */
    v = voice_new();
-
-   /* Get the sound. */
-   s = &sound_list[sound];
+   if (v == NULL)
+      return -1;
 
    /* Try to play the sound. */
    if (sound_al_playPos( v, s, px, py, vx, vy ))
@@ -322,7 +400,6 @@ int sound_playPos( int sound, double px, double py, double vx, double vy )
 
    /* Actually add the voice to the list. */
    v->state = VOICE_PLAYING;
-   v->id = ++voice_genid;
    voice_add(v);
 
    return v->id;
@@ -364,7 +441,8 @@ int sound_updatePos( int voice, double px, double py, double vx, double vy )
  */
 int sound_update( double dt )
 {
-   alVoice *v, *tv;
+   int i;
+   alVoice *v;
 
    /* Update music if needed. */
    music_update(dt);
@@ -375,49 +453,38 @@ int sound_update( double dt )
    /* System update. */
    sound_al_update();
 
-   if (voice_active == NULL)
+   /* Pick up the sounds decoded in the background. */
+   if (sound_prefetchPending > 0)
+      sound_prefetchCollect( 0 );
+
+   if (array_size(voice_active) == 0)
       return 0;
 
    voiceLock();
 
-   /* The actual control loop. */
-   for (v=voice_active; v!=NULL; v=v->next) {
+   /* The actual control loop, backwards so released voices can be swapped
+    * out of the active list. */
+   for (i=array_size(voice_active)-1; i>=0; i--) {
+      v = &voice_slots[ voice_active[i] ];
+
+      /* Virtual voices keep track of where they would be. */
+      if (!voice_paused)
+         v->elapsed += dt * voice_speed;
 
       /* Run first to clear in same iteration. */
       sound_al_updateVoice( v );
 
       /* Destroy and toss into pool. */
-      if ((v->state == VOICE_STOPPED) || (v->state == VOICE_DESTROY)) {
-
-         /* Remove from active list. */
-         tv = v->prev;
-         if (tv == NULL) {
-            voice_active = v->next;
-            if (voice_active != NULL)
-               voice_active->prev = NULL;
-         }
-         else {
-            tv->next = v->next;
-            if (tv->next != NULL)
-               tv->next->prev = tv;
-         }
-
-         /* Add to free pool. */
-         v->next = voice_pool;
-         v->prev = NULL;
-         voice_pool = v;
-         if (v->next != NULL)
-            v->next->prev = v;
-
-         /* Avoid loop blockage. */
-         v = (tv != NULL) ? tv->next : voice_active;
-         if (v == NULL)
-            break;
-      }
+      if ((v->state == VOICE_STOPPED) || (v->state == VOICE_DESTROY))
+         voice_release( v );
    }
 
    voiceUnlock();
 
+   /* Give the sources to the voices that matter most. */
+   if (!voice_paused)
+      voice_schedule();
+
    return 0;
 }
 
@@ -431,6 +498,7 @@ void sound_pause (void)
       return;
 
    sound_al_pause();
+   voice_paused = 1;
 
    if (snd_compression >= 0)
       sound_al_pauseGroup( snd_compressionG );
@@ -446,6 +514,7 @@ void sound_resume (void)
       return;
 
    sound_al_resume();
+   voice_paused = 0;
 
    if (snd_compression >= 0)
       sound_al_resumeGroup( snd_compressionG );
@@ -457,17 +526,19 @@ void sound_resume (void)
  */
 void sound_stopAll (void)
 {
+   int i;
    alVoice *v;
 
    if (sound_disabled)
       return;
 
    /* Make sure there are voices. */
-   if (voice_active==NULL)
+   if (array_size(voice_active) == 0)
       return;
 
    voiceLock();
-   for (v=voice_active; v!=NULL; v=v->next) {
+   for (i=0; i<array_size(voice_active); i++) {
+      v = &voice_slots[ voice_active[i] ];
       sound_al_stop( v );
       v->state = VOICE_STOPPED;
    }
@@ -514,6 +585,10 @@ int sound_updateListener( double dir, double px, double py,
    if (sound_disabled)
       return 0;
 
+   /* Used to prioritize voices. */
+   voice_lx = px;
+   voice_ly = py;
+
    return sound_al_updateListener( dir, px, py, vx, vy );
 }
 
@@ -552,6 +627,7 @@ void sound_setSpeed( double s )
       sound_al_setSpeedVolume( 1. ); /* Restore volume. */
    }
    snd_compression_gain = v;
+   voice_speed = s;
 
    return sound_al_setSpeed( s );
 }
@@ -559,6 +635,8 @@ void sound_setSpeed( double s )
 
 /**
  * @brief Makes the list of available sounds.
+ *
+ * Sounds are only registered, they get decoded when first used.
  */
 static int sound_makeList (void)
 {
@@ -566,7 +644,6 @@ static int sound_makeList (void)
    size_t i;
    char path[PATH_MAX];
    int len, suflen, flen;
-   SDL_RWops *rw;
 
    if (sound_disabled)
       return 0;
@@ -591,19 +668,17 @@ static int sound_makeList (void)
             (strncmp( &files[i][flen - suflen], SOUND_SUFFIX_OGG, suflen)!=0))
          continue;
 
-      /* Load the sound. */
+      /* Register the sound. */
       nsnprintf( path, PATH_MAX, SOUND_PATH"%s", files[i] );
-      rw = PHYSFSRWOPS_openRead( path );
 
       /* remove the suffix */
       len = flen - suflen;
       files[i][len] = '\0';
 
-      source_newRW( rw, files[i], 0 );
-      SDL_RWclose( rw );
+      sound_register( path, files[i] );
    }
 
-   DEBUG( n_("Loaded %d Sound", "Loaded %d Sounds", array_size(sound_list)), array_size(sound_list) );
+   DEBUG( n_("Registered %d Sound", "Registered %d Sounds", array_size(sound_list)), array_size(sound_list) );
 
    /* Clean up. */
    PHYSFS_freeList( files );
@@ -612,6 +687,231 @@ static int sound_makeList (void)
 }
 
 
+/**
+ * @brief Registers a sound to be decoded when first used.
+ *
+ *    @param filename File to decode the sound from.
+ *    @param name Name of the sound.
+ *    @return ID of the sound.
+ */
+static int sound_register( const char *filename, const char *name )
+{
+   alSound *snd;
+
+   snd = &array_grow( &sound_list );
+   memset( snd, 0, sizeof(alSound) );
+   snd->filename = strdup( filename );
+   snd->name     = strdup( name );
+
+   return snd-sound_list;
+}
+
+
+/**
+ * @brief Gets a sound, decoding it if needed.
+ *
+ *    @param sound ID of the sound to get.
+ *    @return The decoded sound or NULL on error.
+ */
+static alSound* sound_load( int sound )
+{
+   alSound *snd;
+   SDL_RWops *rw;
+   int ret;
+
+   if ((sound < 0) || (sound >= array_size(sound_list)))
+      return NULL;
+
+   snd = &sound_list[sound];
+   snd->lastused = ++sound_tick;
+   if (snd->buf != 0)
+      return snd;
+
+   /* Don't retry sounds that failed to load. */
+   if (snd->failed)
+      return NULL;
+
+   rw = PHYSFSRWOPS_openRead( snd->filename );
+   if (rw == NULL) {
+      WARN(_("Unable to open sound file '%s'."), snd->filename);
+      snd->failed = 1;
+      return NULL;
+   }
+   ret = sound_al_load( snd, rw, snd->name );
+   SDL_RWclose( rw );
+   if (ret != 0) {
+      snd->buf    = 0;
+      snd->failed = 1;
+      return NULL;
+   }
+
+   sound_cached += snd->size;
+   sound_evict();
+
+   return snd;
+}
+
+
+/**
+ * @brief Frees the decoded buffer of a sound, it can be decoded again later.
+ *
+ *    @param snd Sound to unload.
+ */
+static void sound_unload( alSound *snd )
+{
+   if (snd->buf == 0)
+      return;
+
+   sound_al_free( snd );
+   sound_cached -= snd->size;
+   snd->buf  = 0;
+   snd->size = 0;
+}
+
+
+/**
+ * @brief Evicts the least recently used sounds until under the memory budget.
+ *
+ * Sounds being played or that can't be decoded again are kept.
+ */
+static void sound_evict (void)
+{
+   int i, j, lru, used;
+   size_t budget;
+   alSound *snd;
+
+   budget = (size_t)MAX( 0, conf.snd_cache ) * 1024 * 1024;
+   while (sound_cached > budget) {
+      lru = -1;
+      for (i=0; i<array_size(sound_list); i++) {
+         snd = &sound_list[i];
+         if ((snd->buf == 0) || snd->pinned || (snd->lastused == sound_tick))
+            continue;
+         if ((lru >= 0) && (snd->lastused >= sound_list[lru].lastused))
+            continue;
+
+         /* Can't free buffers attached to sources. */
+         used = 0;
+         for (j=0; j<array_size(voice_active); j++) {
+            if (voice_slots[ voice_active[j] ].buffer == snd->buf) {
+               used = 1;
+               break;
+            }
+         }
+         if (!used)
+            lru = i;
+      }
+
+      /* Everything left is in use. */
+      if (lru < 0)
+         break;
+      sound_unload( &sound_list[lru] );
+   }
+}
+
+
+/**
+ * @brief Starts decoding a sound on a worker thread so it's ready when played.
+ *
+ *    @param sound ID of the sound to prefetch.
+ */
+void sound_prefetch( int sound )
+{
+   alSound *snd;
+   SoundPrefetch *job;
+
+   if (sound_disabled)
+      return;
+
+   if ((sound < 0) || (sound >= array_size(sound_list)))
+      return;
+
+   snd = &sound_list[sound];
+   if ((snd->buf != 0) || snd->prefetching || snd->failed)
+      return;
+   snd->prefetching = 1;
+
+   job = calloc( 1, sizeof(SoundPrefetch) );
+   job->sound    = sound;
+   job->filename = strdup( snd->filename );
+   sound_prefetchPending++;
+   if (threadpool_newJob( sound_prefetchJob, job ) < 0)
+      sound_prefetchJob( job ); /* No threadpool, decode it now. */
+}
+
+
+/**
+ * @brief Decodes a prefetched sound, runs on a worker thread.
+ */
+static int sound_prefetchJob( void *data )
+{
+   SoundPrefetch *job;
+   SDL_RWops *rw;
+
+   job = (SoundPrefetch*) data;
+   rw  = PHYSFSRWOPS_openRead( job->filename );
+   if (rw == NULL)
+      job->ret = -1;
+   else {
+      job->ret = sound_al_load( &job->snd, rw, job->filename );
+      SDL_RWclose( rw );
+   }
+
+   /* Hand it over to the main thread. */
+   SDL_LockMutex( sound_prefetchLock );
+   array_push_back( &sound_prefetchDone, job );
+   SDL_UnlockMutex( sound_prefetchLock );
+   return 0;
+}
+
+
+/**
+ * @brief Picks up the sounds decoded by the worker threads.
+ *
+ *    @param wait Whether to wait for all the prefetches to finish.
+ */
+static void sound_prefetchCollect( int wait )
+{
+   int i, n;
+   SoundPrefetch *job;
+   alSound *snd;
+
+   while (sound_prefetchPending > 0) {
+      SDL_LockMutex( sound_prefetchLock );
+      n = array_size( sound_prefetchDone );
+      for (i=0; i<n; i++) {
+         job = sound_prefetchDone[i];
+         snd = &sound_list[ job->sound ];
+         snd->prefetching = 0;
+         if (job->ret == 0) {
+            /* Might have been decoded in the meantime. */
+            if (snd->buf == 0) {
+               snd->buf     = job->snd.buf;
+               snd->length  = job->snd.length;
+               snd->size    = job->snd.size;
+               snd->lastused = ++sound_tick;
+               sound_cached += snd->size;
+            }
+            else
+               sound_al_free( &job->snd );
+         }
+         free( job->filename );
+         free( job );
+      }
+      array_resize( &sound_prefetchDone, 0 );
+      SDL_UnlockMutex( sound_prefetchLock );
+      sound_prefetchPending -= n;
+
+      if (!wait)
+         break;
+      if (sound_prefetchPending > 0)
+         SDL_Delay( 1 );
+   }
+
+   sound_evict();
+}
+
+
 /**
  * @brief Sets the volume.
  *
@@ -667,7 +967,8 @@ static void sound_free( alSound *snd )
    free(snd->filename);
 
    /* Free internals. */
-   sound_al_free(snd);
+   if (snd->buf != 0)
+      sound_al_free(snd);
 }
 
 
@@ -696,13 +997,19 @@ int sound_createGroup( int size )
  */
 int sound_playGroup( int group, int sound, int once )
 {
+   alSound *s;
+
    if (sound_disabled)
       return 0;
 
-   if ((sound < 0) || (sound >= array_size(sound_list)))
+   s = sound_load( sound );
+   if (s == NULL)
       return -1;
 
-   return sound_al_playGroup( group, &sound_list[sound], once );
+   /* Group sources hold on to the buffer, so it can't be evicted. */
+   s->pinned = 1;
+
+   return sound_al_playGroup( group, s, once );
 }
 
 
@@ -815,21 +1122,33 @@ void voice_unlock (void)
 /**
  * @brief Gets a new voice ready to be used.
  *
- *    @return New voice ready to use.
+ * The voice stays free until it is added with voice_add.
+ *
+ *    @return New voice ready to use or NULL if there are too many voices.
  */
 alVoice* voice_new (void)
 {
    alVoice *v;
+   int slot;
 
-   /* No free voices, allocate a new one. */
-   if (voice_pool == NULL) {
-      v = calloc( 1, sizeof(alVoice) );
-      voice_pool = v;
-      return v;
+   /* Reuse the last freed slot. */
+   if (array_size(voice_free) > 0)
+      return &voice_slots[ voice_free[ array_size(voice_free)-1 ] ];
+
+   /* Handles can only address so many slots. */
+   slot = array_size(voice_slots);
+   if (slot > VOICE_INDEX_MASK) {
+      WARN(_("Too many voices playing!"));
+      return NULL;
    }
 
-   /* First free voice. */
-   v = voice_pool; /* We do not touch the next nor prev, it's still in the pool. */
+   /* No free voices, allocate a new one. */
+   voiceLock();
+   v = &array_grow( &voice_slots );
+   memset( v, 0, sizeof(alVoice) );
+   v->gen = 1;
+   array_push_back( &voice_free, slot );
+   voiceUnlock();
    return v;
 }
 
@@ -837,65 +1156,161 @@ alVoice* voice_new (void)
 /**
  * @brief Adds a voice to the active voice stack.
  *
- *    @param v Voice to add to the active voice stack.
+ *    @param v Voice to add to the active voice stack, must be from voice_new.
  *    @return 0 on success.
  */
 int voice_add( alVoice* v )
 {
-   alVoice *tv;
+   int slot;
 
-   /* Remove from pool. */
-   if (v->prev != NULL) {
-      tv = v->prev;
-      tv->next = v->next;
-      if (tv->next != NULL)
-         tv->next->prev = tv;
-   }
-   else { /* Set pool to be the next. */
-      voice_pool = v->next;
-      if (voice_pool != NULL)
-         voice_pool->prev = NULL;
-   }
+   slot = v - voice_slots;
 
-   /* Insert to the front of active voices. */
    voiceLock();
-   tv = voice_active;
-   v->next = tv;
-   v->prev = NULL;
-   voice_active = v;
-   if (tv != NULL)
-      tv->prev = v;
+   /* Remove from pool, voice_new always hands out the last free slot. */
+   array_resize( &voice_free, array_size(voice_free)-1 );
+
+   /* Give it a handle and activate it. */
+   v->id     = (v->gen << VOICE_INDEX_BITS) | slot;
+   v->active = array_size(voice_active);
+   array_push_back( &voice_active, slot );
    voiceUnlock();
    return 0;
 }
 
 
+/**
+ * @brief Frees a voice, invalidating its handle.
+ *
+ * Must be called with the voices locked.
+ *
+ *    @param v Voice to free.
+ */
+static void voice_release( alVoice *v )
+{
+   int slot, last;
+
+   slot = v - voice_slots;
+
+   /* Swap the last active voice into its place. */
+   last = voice_active[ array_size(voice_active)-1 ];
+   voice_active[ v->active ] = last;
+   voice_slots[ last ].active = v->active;
+   array_resize( &voice_active, array_size(voice_active)-1 );
+
+   /* Stale handles won't match anymore. */
+   v->id  = 0;
+   v->gen = (v->gen % VOICE_GEN_MAX) + 1;
+   array_push_back( &voice_free, slot );
+}
+
+
 /**
  * @brief Gets a voice by identifier.
  *
+ * Voices are only modified from the main thread so no locking is needed.
+ *
  *    @param id Identifier to look for.
  *    @return Voice matching identifier or NULL if not found.
  */
 alVoice* voice_get( int id )
 {
-   alVoice *v;
+   int slot;
 
-   /* Make sure there are voices. */
-   if (voice_active==NULL)
+   if (id <= 0)
       return NULL;
 
-   voiceLock();
-   for (v=voice_active; v!=NULL; v=v->next)
-      if (v->id == id)
-         break;
-   voiceUnlock();
+   slot = id & VOICE_INDEX_MASK;
+   if ((slot >= array_size(voice_slots)) || (voice_slots[slot].id != id))
+      return NULL;
 
-   return v;
+   return &voice_slots[slot];
+}
+
+
+/**
+ * @brief Compares voice priorities for qsort.
+ */
+static int voice_cmpPrio( const void *p1, const void *p2 )
+{
+   const VoicePrio *v1, *v2;
+   v1 = (const VoicePrio*) p1;
+   v2 = (const VoicePrio*) p2;
+   if (v1->key < v2->key)
+      return -1;
+   else if (v1->key > v2->key)
+      return +1;
+   return v1->slot - v2->slot;
+}
+
+
+/**
+ * @brief Binds the most important voices to sources.
+ *
+ * Voices not relative to the listener are ranked by distance to the listener,
+ * which is what mostly decides how loud they are. Voices that lose their
+ * source keep playing virtually and get resumed at the right offset if they
+ * become important again.
+ */
+static void voice_schedule (void)
+{
+   int i, n, nsources, nvirtual;
+   alVoice *v;
+   VoicePrio *p;
+
+   /* Count the sources voices can use. */
+   n        = array_size(voice_active);
+   nsources = sound_al_freeSources();
+   nvirtual = 0;
+   for (i=0; i<n; i++) {
+      if (voice_slots[ voice_active[i] ].source != 0)
+         nsources++;
+      else
+         nvirtual++;
+   }
+
+   /* Nothing to do if all voices are playing or no source can be used. */
+   if ((nvirtual == 0) || (nsources == 0))
+      return;
+
+   /* Enough sources for everyone. */
+   if (n <= nsources) {
+      for (i=0; i<n; i++) {
+         v = &voice_slots[ voice_active[i] ];
+         if (v->source == 0)
+            sound_al_bindVoice( v );
+      }
+      return;
+   }
+
+   /* Rank the voices. */
+   array_resize( &voice_prio, n );
+   for (i=0; i<n; i++) {
+      p       = &voice_prio[i];
+      p->slot = voice_active[i];
+      v       = &voice_slots[ p->slot ];
+      if (v->relative)
+         p->key = -1.;
+      else
+         p->key = pow2(v->pos[0] - voice_lx) + pow2(v->pos[1] - voice_ly);
+   }
+   qsort( voice_prio, n, sizeof(VoicePrio), voice_cmpPrio );
+
+   /* Free the sources of the least important voices first. */
+   for (i=nsources; i<n; i++)
+      sound_al_unbindVoice( &voice_slots[ voice_prio[i].slot ] );
+   for (i=0; i<nsources; i++) {
+      v = &voice_slots[ voice_prio[i].slot ];
+      if (v->source == 0)
+         sound_al_bindVoice( v );
+   }
 }
 
 
 /**
  * @brief Loads a new sound source from a RWops.
+ *
+ * The RWops can't be read again later, so the sound is decoded right away and
+ * never evicted.
  */
 int source_newRW( SDL_RWops *rw, const char *name, unsigned int flags )
 {
@@ -913,20 +1328,23 @@ int source_newRW( SDL_RWops *rw, const char *name, unsigned int flags )
 
    sndl = &array_grow( &sound_list );
    memcpy( sndl, &snd, sizeof(alSound) );
-   sndl->name = strdup( name );
+   sndl->name   = strdup( name );
+   sndl->pinned = 1;
+   sound_cached += sndl->size;
 
    return sndl-sound_list;
 }
 
 
 /**
- * @brief Loads a new source from a file.
+ * @brief Registers a new source from a file, decoded when first used.
  */
 int source_new( const char* filename, unsigned int flags )
 {
-   SDL_RWops *rw = PHYSFSRWOPS_openRead( filename );
-   int id = source_newRW( rw, filename, flags );
-   SDL_RWclose( rw );
-   return id;
-}
+   (void) flags;
+
+   if (sound_disabled)
+      return -1;
 
+   return sound_register( filename, filename );
+}
@@ -131,7 +131,7 @@ static int al_enableEFX (void);
  * General.
  */
 static ALuint sound_al_getSource (void);
-static int al_playVoice( alVoice *v, alSound *s,
+static void al_playVoice( alVoice *v, alSound *s,
       ALfloat px, ALfloat py, ALfloat vx, ALfloat vy, ALint relative );
 static int sound_al_loadWav( ALuint *buf, SDL_RWops *rw );
 static int sound_al_loadOgg( ALuint *buf, OggVorbis_File *vf );
@@ -742,6 +742,7 @@ int sound_al_load( alSound *snd, SDL_RWops *rw, const char *name )
    }
    else
       snd->length = (double)size / (double)(freq * (bits/8) * channels);
+   snd->size = size;
 
    /* Check for errors. */
    al_checkErr();
@@ -849,16 +850,54 @@ static ALuint sound_al_getSource (void)
 
 
 /**
- * @brief Plays a voice.
+ * @brief Gets the number of free sources voices can be bound to.
+ *
+ *    @return Number of free sources.
+ */
+int sound_al_freeSources (void)
+{
+   return source_nstack;
+}
+
+
+/**
+ * @brief Sets up a voice to play a sound.
+ *
+ * The voice is bound to a source if there is a free one, otherwise it starts
+ * out virtual until the voice scheduler gives it one.
  */
-static int al_playVoice( alVoice *v, alSound *s,
+static void al_playVoice( alVoice *v, alSound *s,
       ALfloat px, ALfloat py, ALfloat vx, ALfloat vy, ALint relative )
 {
-   /* Set up the source and buffer. */
+   v->buffer   = s->buf;
+   v->length   = s->length;
+   v->elapsed  = 0.;
+   v->relative = relative;
+   v->source   = 0;
+
+   /* Update position. */
+   v->pos[0] = px;
+   v->pos[1] = py;
+   v->pos[2] = 0.;
+   v->vel[0] = vx;
+   v->vel[1] = vy;
+   v->vel[2] = 0.;
+
+   sound_al_bindVoice( v );
+}
+
+
+/**
+ * @brief Binds a virtual voice to a free source, resuming where it would be.
+ *
+ *    @param v Voice to bind.
+ *    @return 0 on success, -1 if there are no free sources.
+ */
+int sound_al_bindVoice( alVoice *v )
+{
    v->source = sound_al_getSource();
    if (v->source == 0)
       return -1;
-   v->buffer = s->buf;
 
    soundLock();
 
@@ -866,15 +905,7 @@ static int al_playVoice( alVoice *v, alSound *s,
    alSourcei( v->source, AL_BUFFER, v->buffer );
 
    /* Enable positional sound. */
-   alSourcei( v->source, AL_SOURCE_RELATIVE, relative );
-
-   /* Update position. */
-   v->pos[0] = px;
-   v->pos[1] = py;
-   v->pos[2] = 0.;
-   v->vel[0] = vx;
-   v->vel[1] = vy;
-   v->vel[2] = 0.;
+   alSourcei( v->source, AL_SOURCE_RELATIVE, v->relative );
 
    /* Set up properties. */
    alSourcef(  v->source, AL_GAIN, svolume*svolume_speed );
@@ -884,7 +915,8 @@ static int al_playVoice( alVoice *v, alSound *s,
    /* Defaults just in case. */
    alSourcei( v->source, AL_LOOPING, AL_FALSE );
 
-   /* Start playing. */
+   /* Start playing, skipping what was played virtually. */
+   alSourcef( v->source, AL_SEC_OFFSET, v->elapsed );
    alSourcePlay( v->source );
 
    /* Check for errors. */
@@ -896,6 +928,29 @@ static int al_playVoice( alVoice *v, alSound *s,
 }
 
 
+/**
+ * @brief Takes the source away from a voice, which keeps playing virtually.
+ *
+ *    @param v Voice to unbind.
+ */
+void sound_al_unbindVoice( alVoice *v )
+{
+   if (v->source == 0)
+      return;
+
+   soundLock();
+   alSourceStop( v->source );
+   alSourcei( v->source, AL_BUFFER, AL_NONE );
+   al_checkErr();
+   soundUnlock();
+
+   /* Put source back on the list. */
+   source_stack[source_nstack] = v->source;
+   source_nstack++;
+   v->source = 0;
+}
+
+
 /**
  * @brief Plays a sound.
  *
@@ -905,7 +960,8 @@ static int al_playVoice( alVoice *v, alSound *s,
  */
 int sound_al_play( alVoice *v, alSound *s )
 {
-   return al_playVoice( v, s, 0., 0., 0., 0., AL_TRUE );
+   al_playVoice( v, s, 0., 0., 0., 0., AL_TRUE );
+   return 0;
 }
 
 
@@ -923,7 +979,8 @@ int sound_al_play( alVoice *v, alSound *s )
 int sound_al_playPos( alVoice *v, alSound *s,
             double px, double py, double vx, double vy )
 {
-   return al_playVoice( v, s, px, py, vx, vy, AL_FALSE );
+   al_playVoice( v, s, px, py, vx, vy, AL_FALSE );
+   return 0;
 }
 
 
@@ -951,9 +1008,10 @@ void sound_al_updateVoice( alVoice *v )
 {
    ALint state;
 
-   /* Invalid source, mark to delete. */
+   /* Virtual voice, done once the sound would have finished. */
    if (v->source == 0) {
-      v->state = VOICE_DESTROY;
+      if (v->elapsed >= v->length)
+         v->state = VOICE_STOPPED;
       return;
    }
 
@@ -26,7 +26,12 @@ typedef struct alSound_ {
    char *filename; /**< Name of the file loaded from. */
    char *name; /**< Buffer's name. */
    double length; /**< Length of the buffer. */
-   ALuint buf; /**< Buffer data. */
+   ALuint buf; /**< Buffer data, 0 if not decoded. */
+   size_t size; /**< Size of the decoded buffer in bytes. */
+   unsigned int lastused; /**< When the sound was last used, for eviction. */
+   int pinned; /**< Whether the buffer can't be evicted. */
+   int prefetching; /**< Whether the sound is being decoded on a worker thread. */
+   int failed; /**< Whether the sound failed to decode. */
 } alSound;
 
 
@@ -51,27 +56,23 @@ typedef enum voice_state_ {
  * A voice would be any object that is creating sound.
  */
 typedef struct alVoice_ {
-   struct alVoice_ *prev; /**< Linked list previous member. */
-   struct alVoice_ *next; /**< Linked list next member. */
-
-   int id; /**< Identifier of the voice. */
+   int id; /**< Handle of the voice, 0 if the slot is free. */
+   int gen; /**< Generation of the slot, bumped every time it is freed. */
+   int active; /**< Position in the active voice list. */
 
    voice_state_t state; /**< Current state of the sound. */
    unsigned int flags; /**< Voice flags. */
 
    ALfloat pos[3]; /**< Position of the voice. */
    ALfloat vel[3]; /**< Velocity of the voice. */
-   ALuint source; /**< Source current in use. */
+   ALint relative; /**< Whether the position is relative to the listener. */
+   ALuint source; /**< Source current in use, 0 if the voice is virtual. */
    ALuint buffer; /**< Buffer attached to the voice. */
+   double length; /**< Length of the sound in seconds. */
+   double elapsed; /**< Seconds of the sound played so far. */
 } alVoice;
 
 
-/*
- * Sound list.
- */
-extern alVoice *voice_active; /**< Active voices. */
-
-
 /*
  * Voice management.
  */
@@ -136,6 +137,9 @@ int sound_al_playPos( alVoice *v, alSound *s,
 int sound_al_updatePos( alVoice *v,
       double px, double py, double vx, double vy );
 void sound_al_updateVoice( alVoice *v );
+int sound_al_bindVoice( alVoice *v );
+void sound_al_unbindVoice( alVoice *v );
+int sound_al_freeSources (void);
 
 /*
  * Sound management.
@@ -19,6 +19,7 @@
 
 #include "space.h"
 
+#include "array.h"
 #include "background.h"
 #include "conf.h"
 #include "damagetype.h"
@@ -53,6 +54,7 @@
 #include "rng.h"
 #include "sound.h"
 #include "spfx.h"
+#include "strhash.h"
 #include "toolkit.h"
 #include "weapon.h"
 
@@ -76,6 +78,8 @@
 
 #define ASTEROID_EXPLODE_INTERVAL 5. /**< Interval of asteroids randomly exploding */
 #define ASTEROID_EXPLODE_CHANCE   0.1 /**< Chance of asteroid exploding each interval */
+#define ASTEROID_GRID_CELL        256. /**< Minimum size of a cell of the asteroid grids. */
+#define ASTEROID_GRID_MAX         64 /**< Maximum number of cells per side of the asteroid grids. */
 
 /*
  * planet <-> system name stack
@@ -117,8 +121,31 @@ static nlua_env landing_env = LUA_NOREF; /**< Landing lua env. */
 static int space_fchg = 0; /**< Faction change counter, to avoid unnecessary calls. */
 static int space_simulating = 0; /**< Are we simulating space? */
 glTexture **asteroid_gfx = NULL;
+static int *asteroid_cand = NULL; /**< Results of the last asteroid grid query (array.h). */
 static size_t nasterogfx = 0; /**< Nb of asteroid gfx. */
 
+/*
+ * Presence spill.
+ */
+#define PRESENCE_EPSILON   1e-9 /**< Presence this close to zero after being retracted is dropped. */
+/**
+ * @brief Systems the presence of a system spills into, in breadth first order.
+ */
+typedef struct PresenceSpill_ {
+   int *sys; /**< Systems reached, starting with the system itself. */
+   int *dist; /**< Number of jumps to each system. */
+   int n; /**< Number of systems reached. */
+   int range; /**< Range the spill was computed up to, -1 if not computed. */
+} PresenceSpill;
+static int *presence_off = NULL; /**< Offsets of each system in presence_adj, systems_nstack+1 long. */
+static int *presence_adj = NULL; /**< Targets of the jumps presence spills through. */
+static PresenceSpill *presence_spill = NULL; /**< Cached spill of each system. */
+static int *presence_mark = NULL; /**< Last search each system was reached by. */
+static int presence_search = 0; /**< Current search. */
+static int presence_nsys = 0; /**< Number of systems in the jump graph. */
+static int presence_dirty = 1; /**< Jump graph has to be rebuilt. */
+static int presence_stale = 0; /**< Presences have to be fully recomputed. */
+
 /*
  * fleet spawn rate
  */
@@ -144,6 +171,15 @@ static int space_parseAssets( xmlNodePtr parent, StarSystem* sys );
 /* system load */
 static void system_init( StarSystem *sys );
 static void asteroid_init( Asteroid *ast, AsteroidAnchor *field );
+static void asteroid_gridInit( AsteroidAnchor *field );
+static int asteroid_gridCell( const AsteroidAnchor *field, double x, double y );
+static void asteroid_gridCells( const AsteroidAnchor *field, double x1, double y1,
+      double x2, double y2, int *cx1, int *cy1, int *cx2, int *cy2 );
+static void asteroid_gridUpdate( AsteroidAnchor *field, Asteroid *a );
+static void asteroid_gridCollect( const AsteroidAnchor *field,
+      int cx1, int cy1, int cx2, int cy2 );
+static int asteroid_gridCmp( const void *p1, const void *p2 );
+static void asteroid_gridStart( const AsteroidAnchor *field );
 static void debris_init( Debris *deb );
 static int systems_load (void);
 static int asteroidTypes_load (void);
@@ -157,9 +193,16 @@ static void system_parseAsteroids( const xmlNodePtr parent, StarSystem *sys );
 /* misc */
 static int getPresenceIndex( StarSystem *sys, int faction );
 static void system_scheduler( double dt, int init );
+static void space_prefetchSounds (void);
 static void asteroid_explode ( Asteroid *a, AsteroidAnchor *field, int give_reward );
 /* Render. */
 static void space_renderJumpPoint( JumpPoint *jp, int i );
+/* Presence. */
+static void presence_graphInvalidate (void);
+static void presence_graphBuild (void);
+static void presence_graphFree (void);
+static const PresenceSpill* presence_getSpill( int sysid, int range );
+static void presence_refreshFaction( StarSystem *sys, int range );
 static void space_renderPlanet( Planet *p );
 static void space_renderAsteroid( Asteroid *a );
 static void space_renderDebris( Debris *d, double x, double y );
@@ -286,7 +329,32 @@ int planet_averagePlanetPrice( const Planet *p, const Commodity *c, credits_t *m
  */
 int planet_setFaction( Planet *p, int faction )
 {
+   StarSystem *sys;
+   const char *sysname;
+   int i;
+
+   /* Move the presence over if the planet is in a system. */
+   sys = NULL;
+   if (!systems_loading) {
+      sysname = planet_getSystem( p->name );
+      if (sysname != NULL)
+         sys = system_get( sysname );
+   }
+   if (sys != NULL) {
+      for (i=0; i<sys->nplanets; i++)
+         if (sys->planets[i] == p)
+            break;
+      if (i >= sys->nplanets)
+         sys = NULL;
+   }
+
+   if (sys != NULL)
+      system_addPresence( sys, p->faction, -p->presenceAmount, p->presenceRange );
    p->faction = faction;
+   if (sys != NULL) {
+      system_addPresence( sys, p->faction, p->presenceAmount, p->presenceRange );
+      presence_refreshFaction( sys, p->presenceRange );
+   }
    return 0;
 }
 
@@ -553,12 +621,13 @@ char* space_getRndPlanet( int landable, unsigned int services,
  */
 double system_getClosest( const StarSystem *sys, int *pnt, int *jp, int *ast, int *fie, double x, double y )
 {
-   int i, k;
-   double d, td;
+   int i, k, c;
+   double d, td, r;
    Planet *p;
    JumpPoint *j;
    Asteroid *as;
    AsteroidAnchor *f;
+   int *cand;
 
    /* Default output. */
    *pnt = -1;
@@ -581,10 +650,13 @@ double system_getClosest( const StarSystem *sys, int *pnt, int *jp, int *ast, in
       }
    }
 
-   /* Asteroids. */
-   for (i=0; i<sys->nasteroids; i++) {
-      f = &sys->asteroids[i];
-      for (k=0; k<f->nb; k++) {
+   /* Asteroids, only the ones in range of the player can be targeted. */
+   r = (player.p == NULL) ? 0. : sqrt( pilot_sensorRange() * player.p->ew_detect );
+   for (i=0; (player.p != NULL) && (i<sys->nasteroids); i++) {
+      f    = &sys->asteroids[i];
+      cand = asteroids_queryCircle( f, &player.p->solid->pos, r );
+      for (c=0; c<array_size(cand); c++) {
+         k  = cand[c];
          as = &f->asteroids[k];
 
          /* Skip invisible asteroids */
@@ -851,9 +923,9 @@ StarSystem* system_get( const char* sysname )
    if ( sysname == NULL )
       return NULL;
 
-   for (i=0; i<systems_nstack; i++)
-      if (strcmp(sysname, systems_stack[i].name)==0)
-         return &systems_stack[i];
+   i = strhash_get( STRHASH_SYSTEM, sysname );
+   if (i >= 0)
+      return &systems_stack[i];
 
    WARN(_("System '%s' not found in stack"), sysname);
    return NULL;
@@ -936,9 +1008,9 @@ Planet* planet_get( const char* planetname )
       return NULL;
    }
 
-   for (i=0; i<array_size(planet_stack); i++)
-      if (strcmp(planet_stack[i].name,planetname)==0)
-         return &planet_stack[i];
+   i = strhash_get( STRHASH_PLANET, planetname );
+   if (i >= 0)
+      return &planet_stack[i];
 
    WARN(_("Planet '%s' not found in the universe"), planetname);
    return NULL;
@@ -1443,6 +1515,9 @@ void space_update( const double dt )
                asteroid_explode( a, ast, 1 );
             }
          }
+
+         /* Keep the grid up to date. */
+         asteroid_gridUpdate( ast, a );
       }
 
       x = 0;
@@ -1475,6 +1550,39 @@ void space_update( const double dt )
 }
 
 
+/**
+ * @brief Prefetches the sounds of the weapons of the pilots in the system.
+ */
+static void space_prefetchSounds (void)
+{
+   int i, j, n;
+   Pilot **pilots;
+   const Outfit *o;
+
+   pilots = pilot_getAll( &n );
+   for (i=0; i<n; i++) {
+      for (j=0; j<pilots[i]->noutfits; j++) {
+         o = pilots[i]->outfits[j]->outfit;
+         if (o == NULL)
+            continue;
+         if (outfit_isLauncher(o)) {
+            o = outfit_ammo(o);
+            if (o == NULL)
+               continue;
+         }
+         if (outfit_isBeam(o)) {
+            sound_prefetch( o->u.bem.sound );
+            sound_prefetch( o->u.bem.sound_off );
+         }
+         else {
+            sound_prefetch( outfit_sound(o) );
+            sound_prefetch( outfit_soundHit(o) );
+         }
+      }
+   }
+}
+
+
 /**
  * @brief Initializes the system.
  *
@@ -1561,6 +1669,7 @@ void space_init( const char* sysname )
          a->appearing = ASTEROID_INIT;
          asteroid_init(a, ast);
       }
+      asteroid_gridInit( ast );
       /* Add the debris to the anchor */
       ast->debris = realloc( ast->debris, (ast->ndebris) * sizeof(Debris) );
       for (j=0; j<ast->ndebris; j++) {
@@ -1618,6 +1727,9 @@ void space_init( const char* sysname )
       pilot_rmFlag( player.p, PILOT_INVISIBLE );
    space_simulating = 0;
 
+   /* Start decoding the weapon sounds that will likely be heard. */
+   space_prefetchSounds();
+
    /* Refresh overlay if necessary (player kept it open). */
    ovr_refresh();
 
@@ -1681,6 +1793,303 @@ void asteroid_init( Asteroid *ast, AsteroidAnchor *field )
 }
 
 
+/**
+ * @brief Sets up the spatial index of an asteroid field.
+ *
+ * The grid covers the field and is updated incrementally as the asteroids
+ *  drift. Asteroids that drift out of the grid are kept in an extra cell
+ *  that is checked by every query.
+ *
+ *    @param field Asteroid field to set up the grid of.
+ */
+static void asteroid_gridInit( AsteroidAnchor *field )
+{
+   int i, j, n;
+   AsteroidType *at;
+   glTexture *gfx;
+
+   /* Largest asteroid the field can have. */
+   field->grid_margin = 0.;
+   for (i=0; i<field->ntype; i++) {
+      at = &asteroid_types[ field->type[i] ];
+      for (j=0; j<at->ngfx; j++) {
+         gfx = at->gfxs[j];
+         field->grid_margin = MAX( field->grid_margin,
+               hypot( gfx->sw/2., gfx->sh/2. ) );
+      }
+   }
+
+   /* Geometry, cells grow with large fields. */
+   field->grid_size = ASTEROID_GRID_CELL;
+   while (2.*field->radius >= field->grid_size*ASTEROID_GRID_MAX)
+      field->grid_size *= 2.;
+   field->grid_n = (int)floor( 2.*field->radius / field->grid_size ) + 1;
+   field->grid_x = field->pos.x - field->radius;
+   field->grid_y = field->pos.y - field->radius;
+
+   n = field->grid_n * field->grid_n + 1;
+   field->grid_head = realloc( field->grid_head, sizeof(int) * n );
+   for (i=0; i<n; i++)
+      field->grid_head[i] = -1;
+
+   for (i=0; i<field->nb; i++) {
+      field->asteroids[i].gcell = -1;
+      asteroid_gridUpdate( field, &field->asteroids[i] );
+   }
+}
+
+
+/**
+ * @brief Gets the cell of a position in the grid of an asteroid field.
+ *
+ *    @return Index of the cell, or the extra cell if outside the grid.
+ */
+static int asteroid_gridCell( const AsteroidAnchor *field, double x, double y )
+{
+   double cx, cy;
+
+   cx = floor( (x - field->grid_x) / field->grid_size );
+   cy = floor( (y - field->grid_y) / field->grid_size );
+   if ((cx < 0.) || (cy < 0.) || (cx >= field->grid_n) || (cy >= field->grid_n))
+      return field->grid_n * field->grid_n;
+   return (int)cy * field->grid_n + (int)cx;
+}
+
+
+/**
+ * @brief Gets the range of cells overlapped by a rectangle.
+ *
+ * The rectangle is clamped to the grid, so a rectangle outside the grid
+ *  gives an empty range (cx1 > cx2 or cy1 > cy2).
+ */
+static void asteroid_gridCells( const AsteroidAnchor *field, double x1, double y1,
+      double x2, double y2, int *cx1, int *cy1, int *cx2, int *cy2 )
+{
+   double n;
+
+   n    = field->grid_n;
+   *cx1 = (int)CLAMP( 0., n, floor( (x1 - field->grid_x) / field->grid_size ) );
+   *cy1 = (int)CLAMP( 0., n, floor( (y1 - field->grid_y) / field->grid_size ) );
+   *cx2 = (int)CLAMP( -1., n-1., floor( (x2 - field->grid_x) / field->grid_size ) );
+   *cy2 = (int)CLAMP( -1., n-1., floor( (y2 - field->grid_y) / field->grid_size ) );
+}
+
+
+/**
+ * @brief Moves an asteroid to the cell of its current position.
+ *
+ *    @param field Field the asteroid belongs to.
+ *    @param a Asteroid to update.
+ */
+static void asteroid_gridUpdate( AsteroidAnchor *field, Asteroid *a )
+{
+   int c;
+
+   c = asteroid_gridCell( field, a->pos.x, a->pos.y );
+   if (c == a->gcell)
+      return;
+
+   /* Unlink from the old cell. */
+   if (a->gcell >= 0) {
+      if (a->gprev >= 0)
+         field->asteroids[ a->gprev ].gnext = a->gnext;
+      else
+         field->grid_head[ a->gcell ] = a->gnext;
+      if (a->gnext >= 0)
+         field->asteroids[ a->gnext ].gprev = a->gprev;
+   }
+
+   /* Link to the new one. */
+   a->gcell = c;
+   a->gprev = -1;
+   a->gnext = field->grid_head[c];
+   if (a->gnext >= 0)
+      field->asteroids[ a->gnext ].gprev = a->id;
+   field->grid_head[c] = a->id;
+}
+
+
+/**
+ * @brief Adds the asteroids of a range of cells to the candidates.
+ */
+static void asteroid_gridCollect( const AsteroidAnchor *field,
+      int cx1, int cy1, int cx2, int cy2 )
+{
+   int cx, cy, k;
+
+   for (cy=cy1; cy<=cy2; cy++)
+      for (cx=cx1; cx<=cx2; cx++)
+         for (k=field->grid_head[ cy*field->grid_n + cx ]; k>=0;
+               k=field->asteroids[k].gnext)
+            array_push_back( &asteroid_cand, k );
+}
+
+
+/**
+ * @brief Compares two asteroid indices (for use with qsort).
+ */
+static int asteroid_gridCmp( const void *p1, const void *p2 )
+{
+   return *(const int*)p1 - *(const int*)p2;
+}
+
+
+/**
+ * @brief Starts an asteroid grid query with the asteroids outside the grid.
+ */
+static void asteroid_gridStart( const AsteroidAnchor *field )
+{
+   int k;
+
+   if (asteroid_cand == NULL)
+      asteroid_cand = array_create( int );
+   array_resize( &asteroid_cand, 0 );
+   for (k=field->grid_head[ field->grid_n*field->grid_n ]; k>=0;
+         k=field->asteroids[k].gnext)
+      array_push_back( &asteroid_cand, k );
+}
+
+
+/**
+ * @brief Gets the asteroids of a field that can overlap a rectangle.
+ *
+ * The asteroids are returned by increasing index, which is the order a full
+ *  scan of the field would visit them. Asteroids in all states are returned.
+ *
+ *    @param field Field to look in.
+ *    @param x1 Left border of the rectangle.
+ *    @param y1 Bottom border of the rectangle.
+ *    @param x2 Right border of the rectangle.
+ *    @param y2 Top border of the rectangle.
+ *    @return Indices of the asteroids (array.h), valid until the next query.
+ */
+int *asteroids_queryRect( const AsteroidAnchor *field,
+      double x1, double y1, double x2, double y2 )
+{
+   int i, n, cx1, cy1, cx2, cy2;
+   const Asteroid *a;
+
+   x1 -= field->grid_margin;
+   y1 -= field->grid_margin;
+   x2 += field->grid_margin;
+   y2 += field->grid_margin;
+
+   asteroid_gridStart( field );
+   asteroid_gridCells( field, x1, y1, x2, y2, &cx1, &cy1, &cx2, &cy2 );
+   asteroid_gridCollect( field, cx1, cy1, cx2, cy2 );
+
+   n = 0;
+   for (i=0; i<array_size(asteroid_cand); i++) {
+      a = &field->asteroids[ asteroid_cand[i] ];
+      if ((a->pos.x >= x1) && (a->pos.x <= x2) &&
+            (a->pos.y >= y1) && (a->pos.y <= y2))
+         asteroid_cand[n++] = asteroid_cand[i];
+   }
+   array_resize( &asteroid_cand, n );
+   qsort( asteroid_cand, n, sizeof(int), asteroid_gridCmp );
+   return asteroid_cand;
+}
+
+
+/**
+ * @brief Gets the asteroids of a field that can overlap a circle.
+ *
+ *    @param field Field to look in.
+ *    @param pos Center of the circle.
+ *    @param r Radius of the circle.
+ *    @return Indices of the asteroids (array.h), valid until the next query.
+ *    @sa asteroids_queryRect
+ */
+int *asteroids_queryCircle( const AsteroidAnchor *field,
+      const Vector2d *pos, double r )
+{
+   int i, n, cx1, cy1, cx2, cy2;
+   double rm;
+   const Asteroid *a;
+
+   rm = r + field->grid_margin;
+
+   asteroid_gridStart( field );
+   asteroid_gridCells( field, pos->x-rm, pos->y-rm, pos->x+rm, pos->y+rm,
+         &cx1, &cy1, &cx2, &cy2 );
+   asteroid_gridCollect( field, cx1, cy1, cx2, cy2 );
+
+   n = 0;
+   for (i=0; i<array_size(asteroid_cand); i++) {
+      a = &field->asteroids[ asteroid_cand[i] ];
+      if (vect_dist2( &a->pos, pos ) <= pow2(rm))
+         asteroid_cand[n++] = asteroid_cand[i];
+   }
+   array_resize( &asteroid_cand, n );
+   qsort( asteroid_cand, n, sizeof(int), asteroid_gridCmp );
+   return asteroid_cand;
+}
+
+
+/**
+ * @brief Gets the asteroids of a field that can overlap a segment.
+ *
+ * Only the cells along the segment are visited, one column at a time.
+ *
+ *    @param field Field to look in.
+ *    @param pos Origin of the segment.
+ *    @param dir Direction of the segment.
+ *    @param range Length of the segment.
+ *    @return Indices of the asteroids (array.h), valid until the next query.
+ *    @sa asteroids_queryRect
+ */
+int *asteroids_querySegment( const AsteroidAnchor *field,
+      const Vector2d *pos, double dir, double range )
+{
+   int i, n, cx, cx1, cx2, cy1, cy2, dummy;
+   double m, sx, sy, ex, ey, xa, xb, ya, yb, t, d2;
+   const Asteroid *a;
+
+   m  = field->grid_margin;
+   sx = pos->x;
+   sy = pos->y;
+   ex = sx + range*cos(dir);
+   ey = sy + range*sin(dir);
+   if (ex < sx) {
+      xa = sx; sx = ex; ex = xa;
+      ya = sy; sy = ey; ey = ya;
+   }
+
+   asteroid_gridStart( field );
+   asteroid_gridCells( field, sx-m, sy, ex+m, sy, &cx1, &dummy, &cx2, &dummy );
+   for (cx=cx1; cx<=cx2; cx++) {
+      /* Part of the segment that can touch the column. */
+      xa = MAX( sx, field->grid_x + cx*field->grid_size - m );
+      xb = MIN( ex, field->grid_x + (cx+1)*field->grid_size + m );
+      if (ex == sx) {
+         ya = sy;
+         yb = ey;
+      }
+      else {
+         ya = sy + (xa-sx) * (ey-sy) / (ex-sx);
+         yb = sy + (xb-sx) * (ey-sy) / (ex-sx);
+      }
+      asteroid_gridCells( field, xa, MIN(ya,yb)-m, xb, MAX(ya,yb)+m,
+            &dummy, &cy1, &dummy, &cy2 );
+      asteroid_gridCollect( field, cx, cy1, cx, cy2 );
+   }
+
+   /* Keep the asteroids close enough to the segment. */
+   n = 0;
+   d2 = pow2(ex-sx) + pow2(ey-sy);
+   for (i=0; i<array_size(asteroid_cand); i++) {
+      a = &field->asteroids[ asteroid_cand[i] ];
+      t = (d2 > 0.) ? ((a->pos.x-sx)*(ex-sx) + (a->pos.y-sy)*(ey-sy)) / d2 : 0.;
+      t = CLAMP( 0., 1., t );
+      if (pow2( sx + t*(ex-sx) - a->pos.x ) + pow2( sy + t*(ey-sy) - a->pos.y ) <= pow2(m))
+         asteroid_cand[n++] = asteroid_cand[i];
+   }
+   array_resize( &asteroid_cand, n );
+   qsort( asteroid_cand, n, sizeof(int), asteroid_gridCmp );
+   return asteroid_cand;
+}
+
+
 /**
  * @brief Initializes a debris.
  *    @param deb Debris to initialize.
@@ -1799,6 +2208,10 @@ static int planets_load ( void )
    PHYSFS_freeList( planet_files );
    free(stdList);
 
+   /* Index names. */
+   for (i=0; i<(size_t)array_size(planet_stack); i++)
+      strhash_set( STRHASH_PLANET, planet_stack[i].name, i );
+
    return 0;
 }
 
@@ -2330,7 +2743,7 @@ int system_addPlanet( StarSystem *sys, const char *planetname )
    /* Add the presence. */
    if (!systems_loading) {
       system_addPresence( sys, planet->faction, planet->presenceAmount, planet->presenceRange );
-      system_setFaction(sys);
+      presence_refreshFaction( sys, planet->presenceRange );
    }
 
    /* Reload graphics if necessary. */
@@ -2394,7 +2807,7 @@ int system_rmPlanet( StarSystem *sys, const char *planetname )
       WARN(_("Unable to find planet '%s' and system '%s' in planet<->system stack."),
             planetname, sys->name );
 
-   system_setFaction(sys);
+   presence_refreshFaction( sys, planet->presenceRange );
 
    economy_addQueuedUpdate();
 
@@ -2474,6 +2887,8 @@ int system_rmJump( StarSystem *sys, const char *jumpname )
 
    /* Remove jump from system. */
    sys->njumps--;
+   map_invalidateJumpPaths();
+   presence_graphInvalidate();
 
    /* Refresh presence */
    system_setFaction(sys);
@@ -2641,6 +3056,10 @@ void systems_reconstructJumps (void)
       sys = &systems_stack[i];
       system_reconstructJumps(sys);
    }
+
+   /* Cached jump paths are no longer valid. */
+   map_invalidateJumpPaths();
+   presence_graphInvalidate();
 }
 
 
@@ -3454,6 +3873,10 @@ static int systems_load (void)
       free( file );
    }
 
+   /* Index names, jumps are looked up by name. */
+   for (i=0; i<(size_t)systems_nstack; i++)
+      strhash_set( STRHASH_SYSTEM, systems_stack[i].name, i );
+
    /*
     * Second pass - loads all the jump routes.
     */
@@ -3574,6 +3997,7 @@ void planets_render (void)
       psolid  = pplayer->solid;
 
    /* Render the asteroids & debris. */
+   gl_batchStart();
    for (i=0; i < cur_system->nasteroids; i++) {
       ast = &cur_system->asteroids[i];
       for (j=0; j < ast->nb; j++)
@@ -3588,6 +4012,7 @@ void planets_render (void)
          }
       }
    }
+   gl_batchEnd();
 
    /* Render gatherable stuff. */
    gatherable_render();
@@ -3666,6 +4091,7 @@ static void space_renderAsteroid( Asteroid *a )
    for (i=0; i<at->nmaterial; i++) {
       com = at->material[i];
       gl_blitSprite( com->gfx_space, a->pos.x, a->pos.y-10.*i, 0, 0, NULL );
+      gl_batchFlush(); /* Text isn't batched, icon goes under its label. */
       nsnprintf(c, sizeof(c), "x%i", at->quantity[i]);
       gl_printRaw( &gl_smallFont, nx+10, ny-5-10.*i, &cFontWhite, -1., c );
    }
@@ -3714,6 +4140,8 @@ void space_exit (void)
    for (i=0; i<(int)nasterogfx; i++)
       gl_freeTexture(asteroid_gfx[i]);
    free(asteroid_gfx);
+   array_free(asteroid_cand);
+   asteroid_cand = NULL;
 
    /* Free the names. */
    free(planetname_stack);
@@ -3755,6 +4183,7 @@ void space_exit (void)
       free(pnt->commodityPrice);
    }
    array_free(planet_stack);
+   strhash_clear( STRHASH_PLANET );
 
    /* Free the systems. */
    for (i=0; i < systems_nstack; i++) {
@@ -3774,6 +4203,7 @@ void space_exit (void)
          free(ast->asteroids);
          free(ast->debris);
          free(ast->type);
+         free(ast->grid_head);
       }
       free(sys->asteroids);
       free(sys->astexclude);
@@ -3783,6 +4213,9 @@ void space_exit (void)
    systems_stack = NULL;
    systems_nstack = 0;
    systems_mstack = 0;
+   strhash_clear( STRHASH_SYSTEM );
+   presence_graphFree();
+   presence_stale = 0;
 
    /* Free the asteroid types. */
    for (i=0; i < asteroid_ntypes; i++) {
@@ -4092,9 +4525,157 @@ static int getPresenceIndex( StarSystem *sys, int faction )
 }
 
 
+/**
+ * @brief Marks the jump graph presence spills through as changed.
+ *
+ * Presences are recomputed from scratch by space_updatePresences afterwards.
+ */
+static void presence_graphInvalidate (void)
+{
+   presence_dirty = 1;
+   if (!systems_loading)
+      presence_stale = 1;
+}
+
+
+/**
+ * @brief Builds the jump graph presence spills through.
+ *
+ * Hidden and exit only jumps don't spill presence.
+ */
+static void presence_graphBuild (void)
+{
+   int i, j, n;
+   StarSystem *sys;
+
+   presence_graphFree();
+   presence_nsys  = systems_nstack;
+   presence_off   = malloc( sizeof(int) * (presence_nsys+1) );
+   presence_spill = calloc( presence_nsys, sizeof(PresenceSpill) );
+   presence_mark  = calloc( presence_nsys, sizeof(int) );
+
+   n = 0;
+   for (i=0; i<presence_nsys; i++)
+      n += systems_stack[i].njumps;
+   presence_adj = malloc( sizeof(int) * MAX(1,n) );
+
+   n = 0;
+   for (i=0; i<presence_nsys; i++) {
+      sys = &systems_stack[i];
+      presence_off[i] = n;
+      presence_spill[i].range = -1;
+      for (j=0; j<sys->njumps; j++) {
+         if (jp_isFlag( &sys->jumps[j], JP_HIDDEN ) || jp_isFlag( &sys->jumps[j], JP_EXITONLY ))
+            continue;
+         if ((sys->jumps[j].targetid < 0) || (sys->jumps[j].targetid >= presence_nsys))
+            continue;
+         presence_adj[n++] = sys->jumps[j].targetid;
+      }
+   }
+   presence_off[presence_nsys] = n;
+   presence_search = 0;
+   presence_dirty  = 0;
+}
+
+
+/**
+ * @brief Frees the jump graph presence spills through.
+ */
+static void presence_graphFree (void)
+{
+   int i;
+
+   for (i=0; i<presence_nsys; i++) {
+      free( presence_spill[i].sys );
+      free( presence_spill[i].dist );
+   }
+   free( presence_spill );
+   presence_spill = NULL;
+   free( presence_off );
+   presence_off   = NULL;
+   free( presence_adj );
+   presence_adj   = NULL;
+   free( presence_mark );
+   presence_mark  = NULL;
+   presence_nsys  = 0;
+   presence_dirty = 1;
+}
+
+
+/**
+ * @brief Gets the systems the presence of a system spills into.
+ *
+ * The search is cached per system, so it only runs again when a larger range
+ * is requested or the jumps change.
+ *
+ *    @param sysid System to spill from.
+ *    @param range Spill range needed.
+ *    @return The spill, entries past the range have to be skipped.
+ */
+static const PresenceSpill* presence_getSpill( int sysid, int range )
+{
+   PresenceSpill *sp;
+   int i, j, t;
+
+   if (presence_dirty || (presence_nsys != systems_nstack))
+      presence_graphBuild();
+
+   sp = &presence_spill[ sysid ];
+   if (sp->range >= range)
+      return sp;
+
+   /* Breadth first search, the output doubles as the queue. */
+   sp->sys  = realloc( sp->sys,  sizeof(int) * presence_nsys );
+   sp->dist = realloc( sp->dist, sizeof(int) * presence_nsys );
+   presence_search++;
+   sp->sys[0]  = sysid;
+   sp->dist[0] = 0;
+   sp->n       = 1;
+   presence_mark[ sysid ] = presence_search;
+   for (i=0; (i<sp->n) && (sp->dist[i] < range); i++) {
+      for (j=presence_off[ sp->sys[i] ]; j<presence_off[ sp->sys[i]+1 ]; j++) {
+         t = presence_adj[j];
+         if (presence_mark[t] == presence_search)
+            continue;
+         presence_mark[t]  = presence_search;
+         sp->sys[ sp->n ]  = t;
+         sp->dist[ sp->n ] = sp->dist[i]+1;
+         sp->n++;
+      }
+   }
+   sp->range = range;
+   return sp;
+}
+
+
+/**
+ * @brief Updates the dominant faction of the systems a presence spills into.
+ *
+ *    @param sys System the presence is from.
+ *    @param range Range of the spill.
+ */
+static void presence_refreshFaction( StarSystem *sys, int range )
+{
+   const PresenceSpill *sp;
+   StarSystem *cur;
+   int i;
+
+   range = MAX( 0, range );
+   sp    = presence_getSpill( system_index(sys), range );
+   for (i=0; (i<sp->n) && (sp->dist[i] <= range); i++) {
+      cur = &systems_stack[ sp->sys[i] ];
+      system_setFaction( cur );
+      cur->ownerpresence = system_getPresence( cur, cur->faction );
+   }
+}
+
+
 /**
  * @brief Adds (or removes) some presence to a system.
  *
+ * The presence spills into the systems up to range jumps away, each one
+ * getting amount/(1+jumps).
+ *
  *    @param sys Pointer to the system to add to or remove from.
  *    @param faction The index of the faction to alter presence for.
  *    @param amount The amount of presence to add (negative to subtract).
@@ -4102,8 +4683,8 @@ static int getPresenceIndex( StarSystem *sys, int faction )
  */
 void system_addPresence( StarSystem *sys, int faction, double amount, int range )
 {
-   int i, x, curSpill;
-   Queue q, qn;
+   int i, x;
+   const PresenceSpill *sp;
    StarSystem *cur;
 
    /* Check for NULL and display a warning. */
@@ -4120,76 +4701,20 @@ void system_addPresence( StarSystem *sys, int faction, double amount, int range
    if (amount == 0)
       return;
 
-   /* Add the presence to the current system. */
-   i = getPresenceIndex(sys, faction);
-   sys->presence[i].value += amount;
-
-   /* If there's no range, we're done here. */
-   if (range < 1)
-      return;
-
-   /* Add the spill. */
-   sys->spilled   = 1;
-   curSpill       = 0;
-   q              = q_create();
-   qn             = q_create();
-
-   /* Create the initial queue consisting of sys adjacencies. */
-   for (i=0; i < sys->njumps; i++) {
-      if (sys->jumps[i].target->spilled == 0 && !jp_isFlag( &sys->jumps[i], JP_HIDDEN ) && !jp_isFlag( &sys->jumps[i], JP_EXITONLY )) {
-         q_enqueue( q, sys->jumps[i].target );
-         sys->jumps[i].target->spilled = 1;
+   range = MAX( 0, range );
+   sp    = presence_getSpill( system_index(sys), range );
+   for (i=0; (i<sp->n) && (sp->dist[i] <= range); i++) {
+      cur = &systems_stack[ sp->sys[i] ];
+      x   = getPresenceIndex(cur, faction);
+      cur->presence[x].value += amount / (1 + sp->dist[i]);
+
+      /* Drop what is left after retracting it all, as if it was never added. */
+      if ((amount < 0.) && (fabs(cur->presence[x].value) < PRESENCE_EPSILON)) {
+         cur->npresence--;
+         memmove( &cur->presence[x], &cur->presence[x+1],
+               sizeof(SystemPresence) * (cur->npresence-x) );
       }
    }
-
-   /* If it's empty, something's wrong. */
-   if (q_isEmpty(q)) {
-      /* Means system isn't connected. */
-      /*WARN(_("q is empty after getting adjacencies of %s."), sys->name);*/
-      q_destroy(q);
-      q_destroy(qn);
-      goto sys_cleanup;
-      return;
-   }
-
-   while (curSpill < range) {
-      /* Pull one off the current range queue. */
-      cur = q_dequeue(q);
-
-      /* Ran out of candidates before running out of spill range! */
-      if (cur == NULL)
-         break;
-
-      /* Enqueue all its adjacencies to the next range queue. */
-      for (i=0; i<cur->njumps; i++) {
-         if (cur->jumps[i].target->spilled == 0 && !jp_isFlag( &cur->jumps[i], JP_HIDDEN ) && !jp_isFlag( &cur->jumps[i], JP_EXITONLY )) {
-            q_enqueue( qn, cur->jumps[i].target );
-            cur->jumps[i].target->spilled = 1;
-         }
-      }
-
-      /* Spill some presence. */
-      x = getPresenceIndex(cur, faction);
-      cur->presence[x].value += amount / (2 + curSpill);
-
-      /* Check to see if we've finished this range and grab the next queue. */
-      if (q_isEmpty(q)) {
-         curSpill++;
-         q_destroy(q);
-         q  = qn;
-         qn = q_create();
-      }
-   }
-
-   /* Destroy the queues. */
-   q_destroy(q);
-   q_destroy(qn);
-
-sys_cleanup:
-   /* Clean up our mess. */
-   for (i=0; i < systems_nstack; i++)
-      systems_stack[i].spilled = 0;
-   return;
 }
 
 
@@ -4247,11 +4772,18 @@ void system_addAllPlanetsPresence( StarSystem *sys )
 
 /**
  * @brief Reset the presence of all systems.
+ *
+ * Only needed when the jumps change, planets changing update the presence
+ * incrementally.
  */
 void space_reconstructPresences( void )
 {
    int i;
 
+   /* The jumps may have changed under us. */
+   presence_dirty = 1;
+   presence_stale = 0;
+
    /* Reset the presence in each system. */
    for (i=0; i<systems_nstack; i++) {
       free(systems_stack[i].presence);
@@ -4272,6 +4804,17 @@ void space_reconstructPresences( void )
 }
 
 
+/**
+ * @brief Recomputes the presences if the jumps changed since they were last
+ *        computed.
+ */
+void space_updatePresences( void )
+{
+   if (presence_stale)
+      space_reconstructPresences();
+}
+
+
 /**
  * @brief See if the position is in an asteroid field.
  *
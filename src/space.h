@@ -247,6 +247,9 @@ typedef struct Asteroid_ {
    int type; /**< The ID of the asteroid type */
    int scanned; /**< Wether the player already scanned this asteroid. */
    double armour; /**< Current "armour" of the asteroid. */
+   int gcell; /**< Cell of the field grid the asteroid is in, -1 if none. */
+   int gnext; /**< Next asteroid in the same cell, -1 if last. */
+   int gprev; /**< Previous asteroid in the same cell, -1 if first. */
 } Asteroid;
 extern glTexture **asteroid_gfx; /**< Asteroid graphics list. */
 
@@ -267,6 +270,13 @@ typedef struct AsteroidAnchor_ {
    double area; /**< Field's area. */
    int *type; /**< Types of asteroids. */
    int ntype; /**< Number of types. */
+   /* Spatial index of the asteroids. */
+   double grid_x; /**< Left border of the grid. */
+   double grid_y; /**< Bottom border of the grid. */
+   double grid_size; /**< Size of a cell. */
+   int grid_n; /**< Number of cells per side. */
+   int *grid_head; /**< First asteroid of each cell, the last one holds the asteroids outside the grid. */
+   double grid_margin; /**< Largest distance from the center of an asteroid to its border. */
 } AsteroidAnchor;
 
 
@@ -324,7 +334,6 @@ struct StarSystem_ {
    /* Presence. */
    SystemPresence *presence; /**< Pointer to an array of presences in this system. */
    int npresence; /**< Number of elements in the presence array. */
-   int spilled; /**< If the system has been spilled to yet. */
    double ownerpresence; /**< Amount of presence the owning faction has in a system. */
 
    /* Markers. */
@@ -420,6 +429,7 @@ void system_addPresence( StarSystem *sys, int faction, double amount, int range
 double system_getPresence( StarSystem *sys, int faction );
 void system_addAllPlanetsPresence( StarSystem *sys );
 void space_reconstructPresences( void );
+void space_updatePresences( void );
 void system_rmCurrentPresence( StarSystem *sys, int faction, double amount );
 
 /*
@@ -478,6 +488,12 @@ int space_calcJumpInPos( StarSystem *in, StarSystem *out, Vector2d *pos, Vector2
 void asteroid_hit( Asteroid *a, const Damage *dmg );
 int space_isInField ( Vector2d *p );
 AsteroidType *space_getType ( int ID );
+int *asteroids_queryRect( const AsteroidAnchor *field,
+      double x1, double y1, double x2, double y2 );
+int *asteroids_queryCircle( const AsteroidAnchor *field,
+      const Vector2d *pos, double r );
+int *asteroids_querySegment( const AsteroidAnchor *field,
+      const Vector2d *pos, double dir, double range );
 
 
 /*
@@ -86,24 +86,31 @@ static SPFX_Base *spfx_effects = NULL; /**< Total special effects. */
 
 
 /**
- * @struct SPFX
+ * @struct SPFXLayer
  *
- * @brief An actual in-game active special effect.
+ * @brief A layer of in-game active special effects.
+ *
+ * Stored as parallel arrays so the update loop can run over plain arrays
+ * of doubles and dead effects can be dropped in a single compaction pass.
  */
-typedef struct SPFX_ {
-   Vector2d pos; /**< Current position. */
-   Vector2d vel; /**< Current velocity. */
-
-   int lastframe; /**< Needed when paused */
-   int effect; /**< The real effect */
-
-   double timer; /**< Time left */
-} SPFX;
+typedef struct SPFXLayer_ {
+   double *x; /**< Current X positions. */
+   double *y; /**< Current Y positions. */
+   double *vx; /**< Current X velocities. */
+   double *vy; /**< Current Y velocities. */
+   double *timer; /**< Time left. */
+   int *effect; /**< The real effects. */
+   int *lastframe; /**< Needed when paused. */
+   int n; /**< Number of live effects. */
+   int m; /**< Number of allocated effects. */
+} SPFXLayer;
 
 
 /* front stack is for effects on player, back is for the rest */
-static SPFX *spfx_stack_front = NULL; /**< Frontal special effect layer. */
-static SPFX *spfx_stack_back = NULL; /**< Back special effect layer. */
+static SPFXLayer spfx_stack_front; /**< Frontal special effect layer. */
+static SPFXLayer spfx_stack_back; /**< Back special effect layer. */
+static int *spfx_order = NULL; /**< Render order of a layer, grouped by effect. */
+static int *spfx_count = NULL; /**< Number of effects of each type when rendering. */
 
 
 /*
@@ -112,7 +119,9 @@ static SPFX *spfx_stack_back = NULL; /**< Back special effect layer. */
 /* General. */
 static int spfx_base_parse( SPFX_Base *temp, const xmlNodePtr parent );
 static void spfx_base_free( SPFX_Base *effect );
-static void spfx_update_layer( SPFX *layer, const double dt );
+static void spfx_update_layer( SPFXLayer *layer, const double dt );
+static void spfx_layer_grow( SPFXLayer *layer );
+static void spfx_layer_free( SPFXLayer *layer );
 /* Haptic. */
 static int spfx_hapticInit (void);
 static void spfx_hapticRumble( double mod );
@@ -250,8 +259,9 @@ int spfx_load (void)
    shake_noise = noise_new( 1, NOISE_DEFAULT_HURST, NOISE_DEFAULT_LACUNARITY );
 
    /* Stacks. */
-   spfx_stack_front = array_create( SPFX );
-   spfx_stack_back = array_create( SPFX );
+   memset( &spfx_stack_front, 0, sizeof(SPFXLayer) );
+   memset( &spfx_stack_back, 0, sizeof(SPFXLayer) );
+   spfx_count = calloc( array_size(spfx_effects)+1, sizeof(int) );
 
    return 0;
 }
@@ -269,10 +279,12 @@ void spfx_free (void)
 
    /* get rid of all the particles and free the stacks */
    spfx_clear();
-   array_free(spfx_stack_front);
-   spfx_stack_front = NULL;
-   array_free(spfx_stack_back);
-   spfx_stack_back = NULL;
+   spfx_layer_free( &spfx_stack_front );
+   spfx_layer_free( &spfx_stack_back );
+   free(spfx_order);
+   spfx_order = NULL;
+   free(spfx_count);
+   spfx_count = NULL;
 
    /* now clear the effects */
    for (i=0; i<array_size(spfx_effects); i++)
@@ -300,10 +312,11 @@ void spfx_add( int effect,
       const double vx, const double vy,
       const int layer )
 {
-   SPFX *cur_spfx;
+   SPFXLayer *cur_layer;
    double ttl, anim;
+   int i;
 
-   if ((effect < 0) || (effect > array_size(spfx_effects))) {
+   if ((effect < 0) || (effect >= array_size(spfx_effects))) {
       WARN(_("Trying to add spfx with invalid effect!"));
       return;
    }
@@ -312,25 +325,80 @@ void spfx_add( int effect,
     * Select the Layer
     */
    if (layer == SPFX_LAYER_FRONT) /* front layer */
-      cur_spfx = &array_grow( &spfx_stack_front );
+      cur_layer = &spfx_stack_front;
    else if (layer == SPFX_LAYER_BACK) /* back layer */
-      cur_spfx = &array_grow( &spfx_stack_back );
+      cur_layer = &spfx_stack_back;
    else {
       WARN(_("Invalid SPFX layer."));
       return;
    }
+   if (cur_layer->n >= cur_layer->m)
+      spfx_layer_grow( cur_layer );
+   i = cur_layer->n++;
 
    /* The actual adding of the spfx */
-   cur_spfx->effect = effect;
-   vect_csetmin( &cur_spfx->pos, px, py );
-   vect_csetmin( &cur_spfx->vel, vx, vy );
+   cur_layer->effect[i]    = effect;
+   cur_layer->lastframe[i] = 0;
+   cur_layer->x[i]         = px;
+   cur_layer->y[i]         = py;
+   cur_layer->vx[i]        = vx;
+   cur_layer->vy[i]        = vy;
    /* Timer magic if ttl != anim */
    ttl = spfx_effects[effect].ttl;
    anim = spfx_effects[effect].anim;
    if (ttl != anim)
-      cur_spfx->timer = ttl + RNGF()*anim;
+      cur_layer->timer[i] = ttl + RNGF()*anim;
    else
-      cur_spfx->timer = ttl;
+      cur_layer->timer[i] = ttl;
+}
+
+
+/**
+ * @brief Grows the arrays of a layer.
+ *
+ *    @param layer Layer to grow.
+ */
+static void spfx_layer_grow( SPFXLayer *layer )
+{
+   layer->m += CLAMP( SPFX_CHUNK_MIN, SPFX_CHUNK_MAX, layer->m );
+   layer->x         = realloc( layer->x,         sizeof(double) * layer->m );
+   layer->y         = realloc( layer->y,         sizeof(double) * layer->m );
+   layer->vx        = realloc( layer->vx,        sizeof(double) * layer->m );
+   layer->vy        = realloc( layer->vy,        sizeof(double) * layer->m );
+   layer->timer     = realloc( layer->timer,     sizeof(double) * layer->m );
+   layer->effect    = realloc( layer->effect,    sizeof(int) * layer->m );
+   layer->lastframe = realloc( layer->lastframe, sizeof(int) * layer->m );
+}
+
+
+/**
+ * @brief Frees the arrays of a layer.
+ *
+ *    @param layer Layer to free.
+ */
+static void spfx_layer_free( SPFXLayer *layer )
+{
+   free( layer->x );
+   free( layer->y );
+   free( layer->vx );
+   free( layer->vy );
+   free( layer->timer );
+   free( layer->effect );
+   free( layer->lastframe );
+   memset( layer, 0, sizeof(SPFXLayer) );
+}
+
+
+/**
+ * @brief Gets the number of live special effects.
+ *
+ *    @param[out] front Number of effects on the front layer.
+ *    @param[out] back Number of effects on the back layer.
+ */
+void spfx_stats( int *front, int *back )
+{
+   *front = spfx_stack_front.n;
+   *back  = spfx_stack_back.n;
 }
 
 
@@ -355,8 +423,8 @@ void spfx_clear (void)
  */
 void spfx_update( const double dt )
 {
-   spfx_update_layer( spfx_stack_front, dt );
-   spfx_update_layer( spfx_stack_back, dt );
+   spfx_update_layer( &spfx_stack_front, dt );
+   spfx_update_layer( &spfx_stack_back, dt );
 }
 
 
@@ -366,23 +434,41 @@ void spfx_update( const double dt )
  *    @param layer Layer the spfx is on.
  *    @param dt Current delta tick.
  */
-static void spfx_update_layer( SPFX *layer, const double dt )
+static void spfx_update_layer( SPFXLayer *layer, const double dt )
 {
-   int i;
-
-   for (i=0; i<array_size(layer); i++) {
-      layer[i].timer -= dt; /* less time to live */
+   int i, n;
+   double *restrict x, *restrict y, *restrict timer;
+   const double *restrict vx, *restrict vy;
+
+   /* Integrate, no dependencies between iterations so it vectorizes. */
+   x     = layer->x;
+   y     = layer->y;
+   vx    = layer->vx;
+   vy    = layer->vy;
+   timer = layer->timer;
+   for (i=0; i<layer->n; i++) {
+      timer[i] -= dt; /* less time to live */
+      x[i]     += dt*vx[i];
+      y[i]     += dt*vy[i];
+   }
 
-      /* time to die! */
-      if (layer[i].timer < 0.) {
-         array_erase( &layer, &layer[i], &layer[i+1] );
-         i--;
+   /* Compact the survivors in a single pass, keeping their order. */
+   n = 0;
+   for (i=0; i<layer->n; i++) {
+      if (timer[i] < 0.) /* time to die! */
          continue;
+      if (n != i) {
+         layer->x[n]         = layer->x[i];
+         layer->y[n]         = layer->y[i];
+         layer->vx[n]        = layer->vx[i];
+         layer->vy[n]        = layer->vy[i];
+         layer->timer[n]     = layer->timer[i];
+         layer->effect[n]    = layer->effect[i];
+         layer->lastframe[n] = layer->lastframe[i];
       }
-
-      /* actually update it */
-      vect_cadd( &layer[i].pos, dt*VX(layer[i].vel), dt*VY(layer[i].vel) );
+      n++;
    }
+   layer->n = n;
 }
 
 
@@ -630,8 +716,8 @@ void spfx_cinematic (void)
  */
 void spfx_render( const int layer )
 {
-   SPFX *spfx_stack;
-   int i;
+   SPFXLayer *spfx_stack;
+   int i, j, neffects;
    SPFX_Base *effect;
    int sx, sy;
    double time;
@@ -640,11 +726,11 @@ void spfx_render( const int layer )
    /* get the appropriate layer */
    switch (layer) {
       case SPFX_LAYER_FRONT:
-         spfx_stack = spfx_stack_front;
+         spfx_stack = &spfx_stack_front;
          break;
 
       case SPFX_LAYER_BACK:
-         spfx_stack = spfx_stack_back;
+         spfx_stack = &spfx_stack_back;
          break;
 
       default:
@@ -652,25 +738,44 @@ void spfx_render( const int layer )
          return;
    }
 
+   if (spfx_stack->n <= 0)
+      return;
+
+   /* Group the effects by type with a counting sort, so all the effects
+    * sharing a texture end up in the same batched draw. Newest first within
+    * each type, as before. */
+   neffects = array_size(spfx_effects);
+   spfx_order = realloc( spfx_order, sizeof(int) * spfx_stack->m );
+   memset( spfx_count, 0, sizeof(int) * (neffects+1) );
+   for (i=0; i<spfx_stack->n; i++)
+      spfx_count[ spfx_stack->effect[i]+1 ]++;
+   for (j=0; j<neffects; j++)
+      spfx_count[j+1] += spfx_count[j];
+   for (i=spfx_stack->n-1; i>=0; i--)
+      spfx_order[ spfx_count[ spfx_stack->effect[i] ]++ ] = i;
+
    /* Now render the layer */
-   for (i=array_size(spfx_stack)-1; i>=0; i--) {
-      effect = &spfx_effects[ spfx_stack[i].effect ];
+   gl_batchStart();
+   for (j=0; j<spfx_stack->n; j++) {
+      i = spfx_order[j];
+      effect = &spfx_effects[ spfx_stack->effect[i] ];
 
       /* Simplifies */
       sx = (int)effect->gfx->sx;
       sy = (int)effect->gfx->sy;
 
       if (!paused) { /* don't calculate frame if paused */
-         time = 1. - fmod(spfx_stack[i].timer,effect->anim) / effect->anim;
-         spfx_stack[i].lastframe = sx * sy * MIN(time, 1.);
+         time = 1. - fmod(spfx_stack->timer[i],effect->anim) / effect->anim;
+         spfx_stack->lastframe[i] = sx * sy * MIN(time, 1.);
       }
 
       /* Renders */
       gl_blitSprite( effect->gfx,
-            VX(spfx_stack[i].pos), VY(spfx_stack[i].pos),
-            spfx_stack[i].lastframe % sx,
-            spfx_stack[i].lastframe / sx,
+            spfx_stack->x[i], spfx_stack->y[i],
+            spfx_stack->lastframe[i] % sx,
+            spfx_stack->lastframe[i] / sx,
             NULL );
    }
+   gl_batchEnd();
 }
 
@@ -34,6 +34,7 @@ void spfx_add( const int effect,
 void spfx_update( const double dt );
 void spfx_render( const int layer );
 void spfx_clear (void);
+void spfx_stats( int *front, int *back );
 
 
 /*
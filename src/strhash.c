@@ -0,0 +1,288 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file strhash.c
+ *
+ * @brief Interns strings in an open addressing hash table.
+ *
+ * Every interned string gets a stable id that can be compared instead of the
+ * string. The data stacks (outfits, ships, systems, ...) register their names
+ * here when loaded so looking them up by name doesn't have to go through the
+ * whole stack.
+ */
+
+/** @cond */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "naev.h"
+/** @endcond */
+
+#include "strhash.h"
+
+#include "array.h"
+
+
+#define STRHASH_MINSIZE    1024 /**< Minimum number of slots in the table. */
+
+
+/**
+ * @brief An interned string.
+ */
+typedef struct StrHashEntry_ {
+   char *str; /**< The string itself. */
+   uint32_t hash; /**< Hash of the string. */
+   int index[STRHASH_NSTACKS]; /**< Index of the string in each stack, -1 if not in it. */
+} StrHashEntry;
+
+
+static StrHashEntry *strhash_entries = NULL; /**< Interned strings, indexed by id. */
+static int *strhash_slots = NULL; /**< Open addressing slots with the entry ids, -1 if empty. */
+static uint32_t strhash_nslots = 0; /**< Number of slots, always a power of two. */
+
+
+/* Prototypes. */
+static uint32_t strhash_hash( const char *str );
+static int strhash_lookup( const char *str, uint32_t hash, uint32_t *slot );
+static void strhash_grow (void);
+
+
+/**
+ * @brief Hashes a string (FNV-1a).
+ */
+static uint32_t strhash_hash( const char *str )
+{
+   uint32_t h;
+   const unsigned char *s;
+
+   h = 2166136261u;
+   for (s=(const unsigned char*)str; *s!='\0'; s++) {
+      h ^= *s;
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+/**
+ * @brief Looks up a string in the table.
+ *
+ *    @param str String to look up.
+ *    @param hash Hash of the string.
+ *    @param[out] slot Slot where the string is or should be inserted.
+ *    @return Id of the string or -1 if not interned.
+ */
+static int strhash_lookup( const char *str, uint32_t hash, uint32_t *slot )
+{
+   uint32_t i, mask;
+   int id;
+
+   if (strhash_nslots == 0) {
+      *slot = 0;
+      return -1;
+   }
+
+   /* Linear probing until an empty slot is hit. */
+   mask = strhash_nslots-1;
+   for (i=hash & mask; ; i=(i+1) & mask) {
+      id = strhash_slots[i];
+      if (id < 0)
+         break;
+      if ((strhash_entries[id].hash == hash) &&
+            (strcmp( strhash_entries[id].str, str ) == 0)) {
+         *slot = i;
+         return id;
+      }
+   }
+   *slot = i;
+   return -1;
+}
+
+
+/**
+ * @brief Doubles the number of slots, keeping the load factor under a half.
+ */
+static void strhash_grow (void)
+{
+   uint32_t i, j, mask;
+
+   strhash_nslots = MAX( STRHASH_MINSIZE, 2*strhash_nslots );
+   free( strhash_slots );
+   strhash_slots = malloc( sizeof(int) * strhash_nslots );
+   for (i=0; i<strhash_nslots; i++)
+      strhash_slots[i] = -1;
+
+   /* Reinsert the entries. */
+   mask = strhash_nslots-1;
+   for (i=0; i<(uint32_t)array_size(strhash_entries); i++) {
+      for (j=strhash_entries[i].hash & mask; strhash_slots[j] >= 0; j=(j+1) & mask);
+      strhash_slots[j] = i;
+   }
+}
+
+
+/**
+ * @brief Interns a string.
+ *
+ *    @param str String to intern.
+ *    @return Id of the interned string, stable until strhash_free is called.
+ */
+int strhash_intern( const char *str )
+{
+   StrHashEntry *e;
+   uint32_t hash, slot;
+   int i, id;
+
+   hash = strhash_hash( str );
+   id   = strhash_lookup( str, hash, &slot );
+   if (id >= 0)
+      return id;
+
+   if (strhash_entries == NULL)
+      strhash_entries = array_create( StrHashEntry );
+   id      = array_size( strhash_entries );
+   e       = &array_grow( &strhash_entries );
+   e->str  = strdup( str );
+   e->hash = hash;
+   for (i=0; i<STRHASH_NSTACKS; i++)
+      e->index[i] = -1;
+
+   /* Insert, growing the table when over half full. */
+   if (2*(uint32_t)array_size(strhash_entries) > strhash_nslots)
+      strhash_grow();
+   else
+      strhash_slots[slot] = id;
+
+   return id;
+}
+
+
+/**
+ * @brief Gets the id of a string without interning it.
+ *
+ *    @param str String to look up.
+ *    @return Id of the interned string or -1 if it's not interned.
+ */
+int strhash_find( const char *str )
+{
+   uint32_t slot;
+   return strhash_lookup( str, strhash_hash( str ), &slot );
+}
+
+
+/**
+ * @brief Gets the string from an interned id.
+ *
+ *    @param id Id of the string to get.
+ *    @return The interned string.
+ */
+const char *strhash_str( int id )
+{
+   return strhash_entries[id].str;
+}
+
+
+/**
+ * @brief Registers the index of a name in a stack.
+ *
+ * If the name is already registered in the stack the first index is kept, to
+ * match a linear search over the stack.
+ *
+ *    @param stack Stack to register in.
+ *    @param name Name to register.
+ *    @param index Index of the element in the stack.
+ */
+void strhash_set( StrHashStack stack, const char *name, int index )
+{
+   StrHashEntry *e;
+
+   if (name == NULL)
+      return;
+
+   e = &strhash_entries[ strhash_intern( name ) ];
+   if ((e->index[stack] < 0) || (index < e->index[stack]))
+      e->index[stack] = index;
+}
+
+
+/**
+ * @brief Unregisters the index of a name in a stack.
+ *
+ *    @param stack Stack to unregister from.
+ *    @param name Name to unregister.
+ *    @param index Index the name had in the stack.
+ */
+void strhash_unset( StrHashStack stack, const char *name, int index )
+{
+   int id;
+
+   if (name == NULL)
+      return;
+
+   id = strhash_find( name );
+   if ((id >= 0) && (strhash_entries[id].index[stack] == index))
+      strhash_entries[id].index[stack] = -1;
+}
+
+
+/**
+ * @brief Gets the index of a name in a stack.
+ *
+ *    @param stack Stack to look in.
+ *    @param name Name to look up.
+ *    @return Index of the element in the stack or -1 if not found.
+ */
+int strhash_get( StrHashStack stack, const char *name )
+{
+   int id;
+
+   if (name == NULL)
+      return -1;
+
+   id = strhash_find( name );
+   if (id < 0)
+      return -1;
+   return strhash_entries[id].index[stack];
+}
+
+
+/**
+ * @brief Unregisters all the names of a stack.
+ *
+ * Interned ids stay valid.
+ *
+ *    @param stack Stack to clear.
+ */
+void strhash_clear( StrHashStack stack )
+{
+   int i;
+
+   if (strhash_entries == NULL)
+      return;
+
+   for (i=0; i<array_size(strhash_entries); i++)
+      strhash_entries[i].index[stack] = -1;
+}
+
+
+/**
+ * @brief Frees all the interned strings.
+ */
+void strhash_free (void)
+{
+   int i;
+
+   if (strhash_entries == NULL)
+      return;
+
+   for (i=0; i<array_size(strhash_entries); i++)
+      free( strhash_entries[i].str );
+   array_free( strhash_entries );
+   strhash_entries = NULL;
+   free( strhash_slots );
+   strhash_slots  = NULL;
+   strhash_nslots = 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef STRHASH_H
+#  define STRHASH_H
+
+
+/**
+ * @brief Stacks that register their names in the string hash.
+ */
+typedef enum StrHashStack_ {
+   STRHASH_OUTFIT, /**< Outfit stack. */
+   STRHASH_SHIP, /**< Ship stack. */
+   STRHASH_SYSTEM, /**< Star system stack. */
+   STRHASH_PLANET, /**< Planet stack. */
+   STRHASH_FACTION, /**< Faction stack. */
+   STRHASH_MISSION, /**< Mission stack. */
+   STRHASH_NSTACKS /**< Number of stacks, not a real stack. */
+} StrHashStack;
+
+
+/*
+ * Interned strings.
+ */
+int strhash_intern( const char *str );
+int strhash_find( const char *str );
+const char *strhash_str( int id );
+
+
+/*
+ * Stack indices.
+ */
+void strhash_set( StrHashStack stack, const char *name, int index );
+void strhash_unset( StrHashStack stack, const char *name, int index );
+int strhash_get( StrHashStack stack, const char *name );
+void strhash_clear( StrHashStack stack );
+void strhash_free (void);
+
+
+#endif /* STRHASH_H */
@@ -602,8 +602,9 @@ void vpool_wait( ThreadQueue *queue )
       threadpool_newJob( vpool_worker, &arg[i] );
    }
 
-   /* Wait for the threads to finish */
-   SDL_CondWait( cond, mutex );
+   /* Wait for the threads to finish, nothing to wait for if empty. */
+   if (cnt > 0)
+      SDL_CondWait( cond, mutex );
    SDL_mutexV( mutex );
 
    /* Clean up */
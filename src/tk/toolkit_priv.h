@@ -185,6 +185,15 @@ typedef struct Window_ {
    int focus; /**< Current focused widget. */
    Widget *widgets; /**< Widget storage. */
    void *udata; /**< Custom data of the window. */
+
+   /* Render cache. */
+   int dirty; /**< Window must be rendered to the cache again. */
+   GLuint fbo; /**< Framebuffer the window is cached in, 0 if not cached. */
+   GLuint fbo_tex; /**< Texture attached to the framebuffer. */
+   int fbo_x; /**< X position of the cache in real pixels. */
+   int fbo_y; /**< Y position of the cache in real pixels. */
+   int fbo_w; /**< Width of the cache in real pixels. */
+   int fbo_h; /**< Height of the cache in real pixels. */
 } Window;
 
 
@@ -195,12 +204,14 @@ void toolkit_setWindowPos( Window *wdw, int x, int y );
 int toolkit_inputWindow( Window *wdw, SDL_Event *event, int purge );
 void window_render( Window* w );
 void window_renderOverlay( Window* w );
+void window_dirty( Window *w );
 
 
 /* Widget stuff. */
 Widget* window_newWidget( Window* w, const char *name );
 void widget_cleanup( Widget *widget );
 Widget* window_getwgt( const unsigned int wid, const char* name );
+void widget_dirty( Widget *wgt );
 void toolkit_setPos( Window *wdw, Widget *wgt, int x, int y );
 void toolkit_focusSanitize( Window *wdw );
 void toolkit_focusClear( Window *wdw );
@@ -152,6 +152,7 @@ void window_disableButton( const unsigned int wid, const char* name )
 
    /* Disable button. */
    wgt->dat.btn.disabled = 1;
+   widget_dirty( wgt );
 
    /* Sanitize focus. */
    wdw = window_wget(wid);
@@ -197,6 +198,7 @@ void window_enableButton( const unsigned int wid, const char *name )
    /* Enable button. */
    wgt->dat.btn.disabled = 0;
    wgt_setFlag(wgt, WGT_FLAG_CANFOCUS);
+   widget_dirty( wgt );
 }
 
 
@@ -219,6 +221,7 @@ void window_buttonCaption( const unsigned int wid, const char *name, const char
 
    free(wgt->dat.btn.display);
    wgt->dat.btn.display = strdup(display);
+   widget_dirty( wgt );
 
    if (wgt->dat.btn.key != 0)
       btn_updateHotkey(wgt);
@@ -110,6 +110,7 @@ void window_checkboxCaption( const unsigned int wid, const char *name, char *dis
 
    free(wgt->dat.chk.display);
    wgt->dat.chk.display = strdup(display);
+   widget_dirty( wgt );
 }
 
 
@@ -143,6 +144,7 @@ int window_checkboxSet( const unsigned int wid, const char *name, int state )
       return -1;
 
    wgt->dat.chk.state = state;
+   widget_dirty( wgt );
    return wgt->dat.chk.state;
 }
 
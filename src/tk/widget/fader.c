@@ -254,6 +254,8 @@ double window_getFaderValue( const unsigned int wid, char* name )
  */
 static void fad_setValue( Widget *fad, double value )
 {
+   widget_dirty( fad );
+
    /* Set value. */
    fad->dat.fad.value  = value * (fad->dat.fad.max - fad->dat.fad.min);
    fad->dat.fad.value += fad->dat.fad.min;
@@ -154,6 +154,7 @@ void window_modifyImage( const unsigned int wid,
 
    /* Set the image. */
    wgt->dat.img.image = image;
+   widget_dirty( wgt );
 
    /* Adjust size. */
    if (w >= 0)
@@ -188,6 +189,7 @@ void window_imgColour( const unsigned int wid,
 
    /* Set the colour. */
    wgt->dat.img.colour = *colour;
+   widget_dirty( wgt );
 }
 
 
@@ -214,6 +216,7 @@ void window_modifyImageLayers( const unsigned int wid,
    img_freeLayers( wgt );
    wgt->dat.img.layers  = layers;
    wgt->dat.img.nlayers = n;
+   widget_dirty( wgt );
 }
 
 
@@ -736,6 +736,7 @@ int toolkit_setImageArray( const unsigned int wid, const char* name, char* elem
    Widget *wgt = iar_getWidget( wid, name );
    if (wgt == NULL)
       return -1;
+   widget_dirty( wgt );
 
    /* Case NULL. */
    if (elem == NULL) {
@@ -797,6 +798,8 @@ int toolkit_setImageArrayOffset( const unsigned int wid, const char* name, doubl
    if (wgt == NULL)
       return -1;
 
+   widget_dirty( wgt );
+
    /* Get dimensions. */
    hmax = iar_maxPos( wgt );
 
@@ -831,6 +834,7 @@ int toolkit_setImageArrayPos( const unsigned int wid, const char* name, int pos
 
    /* Set position. */
    wgt->dat.iar.selected = CLAMP( 0, wgt->dat.iar.nelements-1, pos );
+   widget_dirty( wgt );
 
    /* Call callback - dangerous if called from within callback. */
    if (wgt->dat.iar.fptr != NULL)
@@ -876,6 +880,7 @@ int toolkit_unsetSelection( const unsigned int wid, const char *name )
 
   /* unset the selection */
   wgt->dat.iar.selected = -1;
+  widget_dirty( wgt );
 
   return 0;
 }
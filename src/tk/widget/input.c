@@ -612,6 +612,7 @@ char* window_setInput( const unsigned int wid, char* name, const char *msg )
       WARN("Trying to set input on non-input widget '%s'.", name);
       return NULL;
    }
+   widget_dirty( wgt );
 
    /* Set the message. */
    if (msg == NULL) {
@@ -478,6 +478,7 @@ char* toolkit_setList( const unsigned int wid, const char* name, char* value )
    for (i=0; i<wgt->dat.lst.noptions; i++) {
       if (strcmp(wgt->dat.lst.options[i],value)==0) {
          wgt->dat.lst.selected = i;
+         widget_dirty( wgt );
          lst_scroll( wgt, 0 ); /* checks boundaries and triggers callback */
          return value;
       }
@@ -498,6 +499,7 @@ char* toolkit_setListPos( const unsigned int wid, const char* name, int pos )
 
    /* Set by pos. */
    wgt->dat.lst.selected = CLAMP( 0, wgt->dat.lst.noptions-1, pos );
+   widget_dirty( wgt );
    lst_scroll( wgt, 0 ); /* checks boundaries and triggers callback */
    return wgt->dat.lst.options[ wgt->dat.lst.selected ];
 }
@@ -543,6 +545,7 @@ int toolkit_setListOffset( const unsigned int wid, const char* name, int off )
       return -1;
 
    wgt->dat.lst.pos = off;
+   widget_dirty( wgt );
    return 0;
 }
 
@@ -507,6 +507,7 @@ int window_tabWinSetActive( const unsigned int wid, const char *tab, int active
 
    /* Set active window. */
    wgt->dat.tab.active = active;
+   widget_dirty( wgt );
 
    /* Create event. */
    if (wgt->dat.tab.onChange != NULL)
@@ -571,6 +572,7 @@ int window_tabSetFont( const unsigned int wid, const char *tab, const glFont *fo
       return -1;
 
    wgt->dat.tab.font = font;
+   widget_dirty( wgt );
    for (i=0; i<wgt->dat.tab.ntabs; i++)
       wgt->dat.tab.namelen[i]  = gl_printWidthRaw( wgt->dat.tab.font,
             wgt->dat.tab.tabnames[i] );
@@ -11,6 +11,7 @@
 /* TODO: better rendering with static VBO and smooth corners */
 
 /** @cond */
+#include <math.h>
 #include <stdarg.h>
 
 #include "naev.h"
@@ -30,6 +31,8 @@
 #define INPUT_DELAY      conf.repeat_delay /**< Delay before starting to repeat. */
 #define INPUT_FREQ       conf.repeat_freq /**< Interval between repetition. */
 
+#define CACHE_MARGIN     8 /**< Margin around the window kept in its render cache, for outlines. */
+
 
 static unsigned int genwid = 0; /**< Generates unique window ids, > 0 */
 
@@ -77,6 +80,13 @@ static gl_vbo *toolkit_vbo; /**< Toolkit VBO. */
 static GLsizei toolkit_vboColourOffset; /**< Colour offset. */
 
 
+/*
+ * Render cache.
+ */
+static int toolkit_cacheFailed = 0; /**< Framebuffers are not usable, render windows directly. */
+static int toolkit_caching = 0; /**< Rendering to a cache, custom widgets are drawn live instead. */
+
+
 /*
  * static prototypes
  */
@@ -92,6 +102,11 @@ static Widget* toolkit_getFocus( Window *wdw );
 static void toolkit_expose( Window *wdw, int expose );
 /* render */
 static void window_renderBorder( Window* w );
+static void window_renderLive( Window *w );
+static int window_isDirty( Window *w, int clean );
+static int window_cacheCreate( Window *w, int fw, int fh );
+static void window_cacheFree( Window *w );
+static int window_renderCache( Window *w );
 /* Death. */
 static void widget_kill( Widget *wgt );
 static void window_kill( Window *wdw );
@@ -139,6 +154,8 @@ void toolkit_setPos( Window *wdw, Widget *wgt, int x, int y )
       wgt->y = wdw->h - wgt->h + y;
    else
       wgt->y = (double) y;
+
+   window_dirty( wdw );
 }
 
 
@@ -249,6 +266,7 @@ Widget* window_newWidget( Window* w, const char *name )
    /* NULL protection. */
    if (w==NULL)
       return NULL;
+   window_dirty( w );
 
    /* Try to find one with the same name first. */
    wlast = NULL;
@@ -358,6 +376,35 @@ Widget* window_getwgt( const unsigned int wid, const char* name )
 }
 
 
+/**
+ * @brief Marks a window as having to be rendered again.
+ *
+ *    @param w Window that changed.
+ */
+void window_dirty( Window *w )
+{
+   w->dirty = 1;
+}
+
+
+/**
+ * @brief Marks the window of a widget as having to be rendered again.
+ *
+ * Has to be called by anything that changes how a widget looks, outside of
+ *  input which already marks the window.
+ *
+ *    @param wgt Widget that changed.
+ */
+void widget_dirty( Widget *wgt )
+{
+   Window *w;
+
+   w = window_wget( wgt->wdw );
+   if (w != NULL)
+      window_dirty( w );
+}
+
+
 /**
  * @brief Gets the dimensions of a window.
  *
@@ -515,6 +562,7 @@ void window_resizeWidget( const unsigned int wid,
    /* Set position. */
    wgt->w = w;
    wgt->h = h;
+   window_dirty( wdw );
 }
 
 
@@ -570,6 +618,7 @@ int window_setDisplayname( const unsigned int wid, const char *displayname )
    wdw->displayname = NULL;
    if (displayname != NULL)
       wdw->displayname  = strdup(displayname);
+   window_dirty( wdw );
    return 0;
 }
 
@@ -650,6 +699,7 @@ unsigned int window_createFlags( const char* name, const char *displayname,
    wdw->yrel         = -1.;
    wdw->flags        = flags;
    wdw->exposed      = !window_isFlag(wdw, WINDOW_NOFOCUS);
+   wdw->dirty        = 1;
 
    /* Dimensions. */
    wdw->w            = (w == -1) ? SCREEN_W : (double) w;
@@ -877,6 +927,7 @@ void window_setBorder( unsigned int wid, int enable )
       window_rmFlag( wdw, WINDOW_NOBORDER );
    else
       window_setFlag( wdw, WINDOW_NOBORDER );
+   window_dirty( wdw );
 }
 
 
@@ -1034,6 +1085,7 @@ static void window_kill( Window *wdw )
       wgt = wgtkill->next;
       widget_kill(wgtkill);
    }
+   window_cacheFree( wdw );
    free(wdw);
 
    /* Clear key repeat, since toolkit could miss the keyup event. */
@@ -1102,6 +1154,7 @@ void window_destroyWidget( unsigned int wid, const char* wgtname )
    window_dead = 1;
    wgt_rmFlag( wgt, WGT_FLAG_FOCUSED );
    wgt_setFlag( wgt, WGT_FLAG_KILL );
+   window_dirty( wdw );
 }
 
 
@@ -1445,11 +1498,15 @@ void window_render( Window *w )
       window_renderBorder(w);
 
    /*
-    * widgets
+    * widgets, custom ones are drawn over the cache by window_renderLive
     */
-   for (wgt=w->widgets; wgt!=NULL; wgt=wgt->next)
-      if ((wgt->render != NULL) && !wgt_isFlag(wgt, WGT_FLAG_KILL))
-         wgt->render( wgt, x, y );
+   for (wgt=w->widgets; wgt!=NULL; wgt=wgt->next) {
+      if ((wgt->render == NULL) || wgt_isFlag(wgt, WGT_FLAG_KILL))
+         continue;
+      if (toolkit_caching && (wgt->type == WIDGET_CUST))
+         continue;
+      wgt->render( wgt, x, y );
+   }
 
    /*
     * focused widget
@@ -1517,6 +1574,213 @@ void toolkit_drawScrollbar( int x, int y, int w, int h, double pos )
 }
 
 
+/**
+ * @brief Renders the custom widgets left out of a window's cache.
+ *
+ * Custom widgets draw whatever they want each frame, so they (also inside
+ *  tabbed windows) are drawn directly over the cached window.
+ *
+ *    @param w Window to render custom widgets of.
+ */
+static void window_renderLive( Window *w )
+{
+   Widget *wgt;
+   Window *wtab;
+
+   if (window_isFlag( w, WINDOW_KILL ))
+      return;
+
+   for (wgt=w->widgets; wgt!=NULL; wgt=wgt->next) {
+      if (wgt_isFlag( wgt, WGT_FLAG_KILL ))
+         continue;
+      if ((wgt->type == WIDGET_CUST) && (wgt->render != NULL))
+         wgt->render( wgt, w->x, w->y );
+      else if (wgt->type == WIDGET_TABBEDWINDOW) {
+         wtab = window_wget( wgt->dat.tab.windows[ wgt->dat.tab.active ] );
+         if (wtab != NULL)
+            window_renderLive( wtab );
+      }
+   }
+}
+
+
+/**
+ * @brief Checks to see if a window or the tabs it shows have changed.
+ *
+ *    @param w Window to check.
+ *    @param clean Whether or not to clear the dirty flags.
+ *    @return 1 if the window has to be rendered again.
+ */
+static int window_isDirty( Window *w, int clean )
+{
+   Widget *wgt;
+   Window *wtab;
+   int dirty;
+
+   dirty = w->dirty;
+   if (clean)
+      w->dirty = 0;
+
+   for (wgt=w->widgets; wgt!=NULL; wgt=wgt->next) {
+      if (wgt->type != WIDGET_TABBEDWINDOW)
+         continue;
+      wtab = window_wget( wgt->dat.tab.windows[ wgt->dat.tab.active ] );
+      if (wtab != NULL)
+         dirty |= window_isDirty( wtab, clean );
+   }
+   return dirty;
+}
+
+
+/**
+ * @brief Creates the framebuffer a window is cached in.
+ *
+ *    @param w Window to create cache of.
+ *    @param fw Width of the cache in real pixels.
+ *    @param fh Height of the cache in real pixels.
+ *    @return 0 on success.
+ */
+static int window_cacheCreate( Window *w, int fw, int fh )
+{
+   GLint fbo;
+   GLenum status;
+
+   window_cacheFree( w );
+
+   /* Texture to render to. */
+   glGenTextures( 1, &w->fbo_tex );
+   glBindTexture( GL_TEXTURE_2D, w->fbo_tex );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+   glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, fw, fh, 0,
+         GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+   glBindTexture( GL_TEXTURE_2D, 0 );
+
+   /* Framebuffer. */
+   glGetIntegerv( GL_FRAMEBUFFER_BINDING, &fbo );
+   glGenFramebuffers( 1, &w->fbo );
+   glBindFramebuffer( GL_FRAMEBUFFER, w->fbo );
+   glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+         GL_TEXTURE_2D, w->fbo_tex, 0 );
+   status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+   glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+   gl_checkErr();
+
+   if (status != GL_FRAMEBUFFER_COMPLETE) {
+      WARN(_("Unable to create framebuffer for window '%s', windows will not be cached."),
+            w->name );
+      window_cacheFree( w );
+      toolkit_cacheFailed = 1;
+      return -1;
+   }
+
+   w->fbo_w = fw;
+   w->fbo_h = fh;
+   return 0;
+}
+
+
+/**
+ * @brief Frees the render cache of a window.
+ *
+ *    @param w Window to free cache of.
+ */
+static void window_cacheFree( Window *w )
+{
+   if (w->fbo != 0) {
+      glDeleteFramebuffers( 1, &w->fbo );
+      w->fbo = 0;
+   }
+   if (w->fbo_tex != 0) {
+      glDeleteTextures( 1, &w->fbo_tex );
+      w->fbo_tex = 0;
+   }
+}
+
+
+/**
+ * @brief Renders a window through its cache.
+ *
+ * The window is only rendered to the cache when it's dirty, otherwise the
+ *  cached texture is just drawn. Custom widgets and overlays are not cached.
+ *
+ *    @param w Window to render.
+ *    @return 0 on success, nonzero if the window has to be rendered directly.
+ */
+static int window_renderCache( Window *w )
+{
+   int x1, y1, x2, y2;
+   GLint fbo;
+   glTexture tex;
+
+   if (toolkit_cacheFailed)
+      return -1;
+
+   /* Area of the window in real pixels, clipped to the screen. */
+   x1 = MAX( 0, floor( (w->x - CACHE_MARGIN + gl_screen.x) / gl_screen.mxscale ) );
+   y1 = MAX( 0, floor( (w->y - CACHE_MARGIN + gl_screen.y) / gl_screen.myscale ) );
+   x2 = MIN( gl_screen.rw,
+         ceil( (w->x + w->w + CACHE_MARGIN + gl_screen.x) / gl_screen.mxscale ) );
+   y2 = MIN( gl_screen.rh,
+         ceil( (w->y + w->h + CACHE_MARGIN + gl_screen.y) / gl_screen.myscale ) );
+   if ((x2 <= x1) || (y2 <= y1))
+      return 0;
+
+   /* Recreate the cache if the window was resized or moved. */
+   if ((w->fbo == 0) || (x2-x1 != w->fbo_w) || (y2-y1 != w->fbo_h)) {
+      if (window_cacheCreate( w, x2-x1, y2-y1 ))
+         return -1;
+      w->dirty = 1;
+   }
+   if ((x1 != w->fbo_x) || (y1 != w->fbo_y)) {
+      w->fbo_x = x1;
+      w->fbo_y = y1;
+      w->dirty = 1;
+   }
+
+   /* Render to the cache, shifting the viewport so the window lands on it.
+    * Alpha is accumulated premultiplied so drawing the cache blends the same
+    * as drawing the window directly. */
+   if (window_isDirty( w, 1 )) {
+      glGetIntegerv( GL_FRAMEBUFFER_BINDING, &fbo );
+      glBindFramebuffer( GL_FRAMEBUFFER, w->fbo );
+      glViewport( -w->fbo_x, -w->fbo_y, gl_screen.rw, gl_screen.rh );
+      gl_clipOffset( w->fbo_x, w->fbo_y );
+      glClearColor( 0., 0., 0., 0. );
+      glClear( GL_COLOR_BUFFER_BIT );
+      glClearColor( 0., 0., 0., 1. );
+      glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+            GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+
+      toolkit_caching = 1;
+      window_render( w );
+      toolkit_caching = 0;
+
+      glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+      gl_clipOffset( 0, 0 );
+      glViewport( 0, 0, gl_screen.rw, gl_screen.rh );
+      glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+   }
+
+   /* Draw the cache. */
+   memset( &tex, 0, sizeof(glTexture) );
+   tex.texture = w->fbo_tex;
+   glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+   gl_blitTexture( &tex,
+         w->fbo_x * gl_screen.mxscale - gl_screen.x,
+         w->fbo_y * gl_screen.myscale - gl_screen.y,
+         w->fbo_w * gl_screen.mxscale, w->fbo_h * gl_screen.myscale,
+         0., 0., 1., 1., NULL, 0. );
+   glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+   window_renderLive( w );
+
+   return 0;
+}
+
+
 /**
  * @brief Renders the windows.
  */
@@ -1528,7 +1792,8 @@ void toolkit_render (void)
    for (w = windows; w!=NULL; w = w->next) {
       if (!window_isFlag(w, WINDOW_NORENDER) &&
             !window_isFlag(w, WINDOW_KILL)) {
-         window_render(w);
+         if (window_renderCache(w))
+            window_render(w);
          window_renderOverlay(w);
       }
    }
@@ -1563,6 +1828,9 @@ int toolkit_inputWindow( Window *wdw, SDL_Event *event, int purge )
    int ret;
    Widget *wgt;
 
+   /* Widgets may change their look on any input (hover, scrolling, ...). */
+   window_dirty( wdw );
+
    /* See if widget needs event. */
    for (wgt=wdw->widgets; wgt!=NULL; wgt=wgt->next) {
       if (wgt_isFlag( wgt, WGT_FLAG_RAWINPUT )) {
@@ -2125,6 +2393,7 @@ static void toolkit_expose( Window *wdw, int expose )
       return;
    else
       wdw->exposed = expose;
+   window_dirty( wdw );
 
    if (expose)
       toolkit_focusSanitize( wdw );
@@ -2150,6 +2419,7 @@ void toolkit_focusClear( Window *wdw )
 
    if (wdw->focus == -1)
       return;
+   window_dirty( wdw );
 
    for (wgt=wdw->widgets; wgt!=NULL; wgt=wgt->next) {
       if (wdw->focus == wgt->id)
@@ -2275,6 +2545,7 @@ void toolkit_focusWidget( Window *wdw, Widget *wgt )
 
    wdw->focus = wgt->id;
    wgt_setFlag( wgt, WGT_FLAG_FOCUSED );
+   window_dirty( wdw );
    if (wgt->focusGain != NULL)
       wgt->focusGain( wgt );
 }
@@ -2497,6 +2768,9 @@ void toolkit_reposition (void)
    int i, xorig, yorig, xdiff, ydiff;
 
    for (w = windows; w != NULL; w = w->next) {
+      /* Cache has to be redone at the new resolution. */
+      window_dirty( w );
+
       /* Fullscreen windows must always be full size, though their widgets
        * don't auto-scale. */
       if (window_isFlag( w, WINDOW_FULLSCREEN )) {
@@ -22,6 +22,7 @@
 #include "unidiff.h"
 
 #include "array.h"
+#include "cond.h"
 #include "economy.h"
 #include "fleet.h"
 #include "log.h"
@@ -34,6 +35,11 @@
 
 #define CHUNK_SIZE      32 /**< Size of chunk to allocate. */
 
+#define DIFF_DIRTY_PRESENCE   (1<<0) /**< Presences may have to be recomputed. */
+#define DIFF_DIRTY_OVERLAY    (1<<1) /**< Overlay map has to be refreshed. */
+#define DIFF_DIRTY_ECONOMY    (1<<2) /**< Queued economy updates have to be run. */
+#define DIFF_DIRTY_PRICES     (1<<3) /**< Commodity prices have to be initialized. */
+
 
 /**
  * @brief Universe diff filepath list.
@@ -41,6 +47,7 @@
 typedef struct UniDiffData_ {
    char *name; /**< Name of the diff (read from XML). */
    char *filename; /**< Filename of the diff. */
+   xmlDocPtr doc; /**< Parsed diff, kept since hunks point into it. */
 } UniDiffData_t;
 static UniDiffData_t *diff_available = NULL; /**< Available diffs. */
 
@@ -144,6 +151,8 @@ typedef struct UniDiff_ {
  * Diff stack.
  */
 static UniDiff_t *diff_stack = NULL; /**< Currently applied universe diffs. */
+static int diff_batch = 0; /**< Nesting level of diff_start/diff_end. */
+static unsigned int diff_dirty = 0; /**< What has to be rebuilt once the diffs are applied. */
 
 
 /*
@@ -160,6 +169,7 @@ static void diff_hunkFailed( UniDiff_t *diff, UniHunk_t *hunk );
 static void diff_hunkSuccess( UniDiff_t *diff, UniHunk_t *hunk );
 static void diff_cleanup( UniDiff_t *diff );
 static void diff_cleanupHunk( UniHunk_t *hunk );
+static void diff_rebuild (void);
 /* Externed. */
 int diff_save( xmlTextWriterPtr writer ); /**< Used in save.c */
 int diff_load( xmlNodePtr parent ); /**< Used in save.c */
@@ -192,10 +202,11 @@ int diff_loadAvailable (void)
          return -1;
       }
 
+      /* Keep the document so applying doesn't have to parse it again. */
       diff = &array_grow(&diff_available);
       diff->filename = diff_files[i];
+      diff->doc      = doc;
       xmlr_attr_strd(node, "name", diff->name);
-      xmlFreeDoc(doc);
    }
    array_free( diff_files );
    array_shrink(&diff_available);
@@ -246,48 +257,83 @@ static UniDiff_t* diff_get( const char *name )
  */
 int diff_apply( const char *name )
 {
-   xmlNodePtr node;
-   xmlDocPtr doc;
-   char *filename;
+   UniDiffData_t *data;
    int i;
 
    /* Check if already applied. */
    if (diff_isApplied(name))
       return 0;
 
-   filename = NULL;
+   data = NULL;
    for (i=0; i<array_size(diff_available); i++) {
       if (strcmp(diff_available[i].name,name)==0) {
-         filename = diff_available[i].filename;
+         data = &diff_available[i];
          break;
       }
    }
-   if (filename == NULL) {
+   if (data == NULL) {
       WARN(_("UniDiff '%s' not found in %s!"), name, UNIDIFF_DATA_PATH);
       return -1;
    }
 
-   doc = xml_parsePhysFS( filename );
-
-   node = doc->xmlChildrenNode;
-   if (strcmp((char*)node->name,"unidiff")) {
-      ERR(_("Malformed unidiff file: missing root element 'unidiff'"));
-      return 0;
-   }
-
    /* Apply it. */
-   diff_patch( node );
-
-   xmlFreeDoc(doc);
+   diff_patch( data->doc->xmlChildrenNode );
+   cond_invalidate();
 
    /* Re-compute the economy. */
-   economy_execQueued();
-   economy_initialiseCommodityPrices();
+   diff_dirty |= DIFF_DIRTY_ECONOMY | DIFF_DIRTY_PRICES;
+   diff_rebuild();
 
    return 0;
 }
 
 
+/**
+ * @brief Starts applying or removing a batch of diffs.
+ *
+ * The universe is only rebuilt once at the matching diff_end instead of after
+ * every diff. Batches can be nested.
+ */
+void diff_start (void)
+{
+   diff_batch++;
+}
+
+
+/**
+ * @brief Ends a batch of diffs, rebuilding what they changed.
+ */
+void diff_end (void)
+{
+   if (diff_batch <= 0) {
+      WARN(_("diff_end called without diff_start!"));
+      return;
+   }
+   diff_batch--;
+   diff_rebuild();
+}
+
+
+/**
+ * @brief Rebuilds what the applied or removed diffs changed, unless batching.
+ */
+static void diff_rebuild (void)
+{
+   if (diff_batch > 0)
+      return;
+
+   if (diff_dirty & DIFF_DIRTY_PRESENCE)
+      space_updatePresences();
+   if (diff_dirty & DIFF_DIRTY_OVERLAY)
+      ovr_refresh();
+   if (diff_dirty & DIFF_DIRTY_ECONOMY)
+      economy_execQueued();
+   if (diff_dirty & DIFF_DIRTY_PRICES)
+      economy_initialiseCommodityPrices();
+   diff_dirty = 0;
+}
+
+
 /**
  * @brief Patches a system.
  *
@@ -728,12 +774,13 @@ static int diff_patch( xmlNodePtr parent )
       }
    }
 
-   /* Prune presences if necessary. */
+   /* Planet changes update the presence as they go, only jump changes need
+    * everything to be recomputed. */
    if (univ_update)
-      space_reconstructPresences();
+      diff_dirty |= DIFF_DIRTY_PRESENCE;
 
    /* Update overlay map just in case. */
-   ovr_refresh();
+   diff_dirty |= DIFF_DIRTY_OVERLAY;
    return 0;
 }
 
@@ -927,7 +974,8 @@ void diff_remove( const char *name )
 
    diff_removeDiff(diff);
 
-   economy_execQueued();
+   diff_dirty |= DIFF_DIRTY_PRESENCE | DIFF_DIRTY_OVERLAY | DIFF_DIRTY_ECONOMY;
+   diff_rebuild();
 }
 
 
@@ -942,7 +990,8 @@ void diff_clear (void)
    while (array_size(diff_stack) > 0)
       diff_removeDiff(&diff_stack[array_size(diff_stack)-1]);
 
-   economy_execQueued();
+   diff_dirty |= DIFF_DIRTY_PRESENCE | DIFF_DIRTY_ECONOMY;
+   diff_rebuild();
 }
 
 
@@ -955,6 +1004,7 @@ void diff_free (void)
    for (int i = 0; i < array_size(diff_available); i++) {
       free(diff_available[i].name);
       free(diff_available[i].filename);
+      xmlFreeDoc(diff_available[i].doc);
    }
    array_free(diff_available);
    diff_available = NULL;
@@ -986,6 +1036,9 @@ static int diff_removeDiff( UniDiff_t *diff )
    int i;
    UniHunk_t hunk;
 
+   /* Conditionals may check applied diffs. */
+   cond_invalidate();
+
    for (i=0; i<diff->napplied; i++) {
       hunk = diff->applied[i];
       /* Invert the type for reverting. */
@@ -1148,6 +1201,8 @@ int diff_load( xmlNodePtr parent )
    xmlNodePtr node, cur;
    char *     diffName;
 
+   /* Rebuild the universe once after all the diffs. */
+   diff_start();
    diff_clear();
 
    node = parent->xmlChildrenNode;
@@ -1167,6 +1222,7 @@ int diff_load( xmlNodePtr parent )
       }
    } while (xml_nextNode(node));
 
+   diff_end();
    return 0;
 
 }
@@ -12,6 +12,8 @@
 
 int diff_loadAvailable (void);
 NONNULL( 1 ) int diff_apply( const char *name );
+void diff_start (void);
+void diff_end (void);
 NONNULL( 1 ) void diff_remove( const char *name );
 void diff_clear (void);
 void diff_free (void);
@@ -22,6 +22,7 @@
 #include "weapon.h"
 
 #include "ai.h"
+#include "array.h"
 #include "camera.h"
 #include "collision.h"
 #include "explosion.h"
@@ -39,6 +40,11 @@
 
 #define WEAPON_CHUNK_MAX      16384 /**< Maximum size to increase array with */
 #define WEAPON_CHUNK_MIN      256 /**< Minimum size to increase array with */
+#define WEAPON_POOL_CHUNK     256 /**< Number of weapons allocated at once by the pool. */
+
+#define WEAPON_GRID_CELL      256. /**< Minimum size of a collision grid cell. */
+#define WEAPON_GRID_MAX       128 /**< Maximum amount of collision grid cells per axis. */
+#define WEAPON_GRID_MARGIN    2. /**< Margin added to the bounding boxes to absorb rounding. */
 
 /* Weapon status */
 #define WEAPON_STATUS_OK         0 /**< Weapon is fine */
@@ -60,7 +66,10 @@ extern int pilot_nstack;
  */
 typedef struct Weapon_ {
    Solid *solid; /**< Actually has its own solid :) */
+   Solid solid_data; /**< Storage of the solid, solid always points here. */
    unsigned int ID; /**< Only used for beam weapons. */
+   WeaponLayer layer; /**< Layer the weapon is in. */
+   int idx; /**< Position of the weapon in its layer. */
 
    int faction; /**< faction of pilot that shot it */
    unsigned int parent; /**< pilot that shot it */
@@ -87,6 +96,7 @@ typedef struct Weapon_ {
    void (*think)(struct Weapon_*, const double); /**< for the smart missiles */
 
    char status; /**< Weapon status - to check for jamming */
+   char removed; /**< Destroyed while its layer was updating, freed afterwards. */
 } Weapon;
 
 
@@ -98,6 +108,11 @@ static int mwbacklayer = 0; /**< alloced memory size */
 static Weapon** wfrontLayer = NULL; /**< in front of pilots, behind player */
 static int nwfrontLayer = 0; /**< number of elements */
 static int mwfrontLayer = 0; /**< alloced memory size */
+static int weapon_layerUpdating = -1; /**< Layer being updated, or -1 if none. */
+
+/* Pool of weapons, allocated in chunks that never move. */
+static Weapon **weapon_chunks  = NULL; /**< Chunks of WEAPON_POOL_CHUNK weapons (array.h). */
+static Weapon **weapon_pool    = NULL; /**< Unused weapons in the chunks (array.h). */
 
 /* Graphics. */
 static gl_vbo  *weapon_vbo     = NULL; /**< Weapon VBO. */
@@ -109,6 +124,43 @@ static int weapon_vboSize      = 0; /**< Size of the VBO. */
 static unsigned int beam_idgen = 0; /**< Beam identifier generator. */
 
 
+/**
+ * @brief Reference to an asteroid candidate of the collision grid.
+ */
+typedef struct WeaponGridAst_ {
+   int anchor; /**< Index of the asteroid anchor in cur_system. */
+   int id; /**< Index of the asteroid in the anchor. */
+} WeaponGridAst;
+
+
+/**
+ * @brief Uniform grid used as a broadphase for weapon collisions.
+ *
+ * It is rebuilt once per frame from the pilot stack, and is only used to cull
+ *  collision candidates. Asteroids are looked up in the grids of their
+ *  fields instead. The candidates are always returned in the same order the
+ *  full scan would visit them, so the narrow phase gives the exact same
+ *  results.
+ */
+typedef struct WeaponGrid_ {
+   double x; /**< Left border of the grid. */
+   double y; /**< Bottom border of the grid. */
+   double size; /**< Size of a cell. */
+   int nx; /**< Number of cells on the X axis. */
+   int ny; /**< Number of cells on the Y axis. */
+   int npilots; /**< Size of the pilot stack when the grid was built. */
+   int nopoly[2]; /**< First two pilot stack indices of ships without polygon. */
+   double *boxes; /**< Bounding boxes of the pilots (x1,y1,x2,y2). */
+   int *pstart; /**< Start of each cell in plist (nx*ny+1 elements). */
+   int *plist; /**< Pilot stack indices of each cell. */
+   unsigned int *pmark; /**< Last query that touched each pilot. */
+   unsigned int query; /**< Current query stamp. */
+   int *pcand; /**< Pilot candidates of the last query. */
+   WeaponGridAst *acand; /**< Asteroid candidates of the last query, in system order. */
+} WeaponGrid;
+static WeaponGrid wgrid; /**< Weapon collision grid. */
+
+
 /*
  * Prototypes
  */
@@ -123,9 +175,21 @@ static void weapon_createAmmo( Weapon *w, const Outfit* outfit, double T,
 static Weapon* weapon_create( const Outfit* outfit, double T,
       const double dir, const Vector2d* pos, const Vector2d* vel,
       const Pilot *parent, const unsigned int target, double time );
+static Weapon* weapon_alloc (void);
+static void weapon_addLayer( Weapon *w, WeaponLayer layer );
 /* Updating. */
 static void weapon_render( Weapon* w, const double dt );
+static void weapons_gridBuild (void);
+static void weapons_gridAddBox( double *box, double x, double y, double w, double h );
+static void weapons_gridCells( const double *box, int *cx1, int *cy1, int *cx2, int *cy2 );
+static void weapons_gridCollect( int cx1, int cy1, int cx2, int cy2 );
+static void weapons_gridFinish (void);
+static void weapons_gridAddAsteroids( int anchor, int *ids );
+static void weapons_gridQueryBox( const double *box );
+static void weapons_gridQuerySegment( const Vector2d *pos, double dir, double range );
+static void weapons_gridFree (void);
 static void weapons_updateLayer( const double dt, const WeaponLayer layer );
+static void weapons_compactLayer( Weapon **wlayer, int *nlayer );
 static void weapon_update( Weapon* w, const double dt, WeaponLayer layer );
 /* Destruction. */
 static void weapon_destroy( Weapon* w, WeaponLayer layer );
@@ -457,11 +521,342 @@ static void think_beam( Weapon* w, const double dt )
  */
 void weapons_update( const double dt )
 {
+   weapons_gridBuild();
    weapons_updateLayer(dt,WEAPON_LAYER_BG);
    weapons_updateLayer(dt,WEAPON_LAYER_FG);
 }
 
 
+/**
+ * @brief Extends a bounding box with a centered rectangle.
+ *
+ *    @param[in,out] box Bounding box to extend (x1,y1,x2,y2).
+ *    @param x X position of the center of the rectangle.
+ *    @param y Y position of the center of the rectangle.
+ *    @param w Width of the rectangle.
+ *    @param h Height of the rectangle.
+ */
+static void weapons_gridAddBox( double *box, double x, double y, double w, double h )
+{
+   box[0] = MIN( box[0], x - w/2. - WEAPON_GRID_MARGIN );
+   box[1] = MIN( box[1], y - h/2. - WEAPON_GRID_MARGIN );
+   box[2] = MAX( box[2], x + w/2. + WEAPON_GRID_MARGIN );
+   box[3] = MAX( box[3], y + h/2. + WEAPON_GRID_MARGIN );
+}
+
+
+/**
+ * @brief Gets the range of cells overlapped by a bounding box.
+ *
+ * Cells are clamped to the grid, which always contains all the objects.
+ *
+ *    @param box Bounding box (x1,y1,x2,y2).
+ *    @param[out] cx1 First column.
+ *    @param[out] cy1 First row.
+ *    @param[out] cx2 Last column.
+ *    @param[out] cy2 Last row.
+ */
+static void weapons_gridCells( const double *box, int *cx1, int *cy1, int *cx2, int *cy2 )
+{
+   *cx1 = CLAMP( 0, wgrid.nx-1, (int)floor( (box[0] - wgrid.x) / wgrid.size ) );
+   *cy1 = CLAMP( 0, wgrid.ny-1, (int)floor( (box[1] - wgrid.y) / wgrid.size ) );
+   *cx2 = CLAMP( 0, wgrid.nx-1, (int)floor( (box[2] - wgrid.x) / wgrid.size ) );
+   *cy2 = CLAMP( 0, wgrid.ny-1, (int)floor( (box[3] - wgrid.y) / wgrid.size ) );
+}
+
+
+/**
+ * @brief Rebuilds the weapon collision grid.
+ *
+ * Pilots don't move while the weapons are updated, so the grid stays valid
+ *  for the whole weapons_update() call.
+ */
+static void weapons_gridBuild (void)
+{
+   int i, k, n, c, nobj, cx, cy, cx1, cy1, cx2, cy2;
+   double bounds[4], *box;
+   Pilot *p;
+   Ship *s;
+   CollPoly *plg;
+
+   if (wgrid.boxes == NULL) {
+      wgrid.boxes  = array_create( double );
+      wgrid.pstart = array_create( int );
+      wgrid.plist  = array_create( int );
+      wgrid.pmark  = array_create( unsigned int );
+      wgrid.pcand  = array_create( int );
+      wgrid.acand  = array_create( WeaponGridAst );
+   }
+
+   /* Compute the bounding boxes. */
+   wgrid.npilots   = pilot_nstack;
+   wgrid.nopoly[0] = INT_MAX;
+   wgrid.nopoly[1] = INT_MAX;
+   nobj = pilot_nstack;
+   array_resize( &wgrid.boxes, 4*nobj );
+   bounds[0] = bounds[1] = INFINITY;
+   bounds[2] = bounds[3] = -INFINITY;
+   for (i=0; i<pilot_nstack; i++) {
+      p   = pilot_stack[i];
+      s   = p->ship;
+      box = &wgrid.boxes[4*i];
+      box[0] = box[1] = INFINITY;
+      box[2] = box[3] = -INFINITY;
+      /* Sprite collisions are done against the sprite rectangle. */
+      weapons_gridAddBox( box, p->solid->pos.x, p->solid->pos.y,
+            s->gfx_space->sw, s->gfx_space->sh );
+      /* Polygon collisions are done against the polygon bounding box. */
+      if (s->npolygon == 0) {
+         if (wgrid.nopoly[0] == INT_MAX)
+            wgrid.nopoly[0] = i;
+         else if (wgrid.nopoly[1] == INT_MAX)
+            wgrid.nopoly[1] = i;
+      }
+      else {
+         k   = s->gfx_space->sx * p->tsy + p->tsx;
+         plg = &s->polygon[k];
+         weapons_gridAddBox( box, p->solid->pos.x + (plg->xmin+plg->xmax)/2.,
+               p->solid->pos.y + (plg->ymin+plg->ymax)/2.,
+               plg->xmax-plg->xmin, plg->ymax-plg->ymin );
+      }
+   }
+   for (i=0; i<nobj; i++) {
+      box = &wgrid.boxes[4*i];
+      bounds[0] = MIN( bounds[0], box[0] );
+      bounds[1] = MIN( bounds[1], box[1] );
+      bounds[2] = MAX( bounds[2], box[2] );
+      bounds[3] = MAX( bounds[3], box[3] );
+   }
+
+   /* Set up the geometry, cells grow when the objects are spread out. */
+   if (nobj == 0) {
+      wgrid.nx = 0;
+      wgrid.ny = 0;
+   }
+   else {
+      wgrid.x    = bounds[0];
+      wgrid.y    = bounds[1];
+      wgrid.size = WEAPON_GRID_CELL;
+      while ((bounds[2]-bounds[0] >= wgrid.size*WEAPON_GRID_MAX) ||
+            (bounds[3]-bounds[1] >= wgrid.size*WEAPON_GRID_MAX))
+         wgrid.size *= 2.;
+      wgrid.nx = (int)floor( (bounds[2]-bounds[0]) / wgrid.size ) + 1;
+      wgrid.ny = (int)floor( (bounds[3]-bounds[1]) / wgrid.size ) + 1;
+   }
+   n = wgrid.nx * wgrid.ny;
+
+   /* Count the entries of each cell. */
+   array_resize( &wgrid.pstart, n+1 );
+   memset( wgrid.pstart, 0, sizeof(int) * (n+1) );
+   for (i=0; i<nobj; i++) {
+      weapons_gridCells( &wgrid.boxes[4*i], &cx1, &cy1, &cx2, &cy2 );
+      for (cy=cy1; cy<=cy2; cy++)
+         for (cx=cx1; cx<=cx2; cx++)
+            wgrid.pstart[ cy*wgrid.nx + cx + 1 ]++;
+   }
+   for (c=0; c<n; c++)
+      wgrid.pstart[c+1] += wgrid.pstart[c];
+
+   /* Fill the cells, shifting the starts while filling and restoring after. */
+   array_resize( &wgrid.plist, wgrid.pstart[n] );
+   for (i=0; i<nobj; i++) {
+      weapons_gridCells( &wgrid.boxes[4*i], &cx1, &cy1, &cx2, &cy2 );
+      for (cy=cy1; cy<=cy2; cy++)
+         for (cx=cx1; cx<=cx2; cx++) {
+            c = cy*wgrid.nx + cx;
+            wgrid.plist[ wgrid.pstart[c]++ ] = i;
+         }
+   }
+   for (c=n; c>0; c--)
+      wgrid.pstart[c] = wgrid.pstart[c-1];
+   if (n > 0)
+      wgrid.pstart[0] = 0;
+
+   /* Reset the query stamps. */
+   array_resize( &wgrid.pmark, pilot_nstack );
+   memset( wgrid.pmark, 0, sizeof(unsigned int) * pilot_nstack );
+   wgrid.query = 0;
+}
+
+
+/**
+ * @brief Adds the pilots of a range of cells to the current candidates.
+ *
+ *    @param cx1 First column.
+ *    @param cy1 First row.
+ *    @param cx2 Last column.
+ *    @param cy2 Last row.
+ */
+static void weapons_gridCollect( int cx1, int cy1, int cx2, int cy2 )
+{
+   int cx, cy, c, j, k;
+
+   for (cy=cy1; cy<=cy2; cy++) {
+      for (cx=cx1; cx<=cx2; cx++) {
+         c = cy*wgrid.nx + cx;
+         for (j=wgrid.pstart[c]; j<wgrid.pstart[c+1]; j++) {
+            k = wgrid.plist[j];
+            if (wgrid.pmark[k] == wgrid.query)
+               continue;
+            wgrid.pmark[k] = wgrid.query;
+            array_push_back( &wgrid.pcand, k );
+         }
+      }
+   }
+}
+
+
+/**
+ * @brief Compares two indices (for use with qsort).
+ */
+static int weapons_gridCmp( const void *p1, const void *p2 )
+{
+   return *(const int*)p1 - *(const int*)p2;
+}
+
+
+/**
+ * @brief Puts the candidates back in stack order.
+ *
+ * Pilots added to the stack after the grid was built are always candidates.
+ */
+static void weapons_gridFinish (void)
+{
+   int i;
+
+   qsort( wgrid.pcand, array_size(wgrid.pcand), sizeof(int), weapons_gridCmp );
+   for (i=wgrid.npilots; i<pilot_nstack; i++)
+      array_push_back( &wgrid.pcand, i );
+}
+
+
+/**
+ * @brief Starts a new grid query.
+ */
+static void weapons_gridStart (void)
+{
+   array_resize( &wgrid.pcand, 0 );
+   array_resize( &wgrid.acand, 0 );
+   wgrid.query++;
+}
+
+
+/**
+ * @brief Adds the asteroids found in the grid of a field to the candidates.
+ *
+ *    @param anchor Index of the field in the current system.
+ *    @param ids Indices of the asteroids in the field, by increasing index.
+ */
+static void weapons_gridAddAsteroids( int anchor, int *ids )
+{
+   int i;
+   WeaponGridAst *ga;
+
+   for (i=0; i<array_size(ids); i++) {
+      ga = &array_grow( &wgrid.acand );
+      ga->anchor = anchor;
+      ga->id     = ids[i];
+   }
+}
+
+
+/**
+ * @brief Gets the candidates that can collide with a bounding box.
+ *
+ *    @param box Bounding box (x1,y1,x2,y2).
+ */
+static void weapons_gridQueryBox( const double *box )
+{
+   int i, cx1, cy1, cx2, cy2;
+
+   weapons_gridStart();
+   if ((wgrid.nx > 0) && (wgrid.ny > 0)) {
+      weapons_gridCells( box, &cx1, &cy1, &cx2, &cy2 );
+      weapons_gridCollect( cx1, cy1, cx2, cy2 );
+   }
+   weapons_gridFinish();
+
+   for (i=0; i<cur_system->nasteroids; i++)
+      weapons_gridAddAsteroids( i, asteroids_queryRect( &cur_system->asteroids[i],
+               box[0], box[1], box[2], box[3] ) );
+}
+
+
+/**
+ * @brief Gets the candidates that can collide with a segment.
+ *
+ * Only the cells crossed by the segment are visited, one column at a time.
+ *
+ *    @param pos Origin of the segment.
+ *    @param dir Direction of the segment.
+ *    @param range Length of the segment.
+ */
+static void weapons_gridQuerySegment( const Vector2d *pos, double dir, double range )
+{
+   int i, cx, cx1, cx2, cy1, cy2, dummy;
+   double sx, sy, ex, ey, xa, xb, ya, yb, box[4];
+
+   weapons_gridStart();
+   if ((wgrid.nx > 0) && (wgrid.ny > 0)) {
+      /* Same end point as the line collision functions. */
+      sx = pos->x;
+      sy = pos->y;
+      ex = sx + range*cos(dir);
+      ey = sy + range*sin(dir);
+      if (ex < sx) {
+         xa = sx; sx = ex; ex = xa;
+         ya = sy; sy = ey; ey = ya;
+      }
+
+      box[0] = sx;
+      box[2] = ex;
+      box[1] = box[3] = sy;
+      weapons_gridCells( box, &cx1, &dummy, &cx2, &dummy );
+      for (cx=cx1; cx<=cx2; cx++) {
+         /* Part of the segment inside the column. */
+         if (ex == sx) {
+            xa = sx;
+            xb = ex;
+            ya = sy;
+            yb = ey;
+         }
+         else {
+            xa = MAX( sx, wgrid.x + cx*wgrid.size );
+            xb = MIN( ex, wgrid.x + (cx+1)*wgrid.size );
+            ya = sy + (xa-sx) * (ey-sy) / (ex-sx);
+            yb = sy + (xb-sx) * (ey-sy) / (ex-sx);
+         }
+         box[0] = xa;
+         box[2] = xb;
+         box[1] = MIN( ya, yb );
+         box[3] = MAX( ya, yb );
+         weapons_gridCells( box, &dummy, &cy1, &dummy, &cy2 );
+         weapons_gridCollect( cx, cy1, cx, cy2 );
+      }
+   }
+   weapons_gridFinish();
+
+   for (i=0; i<cur_system->nasteroids; i++)
+      weapons_gridAddAsteroids( i, asteroids_querySegment( &cur_system->asteroids[i],
+               pos, dir, range ) );
+}
+
+
+/**
+ * @brief Frees the weapon collision grid.
+ */
+static void weapons_gridFree (void)
+{
+   array_free( wgrid.boxes );
+   array_free( wgrid.pstart );
+   array_free( wgrid.plist );
+   array_free( wgrid.pmark );
+   array_free( wgrid.pcand );
+   array_free( wgrid.acand );
+   memset( &wgrid, 0, sizeof(WeaponGrid) );
+}
+
+
 /**
  * @brief Updates all the weapons in the layer.
  *
@@ -470,7 +865,7 @@ void weapons_update( const double dt )
  */
 static void weapons_updateLayer( const double dt, const WeaponLayer layer )
 {
-   Weapon **wlayer;
+   Weapon ***wlayer;
    int *nlayer;
    Weapon *w;
    int i;
@@ -481,11 +876,11 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
    /* Choose layer. */
    switch (layer) {
       case WEAPON_LAYER_BG:
-         wlayer = wbackLayer;
+         wlayer = &wbackLayer;
          nlayer = &nwbackLayer;
          break;
       case WEAPON_LAYER_FG:
-         wlayer = wfrontLayer;
+         wlayer = &wfrontLayer;
          nlayer = &nwfrontLayer;
          break;
 
@@ -494,9 +889,14 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
          return;
    }
 
-   i = 0;
-   while (i < *nlayer) {
-      w = wlayer[i];
+   /* Weapons destroyed during the loop (even by explosions from other
+    * weapons) are only marked, so the layer doesn't get reordered under us. */
+   weapon_layerUpdating = layer;
+   for (i=0; i < *nlayer; i++) {
+      /* Layer may get reallocated when new weapons are added. */
+      w = (*wlayer)[i];
+      if (w->removed)
+         continue;
 
       switch (w->outfit->type) {
 
@@ -590,17 +990,40 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
             break;
       }
 
-      /* Out of bounds, loop is over. */
-      if (i >= *nlayer)
-         break;
-
-      /* Only increment if weapon wasn't deleted. */
-      if (w == wlayer[i]) {
+      /* Only update if weapon wasn't deleted. */
+      if (!w->removed)
          weapon_update(w,dt,layer);
-         if ((i < *nlayer) && (w == wlayer[i]))
-            i++;
+   }
+   weapon_layerUpdating = -1;
+
+   weapons_compactLayer( *wlayer, nlayer );
+}
+
+
+/**
+ * @brief Frees the weapons marked as removed and closes the gaps they leave.
+ *
+ *    @param wlayer Layer to compact.
+ *    @param nlayer Number of weapons in the layer.
+ */
+static void weapons_compactLayer( Weapon **wlayer, int *nlayer )
+{
+   int i, j;
+   Weapon *w;
+
+   j = 0;
+   for (i=0; i < *nlayer; i++) {
+      w = wlayer[i];
+      if (w->removed) {
+         weapon_free(w);
+         continue;
       }
+      w->idx      = j;
+      wlayer[j++] = w;
    }
+   for (i=j; i < *nlayer; i++)
+      wlayer[i] = NULL;
+   *nlayer = j;
 }
 
 
@@ -842,15 +1265,15 @@ static int weapon_checkCanHit( Weapon* w, Pilot *p )
  */
 static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
 {
-   int i, j, b, psx, psy, k, n;
+   int i, c, b, psx, psy, k, n, nopoly;
    unsigned int coll, usePoly=1;
    glTexture *gfx;
    CollPoly *plg, *polygon;
    Vector2d crash[2];
    Pilot *p;
-   AsteroidAnchor *ast;
    Asteroid *a;
    AsteroidType *at;
+   double box[4];
 
    gfx = NULL;
    polygon = NULL;
@@ -873,9 +1296,29 @@ static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
          if (w->outfit->u.amm.npolygon == 0)
             usePoly = 0;
       }
+
+      /* Get the candidates overlapping the sprite or the polygon. */
+      box[0] = box[1] = INFINITY;
+      box[2] = box[3] = -INFINITY;
+      weapons_gridAddBox( box, w->solid->pos.x, w->solid->pos.y, gfx->sw, gfx->sh );
+      if (usePoly)
+         weapons_gridAddBox( box, w->solid->pos.x + (polygon->xmin+polygon->xmax)/2.,
+               w->solid->pos.y + (polygon->ymin+polygon->ymax)/2.,
+               polygon->xmax-polygon->xmin, polygon->ymax-polygon->ymin );
+      weapons_gridQueryBox( box );
    }
+   else
+      weapons_gridQuerySegment( &w->solid->pos, w->solid->dir,
+            w->outfit->u.bem.range );
 
-   for (i=0; i<pilot_nstack; i++) {
+   /* Any ship without polygon disables polygon collisions for the rest of the
+    * stack, even if it is not a candidate. */
+   nopoly = wgrid.nopoly[0];
+   if ((nopoly < wgrid.npilots) && (pilot_stack[nopoly]->id == w->parent))
+      nopoly = wgrid.nopoly[1];
+
+   for (c=0; c<array_size(wgrid.pcand); c++) {
+      i = wgrid.pcand[c];
       p = pilot_stack[i];
 
       psx = pilot_stack[i]->tsx;
@@ -884,7 +1327,7 @@ static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
       if (w->parent == pilot_stack[i]->id) continue; /* pilot is self */
 
       /* See if the ship has a collision polygon. */
-      if (p->ship->npolygon == 0)
+      if ((i >= nopoly) || (p->ship->npolygon == 0))
          usePoly = 0;
 
       /* Beam weapons have special collisions. */
@@ -953,53 +1396,28 @@ static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
    }
 
    /* Collide with asteroids*/
-   if (outfit_isAmmo(w->outfit)) {
-      for (i=0; i<cur_system->nasteroids; i++) {
-         ast = &cur_system->asteroids[i];
-         for (j=0; j<ast->nb; j++) {
-            a = &ast->asteroids[j];
-            at = space_getType ( a->type );
-            if ( (a->appearing == ASTEROID_VISIBLE) &&
-                  CollideSprite( gfx, w->sx, w->sy, &w->solid->pos,
-                        at->gfxs[a->gfxID], 0, 0, &a->pos,
-                        &crash[0] ) ) {
-               weapon_hitAst( w, a, layer, &crash[0] );
-               return; /* Weapon is destroyed. */
-            }
-         }
-      }
-   }
-   else if (outfit_isBolt(w->outfit)) {
-      for (i=0; i<cur_system->nasteroids; i++) {
-         ast = &cur_system->asteroids[i];
-         for (j=0; j<ast->nb; j++) {
-            a = &ast->asteroids[j];
-            at = space_getType ( a->type );
-            if ( (a->appearing == ASTEROID_VISIBLE) &&
-                  CollideSprite( gfx, w->sx, w->sy, &w->solid->pos,
-                        at->gfxs[a->gfxID], 0, 0, &a->pos,
-                        &crash[0] ) ) {
-               weapon_hitAst( w, a, layer, &crash[0] );
-               return; /* Weapon is destroyed. */
-            }
+   for (c=0; c<array_size(wgrid.acand); c++) {
+      a  = &cur_system->asteroids[ wgrid.acand[c].anchor ].asteroids[ wgrid.acand[c].id ];
+      at = space_getType ( a->type );
+      if (a->appearing != ASTEROID_VISIBLE)
+         continue;
+
+      if (outfit_isAmmo(w->outfit) || outfit_isBolt(w->outfit)) {
+         if (CollideSprite( gfx, w->sx, w->sy, &w->solid->pos,
+                  at->gfxs[a->gfxID], 0, 0, &a->pos,
+                  &crash[0] )) {
+            weapon_hitAst( w, a, layer, &crash[0] );
+            return; /* Weapon is destroyed. */
          }
       }
-   }
-   else if (b) { /* Beam */
-      for (i=0; i<cur_system->nasteroids; i++) {
-         ast = &cur_system->asteroids[i];
-         for (j=0; j<ast->nb; j++) {
-            a = &ast->asteroids[j];
-            at = space_getType ( a->type );
-            if ( (a->appearing == ASTEROID_VISIBLE) &&
-                  CollideLineSprite( &w->solid->pos, w->solid->dir,
-                        w->outfit->u.bem.range,
-                        at->gfxs[a->gfxID], 0, 0, &a->pos,
-                        crash ) ) {
-               weapon_hitAstBeam( w, a, layer, crash, dt );
-               /* No return because beam can still think, it's not
-                * destroyed like the other weapons.*/
-            }
+      else if (b) { /* Beam */
+         if (CollideLineSprite( &w->solid->pos, w->solid->dir,
+                  w->outfit->u.bem.range,
+                  at->gfxs[a->gfxID], 0, 0, &a->pos,
+                  crash )) {
+            weapon_hitAstBeam( w, a, layer, crash, dt );
+            /* No return because beam can still think, it's not
+             * destroyed like the other weapons.*/
          }
       }
    }
@@ -1409,7 +1827,7 @@ static void weapon_createBolt( Weapon *w, const Outfit* outfit, double T,
    vect_cadd( &v, outfit->u.blt.speed*cos(rdir), outfit->u.blt.speed*sin(rdir));
    w->timer = outfit->u.blt.range / outfit->u.blt.speed;
    w->falloff = w->timer - outfit->u.blt.falloff / outfit->u.blt.speed;
-   w->solid = solid_create( mass, rdir, pos, &v, SOLID_UPDATE_EULER );
+   solid_init( w->solid, mass, rdir, pos, &v, SOLID_UPDATE_EULER );
    w->voice = sound_playPos( w->outfit->u.blt.sound,
          w->solid->pos.x,
          w->solid->pos.y,
@@ -1476,7 +1894,7 @@ static void weapon_createAmmo( Weapon *w, const Outfit* launcher, double T,
    /* Set up ammo details. */
    mass        = w->outfit->mass;
    w->timer    = ammo->u.amm.duration * parent->stats.launch_range;
-   w->solid    = solid_create( mass, rdir, pos, &v, SOLID_UPDATE_RK4 );
+   solid_init( w->solid, mass, rdir, pos, &v, SOLID_UPDATE_RK4 );
    if (w->outfit->u.amm.thrust != 0.) {
       weapon_setThrust( w, w->outfit->u.amm.thrust * mass );
       w->solid->speed_max = w->outfit->u.amm.speed; /* Limit speed, we only care if it has thrust. */
@@ -1531,7 +1949,8 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
    Weapon* w;
 
    /* Create basic features */
-   w           = calloc( 1, sizeof(Weapon) );
+   w           = weapon_alloc();
+   w->solid    = &w->solid_data;
    w->dam_mod  = 1.; /* Default of 100% damage. */
    w->dam_as_dis_mod = 0.; /* Default of 0% damage to disable. */
    w->faction  = parent->faction; /* non-changeable */
@@ -1578,7 +1997,7 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
          else if (rdir >= 2.*M_PI)
             rdir -= 2.*M_PI;
          mass = 1.; /**< Needs a mass. */
-         w->solid = solid_create( mass, rdir, pos, vel, SOLID_UPDATE_EULER );
+         solid_init( w->solid, mass, rdir, pos, vel, SOLID_UPDATE_EULER );
          w->think = think_beam;
          w->timer = outfit->u.bem.duration;
          w->voice = sound_playPos( w->outfit->u.bem.sound,
@@ -1598,7 +2017,7 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
       default:
          WARN(_("Weapon of type '%s' has no create implemented yet!"),
                w->outfit->name);
-         w->solid = solid_create( 1., dir, pos, vel, SOLID_UPDATE_EULER );
+         solid_init( w->solid, 1., dir, pos, vel, SOLID_UPDATE_EULER );
          break;
    }
 
@@ -1610,35 +2029,51 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
 
 
 /**
- * @brief Creates a new weapon.
+ * @brief Gets an unused weapon from the pool.
  *
- *    @param outfit Outfit which spawns the weapon.
- *    @param T Temperature of the shooter.
- *    @param dir Direction of the shooter.
- *    @param pos Position of the shooter.
- *    @param vel Velocity of the shooter.
- *    @param parent Pilot ID of the shooter.
- *    @param target Target ID that is getting shot.
- *    @param time Expected flight time.
+ * Weapons are allocated in chunks that are never moved or freed until
+ *  weapon_exit, so pointers to them stay valid.
+ *
+ *    @return A zeroed weapon.
  */
-void weapon_add( const Outfit* outfit, const double T, const double dir,
-      const Vector2d* pos, const Vector2d* vel,
-      const Pilot *parent, unsigned int target, double time )
+static Weapon* weapon_alloc (void)
 {
-   WeaponLayer layer;
-   Weapon *w;
-   Weapon **curLayer;
-   int *mLayer, *nLayer;
-   GLsizei size;
+   int i;
+   Weapon *chunk, *w;
 
-   if (!outfit_isBolt(outfit) &&
-         !outfit_isLauncher(outfit)) {
-      ERR(_("Trying to create a Weapon from a non-Weapon type Outfit"));
-      return;
+   /* Grow the pool by a chunk if empty. */
+   if ((weapon_pool == NULL) || (array_size(weapon_pool) == 0)) {
+      if (weapon_chunks == NULL) {
+         weapon_chunks = array_create( Weapon* );
+         weapon_pool   = array_create( Weapon* );
+      }
+      chunk = malloc( sizeof(Weapon) * WEAPON_POOL_CHUNK );
+      if (chunk == NULL)
+         ERR(_("Out of Memory"));
+      array_push_back( &weapon_chunks, chunk );
+      /* Pushed backwards so they get used in memory order. */
+      for (i=WEAPON_POOL_CHUNK-1; i>=0; i--)
+         array_push_back( &weapon_pool, &chunk[i] );
    }
 
-   layer = (parent->id==PLAYER_ID) ? WEAPON_LAYER_FG : WEAPON_LAYER_BG;
-   w     = weapon_create( outfit, T, dir, pos, vel, parent, target, time );
+   w = array_back( weapon_pool );
+   array_resize( &weapon_pool, array_size(weapon_pool)-1 );
+   memset( w, 0, sizeof(Weapon) );
+   return w;
+}
+
+
+/**
+ * @brief Adds a weapon to a layer.
+ *
+ *    @param w Weapon to add.
+ *    @param layer Layer to add it to.
+ */
+static void weapon_addLayer( Weapon *w, WeaponLayer layer )
+{
+   Weapon **curLayer;
+   int *mLayer, *nLayer;
+   GLsizei size;
 
    /* set the proper layer */
    switch (layer) {
@@ -1658,9 +2093,7 @@ void weapon_add( const Outfit* outfit, const double T, const double dir,
          return;
    }
 
-   if (*mLayer > *nLayer) /* more memory alloced than needed */
-      curLayer[(*nLayer)++] = w;
-   else { /* need to allocate more memory */
+   if (*mLayer <= *nLayer) { /* need to allocate more memory */
       if ((*mLayer) == 0)
          (*mLayer) = WEAPON_CHUNK_MIN;
       else
@@ -1668,13 +2101,12 @@ void weapon_add( const Outfit* outfit, const double T, const double dir,
 
       switch (layer) {
          case WEAPON_LAYER_BG:
-            curLayer   = wbackLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
+            curLayer = wbackLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
             break;
          case WEAPON_LAYER_FG:
-            curLayer   = wfrontLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
+            curLayer = wfrontLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
             break;
       }
-      curLayer[(*nLayer)++] = w;
 
       /* Grow the vertex stuff. */
       weapon_vboSize = mwfrontLayer + mwbacklayer;
@@ -1684,6 +2116,42 @@ void weapon_add( const Outfit* outfit, const double T, const double dir,
          weapon_vbo = gl_vboCreateStream( size, NULL );
       gl_vboData( weapon_vbo, size, weapon_vboData );
    }
+
+   /* Remember where it is so it can be removed directly. */
+   w->layer = layer;
+   w->idx   = *nLayer;
+   curLayer[(*nLayer)++] = w;
+}
+
+
+/**
+ * @brief Creates a new weapon.
+ *
+ *    @param outfit Outfit which spawns the weapon.
+ *    @param T Temperature of the shooter.
+ *    @param dir Direction of the shooter.
+ *    @param pos Position of the shooter.
+ *    @param vel Velocity of the shooter.
+ *    @param parent Pilot ID of the shooter.
+ *    @param target Target ID that is getting shot.
+ *    @param time Expected flight time.
+ */
+void weapon_add( const Outfit* outfit, const double T, const double dir,
+      const Vector2d* pos, const Vector2d* vel,
+      const Pilot *parent, unsigned int target, double time )
+{
+   WeaponLayer layer;
+   Weapon *w;
+
+   if (!outfit_isBolt(outfit) &&
+         !outfit_isLauncher(outfit)) {
+      ERR(_("Trying to create a Weapon from a non-Weapon type Outfit"));
+      return;
+   }
+
+   layer = (parent->id==PLAYER_ID) ? WEAPON_LAYER_FG : WEAPON_LAYER_BG;
+   w     = weapon_create( outfit, T, dir, pos, vel, parent, target, time );
+   weapon_addLayer( w, layer );
 }
 
 
@@ -1708,9 +2176,6 @@ unsigned int beam_start( const Outfit* outfit,
 {
    WeaponLayer layer;
    Weapon *w;
-   Weapon **curLayer;
-   int *mLayer, *nLayer;
-   GLsizei size;
 
    if (!outfit_isBeam(outfit)) {
       ERR(_("Trying to create a Beam Weapon from a non-beam outfit."));
@@ -1723,50 +2188,7 @@ unsigned int beam_start( const Outfit* outfit,
    w->mount = mount;
    w->exp_timer = 0.;
 
-   /* set the proper layer */
-   switch (layer) {
-      case WEAPON_LAYER_BG:
-         curLayer = wbackLayer;
-         nLayer = &nwbackLayer;
-         mLayer = &mwbacklayer;
-         break;
-      case WEAPON_LAYER_FG:
-         curLayer = wfrontLayer;
-         nLayer = &nwfrontLayer;
-         mLayer = &mwfrontLayer;
-         break;
-
-      default:
-         ERR(_("Invalid WEAPON_LAYER specified"));
-         return -1;
-   }
-
-   if (*mLayer > *nLayer) /* more memory alloced than needed */
-      curLayer[(*nLayer)++] = w;
-   else { /* need to allocate more memory */
-      if ((*mLayer) == 0)
-         (*mLayer) = WEAPON_CHUNK_MIN;
-      else
-         (*mLayer) += MIN( (*mLayer), WEAPON_CHUNK_MAX );
-
-      switch (layer) {
-         case WEAPON_LAYER_BG:
-            curLayer = wbackLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
-            break;
-         case WEAPON_LAYER_FG:
-            curLayer = wfrontLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
-            break;
-      }
-      curLayer[(*nLayer)++] = w;
-
-      /* Grow the vertex stuff. */
-      weapon_vboSize = mwfrontLayer + mwbacklayer;
-      size = sizeof(GLfloat) * (2+4) * weapon_vboSize;
-      weapon_vboData = realloc( weapon_vboData, size );
-      if (weapon_vbo == NULL)
-         weapon_vbo = gl_vboCreateStream( size, NULL );
-      gl_vboData( weapon_vbo, size, weapon_vboData );
-   }
+   weapon_addLayer( w, layer );
 
    return w->ID;
 }
@@ -1806,7 +2228,7 @@ void beam_end( const unsigned int parent, unsigned int beam )
 
    /* Now try to destroy the beam. */
    for (i=0; i<*nLayer; i++) {
-      if (curLayer[i]->ID == beam) { /* Found it. */
+      if ((curLayer[i]->ID == beam) && !curLayer[i]->removed) { /* Found it. */
          weapon_destroy(curLayer[i], layer);
          break;
       }
@@ -1822,7 +2244,6 @@ void beam_end( const unsigned int parent, unsigned int beam )
  */
 static void weapon_destroy( Weapon* w, WeaponLayer layer )
 {
-   int i;
    Weapon** wlayer;
    int *nlayer;
 
@@ -1841,18 +2262,28 @@ static void weapon_destroy( Weapon* w, WeaponLayer layer )
          return;
    }
 
-   for (i=0; (wlayer[i] != w) && (i < *nlayer); i++); /* get to the current position */
-   if (i >= *nlayer) {
+   if ((w->layer != layer) || (w->idx >= *nlayer) || (wlayer[w->idx] != w)) {
       WARN(_("Trying to destroy weapon not found in stack!"));
       return;
    }
 
-   weapon_free(wlayer[i]);
-   wlayer[i] = NULL;
+   /* Already pending removal. */
+   if (w->removed)
+      return;
+
+   /* Layer is being iterated, remove it once the update is done. */
+   if ((int)layer == weapon_layerUpdating) {
+      w->removed = 1;
+      return;
+   }
+
+   /* Swap the last weapon into its place. */
    (*nlayer)--;
+   wlayer[w->idx] = wlayer[*nlayer];
+   wlayer[w->idx]->idx = w->idx;
+   wlayer[*nlayer] = NULL;
 
-   for ( ; i < (*nlayer); i++)
-      wlayer[i] = wlayer[i+1];
+   weapon_free(w);
 }
 
 
@@ -1884,14 +2315,12 @@ static void weapon_free( Weapon* w )
             w->solid->vel.y);
    }
 
-   /* Free the solid. */
-   solid_free(w->solid);
-
 #ifdef DEBUGGING
    memset(w, 0, sizeof(Weapon));
 #endif /* DEBUGGING */
 
-   free(w);
+   /* Give it back to the pool. */
+   array_push_back( &weapon_pool, w );
 }
 
 /**
@@ -1918,6 +2347,8 @@ void weapon_clear (void)
  */
 void weapon_exit (void)
 {
+   int i;
+
    weapon_clear();
 
    /* Destroy front layer. */
@@ -1930,6 +2361,18 @@ void weapon_exit (void)
    wfrontLayer  = NULL;
    mwfrontLayer = 0;
 
+   /* Destroy the pool. */
+   if (weapon_chunks != NULL)
+      for (i=0; i<array_size(weapon_chunks); i++)
+         free( weapon_chunks[i] );
+   array_free( weapon_chunks );
+   weapon_chunks = NULL;
+   array_free( weapon_pool );
+   weapon_pool = NULL;
+
+   /* Destroy collision grid. */
+   weapons_gridFree();
+
    /* Destroy VBO. */
    free( weapon_vboData );
    weapon_vboData = NULL;
@@ -1985,6 +2428,8 @@ static void weapon_explodeLayer( WeaponLayer layer,
 
    /* Now try to destroy the weapons affected. */
    for (i=0; i<*nLayer; i++) {
+      if (curLayer[i]->removed)
+         continue;
       if (((mode & EXPL_MODE_MISSILE) && outfit_isAmmo(curLayer[i]->outfit)) ||
             ((mode & EXPL_MODE_BOLT) && outfit_isBolt(curLayer[i]->outfit))) {
 
@@ -1993,7 +2438,9 @@ static void weapon_explodeLayer( WeaponLayer layer,
 
          if (dist < rad2) {
             weapon_destroy(curLayer[i], layer);
-            i--;
+            /* Swapped out unless it was only marked for removal. */
+            if ((int)layer != weapon_layerUpdating)
+               i--;
          }
       }
    }